@@ -50,6 +50,14 @@
 #include <lzma.h>
 #endif
 
+#if WITH_BROTLIDEC
+#include <brotli/decode.h>
+#endif
+
+#if WITH_ZSTD
+#include <zstd.h>
+#endif
+
 #include <libwget.h>
 #include "private.h"
 
@@ -66,6 +74,14 @@ struct _wget_decompressor_st {
 	bz_stream
 		bz_strm;
 #endif
+#if WITH_BROTLIDEC
+	BrotliDecoderState
+		*brotli_strm;
+#endif
+#if WITH_ZSTD
+	ZSTD_DStream
+		*zstd_strm;
+#endif
 
 	int
 		(*decompress)(wget_decompressor_t *dc, char *src, size_t srclen),
@@ -262,6 +278,120 @@ static void bzip2_exit(wget_decompressor_t *dc)
 }
 #endif // WITH_BZIP2
 
+#if WITH_BROTLIDEC
+static int brotli_init(BrotliDecoderState **strm)
+{
+	if (!(*strm = BrotliDecoderCreateInstance(NULL, NULL, NULL))) {
+		error_printf(_("Failed to init Brotli decompression\n"));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int brotli_decompress(wget_decompressor_t *dc, char *src, size_t srclen)
+{
+	BrotliDecoderState *strm;
+	BrotliDecoderResult status;
+	uint8_t dst[10240], *next_out;
+	const uint8_t *next_in;
+	size_t avail_in, avail_out;
+
+	if (!srclen) {
+		// special case to avoid decompress errors
+		if (dc->put_data)
+			dc->put_data(dc->context, "", 0);
+
+		return 0;
+	}
+
+	strm = dc->brotli_strm;
+	next_in = (const uint8_t *) src;
+	avail_in = srclen;
+
+	do {
+		next_out = dst;
+		avail_out = sizeof(dst);
+
+		status = BrotliDecoderDecompressStream(strm, &avail_in, &next_in, &avail_out, &next_out, NULL);
+		if (status != BROTLI_DECODER_RESULT_ERROR && avail_out < sizeof(dst)) {
+			if (dc->put_data)
+				dc->put_data(dc->context, (char *) dst, sizeof(dst) - avail_out);
+		}
+	} while (status == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+
+	if (status == BROTLI_DECODER_RESULT_SUCCESS || status == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT)
+		return 0;
+
+	error_printf(_("Failed to uncompress Brotli stream (%s)\n"), BrotliDecoderErrorString(BrotliDecoderGetErrorCode(strm)));
+	return -1;
+}
+
+static void brotli_exit(wget_decompressor_t *dc)
+{
+	BrotliDecoderDestroyInstance(dc->brotli_strm);
+}
+#endif // WITH_BROTLIDEC
+
+#if WITH_ZSTD
+static int zstd_init(ZSTD_DStream **strm)
+{
+	if (!(*strm = ZSTD_createDStream())) {
+		error_printf(_("Failed to init Zstandard decompression\n"));
+		return -1;
+	}
+
+	if (ZSTD_isError(ZSTD_initDStream(*strm))) {
+		error_printf(_("Failed to init Zstandard decompression\n"));
+		ZSTD_freeDStream(*strm);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int zstd_decompress(wget_decompressor_t *dc, char *src, size_t srclen)
+{
+	ZSTD_inBuffer input = { .src = src, .size = srclen };
+	ZSTD_outBuffer output;
+	char dst[10240];
+	size_t status;
+
+	if (!srclen) {
+		// special case to avoid decompress errors
+		if (dc->put_data)
+			dc->put_data(dc->context, "", 0);
+
+		return 0;
+	}
+
+	// a full output buffer means there might be more data to flush
+	do {
+		output.dst = dst;
+		output.size = sizeof(dst);
+		output.pos = 0;
+
+		status = ZSTD_decompressStream(dc->zstd_strm, &output, &input);
+		if (ZSTD_isError(status)) {
+			error_printf(_("Failed to uncompress Zstandard stream (%s)\n"), ZSTD_getErrorName(status));
+			return -1;
+		}
+
+		if (output.pos) {
+			if (dc->put_data)
+				dc->put_data(dc->context, dst, output.pos);
+		}
+	} while (input.pos < input.size || output.pos == output.size);
+
+	return 0;
+}
+
+static void zstd_exit(wget_decompressor_t *dc)
+{
+	ZSTD_freeDStream(dc->zstd_strm);
+}
+#endif // WITH_ZSTD
+
 static int identity(wget_decompressor_t *dc, char *src, size_t srclen)
 {
 	if (dc->put_data)
@@ -305,8 +435,24 @@ wget_decompressor_t *wget_decompress_open(int encoding,
 			dc->exit = lzma_exit;
 		}
 #endif
-	} else {
-		// identity
+	} else if (encoding == wget_content_encoding_brotli) {
+#if WITH_BROTLIDEC
+		if ((rc = brotli_init(&dc->brotli_strm)) == 0) {
+			dc->decompress = brotli_decompress;
+			dc->exit = brotli_exit;
+		}
+#endif
+	} else if (encoding == wget_content_encoding_zstd) {
+#if WITH_ZSTD
+		if ((rc = zstd_init(&dc->zstd_strm)) == 0) {
+			dc->decompress = zstd_decompress;
+			dc->exit = zstd_exit;
+		}
+#endif
+	}
+
+	if (!dc->decompress) {
+		// identity or support not compiled in, the data is passed through unchanged
 		dc->decompress = identity;
 	}
 
@@ -0,0 +1,324 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * fingerprint set routines
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwget.h>
+#include "private.h"
+
+// A set of 64bit fingerprints, using open addressing with linear probing.
+// The fingerprints are stored inline, so a set without keys needs just 8 bytes per slot.
+//
+// Without a compare function, two keys with the same fingerprint are considered equal.
+// With 64bit fingerprints a false positive is very unlikely, e.g. ~3 * 10^-6 for 10M entries.
+// With a compare function (exact-verify mode) the keys are stored as well and compared
+// on equal fingerprints.
+
+struct _wget_fpset_st {
+	unsigned long long
+		(*hash)(const void *); // hash function, the result is turned into the fingerprint
+	int
+		(*cmp)(const void *, const void *); // compare function, NULL: fingerprints only
+	void
+		(*key_destructor)(void *); // key destructor function
+	unsigned long long
+		*fp; // fingerprints, 0 marks an unused slot
+	void
+		**keys; // keys in exact-verify mode, else NULL
+	int
+		max, // allocated slots, always a power of 2
+		cur, // slots in use
+		threshold; // resize when cur reaches threshold
+};
+
+// mix the bits (finalizer of splitmix64), so that weak hash functions still spread well
+static unsigned long long G_GNUC_WGET_CONST _fingerprint(unsigned long long h)
+{
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+
+	return h ? h : 1; // 0 is reserved for unused slots
+}
+
+// 64bit FNV-1a hash of 'len' bytes of 'data'.
+// To hash several pieces of data, pass the result of the previous call as 'h', else 0.
+unsigned long long wget_fpset_hash(unsigned long long h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	if (!h)
+		h = 0xcbf29ce484222325ULL;
+
+	for (const unsigned char *e = p + len; p < e; p++)
+		h = (h ^ *p) * 0x100000001b3ULL;
+
+	return h;
+}
+
+// create a fingerprint set with initial size <max> (rounded up to a power of 2)
+// hash: computes the fingerprint of a key, may be NULL if only wget_fpset_add_fingerprint() is used
+// cmp: comparison function to verify keys with equal fingerprints, NULL to store fingerprints only
+// in exact-verify mode the keys are owned by the set and freed by wget_fpset_free()
+wget_fpset_t *wget_fpset_create(int max, unsigned long long (*hash)(const void *), int (*cmp)(const void *, const void *))
+{
+	wget_fpset_t *set = xmalloc(sizeof(wget_fpset_t));
+	int n;
+
+	for (n = 16; n < max && n < (1 << 30); n <<= 1);
+
+	set->hash = hash;
+	set->cmp = cmp;
+	set->key_destructor = cmp ? free : NULL;
+	set->fp = xcalloc(n, sizeof(unsigned long long));
+	set->keys = cmp ? xcalloc(n, sizeof(void *)) : NULL;
+	set->max = n;
+	set->cur = 0;
+	set->threshold = n / 4 * 3;
+
+	return set;
+}
+
+static void _fpset_rehash(wget_fpset_t *set)
+{
+	unsigned long long *fp = set->fp;
+	void **keys = set->keys;
+	int max = set->max, mask = max * 2 - 1;
+
+	set->fp = xcalloc(max * 2, sizeof(unsigned long long));
+	if (keys)
+		set->keys = xcalloc(max * 2, sizeof(void *));
+
+	for (int it = 0; it < max; it++) {
+		if (fp[it]) {
+			int pos = (int)(fp[it] & mask);
+
+			while (set->fp[pos])
+				pos = (pos + 1) & mask;
+
+			set->fp[pos] = fp[it];
+			if (keys)
+				set->keys[pos] = keys[it];
+		}
+	}
+
+	xfree(keys);
+	xfree(fp);
+
+	set->max = max * 2;
+	set->threshold = set->max / 4 * 3;
+}
+
+// returns the slot of the entry or the unused slot where it would be stored
+static int _fpset_find(const wget_fpset_t *set, const void *key, unsigned long long fp)
+{
+	int mask = set->max - 1, pos = (int)(fp & mask);
+
+	for (; set->fp[pos]; pos = (pos + 1) & mask) {
+		if (set->fp[pos] == fp && (!set->keys || key == set->keys[pos] || !set->cmp(key, set->keys[pos])))
+			break;
+	}
+
+	return pos;
+}
+
+static int _fpset_add(wget_fpset_t *set, const void *key, unsigned long long fp)
+{
+	int pos;
+
+	if (set->fp[pos = _fpset_find(set, key, fp)])
+		return 1;
+
+	set->fp[pos] = fp;
+	if (set->keys)
+		set->keys[pos] = (void *)key;
+
+	if (++set->cur >= set->threshold)
+		_fpset_rehash(set);
+
+	return 0;
+}
+
+// Add 'key' to the set.
+// Returns 0 if the key has been added, 1 if it already was in the set.
+// In exact-verify mode the set takes ownership of a key that has been added.
+int wget_fpset_add(wget_fpset_t *set, const void *key)
+{
+	if (!set)
+		return -1;
+
+	return _fpset_add(set, key, _fingerprint(set->hash(key)));
+}
+
+// Add a precomputed hash (e.g. from wget_fpset_hash()) to a set without compare function.
+// Returns 0 if the fingerprint has been added, 1 if it already was in the set.
+int wget_fpset_add_fingerprint(wget_fpset_t *set, unsigned long long hash)
+{
+	if (!set || set->keys)
+		return -1;
+
+	return _fpset_add(set, NULL, _fingerprint(hash));
+}
+
+int wget_fpset_contains(const wget_fpset_t *set, const void *key)
+{
+	if (!set)
+		return 0;
+
+	return !!set->fp[_fpset_find(set, key, _fingerprint(set->hash(key)))];
+}
+
+int wget_fpset_contains_fingerprint(const wget_fpset_t *set, unsigned long long hash)
+{
+	if (!set || set->keys)
+		return 0;
+
+	return !!set->fp[_fpset_find(set, NULL, _fingerprint(hash))];
+}
+
+// returns the key of the set that equals 'key', NULL if there is none (exact-verify mode only)
+void *wget_fpset_get(const wget_fpset_t *set, const void *key)
+{
+	if (!set || !set->keys)
+		return NULL;
+
+	return set->keys[_fpset_find(set, key, _fingerprint(set->hash(key)))];
+}
+
+int wget_fpset_size(const wget_fpset_t *set)
+{
+	return set ? set->cur : 0;
+}
+
+// number of bytes allocated by the set (without the keys)
+size_t wget_fpset_memory(const wget_fpset_t *set)
+{
+	if (!set)
+		return 0;
+
+	return sizeof(wget_fpset_t) + set->max * (sizeof(unsigned long long) + (set->keys ? sizeof(void *) : 0));
+}
+
+// call browse() for each key, exact-verify mode only
+int wget_fpset_browse(const wget_fpset_t *set, int (*browse)(void *ctx, const void *key), void *ctx)
+{
+	int ret = 0;
+
+	if (set && set->keys) {
+		for (int it = 0; it < set->max && !ret; it++) {
+			if (set->fp[it])
+				ret = browse(ctx, set->keys[it]);
+		}
+	}
+
+	return ret;
+}
+
+// Direct access to the fingerprint table of a set without compare function, e.g. to save it to a file.
+// Returns the number of slots (a power of 2) and sets '*fp' to the table, unused slots are 0.
+// The table is valid until the set is changed.
+int wget_fpset_get_fingerprints(const wget_fpset_t *set, const unsigned long long **fp)
+{
+	if (!set || set->keys) {
+		*fp = NULL;
+		return 0;
+	}
+
+	*fp = set->fp;
+	return set->max;
+}
+
+// Add the fingerprints of a table returned by wget_fpset_get_fingerprints(), 0 entries are skipped.
+// If 'set' is empty and 'n' is a power of 2, the table is taken as it is without rehashing.
+// Returns the number of fingerprints that have been added, -1 on error.
+int wget_fpset_add_fingerprints(wget_fpset_t *set, const unsigned long long *fp, int n)
+{
+	int added = 0;
+
+	if (!set || set->keys || n < 0)
+		return -1;
+
+	if (!set->cur && n >= set->max && !(n & (n - 1))) {
+		if (n > set->max) {
+			xfree(set->fp);
+			set->fp = xmalloc(n * sizeof(unsigned long long));
+			set->max = n;
+			set->threshold = n / 4 * 3;
+		}
+		memcpy(set->fp, fp, n * sizeof(unsigned long long));
+
+		for (int it = 0; it < n; it++) {
+			if (fp[it])
+				added++;
+		}
+
+		if ((set->cur = added) >= set->threshold)
+			_fpset_rehash(set);
+
+		return added;
+	}
+
+	for (int it = 0; it < n; it++) {
+		if (fp[it] && !_fpset_add(set, NULL, fp[it]))
+			added++;
+	}
+
+	return added;
+}
+
+void wget_fpset_set_key_destructor(wget_fpset_t *set, void (*destructor)(void *key))
+{
+	if (set)
+		set->key_destructor = destructor;
+}
+
+void wget_fpset_clear(wget_fpset_t *set)
+{
+	if (set) {
+		if (set->keys) {
+			for (int it = 0; it < set->max; it++) {
+				if (set->fp[it] && set->key_destructor)
+					set->key_destructor(set->keys[it]);
+			}
+			memset(set->keys, 0, set->max * sizeof(void *));
+		}
+
+		memset(set->fp, 0, set->max * sizeof(unsigned long long));
+		set->cur = 0;
+	}
+}
+
+void wget_fpset_free(wget_fpset_t **set)
+{
+	if (set && *set) {
+		wget_fpset_clear(*set);
+		xfree((*set)->keys);
+		xfree((*set)->fp);
+		xfree(*set);
+	}
+}
@@ -36,11 +36,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <c-ctype.h>
 #include <time.h>
 #include <errno.h>
 #include <sys/socket.h>
+#if defined __SSE2__ && defined __GNUC__
+#include <emmintrin.h>
+#endif
 #include <netinet/in.h>
 #if WITH_ZLIB
 //#include <zlib.h>
@@ -53,6 +57,7 @@
 #include "private.h"
 
 #define HTTP_CTYPE_SEPERATOR (1<<0)
+#define HTTP2_MAX_STREAMS 100 // upper limit of concurrent streams per HTTP/2 session
 #define _http_isseperator(c) (http_ctype[(unsigned char)(c)]&HTTP_CTYPE_SEPERATOR)
 
 static const unsigned char
@@ -633,6 +638,10 @@ const char *wget_http_parse_content_encoding(const char *s, char *content_encodi
 		// 'xz' is the tag currently understood by Firefox (2.1.2014)
 		// 'lzma' / 'x-lzma' are the tags currently understood by ELinks
 		*content_encoding = wget_content_encoding_lzma;
+	else if (!wget_strcasecmp_ascii(s, "br"))
+		*content_encoding = wget_content_encoding_brotli;
+	else if (!wget_strcasecmp_ascii(s, "zstd"))
+		*content_encoding = wget_content_encoding_zstd;
 	else
 		*content_encoding = wget_content_encoding_identity;
 
@@ -655,6 +664,35 @@ const char *wget_http_parse_connection(const char *s, char *keep_alive)
 	return s;
 }
 
+// Retry-After: 120
+// Retry-After: Fri, 31 Dec 1999 23:59:59 GMT
+const char *wget_http_parse_retry_after(const char *s, int *seconds)
+{
+	while (c_isblank(*s)) s++;
+
+	if (c_isdigit(*s)) {
+		long long n = 0;
+
+		for (; c_isdigit(*s); s++) {
+			if (n <= INT_MAX)
+				n = n * 10 + (*s - '0');
+		}
+
+		*seconds = n > INT_MAX ? INT_MAX : (int) n;
+	} else {
+		time_t date = wget_http_parse_full_date(s), now = time(NULL);
+
+		if (date > now)
+			*seconds = date - now > INT_MAX ? INT_MAX : (int) (date - now);
+		else
+			*seconds = 0;
+
+		s += strlen(s);
+	}
+
+	return s;
+}
+
 const char *wget_http_parse_etag(const char *s, const char **etag)
 {
 	const char *p;
@@ -1064,77 +1102,234 @@ const char *wget_http_parse_setcookie(const char *s, wget_cookie_t *cookie)
 	return s;
 }
 
-/* content of <buf> will be destroyed */
+// The response header names we understand, see _header_id()
+enum {
+	HEADER_UNKNOWN,
+	HEADER_CONTENT_ENCODING,
+	HEADER_CONTENT_TYPE,
+	HEADER_CONTENT_LENGTH,
+	HEADER_CONTENT_DISPOSITION,
+	HEADER_CONNECTION,
+	HEADER_LAST_MODIFIED,
+	HEADER_LOCATION,
+	HEADER_LINK,
+	HEADER_TRANSFER_ENCODING,
+	HEADER_SET_COOKIE,
+	HEADER_STRICT_TRANSPORT_SECURITY,
+	HEADER_WWW_AUTHENTICATE,
+	HEADER_DIGEST,
+	HEADER_ICY_METAINT,
+	HEADER_ETAG,
+	HEADER_RETRY_AFTER
+};
 
-/* buf must be 0-terminated */
-wget_http_response_t *wget_http_parse_response_header(char *buf)
+// Perfect hash of the names above: ((length << 2) + name[2] + name[length - 1]) & 31, characters lowercased.
+// The slots must be recomputed when a name is added.
+#define _HEADER_NAME(s, id) { s, sizeof(s) - 1, id }
+static const struct {
+	const char *
+		name;
+	unsigned char
+		length,
+		id;
+} _header_names[32] = {
+	[ 1] = _HEADER_NAME("Set-Cookie", HEADER_SET_COOKIE),
+	[ 3] = _HEADER_NAME("Content-Type", HEADER_CONTENT_TYPE),
+	[ 4] = _HEADER_NAME("Connection", HEADER_CONNECTION),
+	[ 8] = _HEADER_NAME("Content-Disposition", HEADER_CONTENT_DISPOSITION),
+	[ 9] = _HEADER_NAME("Link", HEADER_LINK),
+	[11] = _HEADER_NAME("Last-Modified", HEADER_LAST_MODIFIED),
+	[12] = _HEADER_NAME("Transfer-Encoding", HEADER_TRANSFER_ENCODING),
+	[14] = _HEADER_NAME("Content-Length", HEADER_CONTENT_LENGTH),
+	[15] = _HEADER_NAME("Strict-Transport-Security", HEADER_STRICT_TRANSPORT_SECURITY),
+	[17] = _HEADER_NAME("Location", HEADER_LOCATION),
+	[18] = _HEADER_NAME("Retry-After", HEADER_RETRY_AFTER),
+	[19] = _HEADER_NAME("Digest", HEADER_DIGEST),
+	[21] = _HEADER_NAME("Content-Encoding", HEADER_CONTENT_ENCODING),
+	[24] = _HEADER_NAME("ETag", HEADER_ETAG),
+	[25] = _HEADER_NAME("ICY-Metaint", HEADER_ICY_METAINT),
+	[28] = _HEADER_NAME("WWW-Authenticate", HEADER_WWW_AUTHENTICATE),
+};
+#undef _HEADER_NAME
+
+static int _header_id(const char *name, size_t namelen)
+{
+	if (namelen >= 4 && namelen <= 25) {
+		unsigned h = ((namelen << 2) + ((unsigned char) name[2] | 0x20) + ((unsigned char) name[namelen - 1] | 0x20)) & 31;
+
+		if (_header_names[h].length == namelen && !wget_strncasecmp_ascii(name, _header_names[h].name, namelen))
+			return _header_names[h].id;
+	}
+
+	return HEADER_UNKNOWN;
+}
+
+// Find the LF ending the line that starts at 's' and the first colon of the line in a single pass.
+// Returns a pointer to the LF or 'end'. *colon is only set if it is NULL.
+static char *_scan_line(char *s, const char *end, char **colon)
+{
+#if defined __SSE2__ && defined __GNUC__
+	const __m128i lf = _mm_set1_epi8('\n'), col = _mm_set1_epi8(':');
+
+	// compare 16 bytes at once
+	for (; end - s >= 16; s += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) s);
+		unsigned lfmask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+
+		if (!*colon) {
+			unsigned colmask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, col));
+
+			if (lfmask)
+				colmask &= (lfmask & -lfmask) - 1; // only colons before the LF
+			if (colmask)
+				*colon = s + __builtin_ctz(colmask);
+		}
+
+		if (lfmask)
+			return s + __builtin_ctz(lfmask);
+	}
+#endif
+
+	for (; s < end; s++) {
+		if (*s == '\n')
+			return s;
+		if (*s == ':' && !*colon)
+			*colon = s;
+	}
+
+	return s;
+}
+
+// Find the "\r\n\r\n" that ends a response header within [start, end).
+// A match is only reported if it begins after 'start'.
+static char *_find_header_end(char *start, const char *end)
+{
+	char *p = start;
+
+	while (end - p > 2 && (p = memchr(p, '\n', end - p - 2))) {
+		if (p > start && p[-1] == '\r' && p[1] == '\r' && p[2] == '\n')
+			return p - 1;
+		p++;
+	}
+
+	return NULL;
+}
+
+static const char *_parse_status_number(const char *s, short *n)
+{
+	int digits;
+
+	for (*n = 0, digits = 0; digits < 3 && c_isdigit(*s); digits++, s++)
+		*n = *n * 10 + (*s - '0');
+
+	return digits ? s : NULL;
+}
+
+// "HTTP/1.1 200 OK", the reason phrase may be missing
+static int _parse_status_line(const char *s, wget_http_response_t *resp)
+{
+	size_t len;
+
+	while (c_isspace(*s)) s++;
+
+	if (strncmp(s, "HTTP/", 5))
+		return 0;
+
+	if (!(s = _parse_status_number(s + 5, &resp->major)) || *s++ != '.'
+		|| !(s = _parse_status_number(s, &resp->minor)))
+		return 0;
+
+	while (c_isblank(*s)) s++;
+
+	if (!(s = _parse_status_number(s, &resp->code)))
+		return 0;
+
+	while (c_isblank(*s)) s++;
+
+	for (len = 0; len < sizeof(resp->reason) - 1 && s[len] && s[len] != '\r' && s[len] != '\n'; len++);
+	memcpy(resp->reason, s, len);
+	resp->reason[len] = 0;
+
+	while (len > 0 && c_isblank(resp->reason[len - 1]))
+		resp->reason[--len] = 0;
+
+	return 1;
+}
+
+// Parse the response header in [buf, end), *end must be 0.
+// The lines are split in one pass, the header names are looked up by a perfect hash.
+static wget_http_response_t *_parse_response_header(char *buf, char *end)
 {
 	const char *s;
-	char *line, *eol;
+	char *line, *eol, *colon;
 	const char *name;
 	size_t namelen;
-	wget_http_response_t *resp = NULL;
+	wget_http_response_t *resp;
 
 	resp = xcalloc(1, sizeof(wget_http_response_t));
 
-	if (sscanf(buf, " HTTP/%3hd.%3hd %3hd %31[^\r\n] ",
-		&resp->major, &resp->minor, &resp->code, resp->reason) >= 3)
-	{
-		if ((eol = strchr(buf + 10, '\n'))) {
-			// eol[-1]=0;
-			// debug_printf("# %s\n",buf);
-		} else {
-			// empty HTTP header
-			return resp;
-		}
-	} else {
+	if (!_parse_status_line(buf, resp)) {
 		error_printf(_("HTTP response header not found\n"));
 		xfree(resp);
 		return NULL;
 	}
 
-	for (line = eol + 1; eol && *line && *line != '\r'; line = eol + 1) {
-		eol = strchr(line + 1, '\n');
-		while (eol && c_isblank(eol[1])) { // handle split lines
-			*eol = eol[-1] = ' ';
-			eol = strchr(eol + 1, '\n');
+	colon = buf; // don't look for a colon in the status line
+	if ((eol = _scan_line(buf, end, &colon)) == end)
+		return resp; // empty HTTP header
+
+	for (line = eol + 1; line < end && *line != '\r' && *line != '\n'; line = eol + 1) {
+		colon = NULL;
+		eol = _scan_line(line, end, &colon);
+
+		while (eol < end && c_isblank(eol[1])) { // handle split lines
+			*eol = ' ';
+			if (eol[-1] == '\r')
+				eol[-1] = ' ';
+			eol = _scan_line(eol + 1, end, &colon);
 		}
 
-		if (eol)
+		*eol = 0;
+		if (eol[-1] == '\r')
 			eol[-1] = 0;
 
-		// debug_printf("# %p %s\n",eol,line);
+		for (name = line; c_isblank(*name); name++);
+		for (namelen = 0; wget_http_istoken(name[namelen]); namelen++);
 
-		s = wget_parse_name_fixed(line, &name, &namelen);
 		// s now points directly after :
+		s = colon ? colon + 1 : eol;
 
-		switch (*name | 0x20) {
-		case 'c':
-			if (!wget_strncasecmp_ascii(name, "Content-Encoding", namelen)) {
-				wget_http_parse_content_encoding(s, &resp->content_encoding);
-			} else if (!wget_strncasecmp_ascii(name, "Content-Type", namelen)) {
-				wget_http_parse_content_type(s, &resp->content_type, &resp->content_type_encoding);
-			} else if (!wget_strncasecmp_ascii(name, "Content-Length", namelen)) {
-				resp->content_length = (size_t)atoll(s);
-				resp->content_length_valid = 1;
-			} else if (!wget_strncasecmp_ascii(name, "Content-Disposition", namelen)) {
-				wget_http_parse_content_disposition(s, &resp->content_filename);
-			} else if (!wget_strncasecmp_ascii(name, "Connection", namelen)) {
-				wget_http_parse_connection(s, &resp->keep_alive);
-			}
+		switch (_header_id(name, namelen)) {
+		case HEADER_CONTENT_ENCODING:
+			wget_http_parse_content_encoding(s, &resp->content_encoding);
+			break;
+		case HEADER_CONTENT_TYPE:
+			wget_http_parse_content_type(s, &resp->content_type, &resp->content_type_encoding);
+			break;
+		case HEADER_CONTENT_LENGTH:
+			resp->content_length = (size_t)atoll(s);
+			resp->content_length_valid = 1;
+			break;
+		case HEADER_CONTENT_DISPOSITION:
+			wget_http_parse_content_disposition(s, &resp->content_filename);
 			break;
-		case 'l':
-			if (!wget_strncasecmp_ascii(name, "Last-Modified", namelen)) {
-				// Last-Modified: Thu, 07 Feb 2008 15:03:24 GMT
-				resp->last_modified = wget_http_parse_full_date(s);
-			} else if (resp->code / 100 == 3 && !wget_strncasecmp_ascii(name, "Location", namelen)) {
+		case HEADER_CONNECTION:
+			wget_http_parse_connection(s, &resp->keep_alive);
+			break;
+		case HEADER_LAST_MODIFIED:
+			// Last-Modified: Thu, 07 Feb 2008 15:03:24 GMT
+			resp->last_modified = wget_http_parse_full_date(s);
+			break;
+		case HEADER_LOCATION:
+			if (resp->code / 100 == 3) {
 				xfree(resp->location);
 				wget_http_parse_location(s, &resp->location);
-			} else if (resp->code / 100 == 3 && !wget_strncasecmp_ascii(name, "Link", namelen)) {
-				// debug_printf("s=%.31s\n",s);
+			}
+			break;
+		case HEADER_LINK:
+			if (resp->code / 100 == 3) {
 				wget_http_link_t link;
 				wget_http_parse_link(s, &link);
-				// debug_printf("link->uri=%s\n",link.uri);
 				if (!resp->links) {
 					resp->links = wget_vector_create(8, 8, NULL);
 					wget_vector_set_destructor(resp->links, (void(*)(void *))wget_http_free_link);
@@ -1142,64 +1337,60 @@ wget_http_response_t *wget_http_parse_response_header(char *buf)
 				wget_vector_add(resp->links, &link, sizeof(link));
 			}
 			break;
-		case 't':
-			if (!wget_strncasecmp_ascii(name, "Transfer-Encoding", namelen)) {
-				wget_http_parse_transfer_encoding(s, &resp->transfer_encoding);
-			}
+		case HEADER_TRANSFER_ENCODING:
+			wget_http_parse_transfer_encoding(s, &resp->transfer_encoding);
 			break;
-		case 's':
-			if (!wget_strncasecmp_ascii(name, "Set-Cookie", namelen)) {
-				// this is a parser. content validation must be done by higher level functions.
-				wget_cookie_t cookie;
-				wget_http_parse_setcookie(s, &cookie);
-
-				if (cookie.name) {
-					if (!resp->cookies) {
-						resp->cookies = wget_vector_create(4, 4, NULL);
-						wget_vector_set_destructor(resp->cookies, (void(*)(void *))wget_cookie_deinit);
-					}
-					wget_vector_add(resp->cookies, &cookie, sizeof(cookie));
+		case HEADER_SET_COOKIE:
+		{
+			// this is a parser. content validation must be done by higher level functions.
+			wget_cookie_t cookie;
+			wget_http_parse_setcookie(s, &cookie);
+
+			if (cookie.name) {
+				if (!resp->cookies) {
+					resp->cookies = wget_vector_create(4, 4, NULL);
+					wget_vector_set_destructor(resp->cookies, (void(*)(void *))wget_cookie_deinit);
 				}
-			}
-			else if (!wget_strncasecmp_ascii(name, "Strict-Transport-Security", namelen)) {
-				resp->hsts = 1;
-				wget_http_parse_strict_transport_security(s, &resp->hsts_maxage, &resp->hsts_include_subdomains);
+				wget_vector_add(resp->cookies, &cookie, sizeof(cookie));
 			}
 			break;
-		case 'w':
-			if (!wget_strncasecmp_ascii(name, "WWW-Authenticate", namelen)) {
-				wget_http_challenge_t challenge;
-				wget_http_parse_challenge(s, &challenge);
-
-				if (!resp->challenges) {
-					resp->challenges = wget_vector_create(2, 2, NULL);
-					wget_vector_set_destructor(resp->challenges, (void(*)(void *))wget_http_free_challenge);
-				}
-				wget_vector_add(resp->challenges, &challenge, sizeof(challenge));
-			}
+		}
+		case HEADER_STRICT_TRANSPORT_SECURITY:
+			resp->hsts = 1;
+			wget_http_parse_strict_transport_security(s, &resp->hsts_maxage, &resp->hsts_include_subdomains);
 			break;
-		case 'd':
-			if (!wget_strncasecmp_ascii(name, "Digest", namelen)) {
-				// http://tools.ietf.org/html/rfc3230
-				wget_http_digest_t digest;
-				wget_http_parse_digest(s, &digest);
-				// debug_printf("%s: %s\n",digest.algorithm,digest.encoded_digest);
-				if (!resp->digests) {
-					resp->digests = wget_vector_create(4, 4, NULL);
-					wget_vector_set_destructor(resp->digests, (void(*)(void *))wget_http_free_digest);
-				}
-				wget_vector_add(resp->digests, &digest, sizeof(digest));
+		case HEADER_WWW_AUTHENTICATE:
+		{
+			wget_http_challenge_t challenge;
+			wget_http_parse_challenge(s, &challenge);
+
+			if (!resp->challenges) {
+				resp->challenges = wget_vector_create(2, 2, NULL);
+				wget_vector_set_destructor(resp->challenges, (void(*)(void *))wget_http_free_challenge);
 			}
+			wget_vector_add(resp->challenges, &challenge, sizeof(challenge));
 			break;
-		case 'i':
-			if (!wget_strncasecmp_ascii(name, "ICY-Metaint", namelen)) {
-				resp->icy_metaint = atoi(s);
+		}
+		case HEADER_DIGEST:
+		{
+			// http://tools.ietf.org/html/rfc3230
+			wget_http_digest_t digest;
+			wget_http_parse_digest(s, &digest);
+			if (!resp->digests) {
+				resp->digests = wget_vector_create(4, 4, NULL);
+				wget_vector_set_destructor(resp->digests, (void(*)(void *))wget_http_free_digest);
 			}
+			wget_vector_add(resp->digests, &digest, sizeof(digest));
 			break;
-		case 'e':
-			if (!wget_strncasecmp_ascii(name, "ETag", namelen)) {
-				wget_http_parse_etag(s, &resp->etag);
-			}
+		}
+		case HEADER_ICY_METAINT:
+			resp->icy_metaint = atoi(s);
+			break;
+		case HEADER_ETAG:
+			wget_http_parse_etag(s, &resp->etag);
+			break;
+		case HEADER_RETRY_AFTER:
+			wget_http_parse_retry_after(s, &resp->retry_after);
 			break;
 		default:
 			break;
@@ -1226,6 +1417,14 @@ wget_http_response_t *wget_http_parse_response_header(char *buf)
 	return resp;
 }
 
+/* content of <buf> will be destroyed */
+
+/* buf must be 0-terminated */
+wget_http_response_t *wget_http_parse_response_header(char *buf)
+{
+	return _parse_response_header(buf, buf + strlen(buf));
+}
+
 int wget_http_free_param(wget_http_header_param_t *param)
 {
 	xfree(param->name);
@@ -1302,6 +1501,13 @@ void wget_http_free_request(wget_http_request_t **req)
 }
 
 wget_http_request_t *wget_http_create_request(const wget_iri_t *iri, const char *method)
+{
+	return wget_http_create_request_with_template(iri, method, NULL);
+}
+
+// The headers of 'tmpl' are sent with the request, right after Host:.
+// 'tmpl' is not copied and must not be changed or freed before the request is freed.
+wget_http_request_t *wget_http_create_request_with_template(const wget_iri_t *iri, const char *method, const wget_http_request_template_t *tmpl)
 {
 	wget_http_request_t *req = xcalloc(1, sizeof(wget_http_request_t));
 
@@ -1309,22 +1515,73 @@ wget_http_request_t *wget_http_create_request(const wget_iri_t *iri, const char
 	wget_buffer_init(&req->esc_host, req->esc_host_buf, sizeof(req->esc_host_buf));
 
 	req->scheme = iri->scheme;
+	req->tmpl = tmpl;
 	strlcpy(req->method, method, sizeof(req->method));
 	wget_iri_get_escaped_resource(iri, &req->esc_resource);
 	wget_iri_get_escaped_host(iri, &req->esc_host);
-	req->headers = wget_vector_create(8, 8, NULL);
-	wget_vector_set_destructor(req->headers, (void(*)(void *))wget_http_free_param);
 
 	return req;
 }
 
+struct wget_http_request_template_st {
+	wget_vector_t *
+		headers; // used for HTTP/2
+	wget_buffer_t *
+		header; // the same headers as "name: value\r\n" lines, used for HTTP/1.1
+};
+
+wget_http_request_template_t *wget_http_create_request_template(void)
+{
+	wget_http_request_template_t *tmpl = xcalloc(1, sizeof(wget_http_request_template_t));
+
+	tmpl->headers = wget_vector_create(8, 8, NULL);
+	wget_vector_set_destructor(tmpl->headers, (void(*)(void *))wget_http_free_param);
+	tmpl->header = wget_buffer_alloc(256);
+
+	return tmpl;
+}
+
+void wget_http_request_template_add_header(wget_http_request_template_t *tmpl, const char *name, const char *value)
+{
+	wget_http_header_param_t param = {
+		.name = strdup(name),
+		.value = strdup(value)
+	};
+
+	wget_vector_add(tmpl->headers, &param, sizeof(param));
+
+	wget_buffer_strcat(tmpl->header, name);
+	wget_buffer_memcat(tmpl->header, ": ", 2);
+	wget_buffer_strcat(tmpl->header, value);
+	wget_buffer_memcat(tmpl->header, "\r\n", 2);
+}
+
+void wget_http_free_request_template(wget_http_request_template_t **tmpl)
+{
+	if (tmpl && *tmpl) {
+		wget_vector_free(&(*tmpl)->headers);
+		wget_buffer_free(&(*tmpl)->header);
+		xfree(*tmpl);
+	}
+}
+
+static void _add_header(wget_http_request_t *req, wget_http_header_param_t *param)
+{
+	if (!req->headers) {
+		req->headers = wget_vector_create(8, 8, NULL);
+		wget_vector_set_destructor(req->headers, (void(*)(void *))wget_http_free_param);
+	}
+
+	wget_vector_add(req->headers, param, sizeof(*param));
+}
+
 void wget_http_add_header_vprintf(wget_http_request_t *req, const char *name, const char *fmt, va_list args)
 {
 	wget_http_header_param_t param;
 
 	param.value = wget_str_vasprintf(fmt, args);
 	param.name = strdup(name);
-	wget_vector_add(req->headers, &param, sizeof(param));
+	_add_header(req, &param);
 }
 
 void wget_http_add_header_printf(wget_http_request_t *req, const char *name, const char *fmt, ...)
@@ -1343,7 +1600,7 @@ void wget_http_add_header(wget_http_request_t *req, const char *name, const char
 		.value = strdup(value)
 	};
 
-	wget_vector_add(req->headers, &param, sizeof(param));
+	_add_header(req, &param);
 }
 
 void wget_http_add_header_param(wget_http_request_t *req, wget_http_header_param_t *param)
@@ -1353,7 +1610,7 @@ void wget_http_add_header_param(wget_http_request_t *req, wget_http_header_param
 		.value = strdup(param->value)
 	};
 
-	wget_vector_add(req->headers, &_param, sizeof(_param));
+	_add_header(req, &_param);
 }
 
 void wget_http_add_credentials(wget_http_request_t *req, wget_http_challenge_t *challenge, const char *username, const char *password)
@@ -1537,34 +1794,67 @@ static int _on_frame_send_callback(nghttp2_session *session G_GNUC_WGET_UNUSED,
 	return 0;
 }
 
-static int _on_frame_recv_callback(nghttp2_session *session G_GNUC_WGET_UNUSED,
-	const nghttp2_frame *frame, void *user_data G_GNUC_WGET_UNUSED)
-{
-	_print_frame_type(frame->hd.type, '<');
-
-	return 0;
-}
-
+// An HTTP/2 session is shared by all threads having a request on it.
+// nghttp2 is not thread-safe, all calls into the session are serialized by 'mutex'.
+// One of the threads waiting for a response reads from the connection and hands the frames
+// over to the streams they belong to, the other ones sleep until their stream is closed or
+// the reading thread returns with its own response (then the next one takes over reading).
+struct wget_http2_st {
+	wget_thread_mutex_t
+		mutex;
+	wget_thread_cond_t
+		cond; // signalled after each read
+	char
+		reading, // a thread reads from the connection
+		goaway, // no new streams, the open ones are still answered
+		failed; // I/O error or timeout, all streams fail
+};
 
-// the following is just needed for the progress bar
+// state of an HTTP/2 stream, shared by the requesting thread and the thread reading the session
 struct _body_callback_context {
 	wget_http_response_t *resp;
 	void *context;
+	int (*header_callback)(void *, wget_http_response_t *);
 	int (*body_callback)(void *, const char *, size_t);
+	wget_buffer_t *pending; // body data received before the requesting thread waits for it
+	uint32_t error; // RST_STREAM error code
+	char header_done; // final response header received
 	char done;
 };
 
+static int _on_frame_recv_callback(nghttp2_session *session,
+	const nghttp2_frame *frame, void *user_data)
+{
+	wget_http_connection_t *conn = (wget_http_connection_t *)user_data;
+
+	_print_frame_type(frame->hd.type, '<');
+
+	if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_RESPONSE) {
+		struct _body_callback_context *ctx = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+
+		if (ctx && ctx->resp->code / 100 != 1) {
+			ctx->header_done = 1;
+			if (ctx->header_callback)
+				ctx->header_callback(ctx->context, ctx->resp);
+		}
+	} else if (frame->hd.type == NGHTTP2_GOAWAY) {
+		debug_printf("HTTP2 GOAWAY (last stream %d)\n", frame->goaway.last_stream_id);
+		conn->http2->goaway = 1;
+	}
+
+	return 0;
+}
+
 static int _on_header_callback(nghttp2_session *session G_GNUC_WGET_UNUSED,
 	const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
 	const uint8_t *value, size_t valuelen,
 	uint8_t flags G_GNUC_WGET_UNUSED, void *user_data G_GNUC_WGET_UNUSED)
 {
-	wget_http_request_t *req = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+	struct _body_callback_context *ctx = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
 
-	if (req) {
+	if (ctx) {
 		if (frame->hd.type == NGHTTP2_HEADERS) {
 			if (frame->headers.cat == NGHTTP2_HCAT_RESPONSE) {
-				struct _body_callback_context *ctx = req->nghttp2_context;
 				wget_http_response_t *resp = ctx->resp;
 				const char *s = wget_strmemdup((char *)value, valuelen);
 
@@ -1633,6 +1923,9 @@ static int _on_header_callback(nghttp2_session *session G_GNUC_WGET_UNUSED,
 					if (!memcmp(name, "icy-metaint", namelen)) {
 						resp->icy_metaint = atoi(s);
 					}
+					else if (!memcmp(name, "retry-after", namelen)) {
+						wget_http_parse_retry_after(s, &resp->retry_after);
+					}
 					break;
 				case 12:
 					if (!memcmp(name, "content-type", namelen)) {
@@ -1696,38 +1989,39 @@ static int _on_header_callback(nghttp2_session *session G_GNUC_WGET_UNUSED,
  * This function is called to indicate that a stream is closed.
  */
 static int _on_stream_close_callback(nghttp2_session *session, int32_t stream_id,
-	uint32_t error_code G_GNUC_WGET_UNUSED, void *user_data G_GNUC_WGET_UNUSED)
+	uint32_t error_code, void *user_data G_GNUC_WGET_UNUSED)
 {
-	wget_http_request_t *req = nghttp2_session_get_stream_user_data(session, stream_id);
+	struct _body_callback_context *ctx = nghttp2_session_get_stream_user_data(session, stream_id);
 
 	debug_printf("closing stream %d\n", stream_id);
-	if (req) {
-		struct _body_callback_context *ctx = req->nghttp2_context;
-
-		if (ctx)
-			ctx->done = 1;
+	if (ctx) {
+		ctx->error = error_code;
+		ctx->done = 1;
 	}
 
 	return 0;
 }
 /*
- * The implementation of nghttp2_on_data_chunk_recv_callback type. We
- * use this function to print the received response body.
+ * The implementation of nghttp2_on_data_chunk_recv_callback type.
+ * The data goes to the body callback of the stream's request.
  */
 static int _on_data_chunk_recv_callback(nghttp2_session *session,
 	uint8_t flags G_GNUC_WGET_UNUSED, int32_t stream_id,
 	const uint8_t *data, size_t len,	void *user_data G_GNUC_WGET_UNUSED)
 {
-	wget_http_request_t *req = nghttp2_session_get_stream_user_data(session, stream_id);
+	struct _body_callback_context *ctx = nghttp2_session_get_stream_user_data(session, stream_id);
 
-	if (req) {
-		struct _body_callback_context *ctx = req->nghttp2_context;
+	if (ctx) {
 //		debug_printf("[INFO] C <---------------------------- S%d (DATA chunk - %zu bytes)\n", stream_id, len);
 		debug_printf("nbytes %zd\n", len);
-		if (ctx && ctx->body_callback)
+		if (ctx->body_callback)
 			ctx->body_callback(ctx->context, (char *)data, (ssize_t)len);
-		// debug_write((char *)data, len);
-		// debug_printf("\n");
+		else {
+			// the requesting thread did not yet call wget_http_get_response_cb()
+			if (!ctx->pending)
+				ctx->pending = wget_buffer_alloc(len);
+			wget_buffer_memcat(ctx->pending, data, len);
+		}
 	}
 	return 0;
 }
@@ -1744,7 +2038,69 @@ static void setup_nghttp2_callbacks(nghttp2_session_callbacks *callbacks)
 }
 #endif
 
-int wget_http_open(wget_http_connection_t **_conn, const wget_iri_t *iri)
+#define CHUNK_COALESCE_MAX 256 // data of smaller chunks is collected before decoding, see _async_body()
+
+// states of a non-blocking request, see wget_http_process()
+enum {
+	ASYNC_IDLE, // connection established, no request pending
+	ASYNC_CONNECT, // TCP connect and TLS handshake
+	ASYNC_SEND, // sending request
+	ASYNC_HEADER, // reading response header
+	ASYNC_BODY, // reading Content-Length bytes or until the server closes
+	ASYNC_CHUNK_SIZE, // chunk-size
+	ASYNC_CHUNK_EXT, // [ chunk-extension ] CRLF
+	ASYNC_CHUNK_DATA, // chunk-data
+	ASYNC_CHUNK_CRLF, // CRLF after chunk-data
+	ASYNC_TRAILER, // *(entity-header CRLF) CRLF
+	ASYNC_DONE
+};
+
+struct wget_http_async_st;
+static ssize_t _async_body(struct wget_http_async_st *async, char *data, size_t length);
+
+struct wget_http_async_st {
+	wget_http_request_t
+		*req;
+	wget_http_response_t
+		*resp;
+	wget_decompressor_t
+		*dc;
+	wget_buffer_t
+		*body; // collects the body if there is no body callback
+	int
+		(*header_callback)(void *context, wget_http_response_t *resp);
+	int
+		(*body_callback)(void *context, const char *data, size_t length);
+	void
+		*context;
+	size_t
+		sent, // number of request bytes sent
+		body_len, // number of (raw) body bytes received
+		chunk_size; // remaining bytes of the current chunk
+	unsigned int
+		flags;
+	char
+		state,
+		request_pending, // set by wget_http_send_request_async() while connecting
+		line_empty; // for detecting the empty line that ends the trailer
+};
+
+// HTTP/1.1 pipelining, see wget_http_set_pipelining()
+struct wget_http_pipeline_st {
+	wget_vector_t
+		*requests; // requests sent and not yet answered, in the order of sending
+	wget_buffer_t
+		*buf; // data read beyond the current response, the start of the next response
+	struct wget_http_async_st
+		parser; // state of the body decoding
+	int
+		max; // max. number of requests in flight
+	char
+		confirmed, // the server answered with HTTP/1.1 and keep-alive
+		failed; // responses can't be matched to requests any more
+};
+
+static int _http_open(wget_http_connection_t **_conn, const wget_iri_t *iri, int nonblocking)
 {
 	static int next_http_proxy = -1;
 	static int next_https_proxy = -1;
@@ -1787,6 +2143,7 @@ int wget_http_open(wget_http_connection_t **_conn, const wget_iri_t *iri)
 	}
 
 	conn->tcp = wget_tcp_init();
+	wget_tcp_set_nonblocking(conn->tcp, nonblocking);
 	if (ssl) {
 		wget_tcp_set_ssl(conn->tcp, 1); // switch SSL on
 		wget_tcp_set_ssl_hostname(conn->tcp, host); // enable host name checking
@@ -1794,9 +2151,16 @@ int wget_http_open(wget_http_connection_t **_conn, const wget_iri_t *iri)
 
 	if ((rc = wget_tcp_connect(conn->tcp, host, port)) == WGET_E_SUCCESS) {
 		conn->esc_host = iri->host ? strdup(iri->host) : NULL;
-		conn->port = iri->resolv_port;
+		conn->port = iri->resolv_port ? strdup(iri->resolv_port) : NULL; // the connection may outlive the IRI (pooling)
 		conn->scheme = iri->scheme;
-		conn->buf = wget_buffer_alloc(102400); // reusable buffer, large enough for most requests and responses
+		conn->proxied = host != iri->host;
+		if (nonblocking) {
+			// thousands of parallel connections, keep the memory footprint small
+			conn->buf = wget_buffer_alloc(16384);
+			conn->async = xcalloc(1, sizeof(struct wget_http_async_st));
+			conn->async->state = ASYNC_CONNECT;
+		} else
+			conn->buf = wget_buffer_alloc(102400); // reusable buffer, large enough for most requests and responses
 #ifdef WITH_LIBNGHTTP2
 		if ((conn->protocol = wget_tcp_get_protocol(conn->tcp)) == WGET_PROTOCOL_HTTP_2_0) {
 			nghttp2_session_callbacks *callbacks;
@@ -1822,6 +2186,10 @@ int wget_http_open(wget_http_connection_t **_conn, const wget_iri_t *iri)
 				wget_http_close(_conn);
 				return WGET_E_INVALID;
 			}
+
+			conn->http2 = xcalloc(1, sizeof(struct wget_http2_st));
+			wget_thread_mutex_init(&conn->http2->mutex);
+			wget_thread_cond_init(&conn->http2->cond);
 		}
 #endif
 	} else {
@@ -1831,6 +2199,72 @@ int wget_http_open(wget_http_connection_t **_conn, const wget_iri_t *iri)
 	return rc;
 }
 
+int wget_http_open(wget_http_connection_t **_conn, const wget_iri_t *iri)
+{
+	return _http_open(_conn, iri, 0);
+}
+
+// Open a connection for use with wget_http_send_request_async() and wget_http_process().
+// The connect (and TLS handshake) just starts here, nothing ever blocks except DNS resolving
+// (see wget_http_prefetch() and wget_http_resolving()) and OCSP requests.
+int wget_http_open_async(wget_http_connection_t **_conn, const wget_iri_t *iri)
+{
+	return _http_open(_conn, iri, 1);
+}
+
+// the proxies used for connections to 'iri', NULL if it is connected directly
+static wget_vector_t *_http_proxies(const wget_iri_t *iri)
+{
+	if (iri->scheme == WGET_IRI_SCHEME_HTTP)
+		return http_proxies;
+	if (iri->scheme == WGET_IRI_SCHEME_HTTPS)
+		return https_proxies;
+	return NULL;
+}
+
+// Resolve the server of 'iri' (or its proxies) in the background, see wget_dns_prefetch().
+void wget_http_prefetch(const wget_iri_t *iri)
+{
+	wget_vector_t *proxies = _http_proxies(iri);
+
+	if (!proxies)
+		wget_dns_prefetch(iri->host, iri->resolv_port);
+
+	for (int it = 0; it < wget_vector_size(proxies); it++) {
+		wget_iri_t *proxy = wget_vector_get(proxies, it);
+
+		wget_dns_prefetch(proxy->host, proxy->resolv_port);
+	}
+}
+
+// Returns 1 while the server of 'iri' (or one of its proxies) is being resolved,
+// wget_http_open_async() would block until the resolution is done.
+int wget_http_resolving(const wget_iri_t *iri)
+{
+	wget_vector_t *proxies = _http_proxies(iri);
+
+	if (!proxies)
+		return wget_dns_resolving(iri->host, iri->resolv_port);
+
+	for (int it = 0; it < wget_vector_size(proxies); it++) {
+		wget_iri_t *proxy = wget_vector_get(proxies, it);
+
+		if (wget_dns_resolving(proxy->host, proxy->resolv_port))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void _async_reset(struct wget_http_async_st *async)
+{
+	wget_decompress_close(async->dc);
+	async->dc = NULL;
+	wget_http_free_response(&async->resp);
+	wget_buffer_free(&async->body);
+	async->req = NULL;
+}
+
 void wget_http_close(wget_http_connection_t **conn)
 {
 	if (*conn) {
@@ -1842,12 +2276,23 @@ void wget_http_close(wget_http_connection_t **conn)
 				error_printf(_("Failed to terminate HTTP2 session (%d)\n"), rc);
 			nghttp2_session_del((*conn)->http2_session);
 		}
+		xfree((*conn)->http2);
 #endif
 		wget_tcp_deinit(&(*conn)->tcp);
+		if ((*conn)->async) {
+			_async_reset((*conn)->async);
+			xfree((*conn)->async);
+		}
+		if ((*conn)->pipeline) {
+			wget_vector_clear_nofree((*conn)->pipeline->requests); // owned by the caller
+			wget_vector_free(&(*conn)->pipeline->requests);
+			wget_buffer_free(&(*conn)->pipeline->buf);
+			xfree((*conn)->pipeline);
+		}
 //		if (!wget_tcp_get_dns_caching())
 //			freeaddrinfo((*conn)->addrinfo);
 		xfree((*conn)->esc_host);
-		// xfree((*conn)->port);
+		xfree((*conn)->port);
 		// xfree((*conn)->scheme);
 		wget_buffer_free(&(*conn)->buf);
 		xfree(*conn);
@@ -1874,47 +2319,82 @@ void wget_http_close(wget_http_connection_t **conn)
 
 static int  G_GNUC_WGET_NONNULL((1,2)) _http_send_request(wget_http_connection_t *conn, wget_http_request_t *req, const void *body, size_t length)
 {
-	ssize_t nbytes;
+	ssize_t nbytes, rc;
 
 #ifdef WITH_LIBNGHTTP2
-	if (wget_tcp_get_protocol(conn->tcp) == WGET_PROTOCOL_HTTP_2_0) {
-		int n = 4 + wget_vector_size(req->headers);
+	if (conn->http2) {
+		wget_vector_t *headers[2] = { req->tmpl ? req->tmpl->headers : NULL, req->headers };
+		int n = 4 + wget_vector_size(headers[0]) + wget_vector_size(headers[1]), timeout;
 		nghttp2_nv nvs[n], *nvp;
 		char resource[req->esc_resource.length + 2];
+		struct _body_callback_context *ctx;
 
 		resource[0] = '/';
 		memcpy(resource + 1, req->esc_resource.data, req->esc_resource.length + 1);
-		INIT_NV(&nvs[0], ":method", "GET")
+		INIT_NV_CS(&nvs[0], ":method", req->method)
 		INIT_NV_CS(&nvs[1], ":path", resource)
 		INIT_NV(&nvs[2], ":scheme", "https")
 		INIT_NV_CS(&nvs[3], ":authority", req->esc_host.data)
 		nvp = &nvs[4];
 
-		for (int it = 0; it < wget_vector_size(req->headers); it++) {
-			wget_http_header_param_t *param = wget_vector_get(req->headers, it);
-			if (!wget_strcasecmp_ascii(param->name, "Connection"))
-				continue;
-			if (!wget_strcasecmp_ascii(param->name, "Accept-Encoding"))
-				continue;
-
-			INIT_NV_CS(nvp, param->name, param->value)
-			nvp++;
+		// the template headers first, as with HTTP/1.1
+		for (int v = 0; v < 2; v++) {
+			for (int it = 0; it < wget_vector_size(headers[v]); it++) {
+				wget_http_header_param_t *param = wget_vector_get(headers[v], it);
+				if (!wget_strcasecmp_ascii(param->name, "Connection"))
+					continue;
+				if (!wget_strcasecmp_ascii(param->name, "Accept-Encoding"))
+					continue;
+
+				INIT_NV_CS(nvp, param->name, param->value)
+				nvp++;
+			}
 		}
 
+		// the response may arrive before wget_http_get_response_cb() is called (another thread reads)
+		ctx = xcalloc(1, sizeof(struct _body_callback_context));
+		ctx->resp = xcalloc(1, sizeof(wget_http_response_t));
+		ctx->resp->major = 2;
+		// we do not get a Keep-Alive header in HTTP2 - let's assume the connection stays open
+		ctx->resp->keep_alive = 1;
+
+		wget_thread_mutex_lock(&conn->http2->mutex);
+
 		// nghttp2 does strdup of name+value and lowercase conversion of 'name'
-		req->stream_id = nghttp2_submit_request(conn->http2_session, NULL, nvs, nvp - nvs, NULL, req);
+		if (conn->http2->goaway || conn->http2->failed)
+			req->stream_id = -1;
+		else
+			req->stream_id = nghttp2_submit_request(conn->http2_session, NULL, nvs, nvp - nvs, NULL, ctx);
 
 		if (req->stream_id < 0) {
+			wget_thread_mutex_unlock(&conn->http2->mutex);
 			error_printf(_("Failed to submit HTTP2 request\n"));
+			wget_http_free_response(&ctx->resp);
+			xfree(ctx);
 			return -1;
 		}
 
+		// send the HEADERS frame now, the server can start working while we wait for the session
+		timeout = wget_tcp_get_timeout(conn->tcp);
+		wget_tcp_set_timeout(conn->tcp, 0);
+		if (nghttp2_session_send(conn->http2_session))
+			conn->http2->failed = 1;
+		wget_tcp_set_timeout(conn->tcp, timeout);
+
+		wget_thread_mutex_unlock(&conn->http2->mutex);
+
+		req->nghttp2_context = ctx;
 		debug_printf("HTTP2 stream id %d\n", req->stream_id);
 
 		return 0;
 	}
 #endif
 
+	if (conn->pipeline && conn->pipeline->failed) {
+		debug_printf("pipeline broken, request not sent\n");
+		return -1;
+	}
+
 	if ((nbytes = wget_http_request_to_buffer(req, conn->buf)) < 0) {
 		error_printf(_("Failed to create request buffer\n"));
 		return -1;
@@ -1924,7 +2404,13 @@ static int  G_GNUC_WGET_NONNULL((1,2)) _http_send_request(wget_http_connection_t
 		nbytes = wget_buffer_memcat(conn->buf, body, length);
 	}
 
-	if (wget_tcp_write(conn->tcp, conn->buf->data, nbytes) != nbytes) {
+	// idempotent requests may go out as TLS 1.3 early data on a fresh connection
+	if (!body && (!strcmp(req->method, "GET") || !strcmp(req->method, "HEAD")))
+		rc = wget_tcp_write_early_data(conn->tcp, conn->buf->data, nbytes);
+	else
+		rc = wget_tcp_write(conn->tcp, conn->buf->data, nbytes);
+
+	if (rc != nbytes) {
 		// An error will be written by the wget_tcp_write function.
 		// error_printf(_("Failed to send %zd bytes (%d)\n"), nbytes, errno);
 		return -1;
@@ -1932,6 +2418,9 @@ static int  G_GNUC_WGET_NONNULL((1,2)) _http_send_request(wget_http_connection_t
 
 	debug_printf("# sent %zd bytes:\n%s", nbytes, conn->buf->data);
 
+	if (conn->pipeline)
+		wget_vector_add_noalloc(conn->pipeline->requests, req);
+
 	return 0;
 }
 
@@ -1971,6 +2460,9 @@ ssize_t wget_http_request_to_buffer(wget_http_request_t *req, wget_buffer_t *buf
 	wget_buffer_bufcat(buf, &req->esc_host);
 	wget_buffer_memcat(buf, "\r\n", 2);
 
+	if (req->tmpl)
+		wget_buffer_bufcat(buf, req->tmpl->header);
+
 	for (int it = 0; it < wget_vector_size(req->headers); it++) {
 		wget_http_header_param_t *param = wget_vector_get(req->headers, it);
 
@@ -1991,80 +2483,156 @@ ssize_t wget_http_request_to_buffer(wget_http_request_t *req, wget_buffer_t *buf
 	return buf->length;
 }
 
-wget_http_response_t *wget_http_get_response_cb(
+#ifdef WITH_LIBNGHTTP2
+// Wait for the response of 'req' while other threads may wait for their streams on the same session.
+static wget_http_response_t *_http2_get_response(
 	wget_http_connection_t *conn,
 	wget_http_request_t *req,
-	unsigned int flags,
 	int (*header_callback)(void *context, wget_http_response_t *resp),
 	int (*body_callback)(void *context, const char *data, size_t length),
-	void *context) // given to body_callback and header_callback
+	void *context)
 {
-	size_t bufsize, body_len = 0, body_size = 0;
-	ssize_t nbytes, nread = 0;
-	char *buf, *p = NULL;
-	wget_http_response_t *resp = NULL;
-	wget_decompressor_t *dc = NULL;
+	struct wget_http2_st *h2 = conn->http2;
+	struct _body_callback_context *ctx = req->nghttp2_context;
+	wget_http_response_t *resp;
+	int timeout, ioflags, rc;
+	long long last_io = wget_get_timemillis(), now;
 
-#ifdef WITH_LIBNGHTTP2
-	int ioflags;
+	if (!ctx)
+		return NULL;
 
-	if (conn->protocol == WGET_PROTOCOL_HTTP_2_0) {
-		resp = xcalloc(1, sizeof(wget_http_response_t));
-		resp->major = 2;
-		// we do not get a Keep-Alive header in HTTP2 - let's assume the connection stays open
-		resp->keep_alive = 1;
+	req->nghttp2_context = NULL;
+
+	wget_thread_mutex_lock(&h2->mutex);
+
+	timeout = wget_tcp_get_timeout(conn->tcp); // temporarily changed by other threads, read it with the lock held
+
+	// catch up with what has been received for this stream while another thread was reading
+	if (ctx->header_done && header_callback)
+		header_callback(context, ctx->resp);
+	if (ctx->pending) {
+		if (body_callback)
+			body_callback(context, ctx->pending->data, ctx->pending->length);
+		wget_buffer_free(&ctx->pending);
+	}
+	ctx->context = context;
+	ctx->header_callback = header_callback;
+	ctx->body_callback = body_callback;
+
+	while (!ctx->done && !h2->failed && !conn->abort_indicator && !_abort_indicator) {
+		if (h2->reading) {
+			// the reading thread wakes us up after each read
+			wget_thread_cond_wait(&h2->cond, &h2->mutex);
+			continue;
+		}
 
-		struct _body_callback_context ctx = { .resp = resp, .context = context, .body_callback = body_callback };
-		req->nghttp2_context = &ctx;
+		ioflags = 0;
+		if (nghttp2_session_want_write(conn->http2_session))
+			ioflags |= WGET_IO_WRITABLE;
+		if (nghttp2_session_want_read(conn->http2_session))
+			ioflags |= WGET_IO_READABLE;
 
-		int timeout = wget_tcp_get_timeout(conn->tcp);
+		if (!ioflags) {
+			h2->failed = 1; // session has been terminated
+			break;
+		}
 
-		for (int rc = 0; rc == 0 && !ctx.done && !conn->abort_indicator && !_abort_indicator;) {
-			ioflags = 0;
-			if (nghttp2_session_want_write(conn->http2_session))
-				ioflags |= WGET_IO_WRITABLE;
-			if (nghttp2_session_want_read(conn->http2_session))
-				ioflags |= WGET_IO_READABLE;
+		// don't block others while waiting for the socket, wake up regularly to
+		// send frames of requests that have been submitted meanwhile
+		h2->reading = 1;
+		wget_thread_mutex_unlock(&h2->mutex);
+		ioflags = wget_ready_2_transfer(wget_tcp_get_sockfd(conn->tcp), timeout < 0 || timeout > 100 ? 100 : timeout, ioflags);
+		wget_thread_mutex_lock(&h2->mutex);
+		h2->reading = 0;
 
-			if (ioflags)
-				ioflags = wget_tcp_ready_2_transfer(conn->tcp, ioflags);
-			// debug_printf("ioflags=%d timeout=%d\n",ioflags,wget_tcp_get_timeout(conn->tcp));
-			if (ioflags <= 0) break; // error or timeout
+		now = wget_get_timemillis();
 
+		if (ioflags > 0) {
 			wget_tcp_set_timeout(conn->tcp, 0); // 0 = immediate
 			rc = 0;
-			if (ioflags & WGET_IO_WRITABLE) {
+			if (ioflags & WGET_IO_WRITABLE)
 				rc = nghttp2_session_send(conn->http2_session);
-			}
 			if (!rc && (ioflags & WGET_IO_READABLE))
 				rc = nghttp2_session_recv(conn->http2_session);
 			wget_tcp_set_timeout(conn->tcp, timeout); // restore old timeout
 
-/*
-			while (nghttp2_session_want_write(conn->http2_session)) {
-				rc = nghttp2_session_send(conn->http2_session);
-			}
-			debug_printf("1 response status %d done %d\n", resp->code, ctx.done);
-			if (nghttp2_session_want_read(conn->http2_session)) {
-				rc = nghttp2_session_recv(conn->http2_session);
+			if (rc) {
+				debug_printf("HTTP2 session failed (%d)\n", rc);
+				h2->failed = 1;
 			}
-*/
+			last_io = now;
+		} else if (ioflags < 0 || (timeout >= 0 && now - last_io >= timeout)) {
+			debug_printf("HTTP2 session timed out\n");
+			h2->failed = 1; // no more data on this connection, all streams fail
 		}
 
-		debug_printf("response status %d\n", resp->code);
-
-		// a workaround for broken server configurations
-		// see http://mail-archives.apache.org/mod_mbox/httpd-dev/200207.mbox/<3D2D4E76.4010502@talex.com.pl>
-		if (resp->content_encoding == wget_content_encoding_gzip &&
-			!wget_strcasecmp_ascii(resp->content_type, "application/x-gzip"))
-		{
-			debug_printf("Broken server configuration gzip workaround triggered\n");
-			resp->content_encoding =  wget_content_encoding_identity;
-		}
+		wget_thread_cond_signal(&h2->cond); // wakes up all waiting threads
+	}
 
-		return resp;
+	if (!ctx->done) {
+		// failed or aborted, the data of this stream is discarded from now on
+		nghttp2_session_set_stream_user_data(conn->http2_session, req->stream_id, NULL);
+		if (!h2->failed)
+			nghttp2_submit_rst_stream(conn->http2_session, NGHTTP2_FLAG_NONE, req->stream_id, NGHTTP2_CANCEL);
 	}
-#endif
+
+	wget_thread_mutex_unlock(&h2->mutex);
+
+	resp = ctx->resp;
+	if (!ctx->done || (ctx->error && !resp->code))
+		wget_http_free_response(&resp);
+	wget_buffer_free(&ctx->pending);
+	xfree(ctx);
+
+	if (!resp)
+		return NULL;
+
+	debug_printf("response status %d\n", resp->code);
+
+	// a workaround for broken server configurations
+	// see http://mail-archives.apache.org/mod_mbox/httpd-dev/200207.mbox/<3D2D4E76.4010502@talex.com.pl>
+	if (resp->content_encoding == wget_content_encoding_gzip &&
+		!wget_strcasecmp_ascii(resp->content_type, "application/x-gzip"))
+	{
+		debug_printf("Broken server configuration gzip workaround triggered\n");
+		resp->content_encoding =  wget_content_encoding_identity;
+	}
+
+	return resp;
+}
+#endif
+
+static wget_http_response_t *_http_get_response_pipelined(
+	wget_http_connection_t *conn,
+	wget_http_request_t *req,
+	unsigned int flags,
+	int (*header_callback)(void *context, wget_http_response_t *resp),
+	int (*body_callback)(void *context, const char *data, size_t length),
+	void *context);
+
+// If the header callback sets resp->body_fd, an identity encoded body with Content-Length is spliced
+// into that file where possible. The body callback is then called with data NULL and the number of bytes written.
+wget_http_response_t *wget_http_get_response_cb(
+	wget_http_connection_t *conn,
+	wget_http_request_t *req,
+	unsigned int flags,
+	int (*header_callback)(void *context, wget_http_response_t *resp),
+	int (*body_callback)(void *context, const char *data, size_t length),
+	void *context) // given to body_callback and header_callback
+{
+	size_t bufsize, body_len = 0, body_size = 0;
+	ssize_t nbytes, nread = 0;
+	char *buf, *p = NULL;
+	wget_http_response_t *resp = NULL;
+	wget_decompressor_t *dc = NULL;
+
+#ifdef WITH_LIBNGHTTP2
+	if (conn->http2)
+		return _http2_get_response(conn, req, header_callback, body_callback, context);
+#endif
+
+	if (conn->pipeline)
+		return _http_get_response_pipelined(conn, req, flags, header_callback, body_callback, context);
 
 	// reuse generic connection buffer
 	buf = conn->buf->data;
@@ -2077,12 +2645,10 @@ wget_http_response_t *wget_http_get_response_cb(
 
 		if (nread < 4) continue;
 
-		if (nread == nbytes)
-			p = buf;
-		else
-			p = buf + nread - nbytes - 3;
+		// the end of the header may start in the previous chunk
+		p = buf + (nread - nbytes >= 3 ? nread - nbytes - 3 : 0);
 
-		if ((p = strstr(p, "\r\n\r\n"))) {
+		if ((p = _find_header_end(p, buf + nread))) {
 			// found end-of-header
 			*p = 0;
 
@@ -2093,7 +2659,7 @@ wget_http_response_t *wget_http_get_response_cb(
 				wget_buffer_memcpy(header, buf, p - buf);
 				wget_buffer_memcat(header, "\r\n\r\n", 4);
 
-				if (!(resp = wget_http_parse_response_header(buf))) {
+				if (!(resp = _parse_response_header(buf, p))) {
 					wget_buffer_free(&header);
 					goto cleanup; // something is wrong with the header
 				}
@@ -2101,7 +2667,7 @@ wget_http_response_t *wget_http_get_response_cb(
 				resp->header = header;
 
 			} else {
-				if (!(resp = wget_http_parse_response_header(buf)))
+				if (!(resp = _parse_response_header(buf, p)))
 					goto cleanup; // something is wrong with the header
 			}
 
@@ -2141,8 +2707,7 @@ wget_http_response_t *wget_http_get_response_cb(
 	buf[body_len] = 0;
 
 	if (resp->transfer_encoding != transfer_encoding_identity) {
-		size_t chunk_size = 0;
-		char *end;
+		struct wget_http_async_st parser = { .resp = resp, .dc = dc, .state = ASYNC_CHUNK_SIZE };
 
 		debug_printf("method 1 %zd %zd:\n", body_len, body_size);
 		// RFC 2616 3.6.1
@@ -2181,109 +2746,50 @@ wget_http_response_t *wget_http_get_response_cb(
 			Remove "chunked" from Transfer-Encoding
 */
 
-		// read each chunk, stripping the chunk info
-		p = buf;
-		for (;;) {
-			// debug_printf("#1 p='%.16s'\n",p);
-			// read: chunk-size [ chunk-extension ] CRLF
-			while ((!(end = strchr(p, '\r')) || end[1] != '\n')) {
-				if (conn->abort_indicator || _abort_indicator)
-					goto cleanup;
-
-				if ((nbytes = wget_tcp_read(conn->tcp, buf + body_len, bufsize - body_len)) <= 0)
-					goto cleanup;
-
-				body_len += nbytes;
-				buf[body_len] = 0;
-				debug_printf("a nbytes %zd body_len %zd\n", nbytes, body_len);
-			}
-			end += 2;
-
-			// now p points to chunk-size (hex)
-			chunk_size = strtoll(p, NULL, 16);
-			debug_printf("chunk size is %zd\n", chunk_size);
-			if (chunk_size == 0) {
-				// now read 'trailer CRLF' which is '*(entity-header CRLF) CRLF'
-				if (*end == '\r' && end[1] == '\n') // shortcut for the most likely case (empty trailer)
-					goto cleanup;
-
-				debug_printf("reading trailer\n");
-				while (!strstr(end, "\r\n\r\n")) {
-					if (body_len > 3) {
-						// just need to keep the last 3 bytes to avoid buffer resizing
-						memmove(buf, buf + body_len - 3, 4); // plus 0 terminator, just in case
-						body_len = 3;
-					}
-
-					if (conn->abort_indicator || _abort_indicator)
-						goto cleanup;
-
-					if ((nbytes = wget_tcp_read(conn->tcp, buf + body_len, bufsize - body_len)) <= 0)
-						goto cleanup;
+		// decode what came with the header, then read until the last chunk and the trailer are through
+		for (nbytes = body_len; ; ) {
+			if (nbytes > 0 && _async_body(&parser, buf, nbytes) < 0)
+				break;
 
-					body_len += nbytes;
-					buf[body_len] = 0;
-					end = buf;
-					debug_printf("a nbytes %zd\n", nbytes);
-				}
-				debug_printf("end of trailer \n");
-				goto cleanup;
-			}
+			if (parser.state == ASYNC_DONE || conn->abort_indicator || _abort_indicator)
+				break;
 
-			p = end + chunk_size + 2;
-			if (p <= buf + body_len) {
-				debug_printf("1 skip chunk_size %zd\n", chunk_size);
-				wget_decompress(dc, end, chunk_size);
-				continue;
-			}
+			if ((nbytes = wget_tcp_read(conn->tcp, buf, bufsize)) <= 0)
+				break;
 
-			wget_decompress(dc, end, (buf + body_len) - end);
+			debug_printf("nbytes %zd\n", nbytes);
+		}
 
-			chunk_size = p - (buf + body_len); // in fact needed bytes to have chunk_size+2 in buf
+		if (parser.state != ASYNC_DONE)
+			resp->keep_alive = 0; // we don't know where the next response starts
+	} else if (resp->content_length_valid) {
+		// read content_length bytes
+		debug_printf("method 2\n");
 
-			debug_printf("need at least %zd more bytes\n", chunk_size);
+		if (body_len)
+			wget_decompress(dc, buf, body_len);
 
-			while (chunk_size > 0) {
+		if (resp->body_fd > 0 && resp->content_encoding == wget_content_encoding_identity) {
+			// move the body from the socket into the file without copying it into user space
+			while (body_len < resp->content_length) {
 				if (conn->abort_indicator || _abort_indicator)
-					goto cleanup;
-
-				if ((nbytes = wget_tcp_read(conn->tcp, buf, bufsize)) <= 0)
-					goto cleanup;
-				debug_printf("a nbytes=%zd chunk_size=%zd\n", nread, chunk_size);
+					break;
 
-				if (chunk_size <= (size_t)nbytes) {
-					if (chunk_size == 1 || !strncmp(buf + chunk_size - 2, "\r\n", 2)) {
-						debug_printf("chunk completed\n");
-						// p=end+chunk_size+2;
-					} else {
-						error_printf(_("Expected end-of-chunk not found\n"));
-						goto cleanup;
-					}
-					if (chunk_size > 2)
-						wget_decompress(dc, buf, chunk_size - 2);
-					body_len = nbytes - chunk_size;
-					if (body_len)
-						memmove(buf, buf + chunk_size, body_len);
-					buf[body_len] = 0;
-					p = buf;
+				if ((nbytes = wget_tcp_splice(conn->tcp, resp->body_fd, resp->content_length - body_len)) <= 0)
 					break;
-				} else {
-					chunk_size -= nbytes;
-					if (chunk_size >= 2)
-						wget_decompress(dc, buf, nbytes);
-					else
-						wget_decompress(dc, buf, nbytes - 1); // special case: we got a partial end-of-chunk
-				}
+
+				body_len += nbytes;
+				debug_printf("spliced %zd total %zd/%zd\n", nbytes, body_len, resp->content_length);
+				body_callback(context, NULL, nbytes); // data went to resp->body_fd
 			}
-		}
-	} else if (resp->content_length_valid) {
-		// read content_length bytes
-		debug_printf("method 2\n");
 
-		if (body_len)
-			wget_decompress(dc, buf, body_len);
+			if (nbytes == WGET_E_INVALID) {
+				debug_printf("splice not possible, reading body\n");
+				nbytes = 1;
+			}
+		}
 
-		while (body_len < resp->content_length) {
+		while (nbytes > 0 && body_len < resp->content_length) {
 			if (conn->abort_indicator || _abort_indicator)
 				break;
 
@@ -2324,7 +2830,8 @@ cleanup:
 
 static int _get_body(void *userdata, const char *data, size_t length)
 {
-	wget_buffer_memcat((wget_buffer_t *)userdata, data, length);
+	if (data)
+		wget_buffer_memcat((wget_buffer_t *)userdata, data, length);
 
 	return 0;
 }
@@ -2353,6 +2860,498 @@ wget_http_response_t *wget_http_get_response(
 	return resp;
 }
 
+// Queue a request on a connection opened by wget_http_open_async().
+// The response is received by calling wget_http_process() whenever the socket is ready.
+// If body_callback is NULL, the body is collected in resp->body (like wget_http_get_response()).
+int wget_http_send_request_async(
+	wget_http_connection_t *conn,
+	wget_http_request_t *req,
+	const void *body,
+	size_t length,
+	unsigned int flags,
+	int (*header_callback)(void *context, wget_http_response_t *resp),
+	int (*body_callback)(void *context, const char *data, size_t length),
+	void *context)
+{
+	struct wget_http_async_st *async = conn->async;
+
+	if (!async || (async->state != ASYNC_IDLE && async->state != ASYNC_CONNECT) || async->request_pending)
+		return WGET_E_INVALID;
+
+	if (wget_http_request_to_buffer(req, conn->buf) < 0) {
+		error_printf(_("Failed to create request buffer\n"));
+		return WGET_E_UNKNOWN;
+	}
+
+	if (body && length)
+		wget_buffer_memcat(conn->buf, body, length);
+
+	_async_reset(async);
+	async->req = req;
+	async->flags = flags;
+	async->header_callback = header_callback;
+	async->body_callback = body_callback;
+	async->context = context;
+	async->sent = 0;
+
+	if (async->state == ASYNC_IDLE)
+		async->state = ASYNC_SEND;
+	else
+		async->request_pending = 1;
+
+	return WGET_E_SUCCESS;
+}
+
+// Feed raw body data into the decoder, used by the blocking, pipelined and non-blocking receive paths.
+// Returns the number of bytes consumed, which is less than 'length' if the body ends within 'data',
+// or -1 on a broken chunked encoding.
+// Each byte of a chunked body is looked at once. The data of larger chunks goes to the decompressor
+// where it is, smaller chunks are moved together over the already parsed chunk framing in 'data'
+// and decoded at once, so a body of tiny chunks doesn't cost a body callback per chunk.
+static ssize_t _async_body(struct wget_http_async_st *async, char *data, size_t length)
+{
+	char *start = data, *end = data + length, *p;
+	char *pending = NULL, *out = NULL; // collected data of small chunks
+	int broken = 0;
+
+	if (async->state == ASYNC_BODY) {
+		wget_http_response_t *resp = async->resp;
+
+		if (resp->content_length_valid && async->body_len + length > resp->content_length) {
+			error_printf(_("Body too large: %zu instead of %zu bytes\n"), async->body_len + length, resp->content_length);
+			length = resp->content_length - async->body_len;
+		}
+
+		async->body_len += length;
+		wget_decompress(async->dc, data, length);
+
+		if (resp->content_length_valid && async->body_len >= resp->content_length)
+			async->state = ASYNC_DONE;
+
+		return length;
+	}
+
+	// RFC 2616 3.6.1, see wget_http_get_response_cb()
+	while (data < end && async->state != ASYNC_DONE && !broken) {
+		switch (async->state) {
+		case ASYNC_CHUNK_SIZE:
+			for (; data < end && c_isxdigit(*data); data++) {
+				if (async->chunk_size > ((size_t) -1) >> 4) {
+					error_printf(_("Chunk size overflow\n"));
+					broken = 1;
+					break;
+				}
+				async->chunk_size = (async->chunk_size << 4) | (c_isdigit(*data) ? *data - '0' : (*data | 0x20) - 'a' + 10);
+			}
+
+			if (data < end)
+				async->state = ASYNC_CHUNK_EXT; // the size ends with an extension, CR or LF
+			break;
+
+		case ASYNC_CHUNK_EXT:
+			// skip extension and CR, usually there is just the CR
+			if (*data == '\r' && end - data > 1 && data[1] == '\n')
+				p = data + 1;
+			else if (!(p = memchr(data, '\n', end - data))) {
+				data = end;
+				break;
+			}
+			data = p + 1;
+
+			debug_printf("chunk size is %zu\n", async->chunk_size);
+			if (async->chunk_size) {
+				async->state = ASYNC_CHUNK_DATA;
+			} else {
+				async->state = ASYNC_TRAILER;
+				async->line_empty = 1;
+			}
+			break;
+
+		case ASYNC_CHUNK_DATA:
+			length = (size_t)(end - data) < async->chunk_size ? (size_t)(end - data) : async->chunk_size;
+
+			if (length >= CHUNK_COALESCE_MAX) {
+				if (out > pending)
+					wget_decompress(async->dc, pending, out - pending);
+				pending = out = NULL;
+				wget_decompress(async->dc, data, length);
+			} else {
+				if (!out)
+					pending = out = data;
+				else if (out != data)
+					memmove(out, data, length);
+				out += length;
+			}
+
+			async->body_len += length;
+			async->chunk_size -= length;
+			data += length;
+			if (!async->chunk_size)
+				async->state = ASYNC_CHUNK_CRLF;
+			break;
+
+		case ASYNC_CHUNK_CRLF:
+			if (*data == '\r' && end - data > 1 && data[1] == '\n') {
+				async->state = ASYNC_CHUNK_SIZE;
+				data += 2;
+				break;
+			}
+
+			if (*data == '\n')
+				async->state = ASYNC_CHUNK_SIZE;
+			else if (*data != '\r') {
+				error_printf(_("Expected end-of-chunk not found\n"));
+				broken = 1;
+				break;
+			}
+			data++;
+			break;
+
+		case ASYNC_TRAILER:
+			if (*data == '\n') {
+				if (async->line_empty)
+					async->state = ASYNC_DONE;
+				async->line_empty = 1;
+			} else if (*data != '\r')
+				async->line_empty = 0;
+			data++;
+			break;
+		}
+	}
+
+	if (out > pending)
+		wget_decompress(async->dc, pending, out - pending);
+
+	return broken ? -1 : data - start;
+}
+
+// the response is complete, hand it over to the caller
+static wget_http_response_t *_async_finish(wget_http_connection_t *conn, int complete)
+{
+	struct wget_http_async_st *async = conn->async;
+	wget_http_response_t *resp = async->resp;
+
+	if (resp->content_length_valid && resp->transfer_encoding == transfer_encoding_identity
+		&& async->dc && async->body_len < resp->content_length)
+	{
+		error_printf(_("Just got %zu of %zu bytes\n"), async->body_len, resp->content_length);
+		complete = 0;
+	}
+
+	if (!complete)
+		resp->keep_alive = 0; // we don't know where the next response starts
+
+	if (async->dc && resp->transfer_encoding == transfer_encoding_identity)
+		resp->content_length = async->body_len;
+
+	wget_decompress_close(async->dc);
+	async->dc = NULL;
+
+	if (async->body) {
+		resp->body = async->body;
+		async->body = NULL;
+		if (!wget_strcasecmp_ascii(async->req->method, "GET"))
+			resp->content_length = resp->body->length;
+	}
+
+	async->resp = NULL;
+	async->req = NULL;
+	async->state = ASYNC_IDLE;
+
+	return resp;
+}
+
+// Read the response to a pipelined request.
+// The data following the response already belongs to the next response, it is kept in pipeline->buf.
+static wget_http_response_t *_http_get_response_pipelined(
+	wget_http_connection_t *conn,
+	wget_http_request_t *req,
+	unsigned int flags,
+	int (*header_callback)(void *context, wget_http_response_t *resp),
+	int (*body_callback)(void *context, const char *data, size_t length),
+	void *context)
+{
+	struct wget_http_pipeline_st *pipeline = conn->pipeline;
+	struct wget_http_async_st *parser = &pipeline->parser;
+	wget_buffer_t *buf = pipeline->buf, *header = NULL;
+	wget_http_response_t *resp;
+	size_t searched = 0, avail;
+	ssize_t nbytes;
+	char *p;
+
+	// responses come in the order of the requests
+	if (pipeline->failed || !wget_vector_size(pipeline->requests) || wget_vector_get(pipeline->requests, 0) != req) {
+		debug_printf("pipelined response out of order\n");
+		pipeline->failed = 1;
+		return NULL;
+	}
+
+	wget_vector_remove_nofree(pipeline->requests, 0);
+
+	while (!(p = _find_header_end(buf->data + searched, buf->data + buf->length))) {
+		if (conn->abort_indicator || _abort_indicator)
+			goto failed;
+
+		if (buf->size - buf->length < 1024)
+			wget_buffer_ensure_capacity(buf, buf->size + 16384);
+
+		searched = buf->length >= 3 ? buf->length - 3 : 0;
+
+		if ((nbytes = wget_tcp_read(conn->tcp, buf->data + buf->length, buf->size - buf->length)) <= 0)
+			goto failed;
+
+		buf->length += nbytes;
+		buf->data[buf->length] = 0; // 0-terminate to allow string functions
+	}
+
+	// found end-of-header
+	*p = 0;
+	debug_printf("# got header %zd bytes:\n%s\n\n", p - buf->data, buf->data);
+
+	if (flags & WGET_HTTP_RESPONSE_KEEPHEADER) {
+		header = wget_buffer_alloc(p - buf->data + 4);
+		wget_buffer_memcpy(header, buf->data, p - buf->data);
+		wget_buffer_memcat(header, "\r\n\r\n", 4);
+	}
+
+	if (!(resp = _parse_response_header(buf->data, p))) {
+		wget_buffer_free(&header);
+		goto failed; // something is wrong with the header
+	}
+
+	resp->header = header;
+
+	p += 4; // skip \r\n\r\n to point to body
+	avail = buf->length - (p - buf->data);
+
+	if (header_callback && header_callback(context, resp)) {
+		// stop requested, we don't know where the next response starts
+		pipeline->failed = 1;
+	} else if (!wget_strcasecmp_ascii(req->method, "HEAD")
+		|| resp->code / 100 == 1 || resp->code == 204 || resp->code == 304
+		|| (resp->transfer_encoding == transfer_encoding_identity && resp->content_length == 0 && resp->content_length_valid))
+	{
+		// no body, see RFC 2616 4.3 and 4.4
+	} else {
+		parser->resp = resp;
+		parser->dc = wget_decompress_open(resp->content_encoding, body_callback, context);
+		parser->body_len = 0;
+		parser->chunk_size = 0;
+		parser->state = resp->transfer_encoding != transfer_encoding_identity ? ASYNC_CHUNK_SIZE : ASYNC_BODY;
+
+		// without Content-Length or chunked encoding, the body ends with the connection
+		if (parser->state == ASYNC_BODY && !resp->content_length_valid)
+			pipeline->failed = 1;
+
+		while (parser->state != ASYNC_DONE) {
+			size_t length;
+
+			if (!avail) {
+				if (conn->abort_indicator || _abort_indicator)
+					break;
+
+				if ((nbytes = wget_tcp_read(conn->tcp, buf->data, buf->size)) <= 0) {
+					if (nbytes == 0 && parser->state == ASYNC_BODY && !resp->content_length_valid)
+						parser->state = ASYNC_DONE; // the server closed the connection to end the body
+					break;
+				}
+
+				p = buf->data;
+				avail = buf->length = nbytes;
+				buf->data[avail] = 0;
+			}
+
+			// don't pass the start of the next response to the decoder
+			length = avail;
+			if (parser->state == ASYNC_BODY && resp->content_length_valid && length > resp->content_length - parser->body_len)
+				length = resp->content_length - parser->body_len;
+
+			if ((nbytes = _async_body(parser, p, length)) < 0)
+				break;
+
+			p += nbytes;
+			avail -= nbytes;
+		}
+
+		if (parser->state != ASYNC_DONE) {
+			if (resp->content_length_valid && parser->state == ASYNC_BODY)
+				error_printf(_("Just got %zu of %zu bytes\n"), parser->body_len, resp->content_length);
+			pipeline->failed = 1;
+		}
+
+		if (resp->transfer_encoding == transfer_encoding_identity)
+			resp->content_length = parser->body_len;
+
+		wget_decompress_close(parser->dc);
+		parser->dc = NULL;
+		parser->resp = NULL;
+		parser->state = ASYNC_IDLE;
+	}
+
+	// keep the start of the next response
+	memmove(buf->data, p, avail);
+	buf->length = avail;
+	buf->data[avail] = 0;
+
+	if (pipeline->failed || !resp->keep_alive) {
+		// following requests won't be answered, the connection must be closed
+		resp->keep_alive = 0;
+		pipeline->failed = 1;
+	} else if (resp->major == 1 && resp->minor == 1)
+		pipeline->confirmed = 1;
+
+	return resp;
+
+failed:
+	pipeline->failed = 1;
+	return NULL;
+}
+
+// Drive a request queued by wget_http_send_request_async() as far as possible without blocking.
+// Returns
+//   WGET_IO_READABLE / WGET_IO_WRITABLE: call again when the socket is ready for this
+//   WGET_E_SUCCESS: the response is complete and returned in *resp
+//   < 0: WGET_E_* error, the connection should be closed
+int wget_http_process(wget_http_connection_t *conn, wget_http_response_t **resp)
+{
+	struct wget_http_async_st *async = conn->async;
+	wget_buffer_t *buf = conn->buf;
+	ssize_t nbytes;
+	char *p;
+	int rc;
+
+	*resp = NULL;
+
+	if (!async || async->state == ASYNC_IDLE || (async->state == ASYNC_CONNECT && !async->request_pending))
+		return WGET_E_INVALID;
+
+	for (;;) {
+		if (conn->abort_indicator || _abort_indicator)
+			return WGET_E_UNKNOWN;
+
+		switch (async->state) {
+		case ASYNC_CONNECT:
+			if ((rc = wget_tcp_handshake(conn->tcp)) != WGET_E_SUCCESS)
+				return rc;
+
+			if (wget_tcp_get_protocol(conn->tcp) == WGET_PROTOCOL_HTTP_2_0) {
+				error_printf(_("HTTP/2 is not supported on non-blocking connections\n"));
+				return WGET_E_UNKNOWN;
+			}
+
+			async->request_pending = 0;
+			async->state = ASYNC_SEND;
+			break;
+
+		case ASYNC_SEND:
+			if ((nbytes = wget_tcp_write(conn->tcp, buf->data + async->sent, buf->length - async->sent)) == WGET_E_AGAIN || nbytes == 0)
+				return WGET_IO_WRITABLE;
+			if (nbytes < 0)
+				return WGET_E_UNKNOWN;
+
+			if ((async->sent += nbytes) < buf->length)
+				break;
+
+			debug_printf("# sent %zu bytes:\n%s", buf->length, buf->data);
+			wget_buffer_reset(buf);
+			async->state = ASYNC_HEADER;
+			break;
+
+		case ASYNC_HEADER:
+			if (buf->size - buf->length < 1024)
+				wget_buffer_ensure_capacity(buf, buf->size + 16384);
+
+			if ((nbytes = wget_tcp_read(conn->tcp, buf->data + buf->length, buf->size - buf->length)) == WGET_E_AGAIN)
+				return WGET_IO_READABLE;
+			if (nbytes <= 0)
+				return nbytes ? WGET_E_UNKNOWN : WGET_E_CONNECT; // 0: connection closed by server
+
+			p = buf->data + (buf->length >= 3 ? buf->length - 3 : 0);
+			buf->length += nbytes;
+			buf->data[buf->length] = 0; // 0-terminate to allow string functions
+
+			if (!(p = _find_header_end(p, buf->data + buf->length)))
+				break;
+
+			// found end-of-header
+			*p = 0;
+			debug_printf("# got header %zd bytes:\n%s\n\n", p - buf->data, buf->data);
+
+			if (async->flags & WGET_HTTP_RESPONSE_KEEPHEADER) {
+				wget_buffer_t *header = wget_buffer_alloc(p - buf->data + 4);
+				wget_buffer_memcpy(header, buf->data, p - buf->data);
+				wget_buffer_memcat(header, "\r\n\r\n", 4);
+
+				if (!(async->resp = _parse_response_header(buf->data, p))) {
+					wget_buffer_free(&header);
+					return WGET_E_UNKNOWN; // something is wrong with the header
+				}
+
+				async->resp->header = header;
+			} else if (!(async->resp = _parse_response_header(buf->data, p)))
+				return WGET_E_UNKNOWN; // something is wrong with the header
+
+			if (!async->body_callback)
+				async->body = wget_buffer_alloc(4096);
+
+			if ((async->header_callback && async->header_callback(async->context, async->resp))
+				|| !wget_strcasecmp_ascii(async->req->method, "HEAD") // a HEAD response won't have a body
+				|| async->resp->code / 100 == 1 || async->resp->code == 204 || async->resp->code == 304
+				|| (async->resp->transfer_encoding == transfer_encoding_identity && async->resp->content_length == 0 && async->resp->content_length_valid))
+			{
+				*resp = _async_finish(conn, 1);
+				return WGET_E_SUCCESS;
+			}
+
+			if (async->body)
+				async->dc = wget_decompress_open(async->resp->content_encoding, _get_body, async->body);
+			else
+				async->dc = wget_decompress_open(async->resp->content_encoding, async->body_callback, async->context);
+
+			async->body_len = 0;
+			async->chunk_size = 0;
+			async->state = async->resp->transfer_encoding != transfer_encoding_identity ? ASYNC_CHUNK_SIZE : ASYNC_BODY;
+
+			// the rest of the buffer is body data
+			p += 4;
+			nbytes = buf->length - (p - buf->data);
+			wget_buffer_reset(buf);
+
+			if (_async_body(async, p, nbytes) < 0) {
+				*resp = _async_finish(conn, 0);
+				return WGET_E_SUCCESS;
+			}
+
+			if (async->state == ASYNC_DONE) {
+				*resp = _async_finish(conn, 1);
+				return WGET_E_SUCCESS;
+			}
+			break;
+
+		default: // body states
+			if ((nbytes = wget_tcp_read(conn->tcp, buf->data, buf->size)) == WGET_E_AGAIN)
+				return WGET_IO_READABLE;
+
+			if (nbytes <= 0) {
+				// without Content-Length or chunked encoding, the body ends with the connection
+				*resp = _async_finish(conn, nbytes == 0 && async->state == ASYNC_BODY && !async->resp->content_length_valid);
+				return WGET_E_SUCCESS;
+			}
+
+			if (_async_body(async, buf->data, nbytes) < 0) {
+				*resp = _async_finish(conn, 0);
+				return WGET_E_SUCCESS;
+			}
+
+			if (async->state == ASYNC_DONE) {
+				*resp = _async_finish(conn, 1);
+				return WGET_E_SUCCESS;
+			}
+			break;
+		}
+	}
+}
+
 static int _get_fd(void *context, const char *data, size_t length)
 {
 	int fd = *(int *)context;
@@ -2538,6 +3537,64 @@ int wget_http_set_https_proxy(const char *proxy, const char *encoding)
 	return 0;
 }
 
+// Returns the number of requests that may be in flight on 'conn' at the same time,
+// 0 if the connection does not take new requests.
+int wget_http_get_max_streams(wget_http_connection_t *conn)
+{
+#ifdef WITH_LIBNGHTTP2
+	if (conn->http2) {
+		uint32_t max;
+
+		wget_thread_mutex_lock(&conn->http2->mutex);
+		if (conn->http2->goaway || conn->http2->failed)
+			max = 0;
+		else
+			max = nghttp2_session_get_remote_settings(conn->http2_session, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+		wget_thread_mutex_unlock(&conn->http2->mutex);
+
+		return max < HTTP2_MAX_STREAMS ? (int) max : HTTP2_MAX_STREAMS;
+	}
+#endif
+
+	if (conn->pipeline && !conn->abort_indicator)
+		return conn->pipeline->failed ? 0 : (conn->pipeline->confirmed ? conn->pipeline->max : 1);
+
+	return conn->abort_indicator ? 0 : 1;
+}
+
+// Enable HTTP/1.1 pipelining on 'conn': up to 'max' requests may be sent before the responses are read.
+// The responses must be read in the order of the requests.
+// Requests are pipelined after the server answered with HTTP/1.1 and keep-alive, see wget_http_get_max_streams().
+// After a response with 'Connection: close' or a response that can't be parsed the connection takes no more requests.
+void wget_http_set_pipelining(wget_http_connection_t *conn, int max)
+{
+	if (conn->protocol == WGET_PROTOCOL_HTTP_2_0 || conn->async)
+		return;
+
+	if (!conn->pipeline) {
+		if (max < 2)
+			return;
+
+		conn->pipeline = xcalloc(1, sizeof(struct wget_http_pipeline_st));
+		conn->pipeline->requests = wget_vector_create(max, -2, NULL);
+		conn->pipeline->buf = wget_buffer_alloc(16384);
+	}
+
+	conn->pipeline->max = max < 1 ? 1 : max;
+}
+
+// Returns the number of pipelined requests on 'conn' that have not been answered yet
+int wget_http_get_pending_requests(wget_http_connection_t *conn)
+{
+	return conn->pipeline ? wget_vector_size(conn->pipeline->requests) : 0;
+}
+
+// Returns 1 if a connection to 'iri' goes through a proxy
+int wget_http_is_proxied(const wget_iri_t *iri)
+{
+	return (iri->scheme == WGET_IRI_SCHEME_HTTP && http_proxies) || (iri->scheme == WGET_IRI_SCHEME_HTTPS && https_proxies);
+}
+
 void wget_http_abort_connection(wget_http_connection_t *conn)
 {
 	if (conn)
@@ -0,0 +1,432 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Pool of idle HTTP connections, shared by all threads
+ *
+ * A connection is checked out for a request and checked in when the response has been read.
+ * Checked in keep-alive connections wait in the pool for the next request to the same
+ * scheme, host and port (and proxy). The number of idle connections is limited per host
+ * and in total, the least recently used ones are closed first.
+ *
+ * HTTP/2 connections are shared: while checked out, further requests to the same host join
+ * the session until it carries as many streams as the server allows.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+
+#include <libwget.h>
+#include "private.h"
+
+typedef struct _POOL_HOST POOL_HOST;
+typedef struct _POOL_CONN POOL_CONN;
+
+struct _POOL_CONN {
+	wget_http_connection_t *
+		conn;
+	POOL_HOST *
+		host;
+	POOL_CONN
+		*prev, // all idle connections, least recently used first
+		*next,
+		*host_next; // idle (resp. shared) connections of the same host, most recently used first
+	long long
+		idle_since; // ms
+	int
+		users; // requests using a shared HTTP/2 connection
+};
+
+struct _POOL_HOST {
+	const char *
+		key; // [proxy:]scheme://host:port
+	POOL_CONN *
+		conns;
+	POOL_CONN *
+		shared; // checked out HTTP/2 connections
+	int
+		nconns;
+};
+
+static wget_hashmap_t
+	*pool_hosts;
+static POOL_CONN
+	*lru_first,
+	*lru_last;
+static wget_http_pool_stats_t
+	stats;
+static wget_thread_mutex_t
+	mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static int
+	max_idle_per_host = 4,
+	max_idle = 64,
+	idle_timeout = 30 * 1000,
+	nidle;
+
+static unsigned int G_GNUC_WGET_PURE _hash_host(const POOL_HOST *host)
+{
+	unsigned int hash = 0;
+	const unsigned char *p;
+
+	for (p = (unsigned char *)host->key; *p; p++)
+		hash = hash * 101 + *p;
+
+	return hash;
+}
+
+static int G_GNUC_WGET_PURE _compare_host(const POOL_HOST *h1, const POOL_HOST *h2)
+{
+	return strcmp(h1->key, h2->key);
+}
+
+static void _free_host(POOL_HOST *host)
+{
+	POOL_CONN *pc;
+
+	// sessions that have not been checked in
+	while ((pc = host->shared)) {
+		host->shared = pc->host_next;
+		wget_http_close(&pc->conn);
+		xfree(pc);
+	}
+
+	xfree(host->key);
+	xfree(host);
+}
+
+// to be called with the mutex held
+static POOL_HOST *_pool_host(POOL_HOST *key)
+{
+	POOL_HOST *host;
+
+	if (!pool_hosts) {
+		pool_hosts = wget_hashmap_create(16, -2, (unsigned int(*)(const void *))_hash_host, (int(*)(const void *, const void *))_compare_host);
+		wget_hashmap_set_key_destructor(pool_hosts, (void(*)(void *))_free_host);
+		wget_hashmap_set_value_destructor(pool_hosts, NULL);
+	}
+
+	if (!(host = wget_hashmap_get(pool_hosts, key))) {
+		host = xcalloc(1, sizeof(POOL_HOST));
+		host->key = wget_strdup(key->key);
+		wget_hashmap_put_noalloc(pool_hosts, host, host);
+	}
+
+	return host;
+}
+
+// an HTTP/2 connection has been checked out, further requests may join it
+static void _pool_share(POOL_HOST *key, wget_http_connection_t *conn)
+{
+	POOL_HOST *host;
+	POOL_CONN *pc;
+
+	if (conn->protocol != WGET_PROTOCOL_HTTP_2_0)
+		return;
+
+	pc = xcalloc(1, sizeof(POOL_CONN));
+	pc->conn = conn;
+	pc->users = 1;
+
+	wget_thread_mutex_lock(&mutex);
+	host = _pool_host(key);
+	pc->host = host;
+	pc->host_next = host->shared;
+	host->shared = pc;
+	wget_thread_mutex_unlock(&mutex);
+}
+
+static char *_make_key(char *buf, size_t size, int proxied, const char *scheme, const char *host, const char *port)
+{
+	snprintf(buf, size, "%s%s://%s:%s", proxied ? "proxy:" : "", scheme, host ? host : "", port ? port : "");
+	return buf;
+}
+
+// unlink an idle connection from the pool, to be called with the mutex held
+static wget_http_connection_t *_pool_unlink(POOL_CONN *pc)
+{
+	wget_http_connection_t *conn = pc->conn;
+	POOL_HOST *host = pc->host;
+	POOL_CONN **pp;
+
+	for (pp = &host->conns; *pp != pc; pp = &(*pp)->host_next)
+		;
+	*pp = pc->host_next;
+	host->nconns--;
+
+	if (pc->prev)
+		pc->prev->next = pc->next;
+	else
+		lru_first = pc->next;
+
+	if (pc->next)
+		pc->next->prev = pc->prev;
+	else
+		lru_last = pc->prev;
+
+	nidle--;
+	xfree(pc);
+
+	return conn;
+}
+
+// An idle HTTP/1.1 connection must not have anything to read.
+// If it has, the server closed it (or sent garbage), it can't be reused.
+// HTTP/2 servers may send frames (e.g. PING) at any time, errors show up with the next request.
+static int _alive(wget_http_connection_t *conn)
+{
+	if (conn->protocol == WGET_PROTOCOL_HTTP_2_0)
+		return 1;
+
+	return wget_ready_2_read(wget_tcp_get_sockfd(conn->tcp), 0) == 0;
+}
+
+// Returns an idle connection to the scheme/host/port of 'iri' from the pool,
+// or opens a new one with wget_http_open().
+int wget_http_pool_checkout(wget_http_connection_t **conn, const wget_iri_t *iri)
+{
+	POOL_HOST *host, key;
+	char buf[256];
+	int rc;
+
+	if (!conn)
+		return WGET_E_INVALID;
+
+	key.key = _make_key(buf, sizeof(buf), wget_http_is_proxied(iri), iri->scheme, iri->host, iri->resolv_port);
+
+	// join an HTTP/2 session that has room for another stream
+	wget_thread_mutex_lock(&mutex);
+	if (pool_hosts && (host = wget_hashmap_get(pool_hosts, &key))) {
+		POOL_CONN *pc;
+
+		for (pc = host->shared; pc; pc = pc->host_next) {
+			if (pc->users < wget_http_get_max_streams(pc->conn)) {
+				debug_printf("share HTTP2 connection to %s (%d users)\n", key.key, pc->users);
+				pc->users++;
+				stats.shared++;
+				*conn = pc->conn;
+				wget_thread_mutex_unlock(&mutex);
+				return WGET_E_SUCCESS;
+			}
+		}
+	}
+	wget_thread_mutex_unlock(&mutex);
+
+	for (;;) {
+		wget_http_connection_t *idle = NULL;
+		long long idle_since = 0;
+
+		wget_thread_mutex_lock(&mutex);
+		if (pool_hosts && (host = wget_hashmap_get(pool_hosts, &key)) && host->conns) {
+			idle_since = host->conns->idle_since;
+			idle = _pool_unlink(host->conns); // most recently used one
+		}
+		wget_thread_mutex_unlock(&mutex);
+
+		if (!idle)
+			break;
+
+		if (idle_timeout >= 0 && wget_get_timemillis() - idle_since >= idle_timeout) {
+			debug_printf("pooled connection to %s timed out\n", key.key);
+			wget_http_close(&idle);
+			wget_thread_mutex_lock(&mutex);
+			stats.expired++;
+			wget_thread_mutex_unlock(&mutex);
+			continue;
+		}
+
+		if (!_alive(idle)) {
+			debug_printf("pooled connection to %s closed by peer\n", key.key);
+			wget_http_close(&idle);
+			wget_thread_mutex_lock(&mutex);
+			stats.dead++;
+			wget_thread_mutex_unlock(&mutex);
+			continue;
+		}
+
+		debug_printf("reuse pooled connection to %s\n", key.key);
+		wget_thread_mutex_lock(&mutex);
+		stats.reused++;
+		wget_thread_mutex_unlock(&mutex);
+		_pool_share(&key, idle);
+		*conn = idle;
+		return WGET_E_SUCCESS;
+	}
+
+	if ((rc = wget_http_open(conn, iri)) == WGET_E_SUCCESS) {
+		wget_thread_mutex_lock(&mutex);
+		stats.opened++;
+		wget_thread_mutex_unlock(&mutex);
+		_pool_share(&key, *conn);
+	}
+
+	return rc;
+}
+
+static void _pool_release(wget_http_connection_t **conn, int reusable)
+{
+	POOL_HOST *host, key;
+	POOL_CONN *pc, *evict, **pp;
+	wget_http_connection_t *closing[8];
+	char buf[256];
+	long long now;
+	int nclosing = 0, it;
+
+	if (!conn || !*conn)
+		return;
+
+	key.key = _make_key(buf, sizeof(buf), (*conn)->proxied, (*conn)->scheme, (*conn)->esc_host, (*conn)->port);
+
+	if ((*conn)->protocol == WGET_PROTOCOL_HTTP_2_0) {
+		// the last user of a shared session decides about its fate
+		wget_thread_mutex_lock(&mutex);
+		if (pool_hosts && (host = wget_hashmap_get(pool_hosts, &key))) {
+			for (pp = &host->shared; *pp && (*pp)->conn != *conn; pp = &(*pp)->host_next)
+				;
+
+			if ((pc = *pp)) {
+				if (--pc->users > 0) {
+					wget_thread_mutex_unlock(&mutex);
+					*conn = NULL;
+					return;
+				}
+
+				*pp = pc->host_next;
+				xfree(pc);
+			}
+		}
+		wget_thread_mutex_unlock(&mutex);
+
+		// a failed stream does not affect the session
+		reusable = wget_http_get_max_streams(*conn) > 0;
+	}
+
+	// unanswered pipelined requests would be answered to the next user
+	if (!reusable || (*conn)->async || (*conn)->abort_indicator || wget_http_get_pending_requests(*conn)
+		|| wget_http_get_max_streams(*conn) <= 0 || max_idle_per_host <= 0 || max_idle <= 0)
+	{
+		wget_http_close(conn);
+		return;
+	}
+
+	now = wget_get_timemillis();
+
+	wget_thread_mutex_lock(&mutex);
+
+	host = _pool_host(&key);
+
+	// make room: the oldest connection of this host
+	if (host->nconns >= max_idle_per_host) {
+		for (evict = host->conns; evict->host_next; evict = evict->host_next)
+			;
+		closing[nclosing++] = _pool_unlink(evict);
+		stats.evicted++;
+	}
+
+	pc = xmalloc(sizeof(POOL_CONN));
+	pc->conn = *conn;
+	pc->host = host;
+	pc->idle_since = now;
+	pc->host_next = host->conns;
+	host->conns = pc;
+	host->nconns++;
+
+	pc->next = NULL;
+	if ((pc->prev = lru_last))
+		lru_last->next = pc;
+	else
+		lru_first = pc;
+	lru_last = pc;
+	nidle++;
+
+	// close least recently used connections of all hosts
+	while (lru_first != pc && nclosing < (int) countof(closing)) {
+		if (idle_timeout >= 0 && now - lru_first->idle_since >= idle_timeout)
+			stats.expired++;
+		else if (nidle > max_idle)
+			stats.evicted++;
+		else
+			break;
+
+		closing[nclosing++] = _pool_unlink(lru_first);
+	}
+
+	wget_thread_mutex_unlock(&mutex);
+
+	*conn = NULL;
+
+	// closing may take a while (TLS shutdown), don't block the other threads
+	for (it = 0; it < nclosing; it++)
+		wget_http_close(&closing[it]);
+}
+
+// Puts a connection into the pool for reuse. *conn is set to NULL.
+// Connections that can't be reused are closed.
+void wget_http_pool_checkin(wget_http_connection_t **conn)
+{
+	_pool_release(conn, 1);
+}
+
+// Gives back a connection after a failed request. *conn is set to NULL.
+// A shared HTTP/2 connection stays open for the other requests, else it is closed.
+void wget_http_pool_discard(wget_http_connection_t **conn)
+{
+	_pool_release(conn, 0);
+}
+
+// Max. number of idle connections per scheme/host/port (default 4), 0 disables pooling.
+void wget_http_pool_set_max_idle_per_host(int max)
+{
+	max_idle_per_host = max;
+}
+
+// Max. number of idle connections in total (default 64).
+void wget_http_pool_set_max_idle(int max)
+{
+	max_idle = max;
+}
+
+// Idle connections are closed after 'timeout' ms (default 30s), -1 means never.
+void wget_http_pool_set_idle_timeout(int timeout)
+{
+	idle_timeout = timeout;
+}
+
+void wget_http_pool_get_stats(wget_http_pool_stats_t *_stats)
+{
+	wget_thread_mutex_lock(&mutex);
+	*_stats = stats;
+	wget_thread_mutex_unlock(&mutex);
+}
+
+// Close all idle connections.
+void wget_http_pool_free(void)
+{
+	wget_http_connection_t *conn;
+
+	wget_thread_mutex_lock(&mutex);
+	while (lru_first) {
+		conn = _pool_unlink(lru_first);
+		wget_http_close(&conn);
+	}
+	wget_hashmap_free(&pool_hosts);
+	wget_thread_mutex_unlock(&mutex);
+}
@@ -154,6 +154,7 @@ void wget_global_deinit(void)
 		}
 		wget_tcp_set_bind_address(NULL, NULL);
 		wget_tcp_set_dns_caching(NULL, 0);
+		wget_http_pool_free();
 		wget_dns_cache_free();
 	}
 
@@ -24,6 +24,7 @@
  * 25.04.2012  Tim Ruehsen  created
  * 16.11.2012               new functions tcp_set_family() and tcp_set_preferred_family()
  *
+ * RFC 8305: Happy Eyeballs Version 2
  * RFC 7413: TCP Fast Open
  */
 
@@ -38,6 +39,7 @@
 #include <sys/types.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <limits.h>
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
@@ -49,6 +51,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 
 #ifdef HAVE_NETINET_TCP_H
 #	include <netinet/tcp.h>
@@ -58,14 +61,30 @@
 #include "private.h"
 #include "net.h"
 
+// resolved addresses, shared by the DNS cache and the connections using them
+struct DNS_ADDR {
+	struct addrinfo *
+		addrinfo;
+	int
+		refs;
+};
+
 // resolver / DNS cache entry
 struct ADDR_ENTRY {
 	const char *
 		host;
 	const char *
 		port;
-	struct addrinfo *
-		addrinfo;
+	struct DNS_ADDR *
+		addr; // NULL for a negative entry
+	long long
+		expires, // the entry is not used after this time (ms)
+		refresh; // a hit after this time resolves the name again in the background (ms)
+	int
+		error, // getaddrinfo() error of a negative entry
+		hits; // since the entry has been (re)filled
+	unsigned int
+		pending : 1; // a (background) resolution is running
 };
 
 static struct wget_tcp_st _global_tcp = {
@@ -74,6 +93,7 @@ static struct wget_tcp_st _global_tcp = {
 	.connect_timeout = -1,
 	.timeout = -1,
 	.family = AF_UNSPEC,
+	.connect_attempt_delay = 250,
 	.caching = 1,
 #if defined(TCP_FASTOPEN) && defined(MSG_FASTOPEN)
 	.tcp_fastopen = 1,
@@ -81,30 +101,47 @@ static struct wget_tcp_st _global_tcp = {
 #endif
 };
 
+// max. number of threads for background resolutions (prefetch and refresh-ahead)
+#define DNS_THREADS_MAX 4
+
 // resolver / DNS cache container
-static wget_vector_t
+static wget_hashmap_t
 	*dns_cache;
+static wget_vector_t
+	*dns_retired, // addresses dropped from the cache but still in use
+	*dns_jobs; // pending background resolutions (ADDR_ENTRY keys)
 static wget_thread_mutex_t
 	dns_mutex = WGET_THREAD_MUTEX_INITIALIZER;
-
-static struct addrinfo *_wget_dns_cache_get(const char *host, const char *port)
+static wget_thread_cond_t
+	dns_cond = WGET_THREAD_COND_INITIALIZER, // new background resolution
+	dns_done_cond = WGET_THREAD_COND_INITIALIZER; // a pending resolution completed
+static wget_thread_t
+	dns_threads[DNS_THREADS_MAX];
+static wget_dns_cache_stats_t
+	dns_stats;
+static int
+	dns_ttl = 5 * 60 * 1000,
+	dns_negative_ttl = 10 * 1000,
+	dns_nthreads, // resolver threads running
+	dns_nidle, // resolver threads waiting for work
+	dns_stop;
+static int
+	(*dns_resolver)(const char *, const char *, const struct addrinfo *, struct addrinfo **) = getaddrinfo;
+
+static unsigned int G_GNUC_WGET_PURE _hash_addr(const struct ADDR_ENTRY *entry)
 {
-	if (dns_cache) {
-		struct ADDR_ENTRY *entryp, entry = { .host = host, .port = port };
-		int index;
+	const unsigned char *p;
+	unsigned int hash = 0;
 
-		wget_thread_mutex_lock(&dns_mutex);
-		entryp = wget_vector_get(dns_cache, (index = wget_vector_find(dns_cache, &entry)));
-		wget_thread_mutex_unlock(&dns_mutex);
+	if ((p = (const unsigned char *)entry->host))
+		for (; *p; p++)
+			hash = hash * 101 + c_tolower(*p);
 
-		if (entryp) {
-			// DNS cache entry found
-			debug_printf("Found dns cache entry #%d\n", index);
-			return entryp->addrinfo;
-		}
-	}
+	if ((p = (const unsigned char *)entry->port))
+		for (hash = hash * 101 + ':'; *p; p++)
+			hash = hash * 101 + c_tolower(*p);
 
-	return NULL;
+	return hash;
 }
 
 static int G_GNUC_WGET_PURE _compare_addr(struct ADDR_ENTRY *a1, struct ADDR_ENTRY *a2)
@@ -117,87 +154,196 @@ static int G_GNUC_WGET_PURE _compare_addr(struct ADDR_ENTRY *a1, struct ADDR_ENT
 	return n;
 }
 
+// all _dns_*() functions must be called with dns_mutex locked
+
+static void _dns_addr_release(struct DNS_ADDR *addr)
+{
+	if (--addr->refs == 0) {
+		for (int it = wget_vector_size(dns_retired) - 1; it >= 0; it--) {
+			if (wget_vector_get(dns_retired, it) == addr) {
+				wget_vector_remove_nofree(dns_retired, it);
+				break;
+			}
+		}
+
+		freeaddrinfo(addr->addrinfo);
+		xfree(addr);
+	}
+}
+
+static void _free_dns_addr(struct DNS_ADDR *addr)
+{
+	freeaddrinfo(addr->addrinfo);
+}
+
+// the cache drops its reference, connections may still use the addresses
+static void _dns_addr_drop(struct DNS_ADDR *addr)
+{
+	if (addr->refs == 1) {
+		_dns_addr_release(addr);
+		return;
+	}
+
+	addr->refs--;
+	if (!dns_retired) {
+		dns_retired = wget_vector_create(8, -2, NULL);
+		wget_vector_set_destructor(dns_retired, (void(*)(void *))_free_dns_addr);
+	}
+	wget_vector_add_noalloc(dns_retired, addr);
+}
+
 static void _free_dns(struct ADDR_ENTRY *entry)
 {
-	freeaddrinfo(entry->addrinfo);
+	if (entry->addr)
+		_dns_addr_drop(entry->addr);
+
+	xfree(entry);
 }
 
-static struct addrinfo * _wget_dns_cache_add(const char *host, const char *port, struct addrinfo *addrinfo)
+static struct ADDR_ENTRY *_dns_entry_new(const char *host, const char *port)
 {
-	// insert addrinfo into dns cache
 	size_t hostlen = host ? strlen(host) + 1 : 0;
 	size_t portlen = port ? strlen(port) + 1 : 0;
-	struct ADDR_ENTRY *entryp = xmalloc(sizeof(struct ADDR_ENTRY) + hostlen + portlen);
-	int index;
+	struct ADDR_ENTRY *entryp = xcalloc(1, sizeof(struct ADDR_ENTRY) + hostlen + portlen);
 
 	if (host) {
 		entryp->host = ((char *)entryp) + sizeof(struct ADDR_ENTRY);
 		memcpy((char *)entryp->host, host, hostlen); // ugly cast, but semantically ok
-	} else
-		entryp->host = NULL;
+	}
 
 	if (port) {
 		entryp->port = ((char *)entryp) + sizeof(struct ADDR_ENTRY) + hostlen;
 		memcpy((char *)entryp->port, port, portlen); // ugly cast, but semantically ok
-	} else
-		entryp->port = NULL;
+	}
 
-	entryp->addrinfo = addrinfo;
+	return entryp;
+}
+
+// (re)fill the cache entry of host:port with 'addrinfo' (or a negative entry with 'error')
+static struct ADDR_ENTRY *_dns_cache_set(const char *host, const char *port, struct addrinfo *addrinfo, int error)
+{
+	struct ADDR_ENTRY *entryp, entry = { .host = host, .port = port };
+	long long now = wget_get_timemillis();
+	int ttl = addrinfo ? dns_ttl : dns_negative_ttl;
 
-	wget_thread_mutex_lock(&dns_mutex);
 	if (!dns_cache) {
-		dns_cache = wget_vector_create(4, -2, (int(*)(const void *, const void *))_compare_addr);
-		wget_vector_set_destructor(dns_cache, (void(*)(void *))_free_dns);
+		dns_cache = wget_hashmap_create(128, -2, (unsigned int(*)(const void *))_hash_addr, (int(*)(const void *, const void *))_compare_addr);
+		wget_hashmap_set_key_destructor(dns_cache, (void(*)(void *))_free_dns);
+		wget_hashmap_set_value_destructor(dns_cache, NULL);
 	}
 
-	if ((index = wget_vector_find(dns_cache, entryp)) == -1) {
+	if (!(entryp = wget_hashmap_get(dns_cache, &entry))) {
 		debug_printf("Add dns cache entry %s:%s\n", host, port);
-		wget_vector_insert_sorted_noalloc(dns_cache, entryp);
-	} else {
-		// race condition:
-		xfree(entryp);
-		freeaddrinfo(addrinfo);
-		addrinfo = wget_vector_get(dns_cache, index);
+		entryp = _dns_entry_new(host, port);
+		wget_hashmap_put_noalloc(dns_cache, entryp, entryp);
+	} else if (entryp->addr) {
+		_dns_addr_drop(entryp->addr);
 	}
-	wget_thread_mutex_unlock(&dns_mutex);
 
-	return addrinfo;
+	if (addrinfo) {
+		entryp->addr = xmalloc(sizeof(struct DNS_ADDR));
+		entryp->addr->addrinfo = addrinfo;
+		entryp->addr->refs = 1;
+	} else
+		entryp->addr = NULL;
+
+	entryp->error = error;
+	entryp->hits = 0;
+	entryp->expires = ttl < 0 ? LLONG_MAX : now + ttl;
+	entryp->refresh = ttl < 0 ? LLONG_MAX : now + ttl - ttl / 4;
+
+	if (entryp->pending) {
+		entryp->pending = 0;
+		wget_thread_cond_signal(&dns_done_cond);
+	}
+
+	return entryp;
 }
 
-void wget_dns_cache_free(void)
+// returns the entry of host:port, a placeholder is added if it doesn't exist
+static struct ADDR_ENTRY *_dns_cache_entry(const char *host, const char *port)
 {
-	wget_thread_mutex_lock(&dns_mutex);
-	wget_vector_free(&dns_cache);
-	wget_thread_mutex_unlock(&dns_mutex);
+	struct ADDR_ENTRY *entryp, entry = { .host = host, .port = port };
+
+	if (!dns_cache || !(entryp = wget_hashmap_get(dns_cache, &entry))) {
+		entryp = _dns_cache_set(host, port, NULL, 0);
+		entryp->expires = 0; // not valid yet
+	}
+
+	return entryp;
 }
 
-struct addrinfo *wget_tcp_resolve(wget_tcp_t *tcp, const char *host, const char *port)
+static void *_dns_thread(void *p G_GNUC_WGET_UNUSED);
+
+// queue a background resolution of the entry's host:port, returns 0 if queued
+static int _dns_queue(struct ADDR_ENTRY *entry)
 {
-	static wget_thread_mutex_t
-		mutex = WGET_THREAD_MUTEX_INITIALIZER;
-	struct addrinfo *addrinfo, *ai, hints;
-	int tries, rc = 0, ai_flags = 0;
+	if (!wget_thread_support())
+		return -1;
 
-	if (!tcp)
-		tcp = &_global_tcp;
+	if (!dns_nidle && dns_nthreads < DNS_THREADS_MAX) {
+		if (wget_thread_start(&dns_threads[dns_nthreads], _dns_thread, NULL, 0)) {
+			error_printf(_("Failed to start DNS resolver thread\n"));
+			if (!dns_nthreads)
+				return -1;
+		} else
+			dns_nthreads++;
+	}
 
-//	if (!port)
-//		port = "0";
+	if (!dns_jobs)
+		dns_jobs = wget_vector_create(8, -2, NULL);
+	wget_vector_add_noalloc(dns_jobs, _dns_entry_new(entry->host, entry->port));
+	entry->pending = 1;
 
-	// if port is NULL,
-	if (tcp->caching) {
-		if ((addrinfo = _wget_dns_cache_get(host, port)))
-			return addrinfo;
+	wget_thread_cond_signal(&dns_cond);
 
-		// prevent multiple address resolutions of the same host/port
-		wget_thread_mutex_lock(&mutex);
-		// now try again
-		if ((addrinfo = _wget_dns_cache_get(host, port))) {
-			wget_thread_mutex_unlock(&mutex);
-			return addrinfo;
+	return 0;
+}
+
+// returns the valid cache entry of host:port or NULL, 'count_miss' updates the statistics on a miss
+static struct ADDR_ENTRY *_dns_cache_get(const char *host, const char *port, int count_miss)
+{
+	struct ADDR_ENTRY *entryp, entry = { .host = host, .port = port };
+	long long now;
+
+	if (!dns_cache || !(entryp = wget_hashmap_get(dns_cache, &entry))) {
+		dns_stats.misses += count_miss;
+		return NULL;
+	}
+
+	if ((now = wget_get_timemillis()) >= entryp->expires) {
+		if (count_miss) {
+			if (entryp->expires) {
+				debug_printf("Expired dns cache entry %s:%s\n", host, port);
+				dns_stats.expired++;
+			}
+			dns_stats.misses++;
 		}
+		return NULL;
 	}
-	addrinfo = NULL;
+
+	if (!entryp->addr) {
+		dns_stats.negative_hits++;
+		return entryp;
+	}
+
+	dns_stats.hits++;
+
+	// refresh-ahead: hot entries are resolved again before they expire
+	if (++entryp->hits >= 2 && now >= entryp->refresh && !entryp->pending) {
+		debug_printf("Refresh dns cache entry %s:%s\n", host, port);
+		if (_dns_queue(entryp) == 0)
+			dns_stats.refreshes++;
+	}
+
+	return entryp;
+}
+
+// resolve host:port without the cache, returns 0 or a getaddrinfo() error code
+static int _resolve(wget_tcp_t *tcp, const char *host, const char *port, struct addrinfo **out_addrinfo)
+{
+	struct addrinfo *addrinfo = NULL, *ai, hints;
+	int tries, rc = 0, ai_flags = 0;
 
 	ai_flags |= (port && c_isdigit(*port) ? AI_NUMERICSERV : 0);
 	ai_flags |= AI_ADDRCONFIG;
@@ -218,21 +364,15 @@ struct addrinfo *wget_tcp_resolve(wget_tcp_t *tcp, const char *host, const char
 
 	// get the IP address for the server
 	for (tries = 0; tries < 3; tries++) {
-		if ((rc = getaddrinfo(host, port, &hints, &addrinfo)) == 0 || rc != EAI_AGAIN)
+		if ((rc = dns_resolver(host, port, &hints, &addrinfo)) == 0 || rc != EAI_AGAIN)
 			break;
 
 		if (tries < 2)
 			wget_millisleep(100);
 	}
 
-	if (rc) {
-		error_printf(_("Failed to resolve %s:%s (%s)\n"), host, port, gai_strerror(rc));
-
-		if (tcp->caching)
-			wget_thread_mutex_unlock(&mutex);
-
-		return NULL;
-	}
+	if (rc)
+		return rc;
 
 	if (tcp->family == AF_UNSPEC && tcp->preferred_family != AF_UNSPEC) {
 		struct addrinfo *preferred = NULL, *preferred_tail = NULL;
@@ -281,16 +421,218 @@ struct addrinfo *wget_tcp_resolve(wget_tcp_t *tcp, const char *host, const char
 		}
 	}
 
+	*out_addrinfo = addrinfo;
+	return 0;
+}
+
+// works on the background resolutions, uses the settings of the global tcp
+static void *_dns_thread(void *p G_GNUC_WGET_UNUSED)
+{
+	struct ADDR_ENTRY *job, *entryp;
+	struct addrinfo *addrinfo;
+	int rc;
+
+	wget_thread_mutex_lock(&dns_mutex);
+
+	while (!dns_stop) {
+		if (!(job = wget_vector_get(dns_jobs, 0))) {
+			dns_nidle++;
+			wget_thread_cond_wait(&dns_cond, &dns_mutex);
+			dns_nidle--;
+			continue;
+		}
+		wget_vector_remove_nofree(dns_jobs, 0);
+		wget_thread_mutex_unlock(&dns_mutex);
+
+		addrinfo = NULL;
+		rc = _resolve(&_global_tcp, job->host, job->port, &addrinfo);
+
+		wget_thread_mutex_lock(&dns_mutex);
+		entryp = _dns_cache_entry(job->host, job->port);
+		if (rc && entryp->addr && wget_get_timemillis() < entryp->expires) {
+			// a failed refresh keeps the old entry until it expires
+			debug_printf("Failed to refresh %s:%s (%s)\n", job->host, job->port, gai_strerror(rc));
+			entryp->pending = 0;
+			wget_thread_cond_signal(&dns_done_cond);
+		} else
+			_dns_cache_set(job->host, job->port, addrinfo, rc);
+		xfree(job);
+	}
+
+	wget_thread_mutex_unlock(&dns_mutex);
+
+	return NULL;
+}
+
+// Connections must not be in use when the cache is freed.
+void wget_dns_cache_free(void)
+{
+	wget_thread_mutex_lock(&dns_mutex);
+	if (dns_nthreads) {
+		dns_stop = 1;
+		wget_thread_cond_signal(&dns_cond);
+		wget_thread_mutex_unlock(&dns_mutex);
+		for (int it = 0; it < dns_nthreads; it++)
+			wget_thread_join(dns_threads[it]);
+		wget_thread_mutex_lock(&dns_mutex);
+		dns_nthreads = 0;
+		dns_stop = 0;
+	}
+
+	wget_hashmap_free(&dns_cache);
+	wget_vector_free(&dns_jobs);
+
+	// addresses still referenced are freed here at latest
+	wget_vector_free(&dns_retired);
+	wget_thread_mutex_unlock(&dns_mutex);
+}
+
+// Resolve host:port in the background to have it in the DNS cache when it is needed.
+// Nothing is done if the name is already cached or being resolved.
+void wget_dns_prefetch(const char *host, const char *port)
+{
+	struct ADDR_ENTRY *entryp;
+
+	if (!_global_tcp.caching || !host)
+		return;
+
+	wget_thread_mutex_lock(&dns_mutex);
+	entryp = _dns_cache_entry(host, port);
+	if (!entryp->pending && wget_get_timemillis() >= entryp->expires) {
+		debug_printf("Prefetch dns entry %s:%s\n", host, port);
+		if (_dns_queue(entryp) == 0)
+			dns_stats.prefetches++;
+	}
+	wget_thread_mutex_unlock(&dns_mutex);
+}
+
+// Returns 1 while host:port is being resolved, e.g. after wget_dns_prefetch().
+// A connect to host:port would wait for the result.
+int wget_dns_resolving(const char *host, const char *port)
+{
+	struct ADDR_ENTRY *entryp, entry = { .host = host, .port = port };
+	int pending = 0;
+
+	if (!host)
+		return 0;
+
+	wget_thread_mutex_lock(&dns_mutex);
+	if (dns_cache && (entryp = wget_hashmap_get(dns_cache, &entry)))
+		pending = entryp->pending;
+	wget_thread_mutex_unlock(&dns_mutex);
+
+	return pending;
+}
+
+// Lifetime of positive DNS cache entries in ms (default 5 minutes), < 0 means forever.
+// Hot entries are resolved again in the background when 3/4 of their lifetime has passed.
+void wget_dns_cache_set_ttl(int ttl)
+{
+	dns_ttl = ttl;
+}
+
+// Lifetime of negative DNS cache entries (names that could not be resolved) in ms (default 10s).
+void wget_dns_cache_set_negative_ttl(int ttl)
+{
+	dns_negative_ttl = ttl;
+}
+
+void wget_dns_cache_get_stats(wget_dns_cache_stats_t *stats)
+{
+	wget_thread_mutex_lock(&dns_mutex);
+	*stats = dns_stats;
+	wget_thread_mutex_unlock(&dns_mutex);
+}
+
+// Replace getaddrinfo(), e.g. by a stub resolver for testing.
+// The returned address lists must be freeable with freeaddrinfo(). NULL restores getaddrinfo().
+void wget_dns_set_resolver(int (*resolver)(const char *, const char *, const struct addrinfo *, struct addrinfo **))
+{
+	dns_resolver = resolver ? resolver : getaddrinfo;
+}
+
+// With caching, *addr gets a reference to the cached addresses that has to be
+// released with _tcp_addrinfo_release().
+static struct addrinfo *_tcp_resolve(wget_tcp_t *tcp, const char *host, const char *port, struct DNS_ADDR **addr)
+{
+	struct ADDR_ENTRY *entryp;
+	struct addrinfo *addrinfo = NULL;
+	int rc = 0;
+
+	if (tcp->caching) {
+		wget_thread_mutex_lock(&dns_mutex);
+
+		// prevent multiple address resolutions of the same host/port:
+		// if it is being resolved (e.g. prefetched), wait for the result
+		for (int count_miss = 1;; count_miss = 0) {
+			if ((entryp = _dns_cache_get(host, port, count_miss)) || !_dns_cache_entry(host, port)->pending)
+				break;
+
+			debug_printf("Waiting for dns resolution of %s:%s\n", host, port);
+			wget_thread_cond_wait(&dns_done_cond, &dns_mutex);
+		}
+
+		if (entryp) {
+			if (entryp->addr) {
+				// DNS cache entry found
+				debug_printf("Found dns cache entry %s:%s\n", host, port);
+				(*addr = entryp->addr)->refs++;
+				addrinfo = entryp->addr->addrinfo;
+			} else
+				rc = entryp->error;
+			wget_thread_mutex_unlock(&dns_mutex);
+
+			if (!addrinfo)
+				error_printf(_("Failed to resolve %s:%s (%s)\n"), host, port, gai_strerror(rc));
+
+			return addrinfo;
+		}
+
+		// we resolve it, others wait for us
+		_dns_cache_entry(host, port)->pending = 1;
+		wget_thread_mutex_unlock(&dns_mutex);
+	}
+
+	if ((rc = _resolve(tcp, host, port, &addrinfo)))
+		error_printf(_("Failed to resolve %s:%s (%s)\n"), host, port, gai_strerror(rc));
+
 	if (tcp->caching) {
-		// In case of a race condition the already existing addrinfo is returned.
-		// The addrinfo argument given to _wget_dns_cache_add() will be freed in this case.
-		addrinfo = _wget_dns_cache_add(host, port, addrinfo);
-		wget_thread_mutex_unlock(&mutex);
+		wget_thread_mutex_lock(&dns_mutex);
+		entryp = _dns_cache_set(host, port, addrinfo, rc);
+		if (entryp->addr)
+			(*addr = entryp->addr)->refs++;
+		wget_thread_mutex_unlock(&dns_mutex);
 	}
 
 	return addrinfo;
 }
 
+static void _tcp_addrinfo_release(wget_tcp_t *tcp)
+{
+	if (tcp->addrinfo_allocated) {
+		freeaddrinfo(tcp->addrinfo);
+	} else if (tcp->dns_addr) {
+		wget_thread_mutex_lock(&dns_mutex);
+		_dns_addr_release(tcp->dns_addr);
+		wget_thread_mutex_unlock(&dns_mutex);
+	}
+
+	tcp->addrinfo = NULL;
+	tcp->dns_addr = NULL;
+}
+
+// With caching, the returned addresses are owned by the DNS cache and stay valid until wget_dns_cache_free().
+struct addrinfo *wget_tcp_resolve(wget_tcp_t *tcp, const char *host, const char *port)
+{
+	struct DNS_ADDR *addr;
+
+	if (!tcp)
+		tcp = &_global_tcp;
+
+	// the reference is never released, the addresses are retired on expiry
+	return _tcp_resolve(tcp, host, port, &addr);
+}
+
 static int G_GNUC_WGET_CONST _value_to_family(int value)
 {
 	switch (value) {
@@ -322,6 +664,26 @@ void wget_tcp_set_tcp_fastopen(wget_tcp_t *tcp, int tcp_fastopen)
 #endif
 }
 
+// Delay in ms before wget_tcp_connect() starts a connection attempt to the next address of a host
+// while the previous attempts are still pending. <= 0 tries the addresses one after the other.
+void wget_tcp_set_connect_attempt_delay(wget_tcp_t *tcp, int delay)
+{
+	(tcp ? tcp : &_global_tcp)->connect_attempt_delay = delay;
+}
+
+// In non-blocking mode, wget_tcp_connect() just starts connecting and wget_tcp_handshake()
+// has to be called until the connection (and the TLS handshake) is established.
+// wget_tcp_read() and wget_tcp_write() return WGET_E_AGAIN instead of waiting.
+void wget_tcp_set_nonblocking(wget_tcp_t *tcp, int nonblocking)
+{
+	(tcp ? tcp : &_global_tcp)->nonblocking = !!nonblocking;
+}
+
+int wget_tcp_get_sockfd(wget_tcp_t *tcp)
+{
+	return tcp ? tcp->sockfd : -1;
+}
+
 void wget_tcp_set_dns_caching(wget_tcp_t *tcp, int caching)
 {
 	(tcp ? tcp : &_global_tcp)->caching = caching;
@@ -515,98 +877,290 @@ int wget_tcp_ready_2_transfer(wget_tcp_t *tcp, int flags)
 	return wget_ready_2_transfer(tcp->sockfd, tcp->timeout, flags);
 }
 
-int wget_tcp_connect(wget_tcp_t *tcp, const char *host, const char *port)
+// create a socket for 'ai', bind it if requested and start connecting.
+// With 'fastopen', the connect is delayed until the first wget_tcp_write().
+// Returns the socket, WGET_E_CONNECT if this address failed or WGET_E_UNKNOWN if we should give up.
+static int _tcp_socket_connect(wget_tcp_t *tcp, struct addrinfo *ai, int fastopen)
 {
-	struct addrinfo *ai;
-	int sockfd = -1, rc, ret = WGET_E_UNKNOWN;
+	int sockfd, rc, on = 1;
 	char adr[NI_MAXHOST], s_port[NI_MAXSERV];
 
-	if (tcp->addrinfo_allocated)
-		freeaddrinfo(tcp->addrinfo);
+	if (wget_get_logger(WGET_LOGGER_DEBUG)->vprintf) {
+		if ((rc = getnameinfo(ai->ai_addr, ai->ai_addrlen, adr, sizeof(adr), s_port, sizeof(s_port), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
+			debug_printf("trying %s:%s...\n", adr, s_port);
+		else
+			debug_printf("trying ???:%s (%s)...\n", s_port, gai_strerror(rc));
+	}
 
-	tcp->addrinfo = wget_tcp_resolve(tcp, host, port);
-	tcp->addrinfo_allocated = !tcp->caching;
+	if ((sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1) {
+		error_printf(_("Failed to create socket (%d)\n"), errno);
+		return WGET_E_CONNECT;
+	}
 
-	for (ai = tcp->addrinfo; ai; ai = ai->ai_next) {
+	_set_async(sockfd);
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on)) == -1)
+		error_printf(_("Failed to set socket option REUSEADDR\n"));
+
+	on = 1;
+	if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (void *)&on, sizeof(on)) == -1)
+		error_printf(_("Failed to set socket option NODELAY\n"));
+
+	if (tcp->bind_addrinfo) {
 		if (wget_get_logger(WGET_LOGGER_DEBUG)->vprintf) {
-			if ((rc = getnameinfo(ai->ai_addr, ai->ai_addrlen, adr, sizeof(adr), s_port, sizeof(s_port), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
-				debug_printf("trying %s:%s...\n", adr, s_port);
+			if ((rc = getnameinfo(tcp->bind_addrinfo->ai_addr, tcp->bind_addrinfo->ai_addrlen, adr, sizeof(adr), s_port, sizeof(s_port), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
+				debug_printf("binding to %s:%s...\n", adr, s_port);
 			else
-				debug_printf("trying ???:%s (%s)...\n", s_port, gai_strerror(rc));
+				debug_printf("binding to ???:%s (%s)...\n", s_port, gai_strerror(rc));
 		}
 
-		if ((sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) != -1) {
-			int on = 1;
+		if (bind(sockfd, tcp->bind_addrinfo->ai_addr, tcp->bind_addrinfo->ai_addrlen) != 0) {
+			error_printf(_("Failed to bind (%d)\n"), errno);
+			close(sockfd);
+			return WGET_E_UNKNOWN;
+		}
+	}
 
-			_set_async(sockfd);
+	if (fastopen) {
+		rc = 0;
+		errno = 0;
+		tcp->connect_addrinfo = ai;
+	} else
+		rc = connect(sockfd, ai->ai_addr, ai->ai_addrlen);
+
+	if (rc < 0
+		&& errno != EAGAIN
+		&& errno != EINPROGRESS
+	) {
+		error_printf(_("Failed to connect (%d)\n"), errno);
+		close(sockfd);
+		return WGET_E_CONNECT;
+	}
 
-			if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on)) == -1)
-				error_printf(_("Failed to set socket option REUSEADDR\n"));
+	return sockfd;
+}
 
-			on = 1;
-			if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (void *)&on, sizeof(on)) == -1)
-				error_printf(_("Failed to set socket option NODELAY\n"));
+struct _connect_attempt {
+	wget_tcp_t
+		tcp;
+	long long
+		started; // ms since epoch
+	short
+		events; // what we are polling for
+};
 
-			if (tcp->bind_addrinfo) {
-				if (wget_get_logger(WGET_LOGGER_DEBUG)->vprintf) {
-					if ((rc = getnameinfo(tcp->bind_addrinfo->ai_addr, tcp->bind_addrinfo->ai_addrlen, adr, sizeof(adr), s_port, sizeof(s_port), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
-						debug_printf("binding to %s:%s...\n", adr, s_port);
-					else
-						debug_printf("binding to ???:%s (%s)...\n", s_port, gai_strerror(rc));
-				}
+// Happy Eyeballs v2 (RFC 8305): instead of waiting for each address to time out, a new
+// non-blocking connection attempt is started every 'connect_attempt_delay' ms (or as soon as
+// the previous one failed), alternating the address families.
+// The first attempt that completes the TCP and TLS handshake wins, the others are closed.
+// The default delay of 250ms and the interleaving with a 'First Address Family Count' of 1 follow
+// sections 4 and 5 of the RFC. Unlike the RFC, the addresses come from one blocking getaddrinfo(),
+// so there is no Resolution Delay for AAAA vs. A answers and the order is that of the resolver.
+static int _tcp_connect_parallel(wget_tcp_t *tcp)
+{
+	struct addrinfo *ai, *fam1, *fam2, **order;
+	struct _connect_attempt *attempts, *a;
+	struct pollfd *pollfds;
+	int *pollidx;
+	int n, it, npoll, timeout, rc, nattempts = 0, nactive = 0, next = 0, ret = WGET_E_CONNECT;
+	long long now, next_start = 0;
+
+	for (n = 0, ai = tcp->addrinfo; ai; ai = ai->ai_next)
+		n++;
+
+	order = xmalloc(n * sizeof(struct addrinfo *));
+	attempts = xcalloc(n, sizeof(struct _connect_attempt));
+	pollfds = xmalloc(n * sizeof(struct pollfd));
+	pollidx = xmalloc(n * sizeof(int));
+
+	// interleave the address families, starting with the family the resolver put first
+	for (it = 0, fam1 = fam2 = tcp->addrinfo; it < n;) {
+		while (fam1 && fam1->ai_family != tcp->addrinfo->ai_family)
+			fam1 = fam1->ai_next;
+		if (fam1) {
+			order[it++] = fam1;
+			fam1 = fam1->ai_next;
+		}
 
-				if (bind(sockfd, tcp->bind_addrinfo->ai_addr, tcp->bind_addrinfo->ai_addrlen) != 0) {
-					error_printf(_("Failed to bind (%d)\n"), errno);
-					close(sockfd);
-					return -1;
+		while (fam2 && fam2->ai_family == tcp->addrinfo->ai_family)
+			fam2 = fam2->ai_next;
+		if (fam2) {
+			order[it++] = fam2;
+			fam2 = fam2->ai_next;
+		}
+	}
+
+	for (;;) {
+		now = wget_get_timemillis();
+
+		// start the next attempt if it's due or if there is nothing else to wait for
+		if (next < n && (!nactive || now >= next_start)) {
+			a = &attempts[nattempts];
+			a->tcp = *tcp;
+			a->tcp.addrinfo = NULL;
+			a->tcp.addrinfo_allocated = 0;
+			a->tcp.dns_addr = NULL;
+			a->tcp.ssl_session = NULL;
+			a->tcp.splice_pipe_open = 0; // the parent's pipe, if any
+			a->tcp.splice_pending = 0;
+			a->tcp.handshake_pending = 0;
+			a->tcp.nonblocking = 1;
+			a->tcp.first_send = 0;
+
+			if ((rc = _tcp_socket_connect(tcp, order[next++], 0)) >= 0) {
+				a->tcp.sockfd = rc;
+				a->tcp.connecting = 1;
+				a->started = now;
+				a->events = POLLOUT;
+				nattempts++;
+				nactive++;
+				next_start = now + tcp->connect_attempt_delay;
+			} else if (rc == WGET_E_UNKNOWN) {
+				ret = rc;
+				break;
+			}
+			continue;
+		}
+
+		if (!nactive)
+			break; // all addresses failed
+
+		// wait until an attempt makes progress, the next attempt is due or the oldest attempt times out
+		timeout = next < n ? (int)(next_start - now) : -1;
+
+		for (npoll = 0, it = 0; it < nattempts; it++) {
+			a = &attempts[it];
+			if (a->tcp.sockfd == -1)
+				continue;
+
+			if (tcp->connect_timeout > 0) {
+				long long left = a->started + tcp->connect_timeout - now;
+
+				if (left <= 0) {
+					debug_printf("connection attempt timed out\n");
+					wget_tcp_close(&a->tcp);
+					nactive--;
+					ret = WGET_E_TIMEOUT;
+					continue;
 				}
+				if (timeout < 0 || left < timeout)
+					timeout = (int) left;
 			}
 
-			if (tcp->ssl)  {
-				rc = connect(sockfd, ai->ai_addr, ai->ai_addrlen);
+			pollfds[npoll].fd = a->tcp.sockfd;
+			pollfds[npoll].events = a->events;
+			pollfds[npoll].revents = 0;
+			pollidx[npoll++] = it;
+		}
+
+		if (!npoll)
+			continue;
+
+		if ((rc = poll(pollfds, npoll, timeout)) <= 0) {
+			if (rc < 0 && errno != EINTR) {
+				error_printf(_("Failed to poll (%d)\n"), errno);
+				break;
+			}
+			continue;
+		}
+
+		for (it = 0; it < npoll; it++) {
+			if (!pollfds[it].revents)
+				continue;
+
+			a = &attempts[pollidx[it]];
+
+			if ((rc = wget_tcp_handshake(&a->tcp)) == WGET_E_SUCCESS) {
+				tcp->sockfd = a->tcp.sockfd;
+				tcp->ssl_session = a->tcp.ssl_session;
+				tcp->protocol = a->tcp.protocol;
+				tcp->connecting = 0;
 				tcp->first_send = 0;
+				a->tcp.sockfd = -1;
+				a->tcp.ssl_session = NULL;
+				ret = WGET_E_SUCCESS;
+				break;
+			} else if (rc == WGET_IO_READABLE) {
+				a->events = POLLIN;
+			} else if (rc == WGET_IO_WRITABLE) {
+				a->events = POLLOUT;
 			} else {
-				if (tcp->tcp_fastopen) {
-					rc = 0;
-					errno = 0;
-					tcp->connect_addrinfo = ai;
-				} else {
-					rc = connect(sockfd, ai->ai_addr, ai->ai_addrlen);
-					tcp->first_send = 0;
-				}
+				wget_tcp_close(&a->tcp);
+				nactive--;
+				next_start = now; // don't wait for the delay to try the next address
+				if ((ret = rc) == WGET_E_CERTIFICATE)
+					break; // stop here - the server cert couldn't be validated
 			}
+		}
 
-			if (rc < 0
-				&& errno != EAGAIN
-				&& errno != EINPROGRESS
-			) {
-				error_printf(_("Failed to connect (%d)\n"), errno);
-				ret = WGET_E_CONNECT;
-				close(sockfd);
-			} else {
-				tcp->sockfd = sockfd;
-				if (tcp->ssl) {
-//					tcp->ssl_session = wget_ssl_open(tcp->sockfd, tcp->ssl_hostname, tcp->connect_timeout);
-//					if (!tcp->ssl_session) {
-					if ((ret = wget_ssl_open(tcp))) {
-						if (ret == WGET_E_CERTIFICATE) {
-							wget_tcp_close(tcp);
-							break; /* stop here - the server cert couldn't be validated */
-						}
-
-						// do not free tcp->addrinfo when calling wget_tcp_close()
-						struct addrinfo *ai_tmp = tcp->addrinfo;
-						tcp->addrinfo = NULL;
-						wget_tcp_close(tcp);
-						tcp->addrinfo = ai_tmp;
-						continue;
-					}
+		if (ret == WGET_E_SUCCESS || ret == WGET_E_CERTIFICATE)
+			break;
+	}
+
+	// close the losers
+	for (it = 0; it < nattempts; it++)
+		wget_tcp_close(&attempts[it].tcp);
+
+	xfree(pollidx);
+	xfree(pollfds);
+	xfree(attempts);
+	xfree(order);
+
+	return ret;
+}
+
+int wget_tcp_connect(wget_tcp_t *tcp, const char *host, const char *port)
+{
+	struct addrinfo *ai;
+	int sockfd = -1, fastopen, ret = WGET_E_UNKNOWN;
+
+	_tcp_addrinfo_release(tcp);
+
+	tcp->remote_port = port ? atoi(port) : 0;
+	tcp->addrinfo = _tcp_resolve(tcp, host, port, &tcp->dns_addr);
+	tcp->addrinfo_allocated = !tcp->caching;
+
+	// race the addresses instead of waiting for each one to time out
+	if (!tcp->nonblocking && tcp->connect_attempt_delay > 0 && tcp->addrinfo && tcp->addrinfo->ai_next)
+		return _tcp_connect_parallel(tcp);
+
+	// TCP Fast Open sends the first data with the SYN, so connect() is delayed until wget_tcp_write()
+	// resp. until the TLS ClientHello is sent
+	fastopen = tcp->tcp_fastopen && !tcp->nonblocking;
+
+	for (ai = tcp->addrinfo; ai; ai = ai->ai_next) {
+		if ((sockfd = _tcp_socket_connect(tcp, ai, fastopen)) < 0) {
+			if (sockfd == WGET_E_UNKNOWN)
+				return sockfd;
+
+			ret = sockfd;
+			continue;
+		}
+
+		if (!fastopen)
+			tcp->first_send = 0;
+
+		tcp->sockfd = sockfd;
+		if (tcp->nonblocking) {
+			// wget_tcp_handshake() does the rest
+			tcp->connecting = 1;
+		} else if (tcp->ssl) {
+			if ((ret = wget_ssl_open(tcp))) {
+				if (ret == WGET_E_CERTIFICATE) {
+					wget_tcp_close(tcp);
+					break; /* stop here - the server cert couldn't be validated */
 				}
 
-				return WGET_E_SUCCESS;
+				// do not free tcp->addrinfo when calling wget_tcp_close()
+				struct addrinfo *ai_tmp = tcp->addrinfo;
+				tcp->addrinfo = NULL;
+				wget_tcp_close(tcp);
+				tcp->addrinfo = ai_tmp;
+				continue;
 			}
-		} else
-			error_printf(_("Failed to create socket (%d)\n"), errno);
+		}
+
+		return WGET_E_SUCCESS;
 	}
 
 	return ret;
@@ -732,12 +1286,98 @@ void wget_tcp_tls_stop(wget_tcp_t *tcp)
 		wget_ssl_server_close(&tcp->ssl_session);
 	else
 		wget_ssl_close(&tcp->ssl_session);
+	tcp->handshake_pending = 0;
+}
+
+// Complete a non-blocking wget_tcp_connect(), including the TLS handshake.
+// Returns WGET_E_SUCCESS if the connection is ready, WGET_IO_READABLE or WGET_IO_WRITABLE
+// if we have to wait for the socket, else a WGET_E_* error.
+int wget_tcp_handshake(wget_tcp_t *tcp)
+{
+	if (tcp->sockfd == -1)
+		return WGET_E_INVALID;
+
+	if (tcp->connecting) {
+		int rc, err = 0;
+		socklen_t len = sizeof(err);
+
+		if ((rc = wget_ready_2_write(tcp->sockfd, 0)) == 0)
+			return WGET_IO_WRITABLE;
+
+		if (rc < 0 || getsockopt(tcp->sockfd, SOL_SOCKET, SO_ERROR, (void *)&err, &len) || err) {
+			error_printf(_("Failed to connect (%d)\n"), err ? err : errno);
+			return WGET_E_CONNECT;
+		}
+
+		tcp->connecting = 0;
+	}
+
+	if (tcp->ssl)
+		return wget_ssl_handshake(tcp);
+
+	return WGET_E_SUCCESS;
+}
+
+#ifdef HAVE_SPLICE
+// pipe buffer used for splicing, the default of 64KB means a syscall pair per 64KB
+#define SPLICE_PIPE_SIZE (1024 * 1024)
+
+static void _tcp_splice_pipe_close(wget_tcp_t *tcp)
+{
+	if (tcp->splice_pipe_open) {
+		close(tcp->splice_pipe[0]);
+		close(tcp->splice_pipe[1]);
+		tcp->splice_pipe_open = 0;
+		tcp->splice_pending = 0;
+	}
 }
 
+// read bytes that have been left in the pipe by wget_tcp_splice()
+static ssize_t _tcp_splice_pipe_read(wget_tcp_t *tcp, char *buf, size_t count)
+{
+	ssize_t rc;
+
+	if (count > tcp->splice_pending)
+		count = tcp->splice_pending;
+
+	while ((rc = read(tcp->splice_pipe[0], buf, count)) < 0 && errno == EINTR);
+
+	if (rc <= 0) {
+		error_printf(_("Failed to read %zu bytes (%d)\n"), count, errno);
+		_tcp_splice_pipe_close(tcp);
+		return WGET_E_UNKNOWN;
+	}
+
+	tcp->splice_pending -= rc;
+
+	return rc;
+}
+#endif
+
 ssize_t wget_tcp_read(wget_tcp_t *tcp, char *buf, size_t count)
 {
 	ssize_t rc;
 
+#ifdef HAVE_SPLICE
+	// data that wget_tcp_splice() could not move into the file comes before the socket data
+	if (tcp->splice_pending)
+		return _tcp_splice_pipe_read(tcp, buf, count);
+#endif
+
+	if (tcp->nonblocking) {
+		if (tcp->ssl_session)
+			return wget_ssl_read_nonblock(tcp->ssl_session, buf, count);
+
+		if ((rc = read(tcp->sockfd, buf, count)) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return WGET_E_AGAIN;
+
+			error_printf(_("Failed to read %zu bytes (%d)\n"), count, errno);
+		}
+
+		return rc;
+	}
+
 	if (tcp->ssl_session) {
 		rc = wget_ssl_read_timeout(tcp->ssl_session, buf, count, tcp->timeout);
 	} else {
@@ -757,11 +1397,109 @@ ssize_t wget_tcp_read(wget_tcp_t *tcp, char *buf, size_t count)
 	return rc;
 }
 
+// Move up to 'count' bytes from the socket into 'fd' without copying them into user space.
+// Returns the number of bytes moved, 0 on EOF or timeout, or < 0 on error.
+// WGET_E_INVALID means that splicing is not possible (TLS, non-blocking mode, O_APPEND, no splice() support),
+// the caller should fall back to wget_tcp_read(). If the destination turns out not to support splice(),
+// the bytes already taken from the socket stay in the pipe and wget_tcp_read() returns them first.
+ssize_t wget_tcp_splice(wget_tcp_t *tcp, int fd, size_t count)
+{
+#ifdef HAVE_SPLICE
+	ssize_t rc, nbytes;
+
+	// TLS records have to be decrypted in user space, splice() refuses files opened with O_APPEND
+	// with bytes waiting in the pipe the destination didn't accept spliced data before
+	if (tcp->ssl_session || tcp->nonblocking || tcp->splice_pending || (fcntl(fd, F_GETFL) & O_APPEND))
+		return WGET_E_INVALID;
+
+	if (!tcp->splice_pipe_open) {
+		if (pipe(tcp->splice_pipe) == -1) {
+			debug_printf("Failed to create pipe for splicing (%d)\n", errno);
+			return WGET_E_INVALID;
+		}
+		tcp->splice_pipe_open = 1;
+
+#ifdef F_SETPIPE_SZ
+		fcntl(tcp->splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+#endif
+	}
+
+	// 0: no timeout / immediate
+	// -1: INFINITE timeout
+	if (tcp->timeout) {
+		if ((rc = wget_ready_2_read(tcp->sockfd, tcp->timeout)) <= 0)
+			return rc;
+	}
+
+	if (count > SPLICE_PIPE_SIZE)
+		count = SPLICE_PIPE_SIZE;
+
+	while ((nbytes = splice(tcp->sockfd, NULL, tcp->splice_pipe[1], NULL, count, SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK)) < 0) {
+		if (errno == EINTR)
+			continue;
+
+		if (errno == EINVAL || errno == ENOSYS) {
+			// the socket doesn't support splice(), nothing has been read yet
+			_tcp_splice_pipe_close(tcp);
+			return WGET_E_INVALID;
+		}
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if ((rc = wget_ready_2_read(tcp->sockfd, tcp->timeout)) <= 0)
+				return rc;
+			continue;
+		}
+
+		error_printf(_("Failed to read %zu bytes (%d)\n"), count, errno);
+		return WGET_E_UNKNOWN;
+	}
+
+	// drain the pipe into the destination
+	for (ssize_t done = 0; done < nbytes; done += rc) {
+		if ((rc = splice(tcp->splice_pipe[0], NULL, fd, NULL, nbytes - done, SPLICE_F_MOVE | SPLICE_F_MORE)) <= 0) {
+			if (rc < 0 && errno == EINTR) {
+				rc = 0;
+				continue;
+			}
+
+			if (rc < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				// the destination file system doesn't support splice(), the rest is up to wget_tcp_read()
+				debug_printf("Failed to splice into file (%d), %zd bytes left in pipe\n", errno, nbytes - done);
+				tcp->splice_pending = nbytes - done;
+				return done ? done : WGET_E_INVALID;
+			}
+
+			error_printf(_("Failed to write %zd bytes (%d)\n"), nbytes - done, errno);
+			_tcp_splice_pipe_close(tcp); // still holds data
+			return WGET_E_UNKNOWN;
+		}
+	}
+
+	return nbytes;
+#else
+	return WGET_E_INVALID;
+#endif
+}
+
 ssize_t wget_tcp_write(wget_tcp_t *tcp, const char *buf, size_t count)
 {
 	ssize_t nwritten = 0, n;
 	int rc;
 
+	if (tcp->nonblocking) {
+		if (tcp->ssl_session)
+			return wget_ssl_write_nonblock(tcp->ssl_session, buf, count);
+
+		if ((n = send(tcp->sockfd, buf, count, 0)) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return WGET_E_AGAIN;
+
+			error_printf(_("Failed to write %zu bytes (%d)\n"), count, errno);
+		}
+
+		return n;
+	}
+
 	if (tcp->ssl_session)
 		return wget_ssl_write_timeout(tcp->ssl_session, buf, count, tcp->timeout);
 
@@ -819,6 +1557,16 @@ ssize_t wget_tcp_write(wget_tcp_t *tcp, const char *buf, size_t count)
 	return 0;
 }
 
+// Like wget_tcp_write(), but on a TLS connection with a deferred handshake 'buf' goes out
+// as 0-RTT early data (see wget_ssl_write_early_data()). Only use it for idempotent requests.
+ssize_t wget_tcp_write_early_data(wget_tcp_t *tcp, const char *buf, size_t count)
+{
+	if (tcp->ssl_session && !tcp->nonblocking)
+		return wget_ssl_write_early_data(tcp->ssl_session, buf, count, tcp->timeout);
+
+	return wget_tcp_write(tcp, buf, count);
+}
+
 ssize_t wget_tcp_vprintf(wget_tcp_t *tcp, const char *fmt, va_list args)
 {
 	char sbuf[4096];
@@ -860,9 +1608,11 @@ void wget_tcp_close(wget_tcp_t *tcp)
 			close(tcp->sockfd);
 			tcp->sockfd = -1;
 		}
-		if (tcp->addrinfo_allocated) {
-			freeaddrinfo(tcp->addrinfo);
-		}
-		tcp->addrinfo = NULL;
+#ifdef HAVE_SPLICE
+		_tcp_splice_pipe_close(tcp);
+#endif
+		tcp->connecting = 0;
+		if (tcp->addrinfo)
+			_tcp_addrinfo_release(tcp);
 	}
 }
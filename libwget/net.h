@@ -31,9 +31,13 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+struct DNS_ADDR;
+
 struct wget_tcp_st {
 	void *
 		ssl_session;
+	struct DNS_ADDR *
+		dns_addr; // reference to the cached addrinfo
 	struct addrinfo *
 		addrinfo;
 	struct addrinfo *
@@ -48,10 +52,15 @@ struct wget_tcp_st {
 		// there is no real 'connect timeout', since connects are async
 		dns_timeout,
 		connect_timeout,
+		connect_attempt_delay, // Happy Eyeballs: delay between parallel connection attempts
 		timeout, // read and write timeouts are the same
 		family,
 		preferred_family,
-		protocol; // WGET_PROTOCOL_HTTP1_1, WGET_PROTOCOL_HTTP2_0
+		remote_port, // port we connected to, part of the TLS session cache key
+		protocol, // WGET_PROTOCOL_HTTP1_1, WGET_PROTOCOL_HTTP2_0
+		splice_pipe[2]; // see wget_tcp_splice()
+	size_t
+		splice_pending; // bytes left in the splice pipe, wget_tcp_read() returns them first
 	unsigned int
 		ssl : 1,
 		passive : 1,
@@ -59,7 +68,11 @@ struct wget_tcp_st {
 		addrinfo_allocated : 1,
 		bind_addrinfo_allocated : 1,
 		tcp_fastopen : 1, // do we use TCP_FASTOPEN or not
-		first_send : 1; // TCP_FASTOPEN's first packet is sent different
+		first_send : 1, // TCP_FASTOPEN's first packet is sent different
+		nonblocking : 1, // connect/read/write never wait, see wget_tcp_set_nonblocking()
+		connecting : 1, // non-blocking connect not yet completed
+		handshake_pending : 1, // non-blocking TLS handshake in progress
+		splice_pipe_open : 1;
 };
 
 #endif /* _LIBWGET_NET_H */
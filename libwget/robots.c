@@ -29,6 +29,7 @@
 # include <config.h>
 #endif
 
+#include <stdlib.h>
 #include <strings.h>
 #include <string.h>
 #include <ctype.h>
@@ -83,6 +84,13 @@ ROBOTS *wget_robots_parse(const char *data)
 				wget_vector_add(robots->paths, &path, sizeof(path));
 			}
 		}
+		else if (collect == 1 && !wget_strncasecmp_ascii(data, "Crawl-delay:", 12)) {
+			// non-standard but widely used, value is in seconds and may have a fraction
+			for (data += 12; *data == ' ' || *data == '\t'; data++);
+			double delay = strtod(data, NULL);
+			if (delay > 0 && delay < 86400)
+				robots->crawl_delay = (int)(delay * 1000);
+		}
 		else if (!wget_strncasecmp_ascii(data, "Sitemap:", 8)) {
 			for (data += 8; *data==' ' || *data == '\t'; data++);
 			for (p = data; !isspace(*p); p++);
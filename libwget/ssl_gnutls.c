@@ -47,8 +47,11 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <netdb.h>
 
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
@@ -75,6 +78,8 @@ static struct _config {
 	wget_ocsp_db_t
 		*ocsp_cert_cache,
 		*ocsp_host_cache;
+	wget_tls_session_db_t
+		*tls_session_cache;
 	char
 		check_certificate,
 		check_hostname,
@@ -83,7 +88,8 @@ static struct _config {
 		key_type,
 		print_info,
 		ocsp,
-		ocsp_stapling;
+		ocsp_stapling,
+		early_data;
 } _config = {
 #ifdef HAVE_GNUTLS_OCSP_H
 	.check_certificate=1,
@@ -99,15 +105,30 @@ static struct _config {
 struct _session_context {
 	const char *
 		hostname;
+	const struct addrinfo *
+		fastopen_ai; // where to send the SYN with the ClientHello
+	int
+		port,
+		sockfd;
 	char
 		ocsp_stapling,
-		valid;
+		valid,
+		resuming, // session data from the cache has been set
+		fastopen, // ClientHello not yet sent, the socket is not connected yet (TCP Fast Open)
+		deferred; // handshake deferred until the first write, to send it as 0-RTT early data
 };
 
 static gnutls_certificate_credentials_t
 	_credentials;
 static gnutls_priority_t
 	_priority_cache;
+static wget_ssl_stats_t
+	_stats;
+static wget_thread_mutex_t
+	_stats_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+
+// how long we keep session resumption data, servers usually expire tickets earlier
+#define TLS_SESSION_MAXAGE (18 * 3600)
 
 void wget_ssl_set_config_string(int key, const char *value)
 {
@@ -122,6 +143,7 @@ void wget_ssl_set_config_string(int key, const char *value)
 	case WGET_SSL_OCSP_SERVER: _config.ocsp_server = value; break;
 	case WGET_SSL_OCSP_CACHE: _config.ocsp_cert_cache = (wget_ocsp_db_t *)value; break;
 	case WGET_SSL_ALPN: _config.alpn = value; break;
+	case WGET_SSL_SESSION_CACHE: _config.tls_session_cache = (wget_tls_session_db_t *)value; break;
 	default: error_printf(_("Unknown config key %d (or value must not be a string)\n"), key);
 	}
 }
@@ -137,6 +159,7 @@ void wget_ssl_set_config_int(int key, int value)
 	case WGET_SSL_PRINT_INFO: _config.print_info = (char)value; break;
 	case WGET_SSL_OCSP: _config.ocsp = (char)value; break;
 	case WGET_SSL_OCSP_STAPLING: _config.ocsp_stapling = (char)value; break;
+	case WGET_SSL_EARLY_DATA: _config.early_data = (char)value; break;
 	default: error_printf(_("Unknown config key %d (or value must not be an integer)\n"), key);
 	}
 }
@@ -510,14 +533,54 @@ static void print_ocsp_verify_res(unsigned int status)
 /* three days */
 #define OCSP_VALIDITY_SECS (3*60*60*24)
 
+/* how long we cache OCSP answers without a nextUpdate, and at most for a host */
+#define OCSP_CACHE_SECS 3600
+
+/* RFC 6960 doesn't limit nextUpdate, don't miss a revocation for longer than a week */
+#define OCSP_CACHE_MAX_SECS (7*60*60*24)
+
+/* Returns the expiry time for caching an OCSP answer with the given nextUpdate */
+static time_t _ocsp_expiry(time_t ntime)
+{
+	time_t now = time(NULL);
+
+	if (ntime == -1 || ntime <= now)
+		return now + OCSP_CACHE_SECS;
+
+	if (ntime - now > OCSP_CACHE_MAX_SECS)
+		return now + OCSP_CACHE_MAX_SECS;
+
+	return ntime;
+}
+
+/* Returns the expiry time for caching the stapled OCSP answer */
+static time_t _stapled_ocsp_expiry(gnutls_session_t session)
+{
+	gnutls_datum_t data;
+	gnutls_ocsp_resp_t resp;
+	unsigned int cert_status;
+	time_t vtime, ntime = -1, rtime;
+
+	if (gnutls_ocsp_status_request_get(session, &data) == GNUTLS_E_SUCCESS
+		&& gnutls_ocsp_resp_init(&resp) == GNUTLS_E_SUCCESS)
+	{
+		if (gnutls_ocsp_resp_import(resp, &data) == GNUTLS_E_SUCCESS)
+			gnutls_ocsp_resp_get_single(resp, 0, NULL, NULL, NULL, NULL, &cert_status, &vtime, &ntime, &rtime, NULL);
+		gnutls_ocsp_resp_deinit(resp);
+	}
+
+	return _ocsp_expiry(ntime);
+}
+
 /* Returns:
  *  0: certificate is revoked
  *  1: certificate is ok
  *  -1: dunno
+ * On 0 and 1, *maxage is set to the time until the answer may be cached.
  */
 static int check_ocsp_response(gnutls_x509_crt_t cert,
 	gnutls_x509_crt_t issuer, wget_buffer_t *data,
-	gnutls_datum_t *nonce)
+	gnutls_datum_t *nonce, time_t *maxage)
 {
 	gnutls_ocsp_resp_t resp;
 	int ret = -1, rc;
@@ -567,6 +630,7 @@ static int check_ocsp_response(gnutls_x509_crt_t cert,
 
 	if (cert_status == GNUTLS_OCSP_CERT_REVOKED) {
 		debug_printf("*** Certificate was revoked at %s", ctime(&rtime));
+		*maxage = _ocsp_expiry(ntime);
 		ret = 0;
 		goto cleanup;
 	}
@@ -610,6 +674,7 @@ static int check_ocsp_response(gnutls_x509_crt_t cert,
 
  finish_ok:
 	debug_printf("OCSP server flags certificate not revoked as of %s", ctime(&vtime));
+	*maxage = _ocsp_expiry(ntime);
 	ret = 1;
 
 cleanup:
@@ -639,13 +704,13 @@ static char *_get_cert_fingerprint(gnutls_x509_crt_t cert, char *fingerprint_hex
 /*
  * Add cert to OCSP cache, being either valid or revoked (valid==0)
  */
-static void _add_cert_to_ocsp_cache(gnutls_x509_crt_t cert, int valid)
+static void _add_cert_to_ocsp_cache(gnutls_x509_crt_t cert, int valid, time_t maxage)
 {
 	if (_config.ocsp_cert_cache) {
 		char fingerprint_hex[64 * 2 +1];
 
 		_get_cert_fingerprint(cert, fingerprint_hex, sizeof(fingerprint_hex));
-		wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(fingerprint_hex, time(NULL) + 3600, valid)); // 1h valid
+		wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(fingerprint_hex, maxage, valid));
 	}
 }
 
@@ -657,7 +722,7 @@ static void _add_cert_to_ocsp_cache(gnutls_x509_crt_t cert, int valid)
  * -1: dunno
  */
 //static int cert_verify_ocsp(gnutls_session_t session)
-static int cert_verify_ocsp(gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer)
+static int cert_verify_ocsp(gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer, time_t *maxage)
 {
 	wget_buffer_t *resp = NULL;
 	unsigned char noncebuf[23];
@@ -676,11 +741,121 @@ static int cert_verify_ocsp(gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer)
 	}
 
 	/* verify and check the response for revoked cert */
-	ret = check_ocsp_response(cert, issuer, resp, &nonce);
+	ret = check_ocsp_response(cert, issuer, resp, &nonce, maxage);
 	wget_buffer_free(&resp);
 
 	return ret;
 }
+
+/* One certificate of the peer's chain to be checked via OCSP */
+struct _ocsp_job {
+	gnutls_x509_crt_t
+		cert,
+		issuer;
+	wget_thread_t
+		tid;
+	time_t
+		maxage;
+	unsigned
+		index;
+	int
+		status; // as returned by cert_verify_ocsp()
+	char
+		fingerprint[64 * 2 + 1],
+		deinit_issuer,
+		started, // runs in its own thread
+		cached; // answered from the OCSP cache
+};
+
+/* An OCSP request in progress, other threads wait for its answer */
+struct _ocsp_lookup {
+	char
+		fingerprint[64 * 2 + 1];
+	time_t
+		maxage;
+	int
+		status,
+		refs;
+	char
+		done;
+};
+
+static wget_stringmap_t
+	*_ocsp_lookups;
+static wget_thread_mutex_t
+	_ocsp_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static wget_thread_cond_t
+	_ocsp_cond = WGET_THREAD_COND_INITIALIZER;
+
+static void *_ocsp_job_thread(void *p)
+{
+	struct _ocsp_job *job = p;
+	struct _ocsp_lookup *lookup;
+	int revoked;
+
+	wget_thread_mutex_lock(&_ocsp_mutex);
+
+	if (_ocsp_lookups && (lookup = wget_stringmap_get(_ocsp_lookups, job->fingerprint))) {
+		// another thread already asks the responder about this certificate
+		lookup->refs++;
+		while (!lookup->done)
+			wget_thread_cond_wait(&_ocsp_cond, &_ocsp_mutex);
+
+		job->status = lookup->status;
+		job->maxage = lookup->maxage;
+
+		if (--lookup->refs == 0)
+			xfree(lookup);
+
+		wget_thread_mutex_unlock(&_ocsp_mutex);
+
+		wget_thread_mutex_lock(&_stats_mutex);
+		_stats.ocsp_shared++;
+		wget_thread_mutex_unlock(&_stats_mutex);
+		return NULL;
+	}
+
+	// the answer might have been cached while this job has been set up
+	if (wget_ocsp_fingerprint_in_cache(_config.ocsp_cert_cache, job->fingerprint, &revoked)) {
+		wget_thread_mutex_unlock(&_ocsp_mutex);
+		job->status = !revoked;
+		job->cached = 1;
+		return NULL;
+	}
+
+	if (!_ocsp_lookups)
+		_ocsp_lookups = wget_stringmap_create(16);
+
+	lookup = wget_calloc(1, sizeof(struct _ocsp_lookup));
+	strcpy(lookup->fingerprint, job->fingerprint);
+	lookup->refs = 1;
+	wget_stringmap_put_noalloc(_ocsp_lookups, lookup->fingerprint, lookup);
+
+	wget_thread_mutex_unlock(&_ocsp_mutex);
+
+	wget_thread_mutex_lock(&_stats_mutex);
+	_stats.ocsp_requests++;
+	wget_thread_mutex_unlock(&_stats_mutex);
+
+	job->status = cert_verify_ocsp(job->cert, job->issuer, &job->maxage);
+	debug_printf("check_ocsp_response() returned %d\n", job->status);
+
+	// cache the answer before the lookup disappears, so no one asks again
+	if (job->status == 1 || job->status == 0)
+		wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(job->fingerprint, job->maxage, job->status));
+
+	wget_thread_mutex_lock(&_ocsp_mutex);
+	lookup->status = job->status;
+	lookup->maxage = job->maxage;
+	lookup->done = 1;
+	wget_stringmap_remove_nofree(_ocsp_lookups, lookup->fingerprint);
+	if (--lookup->refs == 0)
+		xfree(lookup);
+	wget_thread_cond_signal(&_ocsp_cond);
+	wget_thread_mutex_unlock(&_ocsp_mutex);
+
+	return NULL;
+}
 #endif // HAVE_GNUTLS_OCSP_H
 
 /* This function will verify the peer's certificate, and check
@@ -688,11 +863,11 @@ static int cert_verify_ocsp(gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer)
  */
 static int _verify_certificate_callback(gnutls_session_t session)
 {
-	unsigned int status, deinit_cert = 0, deinit_issuer = 0;
+	unsigned int status, deinit_cert = 0;
 	const gnutls_datum_t *cert_list = 0;
 	unsigned int cert_list_size;
-	int ret = -1, err, ocsp_ok = 0;
-	gnutls_x509_crt_t cert = NULL, issuer = NULL;
+	int ret = -1, err;
+	gnutls_x509_crt_t cert = NULL;
 	const char *hostname;
 	const char *tag = _config.check_certificate ? _("ERROR") : _("WARNING");
 
@@ -729,7 +904,7 @@ static int _verify_certificate_callback(gnutls_session_t session)
 				if (gnutls_x509_crt_init(&cert) == GNUTLS_E_SUCCESS) {
 					if ((cert_list = gnutls_certificate_get_peers(session, &cert_list_size))) {
 						if (gnutls_x509_crt_import(cert, &cert_list[0], GNUTLS_X509_FMT_DER) == GNUTLS_E_SUCCESS) {
-							_add_cert_to_ocsp_cache(cert, 0);
+							_add_cert_to_ocsp_cache(cert, 0, _stapled_ocsp_expiry(session));
 						}
 					}
 					gnutls_x509_crt_deinit(cert);
@@ -806,6 +981,7 @@ static int _verify_certificate_callback(gnutls_session_t session)
 	// Now, we are going to check the revocation status via OCSP
 #ifdef HAVE_GNUTLS_OCSP_H
 	unsigned nvalid = 0, nrevoked = 0;
+	time_t host_maxage = time(NULL) + OCSP_CACHE_SECS; // the host is valid until the first of its certs expires
 
 	if (_config.ocsp_stapling) {
 		if (!ctx->valid && ctx->ocsp_stapling) {
@@ -813,7 +989,11 @@ static int _verify_certificate_callback(gnutls_session_t session)
 			if (gnutls_ocsp_status_request_is_checked(session, 0)) {
 				info_printf("Server certificate is valid regarding OCSP stapling\n");
 //				_get_cert_fingerprint(cert, fingerprint, sizeof(fingerprint)); // calc hexadecimal fingerprint string
-				_add_cert_to_ocsp_cache(cert, 1);
+				time_t maxage = _stapled_ocsp_expiry(session);
+
+				_add_cert_to_ocsp_cache(cert, 1, maxage);
+				if (maxage < host_maxage)
+					host_maxage = maxage;
 				nvalid = 1;
 			} else if (!_config.ocsp)
 				error_printf(_("WARNING: The certificate's (stapled) OCSP status has not been sent\n"));
@@ -823,21 +1003,25 @@ static int _verify_certificate_callback(gnutls_session_t session)
 	}
 
 	if (_config.ocsp) {
+		struct _ocsp_job *jobs = wget_calloc(cert_list_size, sizeof(struct _ocsp_job));
+		unsigned njobs = 0;
+		long long start = wget_get_timemillis();
+
+		// collect the certificates with unknown revocation status
 		for (unsigned it = nvalid; it < cert_list_size; it++) {
-			char fingerprint[64 * 2 +1];
+			struct _ocsp_job *job = &jobs[njobs];
 			int revoked;
 
-			if (deinit_cert)
-				gnutls_x509_crt_deinit(cert);
-			gnutls_x509_crt_init(&cert);
-			if ((err = gnutls_x509_crt_import(cert, &cert_list[it], GNUTLS_X509_FMT_DER)) != GNUTLS_E_SUCCESS) {
+			gnutls_x509_crt_init(&job->cert);
+			if ((err = gnutls_x509_crt_import(job->cert, &cert_list[it], GNUTLS_X509_FMT_DER)) != GNUTLS_E_SUCCESS) {
 				error_printf(_("%s: Failed to parse certificate[%d]: %s\n"), tag, it, gnutls_strerror (err));
+				gnutls_x509_crt_deinit(job->cert);
 				continue;
 			}
 
-			_get_cert_fingerprint(cert, fingerprint, sizeof(fingerprint)); // calc hexadecimal fingerprint string
+			_get_cert_fingerprint(job->cert, job->fingerprint, sizeof(job->fingerprint)); // calc hexadecimal fingerprint string
 
-			if (wget_ocsp_fingerprint_in_cache(_config.ocsp_cert_cache, fingerprint, &revoked)) {
+			if (wget_ocsp_fingerprint_in_cache(_config.ocsp_cert_cache, job->fingerprint, &revoked)) {
 				// found cert's fingerprint in cache
 				if (revoked) {
 					debug_printf("Certificate[%u] of '%s' has been revoked (cached)\n", it, hostname);
@@ -846,45 +1030,74 @@ static int _verify_certificate_callback(gnutls_session_t session)
 					debug_printf("Certificate[%u] of '%s' is valid (cached)\n", it, hostname);
 					nvalid++;
 				}
+				gnutls_x509_crt_deinit(job->cert);
 				continue;
 			}
 
-			if (deinit_issuer) {
-				gnutls_x509_crt_deinit(issuer);
-				deinit_issuer = 0;
-			}
-			if ((err = gnutls_certificate_get_issuer(_credentials, cert, &issuer, 0)) != GNUTLS_E_SUCCESS && it < cert_list_size - 1) {
-				gnutls_x509_crt_init(&issuer);
-				deinit_issuer = 1;
-				if ((err = gnutls_x509_crt_import(issuer, &cert_list[it + 1], GNUTLS_X509_FMT_DER))  != GNUTLS_E_SUCCESS) {
+			if ((err = gnutls_certificate_get_issuer(_credentials, job->cert, &job->issuer, 0)) != GNUTLS_E_SUCCESS && it < cert_list_size - 1) {
+				gnutls_x509_crt_init(&job->issuer);
+				if ((err = gnutls_x509_crt_import(job->issuer, &cert_list[it + 1], GNUTLS_X509_FMT_DER))  != GNUTLS_E_SUCCESS) {
 					debug_printf("Decoding error: %s\n", gnutls_strerror(err));
+					gnutls_x509_crt_deinit(job->issuer);
+					gnutls_x509_crt_deinit(job->cert);
 					continue;
 				}
+				job->deinit_issuer = 1;
 			} else if (err  != GNUTLS_E_SUCCESS) {
 				debug_printf("Cannot find issuer: %s\n", gnutls_strerror(err));
+				gnutls_x509_crt_deinit(job->cert);
 				continue;
 			}
 
-			ocsp_ok = cert_verify_ocsp(cert, issuer);
-			debug_printf("check_ocsp_response() returned %d\n", ocsp_ok);
+			job->index = it;
+			njobs++;
+		}
+
+		// ask the OCSP responders in parallel, the first job runs in this thread
+		for (unsigned it = 1; it < njobs; it++) {
+			if (wget_thread_support() && wget_thread_start(&jobs[it].tid, _ocsp_job_thread, &jobs[it], 0) == 0)
+				jobs[it].started = 1;
+		}
 
-			if (ocsp_ok == 1) {
-				debug_printf("Certificate[%u] of '%s' is valid (via OCSP)\n", it, hostname);
-				wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(fingerprint, time(NULL) + 3600, 1)); // 1h valid
+		for (unsigned it = 0; it < njobs; it++) {
+			if (jobs[it].started)
+				wget_thread_join(jobs[it].tid);
+			else
+				_ocsp_job_thread(&jobs[it]);
+		}
+
+		for (unsigned it = 0; it < njobs; it++) {
+			struct _ocsp_job *job = &jobs[it];
+			const char *via = job->cached ? "cached" : "via OCSP";
+
+			if (job->status == 1) {
+				debug_printf("Certificate[%u] of '%s' is valid (%s)\n", job->index, hostname, via);
 				nvalid++;
-			} else if (ocsp_ok == 0) {
-				debug_printf(_("%s: Certificate[%u] of '%s' has been revoked (via OCSP)\n"), tag, it, hostname);
-				wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(fingerprint, time(NULL) + 3600, 0));  // cert has been revoked
+			} else if (job->status == 0) {
+				debug_printf(_("%s: Certificate[%u] of '%s' has been revoked (%s)\n"), tag, job->index, hostname, via);
 				nrevoked++;
 			} else {
 				error_printf(_("WARNING: OCSP response ignored\n"));
 			}
+
+			if (job->status >= 0 && !job->cached && job->maxage < host_maxage)
+				host_maxage = job->maxage;
+
+			if (job->deinit_issuer)
+				gnutls_x509_crt_deinit(job->issuer);
+			gnutls_x509_crt_deinit(job->cert);
 		}
+
+		xfree(jobs);
+
+		wget_thread_mutex_lock(&_stats_mutex);
+		_stats.ocsp_time_ms += wget_get_timemillis() - start;
+		wget_thread_mutex_unlock(&_stats_mutex);
 	}
 
 	if (_config.ocsp_stapling || _config.ocsp) {
 		if (nvalid == cert_list_size) {
-			wget_ocsp_db_add_host(_config.ocsp_cert_cache, wget_ocsp_new(hostname, time(NULL) + 3600, 1)); // 1h valid
+			wget_ocsp_db_add_host(_config.ocsp_cert_cache, wget_ocsp_new(hostname, host_maxage, 1));
 		} else if (nrevoked) {
 			wget_ocsp_db_add_host(_config.ocsp_cert_cache, wget_ocsp_new(hostname, 0, 0)); // remove entry from cache
 			ret = -1;
@@ -897,8 +1110,6 @@ static int _verify_certificate_callback(gnutls_session_t session)
 out:
 	if (deinit_cert)
 		gnutls_x509_crt_deinit(cert);
-	if (deinit_issuer)
-		gnutls_x509_crt_deinit(issuer);
 
 	return _config.check_certificate ? ret : 0;
 }
@@ -1064,6 +1275,11 @@ void wget_ssl_deinit(void)
 	wget_thread_mutex_lock(&_mutex);
 
 	if (_init == 1) {
+#ifdef HAVE_GNUTLS_OCSP_H
+		wget_thread_mutex_lock(&_ocsp_mutex);
+		wget_stringmap_free(&_ocsp_lookups);
+		wget_thread_mutex_unlock(&_ocsp_mutex);
+#endif
 		gnutls_certificate_free_credentials(_credentials);
 		gnutls_priority_deinit(_priority_cache);
 		gnutls_global_deinit();
@@ -1076,11 +1292,13 @@ void wget_ssl_deinit(void)
 
 static int _do_handshake(gnutls_session_t session, int sockfd, int timeout)
 {
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
 	int ret;
 
 	// Wait for socket being ready before we call gnutls_handshake().
 	// I had problems on a KVM Win7 + CygWin (gnutls 3.2.4-1).
-	int rc = wget_ready_2_write(sockfd, timeout);
+	// With TCP Fast Open the socket is not connected yet, the ClientHello goes out with the SYN.
+	int rc = ctx && ctx->fastopen ? 1 : wget_ready_2_write(sockfd, timeout);
 
 	if (rc == 0)
 		ret = WGET_E_TIMEOUT;
@@ -1098,6 +1316,8 @@ static int _do_handshake(gnutls_session_t session, int sockfd, int timeout)
 
 				if (rc == GNUTLS_E_CERTIFICATE_ERROR)
 					ret = WGET_E_CERTIFICATE;
+				else if (ctx && ctx->fastopen_ai && (rc == GNUTLS_E_PULL_ERROR || rc == GNUTLS_E_PUSH_ERROR))
+					ret = WGET_E_CONNECT; // with TCP Fast Open the connect is part of the handshake
 				else
 					ret = WGET_E_HANDSHAKE;
 			}
@@ -1116,24 +1336,91 @@ static int _do_handshake(gnutls_session_t session, int sockfd, int timeout)
 	return ret;
 }
 
-int wget_ssl_open(wget_tcp_t *tcp)
+// put the resumption data of an established session into the session cache
+static void _session_store(gnutls_session_t session)
 {
-	gnutls_session_t session;
-	int ret = WGET_E_UNKNOWN;
-	int rc, sockfd, connect_timeout;
-	const char *hostname;
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+	gnutls_datum_t data;
+	int rc;
 
-	if (!tcp)
-		return WGET_E_INVALID;
+	// never reuse a session whose certificate chain has not been verified
+	if (!_config.tls_session_cache || !ctx->hostname || !_config.check_certificate)
+		return;
+
+	if ((rc = gnutls_session_get_data2(session, &data)) != GNUTLS_E_SUCCESS) {
+		debug_printf("GnuTLS: Failed to get session data: %s\n", gnutls_strerror(rc));
+		return;
+	}
+
+	wget_tls_session_db_add(_config.tls_session_cache,
+		wget_tls_session_new(ctx->hostname, ctx->port, time(NULL) + TLS_SESSION_MAXAGE, data.data, data.size));
+	gnutls_free(data.data);
+
+	wget_thread_mutex_lock(&_stats_mutex);
+	_stats.sessions_stored++;
+	wget_thread_mutex_unlock(&_stats_mutex);
+}
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+// TLS 1.3 servers send their tickets after the handshake, catch them as they come in
+static int _session_ticket_hook(gnutls_session_t session, unsigned int htype, unsigned when, unsigned int incoming, const gnutls_datum_t *msg)
+{
+	// TLS 1.2 tickets are part of the handshake and are stored by _session_finish()
+	if (htype == GNUTLS_HANDSHAKE_NEW_SESSION_TICKET && when == GNUTLS_HOOK_POST && incoming
+		&& gnutls_protocol_get_version(session) == GNUTLS_TLS1_3)
+		_session_store(session);
+
+	return 0;
+}
+#endif
+
+#ifdef MSG_FASTOPEN
+// GnuTLS push function that sends the ClientHello along with the SYN (TCP Fast Open, RFC 7413)
+static ssize_t _fastopen_push(gnutls_transport_ptr_t ptr, const void *buf, size_t count)
+{
+	struct _session_context *ctx = ptr;
+	ssize_t n;
+
+	if (!ctx->fastopen)
+		return send(ctx->sockfd, buf, count, 0);
+
+	ctx->fastopen = 0;
+
+	if ((n = sendto(ctx->sockfd, buf, count, MSG_FASTOPEN, ctx->fastopen_ai->ai_addr, ctx->fastopen_ai->ai_addrlen)) >= 0) {
+		wget_thread_mutex_lock(&_stats_mutex);
+		_stats.fastopen++;
+		wget_thread_mutex_unlock(&_stats_mutex);
+		return n;
+	}
+
+	if (errno == EOPNOTSUPP) {
+		// fallback from fastopen, e.g. when fastopen is disabled in system
+		if (connect(ctx->sockfd, ctx->fastopen_ai->ai_addr, ctx->fastopen_ai->ai_addrlen) < 0 && errno != EINPROGRESS)
+			return -1;
+		errno = EAGAIN;
+	} else if (errno == EINPROGRESS) {
+		// no TFO cookie for this server yet: the SYN went out without data
+		errno = EAGAIN;
+	}
+
+	return -1;
+}
+#endif
+
+// create a client session for tcp->sockfd, the handshake is not started yet
+static gnutls_session_t _session_init(wget_tcp_t *tcp)
+{
+	gnutls_session_t session;
+	const char *hostname = tcp->ssl_hostname;
+	int sockfd = tcp->sockfd;
+	int rc;
 
 	if (!_init)
 		wget_ssl_init();
 
-	hostname = tcp->ssl_hostname;
-	sockfd= tcp->sockfd;
-	connect_timeout = tcp->connect_timeout;
-
-#ifdef GNUTLS_NONBLOCK
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+	gnutls_init(&session, GNUTLS_CLIENT | GNUTLS_NONBLOCK | (_config.early_data ? GNUTLS_ENABLE_EARLY_DATA : 0));
+#elif defined GNUTLS_NONBLOCK
 	gnutls_init(&session, GNUTLS_CLIENT | GNUTLS_NONBLOCK);
 #else
 	// very old gnutls version, likely to not work.
@@ -1145,10 +1432,42 @@ int wget_ssl_open(wget_tcp_t *tcp)
 	if (hostname)
 		gnutls_server_name_set(session, GNUTLS_NAME_DNS, hostname, strlen(hostname));
 	gnutls_credentials_set(session, GNUTLS_CRD_CERTIFICATE, _credentials);
-	gnutls_transport_set_ptr(session, (gnutls_transport_ptr_t)(ptrdiff_t)sockfd);
 
 	struct _session_context *ctx = wget_calloc(1, sizeof(struct _session_context));
 	ctx->hostname = wget_strdup(hostname);
+	ctx->port = tcp->remote_port ? tcp->remote_port : 443;
+	ctx->sockfd = sockfd;
+
+#ifdef MSG_FASTOPEN
+	// wget_tcp_connect() left the connect to us, the ClientHello is our first data
+	if (tcp->tcp_fastopen && tcp->first_send && tcp->connect_addrinfo) {
+		ctx->fastopen = 1;
+		ctx->fastopen_ai = tcp->connect_addrinfo;
+		tcp->first_send = 0;
+		gnutls_transport_set_ptr2(session, (gnutls_transport_ptr_t)(ptrdiff_t)sockfd, ctx);
+		gnutls_transport_set_push_function(session, _fastopen_push);
+	} else
+#endif
+		gnutls_transport_set_ptr(session, (gnutls_transport_ptr_t)(ptrdiff_t)sockfd);
+
+	// RFC 5077 / RFC 8446 session resumption: skip key exchange and certificate verification
+	if (_config.tls_session_cache && hostname) {
+		void *data;
+		size_t size;
+
+		if (wget_tls_session_get(_config.tls_session_cache, hostname, ctx->port, &data, &size) == 0) {
+			if ((rc = gnutls_session_set_data(session, data, size)) == GNUTLS_E_SUCCESS) {
+				debug_printf("Trying to resume TLS session for %s:%d\n", hostname, ctx->port);
+				ctx->resuming = 1;
+			} else
+				debug_printf("GnuTLS: Failed to set session data: %s\n", gnutls_strerror(rc));
+			xfree(data);
+		}
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+		gnutls_handshake_set_hook_function(session, GNUTLS_HANDSHAKE_NEW_SESSION_TICKET, GNUTLS_HOOK_POST, _session_ticket_hook);
+#endif
+	}
 
 #ifdef HAVE_GNUTLS_OCSP_H
 	// If we know the cert chain for the hostname being valid at the moment,
@@ -1202,9 +1521,56 @@ int wget_ssl_open(wget_tcp_t *tcp)
 	}
 #endif
 
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+	// 0-RTT needs a session to resume, and with ALPN we had to know the protocol before the handshake
+	if (_config.early_data && ctx->resuming && !_config.alpn && !tcp->nonblocking)
+		ctx->deferred = 1;
+#endif
+
 	gnutls_session_set_ptr(session, ctx);
 
-	ret = _do_handshake(session, sockfd, connect_timeout);
+	return session;
+}
+
+// bookkeeping after a client handshake, 'ret' is the handshake result
+static void _session_handshake_done(gnutls_session_t session, int ret)
+{
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+
+	if (_config.print_info)
+		_print_info(session);
+
+	if (ret == WGET_E_SUCCESS) {
+		int resumed = gnutls_session_is_resumed(session);
+
+		debug_printf("Handshake completed%s\n", resumed ? " (session resumed)" : "");
+
+		wget_thread_mutex_lock(&_stats_mutex);
+		if (resumed)
+			_stats.resumed_handshakes++;
+		else
+			_stats.full_handshakes++;
+		wget_thread_mutex_unlock(&_stats_mutex);
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+		// with TLS 1.3 the ticket arrives later, see _session_ticket_hook()
+		if (gnutls_protocol_get_version(session) != GNUTLS_TLS1_3)
+#endif
+			_session_store(session);
+	} else {
+		if (ret == WGET_E_TIMEOUT)
+			debug_printf("Handshake timed out\n");
+
+		// don't try the same session data again
+		if (ctx->resuming && _config.tls_session_cache)
+			wget_tls_session_db_add(_config.tls_session_cache, wget_tls_session_new(ctx->hostname, ctx->port, 0, NULL, 0));
+	}
+}
+
+// evaluate the handshake result 'ret', on success the session is attached to tcp, else it is freed
+static int _session_finish(wget_tcp_t *tcp, gnutls_session_t session, int ret)
+{
+	int rc;
 
 #if GNUTLS_VERSION_NUMBER >= 0x030200
 	if (_config.alpn) {
@@ -1219,15 +1585,13 @@ int wget_ssl_open(wget_tcp_t *tcp)
 	}
 #endif
 
-	if (_config.print_info)
-		_print_info(session);
+	_session_handshake_done(session, ret);
 
 	if (ret == WGET_E_SUCCESS) {
-		debug_printf("Handshake completed\n");
 		tcp->ssl_session = session;
 	} else {
-		if (ret == WGET_E_TIMEOUT)
-			debug_printf("Handshake timed out\n");
+		struct _session_context *ctx = gnutls_session_get_ptr(session);
+
 		xfree(ctx->hostname);
 		xfree(ctx);
 		gnutls_deinit(session);
@@ -1236,16 +1600,131 @@ int wget_ssl_open(wget_tcp_t *tcp)
 	return ret;
 }
 
+int wget_ssl_open(wget_tcp_t *tcp)
+{
+	gnutls_session_t session;
+
+	if (!tcp)
+		return WGET_E_INVALID;
+
+	session = _session_init(tcp);
+
+	if (((struct _session_context *) gnutls_session_get_ptr(session))->deferred) {
+		// the handshake is done with the first read or write, see wget_ssl_write_early_data()
+		debug_printf("Handshake deferred for 0-RTT early data\n");
+		tcp->ssl_session = session;
+		return WGET_E_SUCCESS;
+	}
+
+	return _session_finish(tcp, session, _do_handshake(session, tcp->sockfd, tcp->connect_timeout));
+}
+
+// Complete a handshake that wget_ssl_open() deferred, offering 'buf' (if not NULL) as 0-RTT early data.
+// Returns the number of bytes the server accepted as early data (0 if none) or WGET_E_* on error.
+static ssize_t _deferred_handshake(gnutls_session_t session, const char *buf, size_t count, int timeout)
+{
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+	ssize_t early = 0;
+	int ret;
+
+	ctx->deferred = 0;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+	if (buf && count) {
+		// the data is queued completely or not at all (some versions return 0 on success)
+		if ((early = gnutls_record_send_early_data(session, buf, count)) >= 0)
+			early = count;
+		else {
+			debug_printf("GnuTLS: Early data not sent: %s\n", gnutls_strerror((int) early));
+			early = 0;
+		}
+	}
+#endif
+
+	ret = _do_handshake(session, ctx->sockfd, timeout);
+	_session_handshake_done(session, ret);
+
+	if (ret != WGET_E_SUCCESS)
+		return ret;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+	if (early > 0) {
+		int accepted = (gnutls_session_get_flags(session) & GNUTLS_SFLAGS_EARLY_DATA) != 0;
+
+		debug_printf("Server %s %zd bytes of early data\n", accepted ? "accepted" : "rejected", early);
+
+		wget_thread_mutex_lock(&_stats_mutex);
+		if (accepted)
+			_stats.early_data_accepted++;
+		else
+			_stats.early_data_rejected++;
+		wget_thread_mutex_unlock(&_stats_mutex);
+
+		if (!accepted)
+			early = 0; // has to be sent again
+	}
+#endif
+
+	return early;
+}
+
+// Non-blocking variant of wget_ssl_open(), to be called whenever the socket is ready.
+// Returns WGET_E_SUCCESS when the handshake is done, WGET_IO_READABLE or WGET_IO_WRITABLE
+// if it has to be called again when the socket becomes ready, else a WGET_E_* error.
+int wget_ssl_handshake(wget_tcp_t *tcp)
+{
+	gnutls_session_t session;
+	int rc, ret;
+
+	if (!tcp)
+		return WGET_E_INVALID;
+
+	if (!tcp->handshake_pending) {
+		if (tcp->ssl_session)
+			return WGET_E_SUCCESS; // already done
+
+		tcp->ssl_session = _session_init(tcp);
+		tcp->handshake_pending = 1;
+	}
+
+	session = tcp->ssl_session;
+
+	if ((rc = gnutls_handshake(session)) != 0 && !gnutls_error_is_fatal(rc))
+		return gnutls_record_get_direction(session) ? WGET_IO_WRITABLE : WGET_IO_READABLE;
+
+	if (rc == 0) {
+		ret = WGET_E_SUCCESS;
+	} else {
+		error_printf("GnuTLS: (%d) %s\n", rc, gnutls_strerror(rc));
+		ret = rc == GNUTLS_E_CERTIFICATE_ERROR ? WGET_E_CERTIFICATE : WGET_E_HANDSHAKE;
+	}
+
+	tcp->ssl_session = NULL;
+	tcp->handshake_pending = 0;
+
+	return _session_finish(tcp, session, ret);
+}
+
+void wget_ssl_get_stats(wget_ssl_stats_t *stats)
+{
+	wget_thread_mutex_lock(&_stats_mutex);
+	*stats = _stats;
+	wget_thread_mutex_unlock(&_stats_mutex);
+}
+
 void wget_ssl_close(void **session)
 {
 	if (session && *session) {
 		gnutls_session_t s = *session;
 		struct _session_context *ctx = gnutls_session_get_ptr(s);
 
+		// nothing to say goodbye to if the handshake never took place
+		if (!ctx->deferred)
+			gnutls_bye(s, GNUTLS_SHUT_RDWR);
+
 		xfree(ctx->hostname);
 		xfree(ctx);
 
-		gnutls_bye(s, GNUTLS_SHUT_RDWR);
 		gnutls_deinit(s);
 		*session = NULL;
 	}
@@ -1253,6 +1732,8 @@ void wget_ssl_close(void **session)
 
 static gnutls_certificate_credentials_t
 	_server_credentials;
+static gnutls_datum_t
+	_server_ticket_key; // session ticket encryption key (RFC 5077)
 static gnutls_priority_t
 	_server_priority_cache;
 
@@ -1267,6 +1748,10 @@ void wget_ssl_server_init(void)
 		gnutls_global_init();
 
 		gnutls_certificate_allocate_credentials(&_server_credentials);
+
+		if ((ret = gnutls_session_ticket_key_generate(&_server_ticket_key)) < 0)
+			error_printf("GnuTLS: Failed to generate session ticket key: %s\n", gnutls_strerror(ret));
+
 		_set_credentials(&_server_credentials);
 
 		/* Generate Diffie-Hellman parameters - for use with DHE
@@ -1296,6 +1781,8 @@ void wget_ssl_server_deinit(void)
 
 	if (_server_init == 1) {
 		gnutls_certificate_free_credentials(_server_credentials);
+		gnutls_free(_server_ticket_key.data);
+		_server_ticket_key.data = NULL;
 		gnutls_priority_deinit(_server_priority_cache);
 		gnutls_global_deinit();
 	}
@@ -1337,6 +1824,10 @@ int wget_ssl_server_open(wget_tcp_t *tcp)
 	 */
 	gnutls_certificate_server_set_request(session, GNUTLS_CERT_IGNORE);
 
+	// allow clients to resume sessions
+	if (_server_ticket_key.data)
+		gnutls_session_ticket_enable_server(session, &_server_ticket_key);
+
 	// gnutls_transport_set_int(session, sockfd);
 	gnutls_transport_set_ptr(session, (gnutls_transport_ptr_t)(ptrdiff_t)sockfd);
 
@@ -1368,8 +1859,22 @@ void wget_ssl_server_close(void **session)
 	}
 }
 
+// complete a deferred handshake before any other read or write
+static int _deferred_handshake_check(gnutls_session_t session, int timeout)
+{
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+
+	if (ctx && ctx->deferred && _deferred_handshake(session, NULL, 0, timeout) < 0)
+		return -1;
+
+	return 0;
+}
+
 ssize_t wget_ssl_read_timeout(void *session, char *buf, size_t count, int timeout)
 {
+	if (_deferred_handshake_check(session, timeout))
+		return -1;
+
 // #if GNUTLS_VERSION_NUMBER >= 0x030107
 #if 0
 	// GnuTLS <= 3.4.5 becomes slow with large timeouts (see loop in gnutls_system_recv_timeout()).
@@ -1423,6 +1928,9 @@ ssize_t wget_ssl_write_timeout(void *session, const char *buf, size_t count, int
 	ssize_t nbytes;
 	int rc;
 
+	if (_deferred_handshake_check(session, timeout))
+		return -1;
+
 	for (;;) {
 		if ((rc = wget_ready_2_write((int)(ptrdiff_t)gnutls_transport_get_ptr(session), timeout)) <= 0)
 			return rc;
@@ -1444,9 +1952,65 @@ ssize_t wget_ssl_write_timeout(void *session, const char *buf, size_t count, int
 	return -1; // never comes here
 }
 
+// Like wget_ssl_write_timeout(), but if wget_ssl_open() deferred the handshake (see WGET_SSL_EARLY_DATA),
+// 'buf' is sent as TLS 1.3 0-RTT early data together with the ClientHello.
+// Early data can be replayed by an attacker, so only use this for idempotent requests.
+ssize_t wget_ssl_write_early_data(void *session, const char *buf, size_t count, int timeout)
+{
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+	ssize_t early, nbytes;
+
+	if (!ctx || !ctx->deferred)
+		return wget_ssl_write_timeout(session, buf, count, timeout);
+
+	if ((early = _deferred_handshake(session, buf, count, timeout)) < 0)
+		return -1;
+
+	if ((size_t) early >= count)
+		return early;
+
+	// rejected by the server (or not all of it fit into the early data limit)
+	if ((nbytes = wget_ssl_write_timeout(session, buf + early, count - early, timeout)) <= 0)
+		return nbytes;
+
+	return early + nbytes;
+}
+
+// read/write without waiting, WGET_E_AGAIN means 'try again when the socket is ready'
+ssize_t wget_ssl_read_nonblock(void *session, char *buf, size_t count)
+{
+	ssize_t nbytes = gnutls_record_recv(session, buf, count);
+
+	if (nbytes >= 0)
+		return nbytes;
+
+	if (nbytes == GNUTLS_E_AGAIN || nbytes == GNUTLS_E_INTERRUPTED)
+		return WGET_E_AGAIN;
+
+	debug_printf("GnuTLS: (%zd) %s\n", nbytes, gnutls_strerror((int) nbytes));
+
+	return -1;
+}
+
+ssize_t wget_ssl_write_nonblock(void *session, const char *buf, size_t count)
+{
+	ssize_t nbytes = gnutls_record_send(session, buf, count);
+
+	if (nbytes >= 0)
+		return nbytes;
+
+	if (nbytes == GNUTLS_E_AGAIN || nbytes == GNUTLS_E_INTERRUPTED)
+		return WGET_E_AGAIN;
+
+	debug_printf("GnuTLS: (%zd) %s\n", nbytes, gnutls_strerror((int) nbytes));
+
+	return -1;
+}
+
 #else // WITH_GNUTLS
 
 #include <stddef.h>
+#include <string.h>
 
 #include <libwget.h>
 #include "private.h"
@@ -1456,9 +2020,14 @@ void wget_ssl_set_config_int(int key, int value) { }
 void wget_ssl_init(void) { }
 void wget_ssl_deinit(void) { }
 int wget_ssl_open(wget_tcp_t *tcp) { return WGET_E_TLS_DISABLED; }
+int wget_ssl_handshake(wget_tcp_t *tcp) { return WGET_E_TLS_DISABLED; }
 void wget_ssl_close(void **session) { }
+void wget_ssl_get_stats(wget_ssl_stats_t *stats) { memset(stats, 0, sizeof(*stats)); }
 ssize_t wget_ssl_read_timeout(void *session, char *buf, size_t count, int timeout) { return 0; }
 ssize_t wget_ssl_write_timeout(void *session, const char *buf, size_t count, int timeout) { return 0; }
+ssize_t wget_ssl_write_early_data(void *session, const char *buf, size_t count, int timeout) { return 0; }
+ssize_t wget_ssl_read_nonblock(void *session, char *buf, size_t count) { return -1; }
+ssize_t wget_ssl_write_nonblock(void *session, const char *buf, size_t count) { return -1; }
 void wget_ssl_server_init(void) { }
 void wget_ssl_server_deinit(void) { }
 int wget_ssl_server_open(wget_tcp_t *tcp) { return WGET_E_TLS_DISABLED; }
@@ -105,7 +105,7 @@ int wget_stringmap_remove(wget_stringmap_t *h, const char *key)
 
 int wget_stringmap_remove_nofree(wget_stringmap_t *h, const char *key)
 {
-	return wget_hashmap_remove(h, key);
+	return wget_hashmap_remove_nofree(h, key);
 }
 
 void wget_stringmap_free(wget_stringmap_t **h)
@@ -30,6 +30,7 @@
 #endif
 
 #include <signal.h>
+#include <time.h>
 
 #include <libwget.h>
 #include "private.h"
@@ -98,6 +99,21 @@ int wget_thread_cond_wait(wget_thread_cond_t *cond, wget_thread_mutex_t *mutex)
 	return pthread_cond_wait(cond, mutex);
 }
 
+// wait at most 'ms' milliseconds, returns ETIMEDOUT if the condition has not been signalled
+int wget_thread_cond_timedwait(wget_thread_cond_t *cond, wget_thread_mutex_t *mutex, int ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	if ((ts.tv_nsec += (ms % 1000) * 1000000L) >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	return pthread_cond_timedwait(cond, mutex, &ts);
+}
+
 bool wget_thread_support(void)
 {
 	return true;
@@ -124,5 +140,6 @@ wget_thread_t wget_thread_self(void) { return 0; }
 int wget_thread_cond_init(wget_thread_cond_t *cond) { return 0; }
 int wget_thread_cond_signal(wget_thread_cond_t *cond) { return 0; }
 int wget_thread_cond_wait(wget_thread_cond_t *cond, wget_thread_mutex_t *mutex) { return 0; }
+int wget_thread_cond_timedwait(wget_thread_cond_t *cond, wget_thread_mutex_t *mutex, int ms) { wget_millisleep(ms); return 0; }
 
 #endif // USE_POSIX_THREADS || USE_PTH_THREADS
@@ -276,6 +276,21 @@ void wget_millisleep(int ms)
 	nanosleep(&(struct timespec){ .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 }, NULL);
 }
 
+/**
+ * \return Milliseconds of a monotonic clock
+ *
+ * The returned value has no relation to the wall clock time, use it to measure intervals
+ * and to calculate timeouts.
+ */
+long long wget_get_timemillis(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 static _GL_INLINE unsigned char G_GNUC_WGET_CONST _unhex(unsigned char c)
 {
 	return c <= '9' ? c - '0' : (c <= 'F' ? c - 'A' + 10 : c - 'a' + 10);
@@ -37,33 +37,29 @@
 #include "log.h"
 #include "blacklist.h"
 
-static wget_hashmap_t
+// IRIs are kept by their fingerprint, the IRI itself is only compared on equal fingerprints.
+// The IRIs are referenced by jobs, so the blacklist owns them until blacklist_free().
+static wget_fpset_t
 	*blacklist;
 
 static wget_thread_mutex_t
 	mutex = WGET_THREAD_MUTEX_INITIALIZER;
 
-// Paul Larson's hash function from Microsoft Research
-// ~ O(1) insertion, search and removal
-static unsigned int G_GNUC_WGET_NONNULL_ALL hash_iri(const wget_iri_t *iri)
+// the parts compared by wget_iri_compare(), terminating 0 included to separate them
+static unsigned long long G_GNUC_WGET_NONNULL_ALL hash_iri(const wget_iri_t *iri)
 {
-	unsigned int h = 0; // use 0 as SALT if hash table attacks doesn't matter
-	const unsigned char *p;
-
-	for (p = (unsigned char *)iri->scheme; p && *p; p++)
-		h = h * 101 + *p;
-
-	for (p = (unsigned char *)iri->port; p && *p; p++)
-		h = h * 101 + *p;
-
-	for (p = (unsigned char *)iri->host; p && *p; p++)
-		h = h * 101 + *p;
-
-	for (p = (unsigned char *)iri->path; p && *p; p++)
-		h = h * 101 + *p;
-
-	for (p = (unsigned char *)iri->query; p && *p; p++)
-		h = h * 101 + *p;
+	unsigned long long h = 0;
+
+	if (iri->scheme)
+		h = wget_fpset_hash(h, iri->scheme, strlen(iri->scheme) + 1);
+	if (iri->port)
+		h = wget_fpset_hash(h, iri->port, strlen(iri->port) + 1);
+	if (iri->host)
+		h = wget_fpset_hash(h, iri->host, strlen(iri->host) + 1);
+	if (iri->path)
+		h = wget_fpset_hash(h, iri->path, strlen(iri->path) + 1);
+	if (iri->query)
+		h = wget_fpset_hash(h, iri->query, strlen(iri->query) + 1);
 
 	return h;
 }
@@ -77,13 +73,13 @@ static int G_GNUC_WGET_NONNULL_ALL _blacklist_print(G_GNUC_WGET_UNUSED void *ctx
 void blacklist_print(void)
 {
 	wget_thread_mutex_lock(&mutex);
-	wget_hashmap_browse(blacklist, (int(*)(void *, const void *, void *))_blacklist_print, NULL);
+	wget_fpset_browse(blacklist, (int(*)(void *, const void *))_blacklist_print, NULL);
 	wget_thread_mutex_unlock(&mutex);
 }
 
 int blacklist_size(void)
 {
-	return wget_hashmap_size(blacklist);
+	return wget_fpset_size(blacklist);
 }
 
 static void _free_entry(wget_iri_t *iri)
@@ -100,13 +96,12 @@ wget_iri_t *blacklist_add(wget_iri_t *iri)
 		wget_thread_mutex_lock(&mutex);
 
 		if (!blacklist) {
-			blacklist = wget_hashmap_create(128, -2, (unsigned int(*)(const void *))hash_iri, (int(*)(const void *, const void *))wget_iri_compare);
-			wget_hashmap_set_key_destructor(blacklist, (void(*)(void *))_free_entry);
+			blacklist = wget_fpset_create(128, (unsigned long long(*)(const void *))hash_iri, (int(*)(const void *, const void *))wget_iri_compare);
+			wget_fpset_set_key_destructor(blacklist, (void(*)(void *))_free_entry);
 		}
 
-		if (!wget_hashmap_contains(blacklist, iri)) {
+		if (!wget_fpset_add(blacklist, iri)) {
 			// info_printf("Add to blacklist: %s\n",iri->uri);
-			wget_hashmap_put_noalloc(blacklist, iri, NULL); // use hashmap as a hashset (without value)
 			wget_thread_mutex_unlock(&mutex);
 			return iri;
 		}
@@ -119,9 +114,29 @@ wget_iri_t *blacklist_add(wget_iri_t *iri)
 	return NULL;
 }
 
+// returns the blacklisted IRI that equals 'iri', 'iri' is added if there is none yet
+// 'iri' is freed if it is not returned
+wget_iri_t *blacklist_get(wget_iri_t *iri)
+{
+	wget_iri_t *entry = NULL;
+
+	if (!iri)
+		return NULL;
+
+	wget_thread_mutex_lock(&mutex);
+	if (blacklist && !(entry = wget_fpset_get(blacklist, iri)) && !wget_fpset_add(blacklist, iri))
+		entry = iri;
+	wget_thread_mutex_unlock(&mutex);
+
+	if (entry != iri)
+		wget_iri_free(&iri);
+
+	return entry;
+}
+
 void blacklist_free(void)
 {
 	wget_thread_mutex_lock(&mutex);
-	wget_hashmap_free(&blacklist);
+	wget_fpset_free(&blacklist);
 	wget_thread_mutex_unlock(&mutex);
 }
@@ -33,6 +33,7 @@
 int in_blacklist(wget_iri_t *iri) G_GNUC_WGET_NONNULL_ALL;
 int blacklist_size(void) G_GNUC_WGET_PURE;
 wget_iri_t *blacklist_add(wget_iri_t *iri);
+wget_iri_t *blacklist_get(wget_iri_t *iri);
 void blacklist_print(void);
 void blacklist_free(void);
 
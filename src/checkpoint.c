@@ -0,0 +1,577 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Crawl checkpoints (--resume-state)
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include <libwget.h>
+
+#include "wget.h"
+#include "log.h"
+#include "blacklist.h"
+#include "host.h"
+#include "checkpoint.h"
+
+// The crawl state is kept in a snapshot file FILE and in a journal FILE.journal.
+// Both hold records of the same format:
+//   'Q' a job has been queued: URL, referer, local filename, level, redirection level and flags
+//   'D' a job is done, the URL will not be downloaded again
+//   'R' robots.txt of a host has been processed: robots.txt URL and the rules in robots.txt format
+// Records are appended to the journal as they happen. A snapshot starts with the fingerprint table
+// of known_urls, followed by the records of the previous snapshot and journal, without the 'Q'
+// records of jobs that are done.
+//
+// To write a snapshot, the journal is renamed to FILE.journal.old and a new journal is started.
+// The old snapshot and FILE.journal.old are folded into FILE.tmp, which then replaces FILE.
+// On resume the files are mapped into memory and the records are applied in the order
+// snapshot, FILE.journal.old (left over by a crash), journal. Applying a record twice does no harm.
+// 'R' and 'D' records are applied first, so that queued jobs that are done are skipped by the blacklist.
+
+#define CHECKPOINT_VERSION 1
+
+#define CHECKPOINT_SITEMAP 1
+#define CHECKPOINT_HEAD_FIRST 2
+
+typedef struct {
+	char
+		magic[8]; // "WGET2CKP" for a snapshot, "WGET2JNL" for a journal
+	unsigned int
+		version, // CHECKPOINT_VERSION
+		nfingerprints; // slots of the known_urls table that follows the header (snapshot only)
+} HEADER;
+
+typedef struct {
+	unsigned int
+		size, // size of the record including the strings
+		url_len,
+		referer_len,
+		filename_len,
+		data_len; // robots.txt rules of an 'R' record
+	int
+		level,
+		redirection_level;
+	char
+		type; // 'Q', 'D' or 'R'
+	unsigned char
+		flags;
+} RECORD; // followed by URL, referer, local filename and data, all not 0-terminated
+
+typedef struct {
+	char
+		*data;
+	const char
+		*records, // first record
+		*end; // end of the last complete record
+	const unsigned long long
+		*fingerprints;
+	size_t
+		size;
+	int
+		nfingerprints;
+} STATE_FILE;
+
+static wget_thread_mutex_t
+	mutex = WGET_THREAD_MUTEX_INITIALIZER; // protects the journal
+static wget_vector_t
+	*robots_iris; // IRIs referenced by restored hosts
+static char
+	*fname_snapshot,
+	*fname_journal,
+	*fname_old,
+	*fname_tmp;
+static int
+	journal_fd = -1;
+
+static int _write_all(int fd, const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		data += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void _add_record(wget_buffer_t *buf, char type, const JOB *job, const char *data, size_t data_len)
+{
+	RECORD record;
+	const char *referer = NULL, *filename = NULL;
+
+	memset(&record, 0, sizeof(record));
+	record.type = type;
+	record.url_len = (unsigned int) strlen(job->iri->uri);
+
+	if (type == 'Q') {
+		if ((referer = job->referer ? job->referer->uri : NULL))
+			record.referer_len = (unsigned int) strlen(referer);
+		if ((filename = job->local_filename))
+			record.filename_len = (unsigned int) strlen(filename);
+		record.level = job->level;
+		record.redirection_level = job->redirection_level;
+		record.flags = (job->sitemap ? CHECKPOINT_SITEMAP : 0) | (job->head_first ? CHECKPOINT_HEAD_FIRST : 0);
+	}
+
+	record.data_len = (unsigned int) data_len;
+	record.size = (unsigned int) sizeof(record) + record.url_len + record.referer_len + record.filename_len + record.data_len;
+
+	wget_buffer_memcat(buf, &record, sizeof(record));
+	wget_buffer_memcat(buf, job->iri->uri, record.url_len);
+	if (referer)
+		wget_buffer_memcat(buf, referer, record.referer_len);
+	if (filename)
+		wget_buffer_memcat(buf, filename, record.filename_len);
+	if (data_len)
+		wget_buffer_memcat(buf, data, data_len);
+}
+
+static void _journal_append(const wget_buffer_t *buf)
+{
+	wget_thread_mutex_lock(&mutex);
+	if (journal_fd != -1 && _write_all(journal_fd, buf->data, buf->length)) {
+		error_printf(_("Failed to write to %s (%d), checkpoints disabled\n"), fname_journal, errno);
+		close(journal_fd);
+		journal_fd = -1;
+	}
+	wget_thread_mutex_unlock(&mutex);
+}
+
+// remember a newly queued job (or an IRI deferred until robots.txt has been processed)
+void checkpoint_add_job(const JOB *job)
+{
+	wget_buffer_t buf;
+	char sbuf[1024];
+
+	if (journal_fd == -1)
+		return;
+
+	wget_buffer_init(&buf, sbuf, sizeof(sbuf));
+	_add_record(&buf, 'Q', job, NULL, 0);
+	_journal_append(&buf);
+	wget_buffer_deinit(&buf);
+}
+
+// remember a finished job, for a robots.txt job the rules of the host are saved
+void checkpoint_job_done(const JOB *job)
+{
+	wget_buffer_t buf, rules;
+	char sbuf[1024];
+
+	if (journal_fd == -1 || !job->iri)
+		return;
+
+	wget_buffer_init(&buf, sbuf, sizeof(sbuf));
+
+	if (job->deferred) {
+		const ROBOTS *robots = job->host->robots;
+
+		// the rules are saved in robots.txt format, so wget_robots_parse() restores them
+		wget_buffer_init(&rules, NULL, 256);
+		if (robots) {
+			wget_buffer_strcpy(&rules, "User-agent: *\n");
+			for (int it = 0; it < wget_vector_size(robots->paths); it++) {
+				ROBOTS_PATH *path = wget_vector_get(robots->paths, it);
+				wget_buffer_printf_append(&rules, "Disallow: %.*s\n", (int) path->len, path->path);
+			}
+			if (robots->crawl_delay)
+				wget_buffer_printf_append(&rules, "Crawl-delay: %d.%03d\n", robots->crawl_delay / 1000, robots->crawl_delay % 1000);
+		}
+
+		_add_record(&buf, 'R', job, rules.data, rules.length);
+		wget_buffer_deinit(&rules);
+	} else
+		_add_record(&buf, 'D', job, NULL, 0);
+
+	_journal_append(&buf);
+	wget_buffer_deinit(&buf);
+}
+
+// returns the size of the record at 'p' or 0 if there is no complete record
+static size_t _get_record(const char *p, const char *end, RECORD *record)
+{
+	size_t left = end - p;
+
+	if (left < sizeof(RECORD))
+		return 0;
+
+	memcpy(record, p, sizeof(RECORD));
+
+	if (record->size > left
+		|| record->url_len > left || record->referer_len > left || record->filename_len > left || record->data_len > left
+		|| record->size != sizeof(RECORD) + (size_t) record->url_len + record->referer_len + record->filename_len + record->data_len)
+		return 0;
+
+	return record->size;
+}
+
+static void _close_state(STATE_FILE *state)
+{
+	if (state->data) {
+#ifdef HAVE_MMAP
+		munmap(state->data, state->size);
+#else
+		xfree(state->data);
+#endif
+		state->data = NULL;
+	}
+}
+
+// map a snapshot or journal into memory
+// returns 0 on success, 1 if the file does not exist, -1 if it is not a valid state file
+static int _open_state(STATE_FILE *state, const char *fname, const char *magic)
+{
+	HEADER header;
+	struct stat st;
+	size_t offset;
+	int fd;
+
+	memset(state, 0, sizeof(*state));
+
+	if ((fd = open(fname, O_RDONLY)) == -1)
+		return errno == ENOENT ? 1 : -1;
+
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(HEADER)) {
+		close(fd);
+		return -1;
+	}
+
+	state->size = st.st_size;
+#ifdef HAVE_MMAP
+	if ((state->data = mmap(NULL, state->size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		state->data = NULL;
+#else
+	state->data = xmalloc(state->size);
+	if (read(fd, state->data, state->size) != (ssize_t) state->size)
+		xfree(state->data);
+#endif
+	close(fd);
+
+	if (!state->data)
+		return -1;
+
+	memcpy(&header, state->data, sizeof(header));
+	offset = sizeof(header) + header.nfingerprints * sizeof(unsigned long long);
+
+	if (memcmp(header.magic, magic, sizeof(header.magic)) || header.version != CHECKPOINT_VERSION || offset > state->size) {
+		_close_state(state);
+		return -1;
+	}
+
+	state->fingerprints = (const unsigned long long *) (state->data + sizeof(header));
+	state->nfingerprints = header.nfingerprints;
+	state->records = state->data + offset;
+
+	// a journal may end with an incomplete record if we have been killed while writing it
+	RECORD record;
+	size_t size;
+
+	for (state->end = state->records; (size = _get_record(state->end, state->data + state->size, &record)); state->end += size);
+
+	return 0;
+}
+
+static void _restore_record(const RECORD *record, const char *p, int pass, void (*restore_job)(JOB *job))
+{
+	const char *url = p, *referer = url + record->url_len, *filename = referer + record->referer_len, *data = filename + record->filename_len;
+	char *s = wget_strmemdup(url, record->url_len);
+	wget_iri_t *iri;
+
+	if (pass == 0 && record->type == 'R') {
+		HOST *host;
+
+		if ((iri = wget_iri_parse(s, NULL)) && (host = hosts_add(iri))) {
+			// the host references the IRI
+			if (record->data_len) {
+				char *rules = wget_strmemdup(data, record->data_len);
+				host->robots = wget_robots_parse(rules);
+				xfree(rules);
+			}
+
+			if (!robots_iris)
+				robots_iris = wget_vector_create(32, -2, NULL);
+			wget_vector_add_noalloc(robots_iris, iri);
+		} else
+			wget_iri_free(&iri);
+	}
+	else if (pass == 0 && record->type == 'D') {
+		blacklist_add(wget_iri_parse(s, NULL));
+	}
+	else if (pass == 1 && record->type == 'Q') {
+		// jobs that are done or already queued are not in the blacklist
+		if ((iri = blacklist_add(wget_iri_parse(s, NULL)))) {
+			JOB job;
+
+			job_init(&job, iri);
+
+			if (record->referer_len) {
+				char *referer_url = wget_strmemdup(referer, record->referer_len);
+				job.referer = blacklist_get(wget_iri_parse(referer_url, NULL));
+				xfree(referer_url);
+			}
+
+			if (record->filename_len)
+				job.local_filename = wget_strmemdup(filename, record->filename_len);
+
+			job.level = record->level;
+			job.redirection_level = record->redirection_level;
+			job.sitemap = !!(record->flags & CHECKPOINT_SITEMAP);
+			job.head_first = !!(record->flags & CHECKPOINT_HEAD_FIRST);
+
+			restore_job(&job);
+		}
+	}
+
+	xfree(s);
+}
+
+static void _restore_state(const STATE_FILE *state, int pass, void (*restore_job)(JOB *job))
+{
+	RECORD record;
+	size_t size;
+
+	for (const char *p = state->records; p < state->end; p += size) {
+		size = _get_record(p, state->end, &record);
+		_restore_record(&record, p + sizeof(RECORD), pass, restore_job);
+	}
+}
+
+static int _open_journal(void)
+{
+	HEADER header = { .magic = "WGET2JNL", .version = CHECKPOINT_VERSION };
+	struct stat st;
+	int fd;
+
+	if ((fd = open(fname_journal, O_WRONLY | O_CREAT | O_APPEND, 0600)) == -1) {
+		error_printf(_("Failed to open %s (%d)\n"), fname_journal, errno);
+		return -1;
+	}
+
+	if (fstat(fd, &st) == 0 && st.st_size == 0 && _write_all(fd, (const char *) &header, sizeof(header))) {
+		error_printf(_("Failed to write to %s (%d)\n"), fname_journal, errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Restore the state saved in 'fname' (if it exists) and start journaling.
+// Restored jobs are handed to restore_job(), the fingerprints of known URLs are added to 'known_urls'.
+// Returns the number of restored jobs or -1 on error.
+int checkpoint_open(const char *fname, wget_fpset_t *known_urls, void (*restore_job)(JOB *job))
+{
+	STATE_FILE state[3];
+	const char *fnames[3];
+	long long start = wget_get_timemillis();
+	int rc = 0, qsize = queue_size();
+
+	fname_snapshot = wget_strdup(fname);
+	fname_journal = wget_str_asprintf("%s.journal", fname);
+	fname_old = wget_str_asprintf("%s.journal.old", fname);
+	fname_tmp = wget_str_asprintf("%s.tmp", fname);
+
+	fnames[0] = fname_snapshot;
+	fnames[1] = fname_old;
+	fnames[2] = fname_journal;
+
+	for (int it = 0; it < 3; it++) {
+		if ((rc = _open_state(&state[it], fnames[it], it ? "WGET2JNL" : "WGET2CKP")) == -1) {
+			error_printf(_("Failed to load state from %s\n"), fnames[it]);
+			while (--it >= 0)
+				_close_state(&state[it]);
+			return -1;
+		}
+	}
+
+	if (state[0].data && known_urls)
+		wget_fpset_add_fingerprints(known_urls, state[0].fingerprints, state[0].nfingerprints);
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (int it = 0; it < 3; it++)
+			_restore_state(&state[it], pass, restore_job);
+	}
+
+	if (state[0].data || state[2].data) {
+		info_printf(_("Restored %d queued URLs and %d known URLs from %s in %lld ms\n"),
+			queue_size() - qsize, blacklist_size(), fname, wget_get_timemillis() - start);
+	}
+
+	if ((journal_fd = _open_journal()) != -1 && state[2].data) {
+		// cut off an incomplete record, new records are appended behind the last complete one
+		if (ftruncate(journal_fd, state[2].end - state[2].data) != 0)
+			error_printf(_("Failed to truncate %s (%d)\n"), fname_journal, errno);
+	}
+
+	for (int it = 0; it < 3; it++)
+		_close_state(&state[it]);
+
+	return journal_fd == -1 ? -1 : queue_size() - qsize;
+}
+
+// fold the old snapshot and FILE.journal.old into a new snapshot
+static int _write_snapshot(const wget_fpset_t *known_urls, wget_thread_mutex_t *known_urls_mutex)
+{
+	STATE_FILE state[2];
+	wget_fpset_t *done;
+	wget_buffer_t buf;
+	HEADER header = { .magic = "WGET2CKP", .version = CHECKPOINT_VERSION };
+	const unsigned long long *fingerprints;
+	RECORD record;
+	size_t size;
+	int fd, rc = 0;
+
+	if (_open_state(&state[0], fname_snapshot, "WGET2CKP") == -1 || _open_state(&state[1], fname_old, "WGET2JNL") == -1) {
+		error_printf(_("Failed to read state from %s\n"), state[0].data ? fname_old : fname_snapshot);
+		_close_state(&state[0]);
+		return -1;
+	}
+
+	// URLs that have been finished since the last snapshot
+	done = wget_fpset_create(128, NULL, NULL);
+	for (const char *p = state[1].records; p < state[1].end; p += size) {
+		size = _get_record(p, state[1].end, &record);
+		if (record.type == 'D')
+			wget_fpset_add_fingerprint(done, wget_fpset_hash(0, p + sizeof(RECORD), record.url_len));
+	}
+
+	if ((fd = open(fname_tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+		error_printf(_("Failed to open %s (%d)\n"), fname_tmp, errno);
+		rc = -1;
+		goto out;
+	}
+
+	wget_thread_mutex_lock(known_urls_mutex);
+	header.nfingerprints = wget_fpset_get_fingerprints(known_urls, &fingerprints);
+	if (_write_all(fd, (const char *) &header, sizeof(header))
+		|| _write_all(fd, (const char *) fingerprints, header.nfingerprints * sizeof(unsigned long long)))
+		rc = -1;
+	wget_thread_mutex_unlock(known_urls_mutex);
+
+	wget_buffer_init(&buf, NULL, 64 * 1024);
+
+	for (int it = 0; it < 2 && !rc; it++) {
+		for (const char *p = state[it].records; p < state[it].end && !rc; p += size) {
+			size = _get_record(p, state[it].end, &record);
+
+			if (record.type == 'Q' && wget_fpset_contains_fingerprint(done, wget_fpset_hash(0, p + sizeof(RECORD), record.url_len)))
+				continue;
+
+			wget_buffer_memcat(&buf, p, size);
+
+			if (buf.length >= 60 * 1024) {
+				rc = _write_all(fd, buf.data, buf.length);
+				wget_buffer_reset(&buf);
+			}
+		}
+	}
+
+	if (!rc)
+		rc = _write_all(fd, buf.data, buf.length);
+
+	wget_buffer_deinit(&buf);
+
+	if (rc || fsync(fd) != 0) {
+		error_printf(_("Failed to write %s (%d)\n"), fname_tmp, errno);
+		rc = -1;
+	}
+
+	close(fd);
+
+	if (!rc && rename(fname_tmp, fname_snapshot) != 0) {
+		error_printf(_("Failed to rename %s to %s (%d)\n"), fname_tmp, fname_snapshot, errno);
+		rc = -1;
+	}
+
+	if (rc)
+		unlink(fname_tmp);
+
+out:
+	wget_fpset_free(&done);
+	_close_state(&state[1]);
+	_close_state(&state[0]);
+
+	return rc;
+}
+
+// Write a snapshot and start a new journal.
+// The fingerprint table of 'known_urls' is written with 'known_urls_mutex' locked.
+void checkpoint_save(const wget_fpset_t *known_urls, wget_thread_mutex_t *known_urls_mutex)
+{
+	struct stat st;
+
+	if (!fname_snapshot)
+		return;
+
+	// if the last checkpoint failed, FILE.journal.old is folded first and the journal is kept
+	if (stat(fname_old, &st) != 0) {
+		wget_thread_mutex_lock(&mutex);
+		if (journal_fd != -1) {
+			close(journal_fd);
+			if (rename(fname_journal, fname_old) != 0)
+				error_printf(_("Failed to rename %s to %s (%d)\n"), fname_journal, fname_old, errno);
+			journal_fd = _open_journal();
+		}
+		wget_thread_mutex_unlock(&mutex);
+	}
+
+	if (_write_snapshot(known_urls, known_urls_mutex) == 0) {
+		unlink(fname_old);
+		debug_printf("checkpoint written to %s\n", fname_snapshot);
+	}
+}
+
+void checkpoint_free(void)
+{
+	wget_thread_mutex_lock(&mutex);
+	if (journal_fd != -1) {
+		close(journal_fd);
+		journal_fd = -1;
+	}
+	wget_thread_mutex_unlock(&mutex);
+
+	xfree(fname_snapshot);
+	xfree(fname_journal);
+	xfree(fname_old);
+	xfree(fname_tmp);
+
+	wget_vector_free(&robots_iris);
+}
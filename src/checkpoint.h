@@ -0,0 +1,37 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Header file for crawl checkpoints (--resume-state)
+ *
+ */
+
+#ifndef _WGET_CHECKPOINT_H
+# define _WGET_CHECKPOINT_H
+
+# include <libwget.h>
+
+# include "job.h"
+
+int checkpoint_open(const char *fname, wget_fpset_t *known_urls, void (*restore_job)(JOB *job)) G_GNUC_WGET_NONNULL((1,3));
+void checkpoint_add_job(const JOB *job) G_GNUC_WGET_NONNULL_ALL;
+void checkpoint_job_done(const JOB *job) G_GNUC_WGET_NONNULL_ALL;
+void checkpoint_save(const wget_fpset_t *known_urls, wget_thread_mutex_t *known_urls_mutex) G_GNUC_WGET_NONNULL((2));
+void checkpoint_free(void);
+
+#endif /* _WGET_CHECKPOINT_H */
@@ -29,6 +29,7 @@
 # include <config.h>
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <libwget.h>
@@ -83,12 +84,15 @@ static void _free_host_entry(HOST *host)
 {
 	if (host) {
 		wget_robots_free(&host->robots);
+		wget_xfree(host->spilled);
 		wget_xfree(host);
 	}
 }
 
-HOST *hosts_add(wget_iri_t *iri)
+static HOST *_hosts_add(wget_iri_t *iri, int *created)
 {
+	HOST *hostp, host = { .scheme = iri->scheme, .host = iri->host };
+
 	wget_thread_mutex_lock(&hosts_mutex);
 
 	if (!hosts) {
@@ -96,18 +100,41 @@ HOST *hosts_add(wget_iri_t *iri)
 		wget_hashmap_set_key_destructor(hosts, (void(*)(void *))_free_host_entry);
 	}
 
-	HOST *hostp = NULL, host = { .scheme = iri->scheme, .host = iri->host };
-
-	if (!wget_hashmap_contains(hosts, &host)) {
+	if (!(hostp = wget_hashmap_get(hosts, &host))) {
 		// info_printf("Add to hosts: %s\n", hostname);
-		wget_hashmap_put_noalloc(hosts, hostp = wget_memdup(&host, sizeof(host)), NULL);
-	}
+		hostp = wget_memdup(&host, sizeof(host));
+		wget_hashmap_put_noalloc(hosts, hostp, hostp); // the value is returned by hosts_get()
+		*created = 1;
+	} else
+		*created = 0;
 
 	wget_thread_mutex_unlock(&hosts_mutex);
 
+	// resolve a new host in the background while its first job waits in the queue,
+	// with a proxy we only connect to the proxy
+	if (*created && !(iri->scheme == WGET_IRI_SCHEME_HTTPS ? config.https_proxy : config.http_proxy))
+		wget_dns_prefetch(iri->host, iri->resolv_port);
+
 	return hostp;
 }
 
+// returns a new HOST entry or NULL if the host already exists
+HOST *hosts_add(wget_iri_t *iri)
+{
+	int created;
+	HOST *hostp = _hosts_add(iri, &created);
+
+	return created ? hostp : NULL;
+}
+
+// returns the HOST entry, it is created if it does not exist yet
+HOST *hosts_get_or_add(wget_iri_t *iri)
+{
+	int created;
+
+	return _hosts_add(iri, &created);
+}
+
 HOST *hosts_get(wget_iri_t *iri)
 {
 	HOST *hostp, host = { .scheme = iri->scheme, .host = iri->host };
@@ -125,6 +152,39 @@ HOST *hosts_get(wget_iri_t *iri)
 	return hostp;
 }
 
+// politeness delay in milliseconds between two requests to 'host'
+int host_get_delay(const HOST *host)
+{
+	const ROBOTS *robots = host->robots;
+
+	if (robots && robots->crawl_delay > config.wait)
+		return robots->crawl_delay;
+
+	return config.wait;
+}
+
+// Each host has a token bucket of size one that is refilled after the politeness delay
+// (--wait, --random-wait, Crawl-delay). Downloading from a host takes its token.
+// Returns 0 if the token has been taken, else the time when the bucket will be refilled.
+// To be called with the queue mutex held.
+long long host_take_token(HOST *host, long long now)
+{
+	int delay = host_get_delay(host);
+
+	if (delay <= 0)
+		return 0;
+
+	if (now < host->next_allowed)
+		return host->next_allowed;
+
+	if (config.random_wait && delay == config.wait)
+		delay = rand() % config.wait + config.wait / 2; // (0.5 - 1.5) * config.wait
+
+	host->next_allowed = now + delay;
+
+	return 0;
+}
+
 void hosts_free(void)
 {
 	wget_thread_mutex_lock(&hosts_mutex);
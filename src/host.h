@@ -42,10 +42,22 @@ typedef struct {
 		*robot_job;
 	ROBOTS
 		*robots;
+	wget_list_t
+		*queue; // FIFO of jobs ready for download, maintained by job.c
+	long long
+		*spilled, // ring buffer of references to jobs spilled to disk (see spill.c), maintained by job.c
+		next_allowed; // politeness: time (see wget_get_timemillis()) when the bucket holds a token again
+	int
+		spilled_first, // position of the oldest entry in 'spilled'
+		nspilled, // number of entries in 'spilled', they are queued behind 'queue'
+		max_spilled; // allocated entries in 'spilled'
 } HOST;
 
 HOST *hosts_add(wget_iri_t *iri);
 HOST *hosts_get(wget_iri_t *iri);
+HOST *hosts_get_or_add(wget_iri_t *iri);
 void hosts_free(void);
+int host_get_delay(const HOST *host) G_GNUC_WGET_PURE;
+long long host_take_token(HOST *host, long long now);
 
 #endif /* _WGET_HOST_H */
@@ -40,13 +40,10 @@
 
 #include "wget.h"
 #include "log.h"
+#include "options.h"
+#include "spill.h"
 #include "job.h"
 
-static wget_list_t
-	*queue;
-static int
-	qsize;
-
 void job_free(JOB *job)
 {
 	if (job) {
@@ -295,26 +292,458 @@ int job_validate_file(JOB *job)
 	return 0;
 }
 
+// The queue is organized per host to avoid scanning all jobs on each dispatch:
+//  - each HOST has a FIFO of jobs that are ready for download (host->queue)
+//  - hosts with ready jobs are kept in a ring that is served round-robin
+//  - jobs handed out to downloaders are kept in the in-flight set of the downloader
+//  - in-flight jobs that have been split into metalink parts are additionally
+//    kept in a list, so that other downloaders may pick up free parts
+// queue_get(), queue_del() and queue_size() do not depend on the number of queued jobs.
+//
+// Jobs found by a downloader (e.g. while parsing HTML) are pushed to a deque owned by
+// that downloader. A downloader takes work from its own deque first, then from the
+// host queues and at last it steals from the deques of other downloaders.
+// Idle downloaders sleep on their own condition in queue_wait() and are woken one at a time.
+// Each wakeup counts up 'wakeups', a downloader only goes to sleep if nothing has been woken
+// since it last looked for work in queue_get(). Else new work might be sitting in the queue unseen.
+//
+// Politeness (--wait, --random-wait, Crawl-delay) is enforced per host when dispatching:
+// a host whose token bucket is empty (see host_take_token()) is parked in 'delayed_hosts'
+// together with its queue, and queue_get() goes on with other hosts. Parked hosts return to the
+// ring when their bucket has been refilled. Downloaders with nothing else to do sleep in
+// queue_wait() until then.
+//
+// Failed jobs and metalink parts are not retried by sleeping downloaders. queue_retry() puts
+// them into a min-heap ordered by due time, queue_get() releases them when they are due.
+//
+// With --max-queue-memory, jobs are spilled to disk (see spill.c) when the estimated memory of the
+// queued jobs exceeds the limit. A host then keeps the head of its FIFO in memory and the tail in
+// 'host->spilled'. All further jobs of that host are spilled as well, so the order of dispatch does
+// not change. The tail is read back when the head has been taken. With a limit set, jobs found by a
+// downloader go to the host queues instead of the downloader's deque.
+
+typedef struct {
+	wget_thread_mutex_t
+		mutex; // protects 'jobs' and 'inflight'
+	wget_thread_cond_t
+		cond; // signalled when there might be new work
+	wget_list_t
+		*jobs; // local deque of JOB pointers: owner takes from the front, thieves from the back
+	wget_hashmap_t
+		*inflight; // set of jobs handed out to this downloader
+	unsigned int
+		wakeups; // value of 'wakeups' when this downloader last looked for work
+	char
+		idle, // waiting in queue_wait()
+		retired; // the downloader should exit after its current work (see queue_retire())
+} WORKER;
+
+typedef struct {
+	long long
+		due; // time (see wget_get_timemillis()) when the job or part is released
+	JOB
+		*job;
+	PART
+		*part; // metalink part to retry, NULL to retry the whole job
+} RETRY;
+
 static wget_thread_mutex_t
-	mutex = WGET_THREAD_MUTEX_INITIALIZER;
+	mutex = WGET_THREAD_MUTEX_INITIALIZER, // protects host queues, ready_hosts and parts_jobs
+	idle_mutex = WGET_THREAD_MUTEX_INITIALIZER; // protects idle, nidle, wakeups and stopped
+static wget_list_t
+	*ready_hosts, // ring of HOST pointers having at least one ready job
+	*delayed_hosts, // HOST pointers having jobs but waiting for a politeness token
+	*parts_jobs; // in-flight jobs with metalink parts
+static WORKER
+	*workers;
+static RETRY
+	*retries; // min-heap of delayed tries, protected by 'mutex'
+static int
+	*idle, // stack of idle worker ids
+	nidle,
+	nworkers,
+	nready, // number of jobs waiting in host queues and deques
+	ndelayed, // number of entries in delayed_hosts
+	nretries,
+	max_retries,
+	qsize;
+static unsigned int
+	wakeups; // number of wakeups so far, also counts those finding no idle downloader
+static long long
+	delayed_until, // earliest refill time of delayed_hosts, 0 if there are none
+	queue_memory; // estimated memory of the jobs in host queues and deques
+static char
+	stopped;
+
+static void _atomic_add_int(int *p, int n)
+{
+#ifdef WITH_SYNC_FETCH_AND_ADD
+	__sync_fetch_and_add(p, n);
+#else
+	static wget_thread_mutex_t
+		add_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+
+	wget_thread_mutex_lock(&add_mutex);
+	*p += n;
+	wget_thread_mutex_unlock(&add_mutex);
+#endif
+}
+
+static void _atomic_add_memory(long long n)
+{
+#ifdef WITH_SYNC_FETCH_AND_ADD
+	__sync_fetch_and_add(&queue_memory, n);
+#else
+	static wget_thread_mutex_t
+		add_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+
+	wget_thread_mutex_lock(&add_mutex);
+	queue_memory += n;
+	wget_thread_mutex_unlock(&add_mutex);
+#endif
+}
+
+// rough heap usage of a queued job, the IRIs are owned by the blacklist
+static long long G_GNUC_WGET_PURE _job_memory(const JOB *job)
+{
+	return sizeof(JOB) + 4 * sizeof(void *) + (job->local_filename ? strlen(job->local_filename) + 1 : 0);
+}
+
+static int _over_memory_limit(void)
+{
+	return config.max_queue_memory && queue_memory > config.max_queue_memory;
+}
+
+static unsigned int G_GNUC_WGET_CONST _job_hash(const JOB *job)
+{
+	return (unsigned int)((size_t)job >> 4);
+}
+
+static int G_GNUC_WGET_CONST _job_compare(const JOB *job1, const JOB *job2)
+{
+	return job1 < job2 ? -1 : (job1 > job2 ? 1 : 0);
+}
+
+static void _free_job(JOB *job)
+{
+	job_free(job);
+	xfree(job);
+}
+
+// prepare one deque for each downloader, must be called before starting the downloaders
+void queue_init(int n)
+{
+	workers = xcalloc(n, sizeof(WORKER));
+	idle = xcalloc(n, sizeof(int));
+	nworkers = n;
+
+	for (int it = 0; it < n; it++) {
+		wget_thread_mutex_init(&workers[it].mutex);
+		wget_thread_cond_init(&workers[it].cond);
+		workers[it].inflight = wget_hashmap_create(4, -2, (unsigned int (*)(const void *))_job_hash, (int (*)(const void *, const void *))_job_compare);
+	}
+}
+
+// wake up one idle downloader
+static void _wakeup_worker(void)
+{
+	wget_thread_mutex_lock(&idle_mutex);
+	wakeups++;
+	if (nidle > 0) {
+		WORKER *worker = &workers[idle[--nidle]];
+
+		worker->idle = 0;
+		wget_thread_cond_signal(&worker->cond);
+	}
+	wget_thread_mutex_unlock(&idle_mutex);
+}
+
+// wake up all idle downloaders
+static void _wakeup_workers(void)
+{
+	wget_thread_mutex_lock(&idle_mutex);
+	wakeups++;
+	while (nidle > 0) {
+		WORKER *worker = &workers[idle[--nidle]];
+
+		worker->idle = 0;
+		wget_thread_cond_signal(&worker->cond);
+	}
+	wget_thread_mutex_unlock(&idle_mutex);
+}
+
+static JOB *_queue_new_job(JOB *job)
+{
+	JOB *jobp = wget_memdup(job, sizeof(JOB));
+
+	if (!jobp->host)
+		jobp->host = hosts_get_or_add(jobp->iri);
+	if (jobp->deferred)
+		jobp->host->robot_job = jobp; // IRIs of this host wait for robots.txt
+
+	_atomic_add_int(&qsize, 1);
+
+	return jobp;
+}
+
+static int G_GNUC_WGET_PURE _host_has_jobs(const HOST *host)
+{
+	return host->queue || host->nspilled;
+}
+
+// write a queued job to disk and free it (to be called with 'mutex' locked)
+// returns 1 if the job has been spilled, else 0
+static int _job_spill(JOB *job)
+{
+	HOST *host = job->host;
+	long long ref;
+
+	// robots.txt jobs and metalink jobs stay in memory
+	if (job->deferred || job->metalink || job->parts || (ref = spill_write(job)) < 0)
+		return 0;
+
+	if (host->nspilled >= host->max_spilled) {
+		int max = host->max_spilled ? host->max_spilled * 2 : 16;
+		long long *spilled = xmalloc(max * sizeof(long long));
+
+		for (int it = 0; it < host->nspilled; it++)
+			spilled[it] = host->spilled[(host->spilled_first + it) % host->max_spilled];
+
+		xfree(host->spilled);
+		host->spilled = spilled;
+		host->spilled_first = 0;
+		host->max_spilled = max;
+	}
+
+	host->spilled[(host->spilled_first + host->nspilled++) % host->max_spilled] = ref;
+
+	_atomic_add_memory(-_job_memory(job));
+	_free_job(job);
+
+	return 1;
+}
+
+// read spilled jobs of 'host' back into its queue, at least one and as many as the memory limit allows
+// (to be called with 'mutex' locked)
+static void _host_page_in(HOST *host)
+{
+	for (int n = 0; host->nspilled && (!n || (n < 64 && !_over_memory_limit())); ) {
+		long long ref = host->spilled[host->spilled_first];
+		JOB job, *jobp;
+
+		host->spilled_first = (host->spilled_first + 1) % host->max_spilled;
+		host->nspilled--;
+
+		if (spill_read(ref, &job)) {
+			_atomic_add_int(&nready, -1);
+			_atomic_add_int(&qsize, -1);
+			continue;
+		}
+
+		job.host = host;
+		jobp = wget_memdup(&job, sizeof(JOB));
+		wget_list_append(&host->queue, &jobp, sizeof(JOB *));
+		_atomic_add_memory(_job_memory(jobp));
+		n++;
+	}
+
+	if (!host->nspilled) {
+		xfree(host->spilled);
+		host->spilled_first = host->max_spilled = 0;
+	}
+}
+
+// append a job to its host's FIFO, in memory or on disk (to be called with 'mutex' locked)
+// the caller takes care that the host is in 'ready_hosts' or 'delayed_hosts'
+// returns NULL if the job has been spilled to disk
+static JOB *_host_append(JOB *job)
+{
+	HOST *host = job->host;
+
+	if ((host->nspilled || _over_memory_limit()) && _job_spill(job))
+		return NULL;
+
+	wget_list_append(&host->queue, &job, sizeof(JOB *));
 
+	return job;
+}
+
+// add a job to the queue of its host, any downloader may take it
+// returns the queued job or NULL if it has been spilled to disk
 JOB *queue_add_job(JOB *job)
 {
 	if (job) {
-		JOB *jobp;
+		JOB *jobp = _queue_new_job(job);
+		HOST *host = jobp->host;
+
+		debug_printf("queue_add_job %p %s\n", (void *)jobp, job->iri->uri);
+
+		_atomic_add_memory(_job_memory(jobp));
 
 		wget_thread_mutex_lock(&mutex);
-		jobp = wget_list_append(&queue, job, sizeof(JOB));
-		qsize++;
+		if (!_host_has_jobs(host))
+			wget_list_append(&ready_hosts, &host, sizeof(HOST *));
+		jobp = _host_append(jobp);
 		wget_thread_mutex_unlock(&mutex);
 
-		debug_printf("queue_add_job %p %s\n", (void *)jobp, job->iri->uri);
+		_atomic_add_int(&nready, 1);
+		_wakeup_worker();
+
+		return jobp;
+	}
+
+	return NULL;
+}
+
+// add a job to the deque of downloader 'worker', idle downloaders may steal it
+JOB *queue_add_job_local(JOB *job, int worker)
+{
+	if (job) {
+		// jobs that may be spilled go through the host queues to keep one order of dispatch,
+		// the deque of a retired downloader is not served any more by its owner
+		if (worker < 0 || worker >= nworkers || config.max_queue_memory || workers[worker].retired)
+			return queue_add_job(job);
+
+		JOB *jobp = _queue_new_job(job);
+
+		_atomic_add_memory(_job_memory(jobp));
+
+		wget_thread_mutex_lock(&workers[worker].mutex);
+		wget_list_append(&workers[worker].jobs, &jobp, sizeof(JOB *));
+		wget_thread_mutex_unlock(&workers[worker].mutex);
+
+		_atomic_add_int(&nready, 1);
+		_wakeup_worker();
+
+		debug_printf("queue_add_job_local %p %s (%d)\n", (void *)jobp, job->iri->uri, worker);
 		return jobp;
 	}
 
 	return NULL;
 }
 
+// make the parts of an in-flight job available to queue_get()
+void queue_add_parts(JOB *job)
+{
+	if (job && job->parts) {
+		wget_thread_mutex_lock(&mutex);
+		wget_list_append(&parts_jobs, &job, sizeof(JOB *));
+		wget_thread_mutex_unlock(&mutex);
+
+		_wakeup_workers();
+	}
+}
+
+// add an entry to the retry heap (to be called with 'mutex' locked)
+static void _retry_push(const RETRY *retry)
+{
+	int n, parent;
+
+	if (nretries >= max_retries) {
+		max_retries = max_retries ? max_retries * 2 : 16;
+		retries = xrealloc(retries, max_retries * sizeof(RETRY));
+	}
+
+	for (n = nretries++; n > 0 && retries[parent = (n - 1) / 2].due > retry->due; n = parent)
+		retries[n] = retries[parent];
+
+	retries[n] = *retry;
+}
+
+// remove the top entry from the retry heap (to be called with 'mutex' locked)
+static void _retry_pop(void)
+{
+	RETRY *last = &retries[--nretries];
+	int n = 0, child;
+
+	while ((child = 2 * n + 1) < nretries) {
+		if (child + 1 < nretries && retries[child + 1].due < retries[child].due)
+			child++;
+		if (last->due <= retries[child].due)
+			break;
+		retries[n] = retries[child];
+		n = child;
+	}
+
+	retries[n] = *last;
+}
+
+// Try a failed job (or metalink part) again in 'delay' milliseconds.
+// The job must have been taken by queue_get(), the downloader must not touch it afterwards.
+void queue_retry(JOB *job, PART *part, int delay)
+{
+	RETRY retry = { .due = wget_get_timemillis() + delay, .job = job, .part = part };
+
+	debug_printf("queue_retry %s in %d ms\n", job->iri->uri, delay);
+
+	if (!part) {
+		if (job->worker < nworkers) {
+			WORKER *worker = &workers[job->worker];
+
+			wget_thread_mutex_lock(&worker->mutex);
+			wget_hashmap_remove_nofree(worker->inflight, job);
+			wget_thread_mutex_unlock(&worker->mutex);
+		}
+
+		job->inuse = 0;
+	}
+
+	wget_thread_mutex_lock(&mutex);
+	_retry_push(&retry);
+	wget_thread_mutex_unlock(&mutex);
+
+	// let an idle downloader know about the new due time
+	_wakeup_worker();
+}
+
+// release due retries to the host queues (to be called with 'mutex' locked)
+// returns the number of released entries
+static int _retries_release(long long now)
+{
+	int n = 0;
+
+	for (; nretries && retries[0].due <= now; n++) {
+		RETRY retry = retries[0];
+
+		_retry_pop();
+
+		if (retry.part) {
+			retry.part->inuse = 0; // queue_get() will find it in parts_jobs
+		} else {
+			HOST *host = retry.job->host;
+
+			_atomic_add_memory(_job_memory(retry.job));
+
+			if (!_host_has_jobs(host))
+				wget_list_append(&ready_hosts, &host, sizeof(HOST *));
+			_host_append(retry.job);
+			_atomic_add_int(&nready, 1);
+		}
+	}
+
+	return n;
+}
+
+// earliest time when a parked host or a delayed try becomes ready, 0 if there is none
+// (to be called with 'mutex' locked)
+static long long _next_due(void)
+{
+	if (nretries && (!delayed_until || retries[0].due < delayed_until))
+		return retries[0].due;
+
+	return delayed_until;
+}
+
+static int _remove_parts_job(JOB *job, JOB **jobpp)
+{
+	if (*jobpp == job) {
+		wget_list_remove(&parts_jobs, jobpp);
+		return 1;
+	}
+
+	return 0;
+}
+
 void queue_del(JOB *job)
 {
 	if (job) {
@@ -324,8 +753,7 @@ void queue_del(JOB *job)
 		if (job->deferred) {
 			JOB new_job = { .iri = NULL };
 
-			if (job->host)
-				job->host->robot_job = NULL;
+			job->host->robot_job = NULL;
 			wget_iri_free(&job->iri);
 
 			// create a job for each deferred IRI
@@ -336,88 +764,435 @@ void queue_del(JOB *job)
 			}
 		}
 
-		job_free(job);
+		if (job->worker < nworkers) {
+			WORKER *worker = &workers[job->worker];
 
-		wget_thread_mutex_lock(&mutex);
-		wget_list_remove(&queue, job);
-		qsize--;
-		wget_thread_mutex_unlock(&mutex);
+			wget_thread_mutex_lock(&worker->mutex);
+			wget_hashmap_remove_nofree(worker->inflight, job);
+			wget_thread_mutex_unlock(&worker->mutex);
+		}
+
+		if (job->parts) {
+			wget_thread_mutex_lock(&mutex);
+			if (parts_jobs) // usually just a few metalink jobs
+				wget_list_browse(parts_jobs, (int(*)(void *, void *))_remove_parts_job, job);
+			wget_thread_mutex_unlock(&mutex);
+		}
+
+		_atomic_add_int(&qsize, -1);
+
+		_free_job(job);
 	}
 }
 
-struct find_free_job_context {
+// did I say, that I like nested function instead using contexts !?
+// gcc, IBM and Intel support nested functions, just clang refuses it
+
+struct find_free_part_context {
 	JOB **job;
 	PART **part;
 };
 
-// did I say, that I like nested function instead using contexts !?
-// gcc, IBM and Intel support nested functions, just clang refuses it
+static int find_free_part(struct find_free_part_context *context, JOB **jobpp)
+{
+	JOB *job = *jobpp;
+
+	for (int it = 0; it < wget_vector_size(job->parts); it++) {
+		PART *part = wget_vector_get(job->parts, it);
+		if (!part->inuse) {
+			part->inuse = 1;
+			*context->part = part;
+			*context->job = job;
+			debug_printf("queue_get part %d/%d %s\n", it + 1, wget_vector_size(job->parts), job->local_filename);
+			return 1;
+		}
+	}
+
+	return 0;
+}
 
-static int find_free_job(struct find_free_job_context *context, JOB *job)
+// park a host with an empty token bucket until 'next' (to be called with 'mutex' locked)
+static void _delay_host(HOST *host, long long next)
 {
-	// debug_printf("%p %p %p %d\n",part_out,job,job->parts,job->inuse);
-	if (context->part && job->parts) {
-		// debug_printf("nparts %d\n",vec_size(job->parts));
+	wget_list_append(&delayed_hosts, &host, sizeof(HOST *));
+	ndelayed++;
 
-		for (int it = 0; it < wget_vector_size(job->parts); it++) {
-			PART *part = wget_vector_get(job->parts, it);
-			if (!part->inuse) {
-				part->inuse = 1;
-				*context->part = part;
-				*context->job = job;
-				debug_printf("queue_get part %d/%d %s\n", it + 1, wget_vector_size(job->parts), job->local_filename);
-				return 1;
-			}
+	if (!delayed_until || next < delayed_until)
+		delayed_until = next;
+}
+
+// move parked hosts with a refilled bucket back into the ring (to be called with 'mutex' locked)
+static void _delayed_hosts_check(long long now)
+{
+	delayed_until = 0;
+
+	for (int n = ndelayed; n > 0; n--) {
+		HOST **hostpp = wget_list_getfirst(delayed_hosts), *host = *hostpp;
+
+		wget_list_remove(&delayed_hosts, hostpp);
+
+		if (host->next_allowed <= now) {
+			wget_list_append(&ready_hosts, &host, sizeof(HOST *));
+			ndelayed--;
+		} else {
+			wget_list_append(&delayed_hosts, &host, sizeof(HOST *));
+			if (!delayed_until || host->next_allowed < delayed_until)
+				delayed_until = host->next_allowed;
 		}
-	} else if (!job->inuse) {
-		job->inuse = 1;
-		*context->job = job;
-		debug_printf("queue_get job %s\n", job->iri->uri);
+	}
+}
+
+// take the next job from the host queues (to be called with 'mutex' locked)
+static JOB *_host_queue_get(long long now)
+{
+	if (delayed_hosts && now >= delayed_until)
+		_delayed_hosts_check(now);
+
+	while (ready_hosts) {
+		HOST **hostpp = wget_list_getfirst(ready_hosts), *host = *hostpp;
+		long long next = host_take_token(host, now);
+
+		wget_list_remove(&ready_hosts, hostpp);
+
+		if (next) {
+			_delay_host(host, next);
+			continue;
+		}
+
+		if (!host->queue) {
+			_host_page_in(host);
+
+			if (!host->queue)
+				continue; // the spilled jobs could not be read
+		}
+
+		JOB **jobpp = wget_list_getfirst(host->queue), *jobp = *jobpp;
+
+		wget_list_remove(&host->queue, jobpp);
+
+		// move the host to the end of the ring or drop it if there is no more work
+		if (_host_has_jobs(host))
+			wget_list_append(&ready_hosts, &host, sizeof(HOST *));
+
+		return jobp;
+	}
+
+	return NULL;
+}
+
+// Take the politeness token for a job from a deque.
+// If the host's bucket is empty, the job is moved to the host queue and 0 is returned.
+static int _job_take_token(JOB *job, long long now)
+{
+	HOST *host = job->host;
+	long long next;
+
+	if (host_get_delay(host) <= 0)
 		return 1;
+
+	wget_thread_mutex_lock(&mutex);
+	if ((next = host_take_token(host, now))) {
+		if (!_host_has_jobs(host))
+			_delay_host(host, next);
+		_host_append(job);
 	}
-	return 0;
+	wget_thread_mutex_unlock(&mutex);
+
+	return !next;
+}
+
+// take a job from the front (owner) or from the back (thief) of a deque
+static JOB *_deque_get(WORKER *worker, int back)
+{
+	JOB **jobpp, *jobp = NULL;
+
+	wget_thread_mutex_lock(&worker->mutex);
+	if (worker->jobs) {
+		jobpp = back ? wget_list_getlast(worker->jobs) : wget_list_getfirst(worker->jobs);
+		jobp = *jobpp;
+		wget_list_remove(&worker->jobs, jobpp);
+	}
+	wget_thread_mutex_unlock(&worker->mutex);
+
+	return jobp;
 }
 
-int queue_get(JOB **job, PART **part)
+int queue_get(int worker, JOB **job, PART **part)
 {
-	struct find_free_job_context
-		context = { .job = job, .part = part };
+	WORKER *self = &workers[worker];
+	JOB *jobp;
+	long long now = wget_get_timemillis();
 
 	*job = NULL;
 	if (part)
 		*part = NULL;
 
+	// work queued after this point makes queue_wait() return at once
+	wget_thread_mutex_lock(&idle_mutex);
+	self->wakeups = wakeups;
+	wget_thread_mutex_unlock(&idle_mutex);
+
+	// our own jobs come first
+	while ((jobp = _deque_get(self, 0)) && !_job_take_token(jobp, now));
+
+	if (!jobp) {
+		int ret = 0, released = 0;
+
+		wget_thread_mutex_lock(&mutex);
+
+		if (nretries && retries[0].due <= now)
+			released = _retries_release(now);
+
+		// parts of already started metalink downloads
+		if (part && parts_jobs) {
+			struct find_free_part_context context = { .job = job, .part = part };
+
+			ret = wget_list_browse(parts_jobs, (int(*)(void *, void *))find_free_part, &context);
+		}
+
+		if (!ret && (ready_hosts || delayed_hosts))
+			jobp = _host_queue_get(now);
+
+		wget_thread_mutex_unlock(&mutex);
+
+		if (released > 1)
+			_wakeup_workers();
+
+		if (ret)
+			return 1;
+
+		// steal from the other downloaders
+		for (int it = 1; !jobp && it < nworkers; it++)
+			while ((jobp = _deque_get(&workers[(worker + it) % nworkers], 1)) && !_job_take_token(jobp, now));
+
+		if (!jobp)
+			return 0;
+	}
+
+	_atomic_add_int(&nready, -1);
+	_atomic_add_memory(-_job_memory(jobp));
+
+	wget_thread_mutex_lock(&self->mutex);
+	wget_hashmap_put_noalloc(self->inflight, jobp, jobp);
+	wget_thread_mutex_unlock(&self->mutex);
+
+	jobp->inuse = 1;
+	jobp->worker = worker;
+	*job = jobp;
+	debug_printf("queue_get job %s\n", jobp->iri->uri);
+
+	return 1;
+}
+
+// Take the next job from the deque of downloader 'worker' if it goes to the same scheme, host and port
+// as 'job' and if 'accept' agrees. Used to pipeline requests, jobs of hosts with a politeness delay are not taken.
+JOB *queue_get_pipelined(int worker, const JOB *job, int (*accept)(JOB *job))
+{
+	WORKER *self = &workers[worker];
+	JOB **jobpp, *jobp = NULL;
+
+	if (host_get_delay(job->host) > 0)
+		return NULL;
+
+	wget_thread_mutex_lock(&self->mutex);
+	if (self->jobs && (jobpp = wget_list_getfirst(self->jobs))) {
+		const wget_iri_t *iri = (*jobpp)->iri;
+
+		if (iri->scheme == job->iri->scheme && !wget_strcmp(iri->host, job->iri->host)
+			&& !wget_strcmp(iri->resolv_port, job->iri->resolv_port) && accept(*jobpp))
+		{
+			jobp = *jobpp;
+			wget_list_remove(&self->jobs, jobpp);
+			wget_hashmap_put_noalloc(self->inflight, jobp, jobp);
+		}
+	}
+	wget_thread_mutex_unlock(&self->mutex);
+
+	if (!jobp)
+		return NULL;
+
+	_atomic_add_int(&nready, -1);
+	_atomic_add_memory(-_job_memory(jobp));
+
+	jobp->inuse = 1;
+	jobp->worker = worker;
+	debug_printf("queue_get_pipelined job %s\n", jobp->iri->uri);
+
+	return jobp;
+}
+
+// wait until new jobs might be available for downloader 'worker',
+// until a host waiting for politeness may be served again, until a retry is due
+// or until the downloader has been retired.
+// Returns at once if there was a wakeup since the last queue_get() of 'worker'.
+void queue_wait(int worker)
+{
+	WORKER *self = &workers[worker];
+	long long until;
+
 	wget_thread_mutex_lock(&mutex);
-	int ret = wget_list_browse(queue, (int(*)(void *, void *))find_free_job, &context);
+	until = _next_due();
 	wget_thread_mutex_unlock(&mutex);
 
-	return ret;
+	wget_thread_mutex_lock(&idle_mutex);
+	if (!stopped && !self->retired && self->wakeups == wakeups && (nready <= 0 || until)) {
+		self->idle = 1;
+		idle[nidle++] = worker;
+
+		while (self->idle && !stopped && !self->retired) {
+			if (!until)
+				wget_thread_cond_wait(&self->cond, &idle_mutex);
+			else {
+				long long ms = until - wget_get_timemillis();
+
+				if (ms <= 0 || wget_thread_cond_timedwait(&self->cond, &idle_mutex, (int) ms) == ETIMEDOUT)
+					break;
+			}
+		}
+
+		if (self->idle) {
+			// timed out, nobody took us from the idle stack
+			for (int it = 0; it < nidle; it++) {
+				if (idle[it] == worker) {
+					idle[it] = idle[--nidle];
+					break;
+				}
+			}
+			self->idle = 0;
+		}
+	}
+	wget_thread_mutex_unlock(&idle_mutex);
+}
+
+// Tell the downloader 'worker' to exit when its current work is done (retire != 0),
+// or allow it to take jobs again before it is restarted (retire == 0).
+// Jobs left in its deque are stolen by the other downloaders.
+void queue_retire(int worker, int retire)
+{
+	WORKER *self = &workers[worker];
+
+	wget_thread_mutex_lock(&idle_mutex);
+	self->retired = !!retire;
+	if (retire && self->idle) {
+		for (int it = 0; it < nidle; it++) {
+			if (idle[it] == worker) {
+				idle[it] = idle[--nidle];
+				break;
+			}
+		}
+		self->idle = 0;
+		wget_thread_cond_signal(&self->cond);
+	}
+	wget_thread_mutex_unlock(&idle_mutex);
+
+	// the jobs in the deque need another owner
+	if (retire && self->jobs)
+		_wakeup_worker();
+}
+
+int queue_retired(int worker)
+{
+	return workers[worker].retired;
+}
+
+// number of downloaders waiting in queue_wait()
+int queue_idle(void)
+{
+	return nidle;
+}
+
+// number of jobs waiting to be handed out to a downloader
+int queue_ready(void)
+{
+	return nready;
+}
+
+// wake up all waiting downloaders, queue_wait() won't block any more
+void queue_stop(void)
+{
+	wget_thread_mutex_lock(&idle_mutex);
+	stopped = 1;
+	for (int it = 0; it < nworkers; it++)
+		wget_thread_cond_signal(&workers[it].cond);
+	wget_thread_mutex_unlock(&idle_mutex);
 }
 
 int queue_empty(void)
 {
-	return !queue;
+	return !qsize;
 }
 
-// did I say, that I like nested function instead using contexts !?
-// gcc, IBM and Intel support nested functions, just clang refuses it
+static int queue_free_func(void *context G_GNUC_WGET_UNUSED, JOB **jobpp)
+{
+	_free_job(*jobpp);
+	return 0;
+}
 
-static int queue_free_func(void *context G_GNUC_WGET_UNUSED, JOB *job)
+static int queue_free_host_func(void *context G_GNUC_WGET_UNUSED, HOST **hostpp)
 {
-	job_free(job);
+	HOST *host = *hostpp;
+
+	wget_list_browse(host->queue, (int(*)(void *, void *))queue_free_func, NULL);
+	wget_list_free(&host->queue);
+	xfree(host->spilled);
+	host->nspilled = host->spilled_first = host->max_spilled = 0;
 	return 0;
 }
 
 void queue_free(void)
 {
 	wget_thread_mutex_lock(&mutex);
-	wget_list_browse(queue, (int(*)(void *, void *))queue_free_func, NULL);
-	wget_list_free(&queue);
-	qsize = 0;
+	wget_list_browse(ready_hosts, (int(*)(void *, void *))queue_free_host_func, NULL);
+	wget_list_free(&ready_hosts);
+	wget_list_browse(delayed_hosts, (int(*)(void *, void *))queue_free_host_func, NULL);
+	wget_list_free(&delayed_hosts);
+	wget_list_free(&parts_jobs);
+	ndelayed = 0;
+	delayed_until = 0;
+
+	// parts belong to in-flight jobs which are freed below
+	for (int it = 0; it < nretries; it++) {
+		if (!retries[it].part)
+			_free_job(retries[it].job);
+	}
+	xfree(retries);
+	nretries = max_retries = 0;
+
+	for (int it = 0; it < nworkers; it++) {
+		wget_list_browse(workers[it].jobs, (int(*)(void *, void *))queue_free_func, NULL);
+		wget_list_free(&workers[it].jobs);
+		wget_hashmap_set_key_destructor(workers[it].inflight, (void(*)(void *))_free_job);
+		wget_hashmap_free(&workers[it].inflight);
+	}
+	xfree(workers);
+	xfree(idle);
+	nworkers = nidle = 0;
+	stopped = 0;
+
+	spill_free();
+
+	qsize = nready = 0;
+	queue_memory = 0;
 	wget_thread_mutex_unlock(&mutex);
 }
 
-static int queue_print_func(void *context G_GNUC_WGET_UNUSED, JOB *job)
+static int queue_print_func(void *context G_GNUC_WGET_UNUSED, JOB **jobpp)
+{
+	info_printf("%s %d\n", (*jobpp)->local_filename, (*jobpp)->inuse);
+	return 0;
+}
+
+static int queue_print_host_func(void *context G_GNUC_WGET_UNUSED, HOST **hostpp)
+{
+	HOST *host = *hostpp;
+
+	if (host->nspilled)
+		info_printf("%s: %d more jobs on disk\n", host->host, host->nspilled);
+
+	return wget_list_browse(host->queue, (int(*)(void *, void *))queue_print_func, NULL);
+}
+
+static int queue_print_inflight_func(void *context G_GNUC_WGET_UNUSED, JOB *job, G_GNUC_WGET_UNUSED void *value)
 {
 	info_printf("%s %d\n", job->local_filename, job->inuse);
 	return 0;
@@ -425,8 +1200,20 @@ static int queue_print_func(void *context G_GNUC_WGET_UNUSED, JOB *job)
 
 void queue_print(void)
 {
+	for (int it = 0; it < nworkers; it++) {
+		wget_thread_mutex_lock(&workers[it].mutex);
+		wget_hashmap_browse(workers[it].inflight, (int(*)(void *, const void *, void *))queue_print_inflight_func, NULL);
+		wget_list_browse(workers[it].jobs, (int(*)(void *, void *))queue_print_func, NULL);
+		wget_thread_mutex_unlock(&workers[it].mutex);
+	}
+
 	wget_thread_mutex_lock(&mutex);
-	wget_list_browse(queue, (int(*)(void *, void *))queue_print_func, NULL);
+	wget_list_browse(ready_hosts, (int(*)(void *, void *))queue_print_host_func, NULL);
+	wget_list_browse(delayed_hosts, (int(*)(void *, void *))queue_print_host_func, NULL);
+	for (int it = 0; it < nretries; it++) {
+		if (!retries[it].part)
+			queue_print_func(NULL, &retries[it].job);
+	}
 	wget_thread_mutex_unlock(&mutex);
 }
 
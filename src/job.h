@@ -39,7 +39,8 @@ typedef struct {
 	off_t
 		length;
 	int
-		id;
+		id,
+		tries; // number of failed tries
 	char
 		inuse,
 		done;
@@ -65,19 +66,33 @@ struct JOB {
 		level, // current recursion level
 		redirection_level, // number of redirections occurred to create this job
 		mirror_pos, // where to look up the next (metalink) mirror to use
-		piece_pos; // where to look up the next (metalink) piece to download
+		piece_pos, // where to look up the next (metalink) piece to download
+		worker, // id of the downloader that got this job from queue_get()
+		tries; // number of failed tries
 	char
 		inuse, // if job is already in use by another downloader thread
 		sitemap, // URL is a sitemap to be scanned in recursive mode
-		head_first; // first check mime type by using a HEAD request
+		head_first, // first check mime type by using a HEAD request
+		saved; // body has been written to disk while downloading
 };
 
 JOB *job_init(JOB *job, wget_iri_t *iri);
+void queue_init(int nworkers);
 JOB *queue_add_job(JOB *job);
+JOB *queue_add_job_local(JOB *job, int worker);
+void queue_add_parts(JOB *job);
+void queue_retry(JOB *job, PART *part, int delay);
 PART *job_add_part(JOB *job, PART *part);
 int queue_size(void) G_GNUC_WGET_PURE;
 int queue_empty(void) G_GNUC_WGET_PURE;
-int queue_get(JOB **job_out, PART **part_out);
+int queue_get(int worker, JOB **job_out, PART **part_out);
+JOB *queue_get_pipelined(int worker, const JOB *job, int (*accept)(JOB *job));
+void queue_wait(int worker);
+void queue_retire(int worker, int retire);
+int queue_retired(int worker) G_GNUC_WGET_PURE;
+int queue_idle(void) G_GNUC_WGET_PURE;
+int queue_ready(void) G_GNUC_WGET_PURE;
+void queue_stop(void);
 int job_validate_file(JOB *job);
 void queue_print(void);
 void job_create_parts(JOB *job);
@@ -109,10 +109,22 @@ static int G_GNUC_WGET_NORETURN print_help(G_GNUC_WGET_UNUSED option_t opt, G_GN
 		"  -r  --recursive         Recursive download. (default: off)\n"
 		"  -H  --span-hosts        Span hosts that were not given on the command line. (default: off)\n"
 		"      --max-threads       Max. concurrent download threads. (default: 5) (NEW!)\n"
+		"      --adaptive-threads  Adjust the number of download threads to the measured throughput,\n"
+		"                          between --min-threads and --max-threads. (default: off) (NEW!)\n"
+		"      --min-threads       Min. concurrent download threads with --adaptive-threads. (default: 1) (NEW!)\n"
+		"      --io-engine         'threads': one blocking connection per download thread,\n"
+		"                          'epoll': event driven connections, see --max-connections. (default: threads) (NEW!)\n"
+		"                          epoll: HTTP/1.1 only, metalink parts use blocking I/O, requires --no-ocsp,\n"
+		"                          host names are resolved in the background with --dns-caching.\n"
+		"      --max-connections   Max. concurrent connections per download thread with --io-engine=epoll. (default: 100) (NEW!)\n"
+		"      --max-queue-memory  Max. memory used by queued jobs, more jobs are spilled to a temporary file.\n"
+		"                          0 = no limit. (default: 0) (NEW!)\n"
 		"      --max-redirect      Max. number of redirections to follow. (default: 20)\n"
 		"  -T  --timeout           General network timeout in seconds.\n"
 		"      --dns-timeout       DNS lookup timeout in seconds.\n"
 		"      --connect-timeout   Connect timeout in seconds.\n"
+		"      --connect-attempt-delay  Seconds before trying the next address of a host while connecting\n"
+		"                          in parallel (Happy Eyeballs). 0 tries one address after the other. (default: 0.25) (NEW!)\n"
 		"      --read-timeout      Read and write timeout in seconds.\n"
 		"  -O  --output-document   File where downloaded content is written to, '-'  for STDOUT.\n"
 		"      --spider            Enable web spider mode. (default: off)\n"
@@ -153,15 +165,17 @@ static int G_GNUC_WGET_NORETURN print_help(G_GNUC_WGET_UNUSED option_t opt, G_GN
 		"      --ignore-case       Ignore case when matching files. (default: off)\n"
 		"  -k  --convert-links     Convert embedded URLs to local URLs. (default: off)\n"
 		"  -K  --backup-converted  When converting, keep the original file with a .orig suffix. (default: off)\n"
-		"  -w  --wait              Wait number of seconds between downloads (per thread). (default: 0)\n"
-		"      --waitretry         Wait up to number of seconds after error (per thread). (default: 10)\n"
-		"      --random-wait       Wait 0.5 up to 1.5*<--wait> seconds between downloads (per thread). (default: off)\n"
+		"  -w  --wait              Wait number of seconds between downloads from the same host. (default: 0)\n"
+		"      --waitretry         Wait up to number of seconds after error before trying again, unless the server sends Retry-After. (default: 10)\n"
+		"      --random-wait       Wait 0.5 up to 1.5*<--wait> seconds between downloads from the same host. (default: off)\n"
 		"      --dns-caching       Caching of domain name lookups. (default: on)\n"
 		"      --tcp-fastopen      Enable TCP Fast Open (TFO). (default: on)\n"
 		"      --iri               Wget dummy option, you can't switch off international support\n"
 		"      --robots            Respect robots.txt standard for recursive downloads. (default: on)\n"
 		"      --restrict-file-names  unix, windows, nocontrol, ascii, lowercase, uppercase, none\n"
 		"  -m  --mirror            Turn on mirroring options -r -N -l inf\n"
+		"      --resume-state      Save the state of a recursive download to a file and resume from it. (default: off) (NEW!)\n"
+		"      --checkpoint-interval  Seconds between checkpoints of --resume-state. (default: 300) (NEW!)\n"
 		"      --follow-tags       Scan additional tag/attributes for URLs, e.g. --follow-tags=\"img/data-500px,img/data-hires\n"
 		"      --ignore-tags       Ignore tag/attributes for URL scanning, e.g. --ignore-tags=\"img,a/href\n"
 		"      --backups           Make backups instead of overwriting/increasing number. (default: 0)\n"
@@ -180,6 +194,8 @@ static int G_GNUC_WGET_NORETURN print_help(G_GNUC_WGET_UNUSED option_t opt, G_GN
 		"                          Download the list with:\n"
 		"                          wget -O suffixes.txt http://mxr.mozilla.org/mozilla-central/source/netwerk/dns/effective_tld_names.dat?raw=1\n"
 		"      --http-keep-alive   Keep connection open for further requests. (default: on)\n"
+		"      --pipelining        Max. number of HTTP/1.1 requests in flight on a keep-alive connection,\n"
+		"                          sent for the next jobs to the same host. 0 = off. (default: 0) (NEW!)\n"
 		"      --save-headers      Save the response headers in front of the response data. (default: off)\n"
 		"      --referer           Include Referer: url in HTTP requets. (default: off)\n"
 		"  -E  --adjust-extension  Append extension to saved file (.html or .css). (default: off)\n"
@@ -214,6 +230,10 @@ static int G_GNUC_WGET_NORETURN print_help(G_GNUC_WGET_UNUSED option_t opt, G_GN
 		"      --ocsp-stapling     Use OCSP stapling to verify the server's certificate. (default: on)\n"
 		"      --ocsp              Use OCSP server access to verify server's certificate. (default: on)\n"
 		"      --ocsp-file         Set file for OCSP chaching. (default: ~/.wget-ocsp)\n"
+		"      --tls-resume        Resume TLS sessions to skip the full handshake on reconnects. (default: on)\n"
+		"      --tls-session-file  Set file for TLS session data, to resume sessions across runs. (default: none)\n"
+		"      --tls-early-data    Send GET requests as TLS 1.3 0-RTT early data on resumed HTTP/1.1 connections.\n"
+		"                          Early data can be replayed by an attacker. (default: off)\n"
 		"      --http2             Use HTTP/2 protocol if possible. (default: on)\n"
 		"\n");
 	puts(
@@ -499,6 +519,22 @@ static int G_GNUC_WGET_PURE G_GNUC_WGET_NONNULL((1)) parse_cert_type(option_t op
 	return 0;
 }
 
+static int G_GNUC_WGET_PURE G_GNUC_WGET_NONNULL((1)) parse_io_engine(option_t opt, const char *val)
+{
+	if (!val || !wget_strcasecmp_ascii(val, "threads"))
+		*((char *)opt->var) = IO_ENGINE_THREADS;
+	else if (!wget_strcasecmp_ascii(val, "epoll")) {
+#ifdef HAVE_SYS_EPOLL_H
+		*((char *)opt->var) = IO_ENGINE_EPOLL;
+#else
+		error_printf_exit("epoll is not available on this platform\n");
+#endif
+	} else
+		error_printf_exit("Unknown I/O engine '%s'\n", val);
+
+	return 0;
+}
+
 // legacy option, needed to succeed test suite
 static int G_GNUC_WGET_PURE G_GNUC_WGET_NONNULL((1)) parse_restrict_names(option_t opt, const char *val)
 {
@@ -574,10 +610,13 @@ static int parse_prefer_family(option_t opt, const char *val)
 // default values for config options (if not 0 or NULL)
 struct config config = {
 	.connect_timeout = -1,
+	.connect_attempt_delay = 250,
 	.dns_timeout = -1,
 	.read_timeout = -1,
 	.max_redirect = 20,
 	.max_threads = 5,
+	.min_threads = 1,
+	.max_connections = 100,
 	.num_threads = 1,
 	.dns_caching = 1,
 	.tcp_fastopen = 1,
@@ -602,6 +641,7 @@ struct config config = {
 	.robots = 1,
 	.tries = 20,
 	.hsts = 1,
+	.tls_resume = 1,
 #if defined WITH_LIBNGHTTP2
 	.http2 = 1,
 #endif
@@ -609,6 +649,7 @@ struct config config = {
 	.ocsp_stapling = 1,
 	.netrc = 1,
 	.waitretry = 10 * 1000,
+	.checkpoint_interval = 5 * 60 * 1000,
 };
 
 static int parse_execute(option_t opt, const char *val);
@@ -617,6 +658,7 @@ static const struct option options[] = {
 	// long name, config variable, parse function, number of arguments, short name
 	// leave the entries in alphabetical order of 'long_name' !
 	{ "accept", &config.accept_patterns, parse_stringlist, 1, 'A' },
+	{ "adaptive-threads", &config.adaptive_threads, parse_bool, 0, 0 },
 	{ "adjust-extension", &config.adjust_extension, parse_bool, 0, 'E' },
 	{ "append-output", &config.logfile_append, parse_string, 1, 'a' },
 	{ "backup-converted", &config.backup_converted, parse_bool, 0, 'K' },
@@ -630,10 +672,12 @@ static const struct option options[] = {
 	{ "certificate-type", &config.cert_type, parse_cert_type, 1, 0 },
 	{ "check-certificate", &config.check_certificate, parse_bool, 0, 0 },
 	{ "check-hostname", &config.check_hostname, parse_bool, 0, 0 },
+	{ "checkpoint-interval", &config.checkpoint_interval, parse_timeout, 1, 0 },
 	{ "chunk-size", &config.chunk_size, parse_numbytes, 1, 0 },
 	{ "clobber", &config.clobber, parse_bool, 0, 0 },
 	{ "config", &config.config_file, parse_string, 1, 0}, // for backward compatibility only
 	{ "config-file", &config.config_file, parse_string, 1, 0},
+	{ "connect-attempt-delay", &config.connect_attempt_delay, parse_timeout, 1, 0 },
 	{ "connect-timeout", &config.connect_timeout, parse_timeout, 1, 0 },
 	{ "content-disposition", &config.content_disposition, parse_bool, 0, 0 },
 	{ "continue", &config.continue_download, parse_bool, 0, 'c' },
@@ -679,13 +723,17 @@ static const struct option options[] = {
 	{ "inet6-only", &config.inet6_only, parse_bool, 0, '6' },
 	{ "input-encoding", &config.input_encoding, parse_string, 1, 0 },
 	{ "input-file", &config.input_file, parse_string, 1, 'i' },
+	{ "io-engine", &config.io_engine, parse_io_engine, 1, 0 },
 	{ "iri", NULL, parse_bool, 0, 0 }, // Wget compatibility, in fact a do-nothing option
 	{ "keep-session-cookies", &config.keep_session_cookies, parse_bool, 0, 0 },
 	{ "level", &config.level, parse_integer, 1, 'l' },
 	{ "load-cookies", &config.load_cookies, parse_string, 1, 0 },
 	{ "local-encoding", &config.local_encoding, parse_string, 1, 0 },
+	{ "max-connections", &config.max_connections, parse_integer, 1, 0 },
+	{ "max-queue-memory", &config.max_queue_memory, parse_numbytes, 1, 0 },
 	{ "max-redirect", &config.max_redirect, parse_integer, 1, 0 },
 	{ "max-threads", &config.max_threads, parse_integer, 1, 0 },
+	{ "min-threads", &config.min_threads, parse_integer, 1, 0 },
 	{ "mirror", &config.mirror, parse_mirror, 0, 'm' },
 	{ "n", NULL, parse_n_option, 1, 'n' }, // special Wget compatibility option
 	{ "netrc", &config.netrc, parse_bool, 0, 0 },
@@ -698,6 +746,7 @@ static const struct option options[] = {
 	{ "page-requisites", &config.page_requisites, parse_bool, 0, 'p' },
 	{ "parent", &config.parent, parse_bool, 0, 0 },
 	{ "password", &config.password, parse_string, 1, 0 },
+	{ "pipelining", &config.pipelining, parse_integer, 1, 0 },
 	{ "post-data", &config.post_data, parse_string, 1, 0 },
 	{ "post-file", &config.post_file, parse_string, 1, 0 },
 	{ "prefer-family", &config.preferred_family, parse_prefer_family, 1, 0 },
@@ -715,6 +764,7 @@ static const struct option options[] = {
 	{ "reject", &config.reject_patterns, parse_stringlist, 1, 'R' },
 	{ "remote-encoding", &config.remote_encoding, parse_string, 1, 0 },
 	{ "restrict-file-names", &config.restrict_file_names, parse_restrict_names, 1, 0 },
+	{ "resume-state", &config.resume_state, parse_string, 1, 0 },
 	{ "robots", &config.robots, parse_bool, 0, 0 },
 	{ "save-cookies", &config.save_cookies, parse_string, 1, 0 },
 	{ "save-headers", &config.save_headers, parse_bool, 0, 0 },
@@ -726,6 +776,9 @@ static const struct option options[] = {
 	{ "tcp-fastopen", &config.tcp_fastopen, parse_bool, 0, 0 },
 	{ "timeout", NULL, parse_timeout, 1, 'T' },
 	{ "timestamping", &config.timestamping, parse_bool, 0, 'N' },
+	{ "tls-early-data", &config.tls_early_data, parse_bool, 0, 0 },
+	{ "tls-resume", &config.tls_resume, parse_bool, 0, 0 },
+	{ "tls-session-file", &config.tls_session_file, parse_string, 1, 0 },
 	{ "tries", &config.tries, parse_integer, 1, 't' },
 	{ "trust-server-names", &config.trust_server_names, parse_bool, 0, 0 },
 	{ "use-server-timestamps", &config.use_server_timestamps, parse_bool, 0, 0 },
@@ -780,7 +833,11 @@ static int G_GNUC_WGET_NONNULL((1)) set_long_option(const char *name, const char
 	if (!opt) {
 		// Maybe the user asked for e.g. https_only or httpsonly instead of https-only
 		// opt_compare_execute() will find these. Wget -e/--execute compatibility.
-		opt = bsearch(name, options, countof(options), sizeof(options[0]), opt_compare_execute);
+		// Without dashes the options are not sorted (e.g. 'http-user' and 'http2'), so no bsearch() here.
+		for (unsigned it = 0; it < countof(options) && !opt; it++) {
+			if (!opt_compare_execute(name, &options[it]))
+				opt = &options[it];
+		}
 	}
 
 	if (!opt)
@@ -1265,6 +1322,18 @@ int init(int argc, const char *const *argv)
 	" -bzip2"
 #endif
 
+#if defined WITH_BROTLIDEC
+	" +brotlidec"
+#else
+	" -brotlidec"
+#endif
+
+#if defined WITH_ZSTD
+	" +zstd"
+#else
+	" -zstd"
+#endif
+
 #if defined WITH_LIBNGHTTP2
 	" +http2"
 #else
@@ -1293,6 +1362,19 @@ int init(int argc, const char *const *argv)
 	// check for correct settings
 	if (config.max_threads < 1)
 		config.max_threads = 1;
+	if (config.min_threads < 1)
+		config.min_threads = 1;
+	else if (config.min_threads > config.max_threads)
+		config.min_threads = config.max_threads;
+	if (config.max_connections < 1)
+		config.max_connections = 1;
+	if (config.io_engine == IO_ENGINE_EPOLL && config.ocsp) {
+		// OCSP requests are sent during the certificate check and would stall all connections of the downloader
+		error_printf(_("--io-engine=epoll does not support OCSP server access, use --no-ocsp (OCSP stapling works)\n"));
+		return -1;
+	}
+	if (config.pipelining < 0)
+		config.pipelining = 0;
 
 	// truncate output document
 	if (config.output_document && strcmp(config.output_document,"-")) {
@@ -1340,6 +1422,11 @@ int init(int argc, const char *const *argv)
 		wget_ocsp_db_load(config.ocsp_db, config.ocsp_file);
 	}
 
+	if (config.tls_resume) {
+		config.tls_session_db = wget_tls_session_db_init(NULL);
+		wget_tls_session_db_load(config.tls_session_db, config.tls_session_file);
+	}
+
 	if (config.base_url)
 		config.base = wget_iri_parse(config.base_url, config.local_encoding);
 
@@ -1357,6 +1444,7 @@ int init(int argc, const char *const *argv)
 	// set module specific options
 	wget_tcp_set_timeout(NULL, config.read_timeout);
 	wget_tcp_set_connect_timeout(NULL, config.connect_timeout);
+	wget_tcp_set_connect_attempt_delay(NULL, config.connect_attempt_delay);
 	wget_tcp_set_dns_timeout(NULL, config.dns_timeout);
 	wget_tcp_set_dns_caching(NULL, config.dns_caching);
 	wget_tcp_set_tcp_fastopen(NULL, config.tcp_fastopen);
@@ -1379,6 +1467,7 @@ int init(int argc, const char *const *argv)
 	wget_ssl_set_config_int(WGET_SSL_PRINT_INFO, config.debug);
 	wget_ssl_set_config_int(WGET_SSL_OCSP, config.ocsp);
 	wget_ssl_set_config_int(WGET_SSL_OCSP_STAPLING, config.ocsp_stapling);
+	wget_ssl_set_config_int(WGET_SSL_EARLY_DATA, config.tls_early_data);
 	wget_ssl_set_config_string(WGET_SSL_SECURE_PROTOCOL, config.secure_protocol);
 	wget_ssl_set_config_string(WGET_SSL_DIRECT_OPTIONS, config.gnutls_options);
 	wget_ssl_set_config_string(WGET_SSL_CA_DIRECTORY, config.ca_directory);
@@ -1387,7 +1476,8 @@ int init(int argc, const char *const *argv)
 	wget_ssl_set_config_string(WGET_SSL_KEY_FILE, config.private_key);
 	wget_ssl_set_config_string(WGET_SSL_CRL_FILE, config.crl_file);
 	wget_ssl_set_config_string(WGET_SSL_OCSP_CACHE, (const char *)config.ocsp_db);
-	if (config.http2)
+	wget_ssl_set_config_string(WGET_SSL_SESSION_CACHE, (const char *)config.tls_session_db);
+	if (config.http2 && config.io_engine != IO_ENGINE_EPOLL) // non-blocking connections are HTTP/1.1 only
 		wget_ssl_set_config_string(WGET_SSL_ALPN, "h2,h2-16,h2-14,http/1.1");
 
 	// convert host lists to lowercase
@@ -1433,12 +1523,14 @@ int init(int argc, const char *const *argv)
 
 void deinit(void)
 {
+	wget_http_pool_free(); // closes idle connections, they hold DNS cache entries
 	wget_dns_cache_free(); // frees DNS cache
 	wget_tcp_set_bind_address(NULL, NULL); // free global bind address
 
 	wget_cookie_db_free(&config.cookie_db);
 	wget_hsts_db_free(&config.hsts_db);
 	wget_ocsp_db_free(&config.ocsp_db);
+	wget_tls_session_db_free(&config.tls_session_db);
 	wget_netrc_db_free(&config.netrc_db);
 	wget_ssl_deinit();
 
@@ -1447,6 +1539,7 @@ void deinit(void)
 	xfree(config.save_cookies);
 	xfree(config.hsts_file);
 	xfree(config.ocsp_file);
+	xfree(config.tls_session_file);
 	xfree(config.netrc_file);
 	xfree(config.config_file);
 	xfree(config.logfile);
@@ -1464,6 +1557,7 @@ void deinit(void)
 	xfree(config.default_page);
 	xfree(config.base_url);
 	xfree(config.input_file);
+	xfree(config.resume_state);
 	xfree(config.input_encoding);
 	xfree(config.local_encoding);
 	xfree(config.remote_encoding);
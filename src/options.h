@@ -41,6 +41,10 @@
 # define RESTRICT_NAMES_UPPERCASE  1<<4
 # define RESTRICT_NAMES_LOWERCASE  1<<5
 
+// values for --io-engine
+# define IO_ENGINE_THREADS  0
+# define IO_ENGINE_EPOLL  1
+
 struct config {
 	wget_iri_t
 		*base;
@@ -58,6 +62,7 @@ struct config {
 		*remote_encoding, // encoding of remote files (if not specified in Content-Type HTTP header or in document itself)
 		*bind_address,
 		*input_file,
+		*resume_state, // file to save the crawl state to and to resume from
 		*base_url,
 		*default_page,
 		*referer,
@@ -90,12 +95,15 @@ struct config {
 		*hsts_db; // in-memory HSTS database
 	wget_ocsp_db_t
 		*ocsp_db; // in-memory fingerprint OCSP database
+	wget_tls_session_db_t
+		*tls_session_db; // in-memory TLS session resumption cache
 	wget_netrc_db_t
 		*netrc_db; // in-memory .netrc database
 	size_t
 		chunk_size;
 	long long
-		quota;
+		quota,
+		max_queue_memory; // bytes, queued jobs beyond are spilled to disk, 0 = no limit
 	int
 		backups,
 		tries,
@@ -106,22 +114,30 @@ struct config {
 		preferred_family,
 		cut_directories,
 		connect_timeout, // ms
+		connect_attempt_delay, // ms between parallel connection attempts, <= 0: sequential
 		dns_timeout, // ms
 		read_timeout, // ms
+		checkpoint_interval, // ms between checkpoints of the crawl state
 		max_redirect,
 		max_threads,
+		min_threads, // lower bound with --adaptive-threads
+		max_connections, // per downloader thread with --io-engine=epoll
+		pipelining, // max. number of pipelined HTTP/1.1 requests per connection, 0 = off
 		num_threads;
 	struct wget_cookie_db_st
 		*cookie_db;
 	char
 		*hsts_file,
 		*ocsp_file,
+		*tls_session_file,
 		*config_file,
 		*netrc_file,
 		netrc,
 		http2,
 		ocsp_stapling,
 		ocsp,
+		tls_resume,
+		tls_early_data, // send idempotent requests as TLS 1.3 0-RTT data
 		mirror,
 		backup_converted,
 		convert_links,
@@ -159,10 +175,12 @@ struct config {
 		keep_session_cookies,
 		cookies,
 		spider,
+		adaptive_threads, // resize the downloader pool between min_threads and max_threads
 		dns_caching,
 		tcp_fastopen,
 		check_certificate,
 		check_hostname,
+		io_engine, // IO_ENGINE_THREADS or IO_ENGINE_EPOLL
 		cert_type, // SSL_X509_FMT_PEM or SSL_X509_FMT_DER (=ASN1)
 		private_key_type, // SSL_X509_FMT_PEM or SSL_X509_FMT_DER (=ASN1)
 		span_hosts,
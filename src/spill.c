@@ -0,0 +1,289 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Spill queued jobs to disk
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <libwget.h>
+
+#include "wget.h"
+#include "log.h"
+#include "blacklist.h"
+#include "spill.h"
+
+// Jobs are appended as compact records to unlinked temporary files (segments).
+// A record is referenced by a 64bit value: segment index (15 bits), offset (32 bits), length (16 bits).
+// Reading a record back releases it, a segment is dropped when all of its records have been read.
+// The IRIs are owned by the blacklist, so on reading back the URL is parsed and replaced by the
+// blacklisted IRI. Referers are written as ids into a table of referer IRIs.
+// The caller (job.c) serializes the calls with its queue mutex.
+
+#define SEGMENT_SIZE (64 * 1024 * 1024)
+#define MAX_SEGMENTS (1 << 15)
+
+#define SPILL_SITEMAP 1
+#define SPILL_HEAD_FIRST 2
+#define SPILL_FILENAME 4
+
+typedef struct {
+	int
+		level,
+		redirection_level,
+		tries,
+		referer; // index into 'referers', -1 if there is no referer
+	unsigned short
+		url_len,
+		filename_len;
+	unsigned char
+		flags;
+} RECORD; // followed by the URL and the local filename, both not 0-terminated
+
+typedef struct {
+	off_t
+		size; // bytes written
+	int
+		fd, // -1 if the slot is unused
+		live; // records not read back yet
+} SEGMENT;
+
+static SEGMENT
+	*segments;
+static wget_vector_t
+	*referers; // referer IRIs indexed by id
+static wget_hashmap_t
+	*referer_ids; // referer IRI -> id
+static int
+	nsegments,
+	cur = -1; // segment that is written to
+static char
+	failed; // spilling disabled after an error
+
+static unsigned int G_GNUC_WGET_CONST _iri_hash(const wget_iri_t *iri)
+{
+	return (unsigned int)((size_t)iri >> 4);
+}
+
+static int G_GNUC_WGET_CONST _iri_compare(const wget_iri_t *iri1, const wget_iri_t *iri2)
+{
+	return iri1 < iri2 ? -1 : (iri1 > iri2 ? 1 : 0);
+}
+
+static int _referer_id(wget_iri_t *referer)
+{
+	int *id;
+
+	if (!referer)
+		return -1;
+
+	if (!referer_ids) {
+		referers = wget_vector_create(128, -2, NULL);
+		referer_ids = wget_hashmap_create(128, -2, (unsigned int (*)(const void *))_iri_hash, (int (*)(const void *, const void *))_iri_compare);
+		wget_hashmap_set_key_destructor(referer_ids, NULL); // the IRIs are owned elsewhere
+	}
+
+	if (!(id = wget_hashmap_get(referer_ids, referer))) {
+		int n = wget_vector_add_noalloc(referers, referer);
+
+		id = wget_memdup(&n, sizeof(int));
+		wget_hashmap_put_noalloc(referer_ids, referer, id);
+	}
+
+	return *id;
+}
+
+static int _segment_open(void)
+{
+	const char *tmpdir;
+	char *fname;
+	int fd;
+
+	if (!(tmpdir = getenv("TMPDIR")) || !*tmpdir)
+		tmpdir = "/tmp";
+
+	fname = wget_str_asprintf("%s/wget2-queue-XXXXXX", tmpdir);
+
+	if ((fd = mkstemp(fname)) != -1)
+		unlink(fname); // the file vanishes when it is closed, also on crashes
+	else
+		error_printf(_("Failed to create queue file '%s' (%d)\n"), fname, errno);
+
+	xfree(fname);
+
+	return fd;
+}
+
+// return a segment with room for 'len' bytes
+static SEGMENT *_segment_get(size_t len)
+{
+	if (cur >= 0 && segments[cur].size + (off_t)len <= SEGMENT_SIZE)
+		return &segments[cur];
+
+	// the current segment is full, take an unused slot
+	for (cur = 0; cur < nsegments && segments[cur].fd != -1; cur++);
+
+	if (cur == nsegments) {
+		if (nsegments >= MAX_SEGMENTS) {
+			cur = -1;
+			return NULL;
+		}
+
+		segments = xrealloc(segments, ++nsegments * sizeof(SEGMENT));
+	}
+
+	if ((segments[cur].fd = _segment_open()) == -1) {
+		cur = -1;
+		return NULL;
+	}
+
+	segments[cur].size = 0;
+	segments[cur].live = 0;
+
+	return &segments[cur];
+}
+
+// write 'job' to disk
+// returns a reference for spill_read() or -1 if the job can't be spilled, the job itself is not touched
+long long spill_write(const JOB *job)
+{
+	RECORD record;
+	SEGMENT *segment;
+	wget_buffer_t buf;
+	char sbuf[1024];
+	size_t url_len = strlen(job->iri->uri);
+	size_t filename_len = job->local_filename ? strlen(job->local_filename) : 0;
+	size_t len = sizeof(RECORD) + url_len + filename_len;
+	long long ref = -1;
+
+	if (failed || len > 0xFFFF)
+		return -1;
+
+	if (!(segment = _segment_get(len))) {
+		failed = 1;
+		return -1;
+	}
+
+	memset(&record, 0, sizeof(record));
+	record.level = job->level;
+	record.redirection_level = job->redirection_level;
+	record.tries = job->tries;
+	record.referer = _referer_id(job->referer);
+	record.url_len = (unsigned short)url_len;
+	record.filename_len = (unsigned short)filename_len;
+	record.flags = (job->sitemap ? SPILL_SITEMAP : 0) | (job->head_first ? SPILL_HEAD_FIRST : 0) | (job->local_filename ? SPILL_FILENAME : 0);
+
+	wget_buffer_init(&buf, sbuf, sizeof(sbuf));
+	wget_buffer_memcat(&buf, &record, sizeof(record));
+	wget_buffer_memcat(&buf, job->iri->uri, url_len);
+	if (filename_len)
+		wget_buffer_memcat(&buf, job->local_filename, filename_len);
+
+	if (pwrite(segment->fd, buf.data, len, segment->size) == (ssize_t)len) {
+		ref = ((long long)cur << 48) | ((long long)segment->size << 16) | (long long)len;
+		segment->size += len;
+		segment->live++;
+	} else {
+		error_printf(_("Failed to write queue file (%d)\n"), errno);
+		failed = 1;
+	}
+
+	wget_buffer_deinit(&buf);
+
+	return ref;
+}
+
+// read a job written by spill_write() into 'job' and release the record
+// returns 0 on success, else -1 (the job is lost)
+int spill_read(long long ref, JOB *job)
+{
+	int index = (int)(ref >> 48);
+	SEGMENT *segment = &segments[index];
+	off_t offset = (off_t)((ref >> 16) & 0xFFFFFFFF);
+	size_t len = (size_t)(ref & 0xFFFF);
+	char sbuf[1024], *data = len <= sizeof(sbuf) ? sbuf : xmalloc(len);
+	RECORD record;
+	int rc = -1;
+
+	if (pread(segment->fd, data, len, offset) == (ssize_t)len) {
+		char *url;
+		wget_iri_t *iri;
+
+		memcpy(&record, data, sizeof(record));
+		url = wget_strmemdup(data + sizeof(record), record.url_len);
+
+		if ((iri = blacklist_get(wget_iri_parse(url, NULL)))) {
+			memset(job, 0, sizeof(JOB));
+			job->iri = iri;
+			job->referer = record.referer >= 0 ? wget_vector_get(referers, record.referer) : NULL;
+			if (record.flags & SPILL_FILENAME)
+				job->local_filename = wget_strmemdup(data + sizeof(record) + record.url_len, record.filename_len);
+			job->level = record.level;
+			job->redirection_level = record.redirection_level;
+			job->tries = record.tries;
+			job->sitemap = !!(record.flags & SPILL_SITEMAP);
+			job->head_first = !!(record.flags & SPILL_HEAD_FIRST);
+			rc = 0;
+		} else
+			error_printf(_("Failed to restore queued URL '%s'\n"), url);
+
+		xfree(url);
+	} else
+		error_printf(_("Failed to read queue file (%d)\n"), errno);
+
+	if (data != sbuf)
+		xfree(data);
+
+	if (--segment->live == 0) {
+		if (index == cur) {
+			// start over with the current segment
+			if (ftruncate(segment->fd, 0) == 0)
+				segment->size = 0;
+		} else {
+			close(segment->fd);
+			segment->fd = -1;
+		}
+	}
+
+	return rc;
+}
+
+void spill_free(void)
+{
+	for (int it = 0; it < nsegments; it++) {
+		if (segments[it].fd != -1)
+			close(segments[it].fd);
+	}
+	xfree(segments);
+	nsegments = 0;
+	cur = -1;
+	failed = 0;
+
+	wget_hashmap_free(&referer_ids);
+	wget_vector_clear_nofree(referers);
+	wget_vector_free(&referers);
+}
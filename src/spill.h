@@ -0,0 +1,33 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Header file for spilling queued jobs to disk
+ *
+ */
+
+#ifndef _WGET_SPILL_H
+# define _WGET_SPILL_H
+
+# include "job.h"
+
+long long spill_write(const JOB *job) G_GNUC_WGET_NONNULL_ALL;
+int spill_read(long long ref, JOB *job) G_GNUC_WGET_NONNULL_ALL;
+void spill_free(void);
+
+#endif /* _WGET_SPILL_H */
@@ -45,7 +45,14 @@
 #include <fnmatch.h>
 #include <sys/stat.h>
 #include <locale.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include "timespec.h" // gnulib gettime()
+#ifdef HAVE_SYS_EPOLL_H
+#	include <sys/epoll.h>
+#	include <sys/resource.h>
+#endif
 
 #include <libwget.h>
 
@@ -56,6 +63,7 @@
 #include "blacklist.h"
 #include "host.h"
 #include "bar.h"
+#include "checkpoint.h"
 
 #define URL_FLG_REDIRECTION  (1<<0)
 #define URL_FLG_SITEMAP      (1<<1)
@@ -69,18 +77,31 @@ typedef struct {
 		*part;
 	wget_http_connection_t
 		*conn;
+	wget_list_t
+		*pipeline; // PIPELINED jobs, their requests have been sent ahead on 'conn' (--pipelining)
 	char
 		*buf;
 	size_t
 		bufsize;
 	int
-		id;
+		id,
+		npipelined; // number of entries in 'pipeline'
 	wget_thread_cond_t
 		cond;
 	char
-		final_error;
+		final_error,
+		running, // the thread has been started and not yet joined, main thread only
+		exited; // the thread function has returned, protected by main_mutex
 } DOWNLOADER;
 
+// a job whose request has been sent before the response of the previous job has been read
+typedef struct {
+	JOB
+		*job;
+	wget_http_request_t
+		*req;
+} PIPELINED;
+
 #define _CONTENT_TYPE_HTML 1
 typedef struct {
 	const char *
@@ -112,6 +133,20 @@ typedef struct {
 } _statistics_t;
 static _statistics_t stats;
 
+// receives the body of a response, either into memory or directly into the destination file
+struct _body_callback_context {
+	DOWNLOADER *downloader; // NULL if there is no progress bar to update
+	JOB *job;
+	wget_buffer_t *body; // NULL if the body is written to disk or not needed
+	char *fname; // file the body is written to while downloading, NULL for stdout
+	size_t expected_length;
+	size_t length; // body bytes received so far
+	int fd; // see fname, -1 if the body is not written while downloading
+	int flag; // open flag of fd
+	char direct; // the body may be written to disk while downloading
+	char discard; // the body is neither needed nor to be saved
+};
+
 static void
 	save_file(wget_http_response_t *resp, const char *fname),
 	append_file(wget_http_response_t *resp, const char *fname),
@@ -129,21 +164,35 @@ static void
 	css_parse_localfile(JOB *job, const char *fname, const char *encoding, wget_iri_t *base);
 static int
 	download_part(DOWNLOADER *downloader);
-static unsigned int G_GNUC_WGET_PURE
-	hash_url(const char *url);
 wget_http_response_t
 	*http_get(wget_iri_t *iri, PART *part, DOWNLOADER *downloader, const char *method);
+static wget_http_request_t
+	*http_create_request(wget_iri_t *iri, const char *method, JOB *job, PART *part, wget_vector_t *challenges);
+static wget_http_request_template_t
+	*http_create_request_template(void);
+static void
+	http_count_response(wget_http_response_t *resp, PART *part),
+	pipeline_cancel(DOWNLOADER *downloader),
+	_body_context_init(struct _body_callback_context *ctx, DOWNLOADER *downloader, JOB *job, int direct),
+	_body_context_finish(struct _body_callback_context *ctx, wget_http_response_t *resp, wget_http_request_t *req);
+static int
+	_get_header(void *context, wget_http_response_t *resp),
+	_get_body(void *context, const char *data, size_t length);
 
 static wget_stringmap_t
 	*etags;
-static wget_hashmap_t
-	*known_urls;
+static wget_fpset_t
+	*known_urls; // fingerprints of URLs found in documents
 static DOWNLOADER
 	*downloaders;
+static wget_http_request_template_t
+	*request_template; // the constant request headers, built from config once
 static void
-	*downloader_thread(void *p);
+	*downloader_thread(void *p),
+	*event_thread(void *p);
 static long long
-	quota;
+	quota,
+	jobs_done; // number of finished jobs, for --adaptive-threads
 static int
 	exit_status,
 	hsts_changed;
@@ -462,12 +511,39 @@ static int in_host_pattern_list(const wget_vector_t *v, const char *hostname)
 	return 0;
 }
 
+// Remember host and directory of a URL given by the user for recursive downloads.
+static void add_to_scope(wget_iri_t *iri)
+{
+	if (!config.span_hosts) {
+		// only download content from hosts given on the command line or from input file
+		if (!wget_vector_contains(config.exclude_domains, iri->host)) {
+			wget_vector_add_str(config.domains, iri->host);
+		}
+	}
+
+	if (!config.parent) {
+		char *p;
+
+		if (!parents)
+			parents = wget_vector_create(4, -2, NULL);
+
+		// calc length of directory part in iri->path (including last /)
+		if (!iri->path || !(p = strrchr(iri->path, '/')))
+			iri->dirlen = 0;
+		else
+			iri->dirlen = p - iri->path + 1;
+
+		wget_vector_add_noalloc(parents, iri);
+	}
+}
+
 // Add URLs given by user (command line or -i option).
 // Needs to be thread-save.
 static void add_url_to_queue(const char *url, wget_iri_t *base, const char *encoding)
 {
 	wget_iri_t *iri;
-	JOB *new_job = NULL, job_buf;
+	JOB *new_job = NULL, job_buf, resume_buf;
+	int deferred = 0;
 
 	iri = wget_iri_parse_base(base, url, encoding);
 
@@ -485,17 +561,16 @@ static void add_url_to_queue(const char *url, wget_iri_t *base, const char *enco
 	wget_thread_mutex_lock(&downloader_mutex);
 
 	if (!blacklist_add(iri)) {
+		// when resuming a crawl, the URL may be known from the saved state but still defines the scope
+		if (config.recursive && config.resume_state && (iri = blacklist_get(wget_iri_parse_base(base, url, encoding))))
+			add_to_scope(iri);
+
 		wget_thread_mutex_unlock(&downloader_mutex);
 		return;
 	}
 
 	if (config.recursive) {
-		if (!config.span_hosts) {
-			// only download content from hosts given on the command line or from input file
-			if (!wget_vector_contains(config.exclude_domains, iri->host)) {
-				wget_vector_add_str(config.domains, iri->host);
-			}
-		}
+		add_to_scope(iri);
 
 		if (config.robots) {
 			HOST * host;
@@ -504,39 +579,31 @@ static void add_url_to_queue(const char *url, wget_iri_t *base, const char *enco
 				// a new host entry has been created
 				new_job = job_init(&job_buf, wget_iri_parse_base(iri, "/robots.txt", encoding));
 				new_job->host = host;
-				host->robot_job = new_job;
 				new_job->deferred = wget_vector_create(2, -2, NULL);
 				wget_vector_add_noalloc(new_job->deferred, iri);
-			} else if ((host = hosts_get(iri)) && (new_job = host->robot_job)) {
-				wget_vector_add_noalloc(new_job->deferred, iri);
+			} else if ((host = hosts_get(iri)) && host->robot_job) {
+				// robots.txt is already queued, download this IRI afterwards
+				wget_vector_add_noalloc(host->robot_job->deferred, iri);
+				deferred = 1;
 			}
 		}
+	}
 
-		if (!config.parent) {
-			char *p;
-
-			if (!parents)
-				parents = wget_vector_create(4, -2, NULL);
-
-			// calc length of directory part in iri->path (including last /)
-			if (!iri->path || !(p = strrchr(iri->path, '/')))
-				iri->dirlen = 0;
-			else
-				iri->dirlen = p - iri->path + 1;
-
-			wget_vector_add_noalloc(parents, iri);
-		}
+	if (config.resume_state) {
+		checkpoint_add_job(job_init(&resume_buf, iri));
 	}
 
-	if (!new_job)
-		new_job = job_init(&job_buf, iri);
+	if (!deferred) {
+		if (!new_job)
+			new_job = job_init(&job_buf, iri);
 
-	if (!new_job->deferred)
-		new_job->local_filename = get_local_filename(iri);
-	else
-		new_job->local_filename = get_local_filename(new_job->iri);
+		if (!new_job->deferred)
+			new_job->local_filename = get_local_filename(iri);
+		else
+			new_job->local_filename = get_local_filename(new_job->iri);
 
-	queue_add_job(new_job);
+		queue_add_job(new_job);
+	}
 
 	wget_thread_mutex_unlock(&downloader_mutex);
 }
@@ -545,18 +612,46 @@ static wget_thread_mutex_t
 	main_mutex = WGET_THREAD_MUTEX_INITIALIZER,
 	known_urls_mutex = WGET_THREAD_MUTEX_INITIALIZER;
 static wget_thread_cond_t
-	main_cond = WGET_THREAD_COND_INITIALIZER, // is signalled whenever a job is done
-	worker_cond = WGET_THREAD_COND_INITIALIZER;  // is signalled whenever a job is added
+	main_cond = WGET_THREAD_COND_INITIALIZER; // is signalled whenever a job is done
 static wget_thread_t
 	input_tid;
+static wget_thread_mutex_t
+	input_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static wget_thread_cond_t
+	input_cond = WGET_THREAD_COND_INITIALIZER; // is signalled when the queue has room for more input URLs
+static volatile int
+	input_running, // the input thread reads URLs, protected by main_mutex
+	input_waiting; // the input thread waits for room in the queue
+static int
+	input_fd = -1;
 static void
-	*input_thread(void *p);
+	*input_thread(void *p),
+	add_input_line(const char *line, size_t len);
+
+// Backpressure for the input thread: it stops reading URLs when INPUT_QUEUE_MAX jobs are queued
+// and continues when the queue is down to INPUT_QUEUE_MAX / 2.
+#define INPUT_QUEUE_MAX 10000
+
+// a job for the checkpoint journal, for IRIs deferred until robots.txt has been downloaded
+static JOB *_resume_job(JOB *job_buf, wget_iri_t *iri, const JOB *job)
+{
+	job_init(job_buf, iri);
+
+	if (job) {
+		job_buf->level = job->level + 1;
+		job_buf->referer = job->deferred ? NULL : job->iri;
+	}
+
+	return job_buf;
+}
 
 // Needs to be thread-save
 static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 {
-	JOB *new_job = NULL, job_buf;
+	JOB *new_job = NULL, job_buf, resume_buf;
+	const ROBOTS *robots = NULL;
 	wget_iri_t *iri;
+	int locked = 1;
 
 	if (flags & URL_FLG_REDIRECTION) { // redirect
 		if (config.max_redirect && job && job->redirection_level >= config.max_redirect) {
@@ -589,6 +684,10 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 		return;
 	}
 
+	// The lock covers the scope (parents, config.domains), that the input thread may extend,
+	// and the robots.txt handshake between hosts_add() and host->robot_job.
+	// The blacklist and the queue have their own locks, the common case of a known host
+	// leaves the critical section before the blacklist lookup.
 	wget_thread_mutex_lock(&downloader_mutex);
 
 	if (config.recursive && !config.parent) {
@@ -643,34 +742,42 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 			// a new host entry has been created
 			new_job = job_init(&job_buf, wget_iri_parse_base(iri, "/robots.txt", encoding));
 			new_job->host = host;
-			host->robot_job = new_job;
 			new_job->deferred = wget_vector_create(2, -2, NULL);
 			wget_vector_add_noalloc(new_job->deferred, iri);
-			blacklist_add(iri);
+			if (blacklist_add(iri) && config.resume_state)
+				checkpoint_add_job(_resume_job(&resume_buf, iri, job));
 		} else if ((host = hosts_get(iri))) {
 			if (host->robot_job) {
 				wget_vector_add_noalloc(host->robot_job->deferred, iri);
+				if (config.resume_state)
+					checkpoint_add_job(_resume_job(&resume_buf, iri, job));
 				wget_thread_mutex_unlock(&downloader_mutex);
 				return;
 			}
 
-			if (host->robots && iri->path) {
-				for (int it = 0; it < wget_vector_size(host->robots->paths); it++) {
-					ROBOTS_PATH *path = wget_vector_get(host->robots->paths, it);
-					if (!strncmp(path->path, iri->path, path->len)) {
-						wget_thread_mutex_unlock(&downloader_mutex);
-						info_printf(_("URL '%s' not followed (disallowed by robots.txt)\n"), iri->uri);
-						wget_iri_free(&iri);
-						return;
-					}
-//					info_printf("checked robot path '%.*s'\n", path->path, path->len);
+			// the rules don't change once robots.txt has been parsed
+			robots = host->robots;
+		}
+	}
+
+	if (!new_job) {
+		wget_thread_mutex_unlock(&downloader_mutex);
+		locked = 0;
+
+		if (robots && iri->path) {
+			for (int it = 0; it < wget_vector_size(robots->paths); it++) {
+				ROBOTS_PATH *path = wget_vector_get(robots->paths, it);
+				if (!strncmp(path->path, iri->path, path->len)) {
+					info_printf(_("URL '%s' not followed (disallowed by robots.txt)\n"), iri->uri);
+					wget_iri_free(&iri);
+					return;
 				}
+//				info_printf("checked robot path '%.*s'\n", path->path, path->len);
 			}
 		}
-	}
 
-	if (!new_job)
 		new_job = job_init(&job_buf, blacklist_add(iri));
+	}
 
 	if (new_job) {
 		if (!config.output_document) {
@@ -686,8 +793,8 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 				new_job->referer = job->referer;
 			} else {
 				new_job->level = job->level + 1;
-				new_job->referer = job->iri;
-				job->iri = NULL;
+				// the IRI of a robots.txt job is freed when the job is done
+				new_job->referer = job->deferred ? NULL : job->iri;
 			}
 		}
 
@@ -695,14 +802,66 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 		if (flags & URL_FLG_SITEMAP && !new_job->deferred)
 			new_job->sitemap = 1;
 
-		// now add the new job to the queue (thread-safe))
-		queue_add_job(new_job);
+		if (config.resume_state && !new_job->deferred)
+			checkpoint_add_job(new_job);
 
-		// and wake up all waiting threads
-		wget_thread_cond_signal(&worker_cond);
+		// now add the new job to the queue of the current downloader (thread-safe)
+		// this also wakes up a waiting downloader
+		queue_add_job_local(new_job, job ? job->worker : -1);
 	}
 
-	wget_thread_mutex_unlock(&downloader_mutex);
+	// a new robots.txt job must be queued before other threads see its host
+	if (locked)
+		wget_thread_mutex_unlock(&downloader_mutex);
+}
+
+// Queue a job restored from a checkpoint (see --resume-state).
+static void restore_job(JOB *job)
+{
+	if (config.recursive && config.robots) {
+		HOST *host;
+
+		if ((host = hosts_add(job->iri))) {
+			// robots.txt of this host has not been processed yet
+			JOB job_buf, *robot_job;
+
+			robot_job = job_init(&job_buf, wget_iri_parse_base(job->iri, "/robots.txt", NULL));
+			robot_job->host = host;
+			robot_job->deferred = wget_vector_create(2, -2, NULL);
+			robot_job->local_filename = get_local_filename(robot_job->iri);
+			wget_vector_add_noalloc(robot_job->deferred, job->iri);
+			queue_add_job(robot_job);
+			xfree(job->local_filename);
+			return;
+		}
+
+		if ((host = hosts_get(job->iri)) && host->robot_job) {
+			wget_vector_add_noalloc(host->robot_job->deferred, job->iri);
+			xfree(job->local_filename);
+			return;
+		}
+	}
+
+	if (!job->local_filename && !config.output_document)
+		job->local_filename = get_local_filename(job->iri);
+
+	queue_add_job(job);
+}
+
+// A job has been processed, remove it from the queue.
+static void job_done(JOB *job)
+{
+	if (config.resume_state && !terminate)
+		checkpoint_job_done(job);
+
+	queue_del(job);
+	_fetch_and_add_longlong(&jobs_done, 1);
+
+	if (input_waiting && queue_size() <= INPUT_QUEUE_MAX / 2) {
+		wget_thread_mutex_lock(&input_mutex);
+		wget_thread_cond_signal(&input_cond);
+		wget_thread_mutex_unlock(&input_mutex);
+	}
 }
 
 static void _convert_links(void)
@@ -825,6 +984,189 @@ static void print_status(DOWNLOADER *downloader G_GNUC_WGET_UNUSED, const char *
 	}
 }
 
+// Adaptive pool sizing (--adaptive-threads).
+// Once per AUTOSCALE_INTERVAL the main thread looks at the number of ready jobs, the number of idle
+// downloaders and the work done since the last round (finished jobs and downloaded bytes per second).
+// The average time a busy downloader spends on a job follows from Little's law.
+// - While jobs are waiting and no downloader is idle, the pool grows by half (at least by one).
+//   If the next round does not show at least 10% more throughput (the latency per job rose instead,
+//   e.g. the remaining jobs are on a slow host), the growth is undone and the pool does not grow
+//   for AUTOSCALE_HOLD rounds.
+// - When downloaders have been idle for AUTOSCALE_IDLE_ROUNDS rounds in a row, half of them are retired.
+//   A retired downloader exits after its current work, its deque is taken over by the others.
+// The number of downloaders stays between --min-threads and --max-threads.
+
+#define AUTOSCALE_INTERVAL 1000 // ms
+#define AUTOSCALE_HOLD 10
+#define AUTOSCALE_IDLE_ROUNDS 3
+
+static struct {
+	long long
+		time, // time of the last round, 0 before the first round
+		bytes, // downloaded bytes at the last round
+		jobs; // finished jobs at the last round
+	double
+		jobs_rate, // throughput before the last growth
+		bytes_rate;
+	int
+		grown, // downloaders started in the last round
+		idle_rounds, // rounds in a row with idle downloaders
+		hold; // rounds to wait before growing again
+} autoscaler;
+
+static int downloader_start(DOWNLOADER *downloader)
+{
+	void *(*thread_func)(void *) = downloader_thread;
+	int rc;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (config.io_engine == IO_ENGINE_EPOLL)
+		thread_func = event_thread;
+#endif
+
+	downloader->exited = 0;
+	queue_retire(downloader->id, 0);
+
+	// start worker threads (I call them 'downloaders')
+	if ((rc = wget_thread_start(&downloader->tid, thread_func, downloader, 0)) != 0)
+		error_printf(_("Failed to start downloader, error %d\n"), rc);
+	else
+		downloader->running = 1;
+
+	return rc;
+}
+
+// to be called by a downloader thread before it returns
+static void downloader_exit(DOWNLOADER *downloader)
+{
+	// if we terminate, tell the other downloaders
+	if (!queue_retired(downloader->id))
+		queue_stop();
+
+	wget_thread_mutex_lock(&main_mutex);
+	downloader->exited = 1;
+	wget_thread_cond_signal(&main_cond);
+	wget_thread_mutex_unlock(&main_mutex);
+}
+
+// number of downloaders that take jobs, to be called with main_mutex locked
+static int downloaders_active(void)
+{
+	int n = 0;
+
+	for (int it = 0; it < config.num_threads; it++) {
+		if (downloaders[it].running && !downloaders[it].exited && !queue_retired(it))
+			n++;
+	}
+
+	return n;
+}
+
+// start up to 'n' downloaders, returns the number of started downloaders
+static int downloaders_grow(int n)
+{
+	int started = 0;
+
+	for (int it = 0; it < config.num_threads && started < n; it++) {
+		if (!downloaders[it].running && downloader_start(&downloaders[it]) == 0)
+			started++;
+	}
+
+	return started;
+}
+
+// retire the 'n' downloaders with the highest ids
+static void downloaders_shrink(int n)
+{
+	for (int it = config.num_threads - 1; it >= 0 && n > 0; it--) {
+		if (downloaders[it].running && !downloaders[it].exited && !queue_retired(it)) {
+			queue_retire(it, 1);
+			n--;
+		}
+	}
+}
+
+// to be called with main_mutex locked
+static void autoscale(long long now)
+{
+	long long bytes = quota, jobs = jobs_done;
+	double secs = (now - autoscaler.time) / 1000.0, jobs_rate, bytes_rate;
+	int active, nidle, nready, n;
+
+	// join the downloaders that have been retired and exited
+	for (int it = 0; it < config.num_threads; it++) {
+		if (downloaders[it].running && downloaders[it].exited) {
+			wget_thread_join(downloaders[it].tid);
+			downloaders[it].running = 0;
+		}
+	}
+
+	if (!autoscaler.time || secs <= 0) {
+		autoscaler.time = now;
+		autoscaler.bytes = bytes;
+		autoscaler.jobs = jobs;
+		return;
+	}
+
+	jobs_rate = (jobs - autoscaler.jobs) / secs;
+	bytes_rate = (bytes - autoscaler.bytes) / secs;
+	autoscaler.time = now;
+	autoscaler.bytes = bytes;
+	autoscaler.jobs = jobs;
+
+	active = downloaders_active();
+	nidle = queue_idle();
+	nready = queue_ready();
+
+	// our printf implementation has no floating point support
+	debug_printf("autoscale: %d downloaders (%d idle), %d jobs ready, %d jobs/s, %lld bytes/s, %d ms per job\n",
+		active, nidle, nready, (int) jobs_rate, (long long) bytes_rate, jobs_rate > 0 ? (int) ((active - nidle) * 1000 / jobs_rate) : 0);
+
+	if (autoscaler.grown) {
+		n = autoscaler.grown;
+		autoscaler.grown = 0;
+
+		if (jobs_rate < autoscaler.jobs_rate * 1.1 && bytes_rate < autoscaler.bytes_rate * 1.1) {
+			// more downloaders did not pay off
+			if (n > active - config.min_threads)
+				n = active - config.min_threads;
+			downloaders_shrink(n);
+			autoscaler.hold = AUTOSCALE_HOLD;
+			return;
+		}
+	}
+
+	if (nidle > 0) {
+		if (++autoscaler.idle_rounds >= AUTOSCALE_IDLE_ROUNDS) {
+			if ((n = nidle / 2) < 1)
+				n = 1;
+			if (n > active - config.min_threads)
+				n = active - config.min_threads;
+			downloaders_shrink(n);
+			autoscaler.idle_rounds = 0;
+		}
+		return;
+	}
+
+	autoscaler.idle_rounds = 0;
+
+	if (autoscaler.hold > 0) {
+		autoscaler.hold--;
+		return;
+	}
+
+	if (nready > 0 && active < config.max_threads) {
+		if ((n = active / 2) < 1)
+			n = 1;
+		if (n > config.max_threads - active)
+			n = config.max_threads - active;
+
+		autoscaler.jobs_rate = jobs_rate;
+		autoscaler.bytes_rate = bytes_rate;
+		autoscaler.grown = downloaders_grow(n);
+	}
+}
+
 static void nop(int sig)
 {
 	if (sig == SIGTERM) {
@@ -844,6 +1186,7 @@ int main(int argc, const char *const *argv)
 	size_t bufsize = 0;
 	char *buf = NULL;
 	bool async_urls = false;
+	long long next_checkpoint = 0, next_autoscale = 0;
 
 	setlocale(LC_ALL, "");
 
@@ -869,7 +1212,7 @@ int main(int argc, const char *const *argv)
 	sigaction(SIGINT, &sig_action, NULL);
 #endif
 
-	known_urls = wget_hashmap_create(128, -2, (unsigned int (*)(const void *))hash_url, (int (*)(const void *, const void *))strcmp);
+	known_urls = wget_fpset_create(128, NULL, NULL);
 
 	n = init(argc, argv);
 	if (n < 0) {
@@ -877,6 +1220,17 @@ int main(int argc, const char *const *argv)
 		goto out;
 	}
 
+	request_template = http_create_request_template();
+
+	if (config.resume_state) {
+		if (checkpoint_open(config.resume_state, known_urls, restore_job) < 0) {
+			set_exit_status(1);
+			goto out;
+		}
+
+		next_checkpoint = wget_get_timemillis() + config.checkpoint_interval;
+	}
+
 	for (; n < argc; n++) {
 		add_url_to_queue(argv[n], config.base, config.local_encoding);
 	}
@@ -907,49 +1261,32 @@ int main(int argc, const char *const *argv)
 		else if (!strcmp(config.input_file, "-")) {
 			if (isatty(STDIN_FILENO)) {
 				ssize_t len;
-				char *url;
 
 				// read URLs from STDIN
-				while ((len = wget_fdgetline(&buf, &bufsize, STDIN_FILENO)) >= 0) {
-					for (url = buf; len && isspace(*url); url++, len--); // skip leading spaces
-					if (*url == '#' || len <= 0) continue; // skip empty lines and comments
-					for (;len && isspace(url[len - 1]); len--);  // skip trailing spaces
-					// debug_printf("len=%zd url=%s\n", len, buf);
-
-					url[len] = 0;
-					add_url_to_queue(buf, config.base, config.input_encoding);
-				}
-			} else {
-				// read URLs asynchronously and process each URL immediately when it arrives
-				if ((rc = wget_thread_start(&input_tid, input_thread, NULL, 0)) != 0) {
-					error_printf(_("Failed to start downloader, error %d\n"), rc);
-				} else {
-					async_urls = true;
-				}
-			}
+				while ((len = wget_fdgetline(&buf, &bufsize, STDIN_FILENO)) >= 0)
+					add_input_line(buf, len);
+			} else
+				input_fd = STDIN_FILENO;
 		} else {
-			int fd;
-			ssize_t len;
-			char *url;
-
 			// read URLs from input file
-			if ((fd = open(config.input_file, O_RDONLY)) >= 0) {
-				while ((len = wget_fdgetline(&buf, &bufsize, fd)) >= 0) {
-					for (url = buf; len && isspace(*url); url++, len--); // skip leading spaces
-					if (*url == '#' || len <= 0) continue; // skip empty lines and comments
-					for (;len && isspace(url[len - 1]); len--);  // skip trailing spaces
-					// debug_printf("len=%zd url=%s\n", len, buf);
-
-					url[len] = 0;
-					add_url_to_queue(url, config.base, config.input_encoding);
-				}
-				close(fd);
-			} else
+			if ((input_fd = open(config.input_file, O_RDONLY)) < 0)
 				error_printf(_("Failed to open input file %s\n"), config.input_file);
 		}
+
+		if (input_fd >= 0) {
+			// read URLs asynchronously and process each URL immediately when it arrives,
+			// downloads start before the input has been read completely
+			input_running = 1;
+			if ((rc = wget_thread_start(&input_tid, input_thread, NULL, 0)) != 0) {
+				error_printf(_("Failed to start downloader, error %d\n"), rc);
+				input_running = 0;
+			} else {
+				async_urls = true;
+			}
+		}
 	}
 
-	if (queue_size() == 0 && !input_tid) {
+	if (queue_size() == 0 && !input_running) {
 		error_printf(_("Nothing to do - goodbye\n"));
 		goto out;
 	}
@@ -976,43 +1313,95 @@ int main(int argc, const char *const *argv)
 	}
 
 	downloaders = xcalloc(config.num_threads, sizeof(DOWNLOADER));
+	queue_init(config.num_threads);
 
-	while (!queue_empty() || input_tid) {
-		for (n = 0; n < config.num_threads; n++) {
-			downloaders[n].id = n;
+	for (n = 0; n < config.num_threads; n++)
+		downloaders[n].id = n;
 
-			// start worker threads (I call them 'downloaders')
-			if ((rc = wget_thread_start(&downloaders[n].tid, downloader_thread, &downloaders[n], 0)) != 0) {
-				error_printf(_("Failed to start downloader, error %d\n"), rc);
-			}
+#ifdef HAVE_SYS_EPOLL_H
+	if (config.io_engine == IO_ENGINE_EPOLL) {
+		struct rlimit rl;
+
+		// each connection needs a file descriptor
+		if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+			rl.rlim_cur = rl.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &rl);
 		}
+	}
+#endif
 
-		wget_thread_mutex_lock(&main_mutex);
-		while (!terminate) {
-			// queue_print();
-			if (queue_empty() && !input_tid) {
-				break;
+	// with --adaptive-threads we start small, autoscale() adds downloaders when they pay off
+	if (config.adaptive_threads && config.min_threads < config.num_threads)
+		downloaders_grow(config.min_threads);
+	else
+		downloaders_grow(config.num_threads);
+
+	wget_thread_mutex_lock(&main_mutex);
+	while (!terminate) {
+		long long now, next = 0;
+
+		// queue_print();
+		if (queue_empty() && !input_running) {
+			break;
+		}
+
+		if (config.progress)
+			bar_printf(config.num_threads, "Files: %d  Bytes: %llu  Redirects: %d  Todo: %d", stats.ndownloads, quota, stats.nredirects, queue_size());
+
+		if (config.quota && quota >= config.quota) {
+			info_printf(_("Quota of %llu bytes reached - stopping.\n"), config.quota);
+			break;
+		}
+
+		now = wget_get_timemillis();
+
+		if (config.adaptive_threads) {
+			if (now >= next_autoscale) {
+				autoscale(now);
+				next_autoscale = now + AUTOSCALE_INTERVAL;
 			}
 
-			if (config.progress)
-				bar_printf(config.num_threads, "Files: %d  Bytes: %llu  Redirects: %d  Todo: %d", stats.ndownloads, quota, stats.nredirects, queue_size());
+			next = next_autoscale;
+		}
 
-			if (config.quota && quota >= config.quota) {
-				info_printf(_("Quota of %llu bytes reached - stopping.\n"), config.quota);
-				break;
+		if (config.resume_state && config.checkpoint_interval > 0) {
+			if (now >= next_checkpoint) {
+				wget_thread_mutex_unlock(&main_mutex);
+				checkpoint_save(known_urls, &known_urls_mutex);
+				wget_thread_mutex_lock(&main_mutex);
+				next_checkpoint = (now = wget_get_timemillis()) + config.checkpoint_interval;
 			}
 
-			// here we sit and wait for an event from our worker threads
-			wget_thread_cond_wait(&main_cond, &main_mutex);
+			if (!next || next_checkpoint < next)
+				next = next_checkpoint;
 		}
+
+		// here we sit and wait for an event from our worker threads (or for the next autoscale round or checkpoint)
+		if (next)
+			wget_thread_cond_timedwait(&main_cond, &main_mutex, next > now ? (int) (next - now) : 0);
+		else
+			wget_thread_cond_wait(&main_cond, &main_mutex);
 	}
 
 	// stop downloaders
 	terminate = 1;
-	wget_thread_cond_signal(&worker_cond);
+	queue_stop();
 	wget_thread_mutex_unlock(&main_mutex);
 
+	if (async_urls) {
+		// a blocking read from STDIN can't be interrupted, the thread is left alone then
+		if (input_fd != STDIN_FILENO || !input_running) {
+			wget_thread_mutex_lock(&input_mutex);
+			wget_thread_cond_signal(&input_cond);
+			wget_thread_mutex_unlock(&input_mutex);
+			wget_thread_join(input_tid);
+		}
+	}
+
 	for (n = 0; n < config.num_threads; n++) {
+		if (!downloaders[n].running)
+			continue;
+
 		//		struct timespec ts;
 		//		gettime(&ts);
 		//		ts.tv_sec += 1;
@@ -1021,8 +1410,12 @@ int main(int argc, const char *const *argv)
 		//		if ((rc=pthread_timedjoin_np(downloader[n].tid, NULL, &ts))!=0)
 		if ((rc = wget_thread_join(downloaders[n].tid)) != 0)
 			error_printf(_("Failed to wait for downloader #%d (%d %d)\n"), n, rc, errno);
+		downloaders[n].running = 0;
 	}
 
+	if (config.resume_state)
+		checkpoint_save(known_urls, &known_urls_mutex);
+
 	if (config.progress)
 		bar_printf(config.num_threads, "Files: %d  Bytes: %llu  Redirects: %d  Todo: %d", stats.ndownloads, quota, stats.nredirects, queue_size());
 	else if ((config.recursive || config.page_requisites || (config.input_file && quota != 0)) && quota) {
@@ -1038,11 +1431,26 @@ int main(int argc, const char *const *argv)
 	if (config.ocsp && config.ocsp_file)
 		wget_ocsp_db_save(config.ocsp_db, config.ocsp_file);
 
+	if (config.tls_resume && config.tls_session_file && wget_tls_session_db_changed(config.tls_session_db))
+		wget_tls_session_db_save(config.tls_session_db, config.tls_session_file);
+
 	if (config.delete_after && config.output_document)
 		unlink(config.output_document);
 
-	if (config.debug)
+	if (config.debug) {
+		wget_ssl_stats_t ssl_stats;
+
+		wget_ssl_get_stats(&ssl_stats);
+		if (ssl_stats.full_handshakes || ssl_stats.resumed_handshakes)
+			debug_printf("TLS handshakes: %llu full, %llu resumed (%llu sessions cached), %llu via TCP Fast Open, early data %llu accepted / %llu rejected\n",
+				ssl_stats.full_handshakes, ssl_stats.resumed_handshakes, ssl_stats.sessions_stored,
+				ssl_stats.fastopen, ssl_stats.early_data_accepted, ssl_stats.early_data_rejected);
+		if (ssl_stats.ocsp_requests || ssl_stats.ocsp_shared)
+			debug_printf("OCSP: %llu requests, %llu shared between threads, %llu ms spent\n",
+				ssl_stats.ocsp_requests, ssl_stats.ocsp_shared, ssl_stats.ocsp_time_ms);
+
 		blacklist_print();
+	}
 
 	if (config.convert_links && !config.delete_after) {
 		_convert_links();
@@ -1055,191 +1463,486 @@ int main(int argc, const char *const *argv)
 	queue_free();
 	blacklist_free();
 	hosts_free();
+	checkpoint_free();
 	xfree(downloaders);
 	bar_deinit();
 	wget_vector_clear_nofree(parents);
 	wget_vector_free(&parents);
-	wget_hashmap_free(&known_urls);
+	wget_fpset_free(&known_urls);
 	wget_stringmap_free(&etags);
+	wget_http_free_request_template(&request_template);
 	deinit();
 
 	return exit_status;
 }
 
-void *input_thread(void *p G_GNUC_WGET_UNUSED)
+// Add the URL in an input line, leading and trailing spaces, empty lines and comments are skipped.
+static void add_input_line(const char *line, size_t len)
 {
-	ssize_t len;
-	size_t bufsize = 0;
-	char *buf = NULL;
+	wget_buffer_t buf;
+	char sbuf[1024];
 
-	while ((len = wget_fdgetline(&buf, &bufsize, STDIN_FILENO)) >= 0) {
-		add_url_to_queue(buf, config.base, config.local_encoding);
-		wget_thread_cond_signal(&worker_cond);
-	}
+	for (; len && isspace(*line); line++, len--); // skip leading spaces
+	if (!len || *line == '#') return; // skip empty lines and comments
+	for (; len && isspace(line[len - 1]); len--); // skip trailing spaces
 
-	// input closed, don't read from it any more
-	debug_printf("input closed\n");
-	input_tid = 0;
-	return NULL;
+	wget_buffer_init(&buf, sbuf, sizeof(sbuf));
+	wget_buffer_memcpy(&buf, line, len);
+	add_url_to_queue(buf.data, config.base, config.input_encoding);
+	wget_buffer_deinit(&buf);
 }
 
-void *downloader_thread(void *p)
+// wait until the queue has room for more input URLs
+static void input_wait(void)
 {
-	static wget_thread_mutex_t
-		etag_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+	if (queue_size() < INPUT_QUEUE_MAX)
+		return;
 
-	DOWNLOADER *downloader = p;
-	wget_http_response_t *resp = NULL;
-	JOB *job;
-	PART *part;
-	int do_wait = 0;
+	wget_thread_mutex_lock(&input_mutex);
+	input_waiting = 1;
+	// the timeout covers a signal sent before we started waiting
+	while (queue_size() > INPUT_QUEUE_MAX / 2 && !terminate)
+		wget_thread_cond_timedwait(&input_cond, &input_mutex, 1000);
+	input_waiting = 0;
+	wget_thread_mutex_unlock(&input_mutex);
+}
 
-	downloader->tid = wget_thread_self(); // to avoid race condition
+// Read URLs from 'input_fd' (--input-file or STDIN) while the downloaders are working.
+// A regular file is mapped into memory and scanned with memchr(), which is vectorized in the common C libraries.
+void *input_thread(void *p G_GNUC_WGET_UNUSED)
+{
+#ifdef HAVE_MMAP
+	struct stat st;
+	char *data;
 
-	wget_thread_mutex_lock(&main_mutex);
+	if (fstat(input_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+		&& (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, input_fd, 0)) != MAP_FAILED)
+	{
+		const char *line = data, *end = data + st.st_size, *eol;
 
-	while (!terminate) {
-		if (queue_get(&downloader->job, &downloader->part) == 0) {
-			if (!wget_thread_support()) {
-				// not needed, but do not leave the lock not matched.
-				wget_thread_mutex_unlock(&main_mutex);
-				return NULL;
-			}
-			// here we sit and wait for a job
-			wget_thread_cond_wait(&worker_cond, &main_mutex);
-			continue;
-		}
-		wget_thread_mutex_unlock(&main_mutex);
+#ifdef MADV_SEQUENTIAL
+		madvise(data, st.st_size, MADV_SEQUENTIAL);
+#endif
 
-		if (config.wait) {
-			if (do_wait) {
-				if (config.random_wait)
-					wget_millisleep(rand() % config.wait + config.wait / 2); // (0.5 - 1.5) * config.wait
-				else
-					wget_millisleep(config.wait);
+		for (; line < end && !terminate; line = eol + 1) {
+			if (!(eol = memchr(line, '\n', end - line)))
+				eol = end;
 
-				if (terminate)
-					break;
-			} else
-				do_wait = 1;
+			input_wait();
+			add_input_line(line, eol - line);
 		}
 
-//		if (config.progress)
-//			bar_print(downloader->id, "Send header...");
-//			bar_update(downloader->id, 0, 0); // update to empty bar
+		munmap(data, st.st_size);
+	} else
+#endif
+	{
+		ssize_t len;
+		size_t bufsize = 0;
+		char *buf = NULL;
 
-		if ((part = downloader->part)) {
-			// download metalink part
-			if (download_part(downloader) == 0) {
-				wget_thread_mutex_lock(&main_mutex);
-				queue_del(downloader->job);
-				wget_thread_cond_signal(&main_cond);
-			} else {
-				wget_thread_mutex_lock(&main_mutex);
-				if (config.progress)
-					wget_thread_cond_signal(&main_cond); // needed for progress bar updates
-			}
+		while (!terminate && (len = wget_fdgetline(&buf, &bufsize, input_fd)) >= 0) {
+			input_wait();
+			add_input_line(buf, len);
+		}
 
-			continue;
-		}
+		xfree(buf);
+	}
 
-		// hey, we got a job...
-		job = downloader->job;
+	if (input_fd != STDIN_FILENO)
+		close(input_fd);
+
+	// input closed, don't read from it any more
+	debug_printf("input closed\n");
+
+	wget_thread_mutex_lock(&main_mutex);
+	input_running = 0;
+	wget_thread_cond_signal(&main_cond);
+	wget_thread_mutex_unlock(&main_mutex);
+
+	return NULL;
+}
+
+// decide if a job needs a HEAD request before downloading
+static int job_head_first(JOB *job)
+{
+	if (config.accept_patterns && !in_pattern_list(config.accept_patterns, job->iri->uri)) {
+		if (config.recursive)
+			job->head_first = 1; // enable mime-type check to assure e.g. text/html to be downloaded and parsed
+	}
+
+	if (config.reject_patterns && in_pattern_list(config.reject_patterns, job->iri->uri)) {
+		if (config.recursive)
+			job->head_first = 1; // enable mime-type check to assure e.g. text/html to be downloaded and parsed
+	}
+
+//	info_printf("head_first=%d deferred=%d iri=%s\n", job->head_first, !!job->deferred, job->iri->uri);
+	return (config.spider || config.chunk_size || job->head_first) && !job->deferred;
+}
+
+// Milliseconds to wait before the next try of a job that failed 'tries' times.
+// A Retry-After header of a 429 or 503 response takes precedence (but we wait one hour at most).
+static int retry_delay(int tries, wget_http_response_t *resp)
+{
+	if (resp && resp->retry_after > 0)
+		return resp->retry_after > 3600 ? 3600 * 1000 : resp->retry_after * 1000;
+
+	return tries * 1000 > config.waitretry ? config.waitretry : tries * 1000;
+}
 
-		if (config.accept_patterns && !in_pattern_list(config.accept_patterns, job->iri->uri)) {
-			if (config.recursive)
-				job->head_first = 1; // enable mime-type check to assure e.g. text/html to be downloaded and parsed
+// Returns 1 if a (missing) response calls for another try of the job.
+static int job_needs_retry(JOB *job, wget_http_response_t *resp)
+{
+	if (resp && resp->code != 429 && resp->code != 503)
+		return 0;
+
+	return !terminate && job->tries + 1 < config.tries;
+}
+
+// Process the response of a HEAD request.
+// Returns 1 if the document has to be downloaded, 0 if the job is done.
+// *jobp is set to NULL if the job has been handed over to the parts queue.
+static int process_head_response(JOB **jobp, wget_http_response_t *resp)
+{
+	static wget_thread_mutex_t
+		etag_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+	JOB *job = *jobp;
+
+	// Wget compatibility
+	if (resp->code/100 == 4)
+		set_exit_status(8);
+
+	if (config.spider || job->head_first) {
+		job->head_first = 0;
+
+		if (resp->code != 200 || !resp->content_type)
+			return 0;
+
+		if (wget_strcasecmp_ascii(resp->content_type, "text/html")
+			&& wget_strcasecmp_ascii(resp->content_type, "text/css")
+			&& wget_strcasecmp_ascii(resp->content_type, "application/xhtml+xml")
+			&& wget_strcasecmp_ascii(resp->content_type, "application/atom+xml")
+			&& wget_strcasecmp_ascii(resp->content_type, "application/rss+xml")
+			&& (!job->sitemap || !wget_strcasecmp_ascii(resp->content_type, "application/xml"))
+			&& (!job->sitemap || !wget_strcasecmp_ascii(resp->content_type, "application/x-gzip"))
+			&& (!job->sitemap || !wget_strcasecmp_ascii(resp->content_type, "text/plain")))
+			return 0;
+
+		if (resp->etag) {
+			wget_thread_mutex_lock(&etag_mutex);
+			if (!etags)
+				etags = wget_stringmap_create(128);
+			int rc = wget_stringmap_put_noalloc(etags, resp->etag, NULL);
+			resp->etag = NULL;
+			wget_thread_mutex_unlock(&etag_mutex);
+
+			if (rc) {
+				info_printf("Not scanning '%s' (known ETag)\n", job->iri->uri);
+				return 0;
+			}
 		}
+	} else if (config.chunk_size && resp->content_length > config.chunk_size) {
+		// create metalink structure without hashing
+		wget_metalink_piece_t piece = { .length = config.chunk_size };
+		wget_metalink_mirror_t mirror = { .location = "-", .iri = job->iri };
+		wget_metalink_t *metalink = xcalloc(1, sizeof(wget_metalink_t));
+		metalink->size = resp->content_length; // total file size
+		metalink->name = wget_strdup(job->local_filename);
 
-		if (config.reject_patterns && in_pattern_list(config.reject_patterns, job->iri->uri)) {
-			if (config.recursive)
-				job->head_first = 1; // enable mime-type check to assure e.g. text/html to be downloaded and parsed
+		ssize_t npieces = (resp->content_length + config.chunk_size - 1) / config.chunk_size;
+		metalink->pieces = wget_vector_create((int) npieces, 1, NULL);
+		for (int it = 0; it < npieces; it++) {
+			piece.position = it * config.chunk_size;
+			wget_vector_add(metalink->pieces, &piece, sizeof(wget_metalink_piece_t));
 		}
 
-//		info_printf("head_first=%d deferred=%d iri=%s\n", job->head_first, !!job->deferred, job->iri->uri);
-		if ((config.spider || config.chunk_size || job->head_first) && !job->deferred) {
-			// In spider mode, we first make a HEAD request.
-			// If the Content-Type header gives us not a parsable type, we are done.
-			print_status(downloader, "[%d] Checking '%s' ...\n", downloader->id, job->iri->uri);
-			for (int tries = 0; !resp && tries < config.tries && !terminate; tries++) {
-				wget_millisleep(tries * 1000 > config.waitretry ? config.waitretry : tries * 1000);
+		metalink->mirrors = wget_vector_create(1, 1, NULL);
 
-				if (terminate)
-					break;
+		wget_vector_add(metalink->mirrors, &mirror, sizeof(wget_metalink_mirror_t));
+
+		job->metalink = metalink;
+
+		// start or resume downloading
+		if (!job_validate_file(job)) {
+			// let other downloaders pick up the parts
+			queue_add_parts(job);
+			*jobp = NULL; // do not remove this job from queue yet
+		} // else file already downloaded and checksum ok
+		return 0;
+	}
+
+	return 1;
+}
+
+// the file the body of a 200 or 206 response is saved to
+static const char *local_filename(JOB *job, wget_http_response_t *resp)
+{
+	if (config.content_disposition && resp->content_filename)
+		return resp->content_filename;
+
+	return config.output_document ? config.output_document : job->local_filename;
+}
+
+// Returns whether process_response() needs the body in memory (metalink, parsing in recursive mode)
+static int body_needed(JOB *job, wget_http_response_t *resp)
+{
+	if (resp->links || job->sitemap || job->deferred)
+		return 1;
+
+	if (!resp->content_type)
+		return 0;
 
-				resp = http_get(job->iri, NULL, downloader, "HEAD");
-				if (resp)
-					print_status(downloader, "HTTP response %d %s\n", resp->code, resp->reason);
-				else if (downloader->final_error)
-					goto ready;
+	if (!wget_strcasecmp_ascii(resp->content_type, "application/metalink4+xml")
+		|| !wget_strcasecmp_ascii(resp->content_type, "application/metalink+xml"))
+		return 1;
+
+	if (config.recursive && (!config.level || job->level < config.level + config.page_requisites)) {
+		return !wget_strcasecmp_ascii(resp->content_type, "text/html")
+			|| !wget_strcasecmp_ascii(resp->content_type, "application/xhtml+xml")
+			|| !wget_strcasecmp_ascii(resp->content_type, "text/css")
+			|| !wget_strcasecmp_ascii(resp->content_type, "application/atom+xml")
+			|| !wget_strcasecmp_ascii(resp->content_type, "application/rss+xml");
+	}
+
+	return 0;
+}
+
+// Process the final response of a download (save, parse, metalink, ...).
+// *jobp is set to NULL if the job has been handed over to the parts queue.
+static void process_response(JOB **jobp, wget_http_response_t *resp)
+{
+	JOB *job = *jobp;
+
+	wget_cookie_normalize_cookies(job->iri, resp->cookies); // sanitize cookies
+	wget_cookie_store_cookies(config.cookie_db, resp->cookies); // store cookies
+
+	// care for HSTS feature
+	if (config.hsts && job->iri->scheme == WGET_IRI_SCHEME_HTTPS && resp->hsts) {
+		wget_hsts_db_add(config.hsts_db, wget_hsts_new(job->iri->host, atoi(job->iri->resolv_port), resp->hsts_maxage, resp->hsts_include_subdomains));
+		hsts_changed = 1;
+	}
+
+	// check if we got a RFC 6249 Metalink response
+	// HTTP/1.1 302 Found
+	// Date: Fri, 20 Apr 2012 15:00:40 GMT
+	// Server: Apache/2.2.22 (Linux/SUSE) mod_ssl/2.2.22 OpenSSL/1.0.0e DAV/2 SVN/1.7.4 mod_wsgi/3.3 Python/2.7.2 mod_asn/1.5 mod_mirrorbrain/2.17.0 mod_fastcgi/2.4.2
+	// X-Prefix: 87.128.0.0/10
+	// X-AS: 3320
+	// X-MirrorBrain-Mirror: ftp.suse.com
+	// X-MirrorBrain-Realm: country
+	// Link: <http://go-oo.mirrorbrain.org/evolution/stable/Evolution-2.24.0.exe.meta4>; rel=describedby; type="application/metalink4+xml"
+	// Link: <http://go-oo.mirrorbrain.org/evolution/stable/Evolution-2.24.0.exe.torrent>; rel=describedby; type="application/x-bittorrent"
+	// Link: <http://ftp.suse.com/pub/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=1; geo=de
+	// Link: <http://ftp.hosteurope.de/mirror/ftp.suse.com/pub/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=2; geo=de
+	// Link: <http://ftp.isr.ist.utl.pt/pub/MIRRORS/ftp.suse.com/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=3; geo=pt
+	// Link: <http://suse.mirrors.tds.net/pub/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=4; geo=us
+	// Link: <http://ftp.kddilabs.jp/Linux/distributions/ftp.suse.com/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=5; geo=jp
+	// Digest: MD5=/sr/WFcZH1MKTyt3JHL2tA==
+	// Digest: SHA=pvNwuuHWoXkNJMYSZQvr3xPzLZY=
+	// Digest: SHA-256=5QgXpvMLXWCi1GpNZI9mtzdhFFdtz6tuNwCKIYbbZfU=
+	// Location: http://ftp.suse.com/pub/projects/go-oo/evolution/stable/Evolution-2.24.0.exe
+	// Content-Type: text/html; charset=iso-8859-1
+
+	if (resp->links) {
+		// Found a Metalink answer (RFC 6249 Metalink/HTTP: Mirrors and Hashes).
+		// We try to find and download the .meta4 file (RFC 5854).
+		// If we can't find the .meta4, download from the link with the highest priority.
+
+		wget_http_link_t *top_link = NULL, *metalink = NULL;
+		int it;
+
+		for (it = 0; it < wget_vector_size(resp->links); it++) {
+			wget_http_link_t *link = wget_vector_get(resp->links, it);
+			if (link->rel == link_rel_describedby) {
+				if (link->type && (!wget_strcasecmp_ascii(link->type, "application/metalink4+xml") ||
+					 !wget_strcasecmp_ascii(link->type, "application/metalink+xml")))
+				{
+					// found a link to a metalink4 description
+					metalink = link;
+					break;
+				}
+			} else if (link->rel == link_rel_duplicate) {
+				if (!top_link || top_link->pri > link->pri)
+					// just save the top priority link
+					top_link = link;
 			}
+		}
 
-			if (!resp)
-				goto ready;
+		if (metalink) {
+			// found a link to a metalink3 or metalink4 description, create a new job
+			add_url(job, "utf-8", metalink->uri, 0);
+			return;
+		} else if (top_link) {
+			// no metalink4 description found, create a new job
+			add_url(job, "utf-8", top_link->uri, 0);
+			return;
+		}
+	}
 
-			// Wget compatibility
-			if (resp->code/100 == 4)
-				set_exit_status(8);
-
-			if (config.spider || job->head_first) {
-				job->head_first = 0;
-
-				if (resp->code != 200 || !resp->content_type)
-					goto ready;
-
-				if (wget_strcasecmp_ascii(resp->content_type, "text/html")
-					&& wget_strcasecmp_ascii(resp->content_type, "text/css")
-					&& wget_strcasecmp_ascii(resp->content_type, "application/xhtml+xml")
-					&& wget_strcasecmp_ascii(resp->content_type, "application/atom+xml")
-					&& wget_strcasecmp_ascii(resp->content_type, "application/rss+xml")
-					&& (!job->sitemap || !wget_strcasecmp_ascii(resp->content_type, "application/xml"))
-					&& (!job->sitemap || !wget_strcasecmp_ascii(resp->content_type, "application/x-gzip"))
-					&& (!job->sitemap || !wget_strcasecmp_ascii(resp->content_type, "text/plain")))
-					goto ready;
-
-				if (resp->etag) {
-					wget_thread_mutex_lock(&etag_mutex);
-					if (!etags)
-						etags = wget_stringmap_create(128);
-					int rc = wget_stringmap_put_noalloc(etags, resp->etag, NULL);
-					resp->etag = NULL;
-					wget_thread_mutex_unlock(&etag_mutex);
+	if (resp->content_type) {
+		if (!wget_strcasecmp_ascii(resp->content_type, "application/metalink4+xml")) {
+			// print_status(downloader, "get metalink4 info\n");
+			// save_file(resp, job->local_filename, O_TRUNC);
+			job->metalink = metalink4_parse(resp->body->data);
+		}
+		else if (!wget_strcasecmp_ascii(resp->content_type, "application/metalink+xml")) {
+			// print_status(downloader, "get metalink3 info\n");
+			// save_file(resp, job->local_filename, O_TRUNC);
+			job->metalink = metalink3_parse(resp->body->data);
+		}
+		if (job->metalink) {
+			if (job->metalink->size <= 0) {
+				error_printf("File length %llu - remove job\n", (unsigned long long)job->metalink->size);
+			} else if (!job->metalink->mirrors) {
+				error_printf("No download mirrors found - remove job\n");
+			} else {
+				// just loaded a metalink description, create parts and sort mirrors
 
-					if (rc) {
-						info_printf("Not scanning '%s' (known ETag)\n", job->iri->uri);
-						goto ready;
+				// start or resume downloading
+				if (!job_validate_file(job)) {
+					// sort mirrors by priority to download from highest priority first
+					wget_metalink_sort_mirrors(job->metalink);
+
+					// let other downloaders pick up the parts
+					queue_add_parts(job);
+
+					*jobp = NULL; // do not remove this job from queue yet
+				} // else file already downloaded and checksum ok
+			}
+			return;
+		}
+	}
+
+	if (resp->code == 200) {
+		if (!job->saved)
+			save_file(resp, local_filename(job, resp));
+
+		if (config.recursive && (!config.level || job->level < config.level + config.page_requisites)) {
+			if (resp->content_type) {
+				if (!wget_strcasecmp_ascii(resp->content_type, "text/html")) {
+					html_parse(job, job->level, resp->body->data, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
+				} else if (!wget_strcasecmp_ascii(resp->content_type, "application/xhtml+xml")) {
+					html_parse(job, job->level, resp->body->data, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
+					// xml_parse(sockfd, resp, job->iri);
+				} else if (!wget_strcasecmp_ascii(resp->content_type, "text/css")) {
+					css_parse(job, resp->body->data, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
+				} else if (!wget_strcasecmp_ascii(resp->content_type, "application/atom+xml")) { // see RFC4287, http://de.wikipedia.org/wiki/Atom_%28Format%29
+					atom_parse(job, resp->body->data, "utf-8", job->iri);
+				} else if (!wget_strcasecmp_ascii(resp->content_type, "application/rss+xml")) { // see http://cyber.law.harvard.edu/rss/rss.html
+					rss_parse(job, resp->body->data, "utf-8", job->iri);
+				} else if (job->sitemap) {
+					if (!wget_strcasecmp_ascii(resp->content_type, "application/xml"))
+						sitemap_parse_xml(job, resp->body->data, "utf-8", job->iri);
+					else if (!wget_strcasecmp_ascii(resp->content_type, "application/x-gzip"))
+						sitemap_parse_xml_gz(job, resp->body, "utf-8", job->iri);
+					else if (!wget_strcasecmp_ascii(resp->content_type, "text/plain"))
+						sitemap_parse_text(job, resp->body->data, "utf-8", job->iri);
+				} else if (job->deferred && !wget_strcasecmp_ascii(resp->content_type, "text/plain")) {
+					debug_printf("Scanning robots.txt ...\n");
+					if ((job->host->robots = wget_robots_parse(resp->body->data))) {
+						// add sitemaps to be downloaded (format http://www.sitemaps.org/protocol.html)
+						for (int it = 0; it < wget_vector_size(job->host->robots->sitemaps); it++) {
+							const char *sitemap = wget_vector_get(job->host->robots->sitemaps, it);
+							info_printf("adding sitemap '%s'\n", sitemap);
+//	debug_printf("XXX adding %s\n", sitemap);
+							add_url(job, "utf-8", sitemap, URL_FLG_SITEMAP); // see http://www.sitemaps.org/protocol.html#escaping
+						}
+//	debug_printf("XXX 4\n");
+//							info_printf("host->robots %p\n", job->host->robots);
 					}
 				}
-			} else if (config.chunk_size && resp->content_length > config.chunk_size) {
-				// create metalink structure without hashing
-				wget_metalink_piece_t piece = { .length = config.chunk_size };
-				wget_metalink_mirror_t mirror = { .location = "-", .iri = job->iri };
-				wget_metalink_t *metalink = xcalloc(1, sizeof(wget_metalink_t));
-				metalink->size = resp->content_length; // total file size
-				metalink->name = wget_strdup(job->local_filename);
-
-				ssize_t npieces = (resp->content_length + config.chunk_size - 1) / config.chunk_size;
-				metalink->pieces = wget_vector_create((int) npieces, 1, NULL);
-				for (int it = 0; it < npieces; it++) {
-					piece.position = it * config.chunk_size;
-					wget_vector_add(metalink->pieces, &piece, sizeof(wget_metalink_piece_t));
+			}
+		}
+	}
+	else if (resp->code == 206 && config.continue_download) { // partial content
+		if (!job->saved)
+			append_file(resp, local_filename(job, resp));
+	}
+	else if (resp->code == 304 && config.timestamping) { // local document is up-to-date
+		if (config.recursive && (!config.level || job->level < config.level + config.page_requisites) && job->local_filename) {
+			const char *ext;
+
+			if (config.content_disposition && resp->content_filename)
+				ext = strrchr(resp->content_filename, '.');
+			else
+				ext = strrchr(job->local_filename, '.');
+
+			if (ext) {
+				if (!wget_strcasecmp_ascii(ext, ".html") || !wget_strcasecmp_ascii(ext, ".htm")) {
+					html_parse_localfile(job, job->level, job->local_filename, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
+				} else if (!wget_strcasecmp_ascii(ext, ".css")) {
+					css_parse_localfile(job, job->local_filename, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
 				}
+			}
+		}
+	} else if (resp->code == 404) {
+		if (!job->deferred) // ignore errors on robots.txt
+			set_exit_status(8);
+	}
+}
+
+void *downloader_thread(void *p)
+{
+	DOWNLOADER *downloader = p;
+	wget_http_response_t *resp = NULL;
+	JOB *job;
+	PART *part;
 
-				metalink->mirrors = wget_vector_create(1, 1, NULL);
+	downloader->tid = wget_thread_self(); // to avoid race condition
 
-				wget_vector_add(metalink->mirrors, &mirror, sizeof(wget_metalink_mirror_t));
+	while (!terminate && !queue_retired(downloader->id)) {
+		if (downloader->pipeline) {
+			// the responses to the requests sent ahead are next on the connection
+			downloader->job = ((PIPELINED *) wget_list_getfirst(downloader->pipeline))->job;
+			downloader->part = NULL;
+		} else if (queue_get(downloader->id, &downloader->job, &downloader->part) == 0) {
+			if (!wget_thread_support() && queue_empty())
+				return NULL;
 
-				job->metalink = metalink;
+			// here we sit and wait for a job or for a host to become ready (--wait, Crawl-delay)
+			queue_wait(downloader->id);
+			continue;
+		}
 
-				// start or resume downloading
-				if (!job_validate_file(job)) {
-					// wake up sleeping workers
-					wget_thread_cond_signal(&worker_cond);
-					job = NULL; // do not remove this job from queue yet
-				} // else file already downloaded and checksum ok
-				goto ready;
+//		if (config.progress)
+//			bar_print(downloader->id, "Send header...");
+//			bar_update(downloader->id, 0, 0); // update to empty bar
+
+		if ((part = downloader->part)) {
+			// download metalink part
+			if (download_part(downloader) == 0) {
+				job_done(downloader->job);
+				wget_thread_mutex_lock(&main_mutex);
+				wget_thread_cond_signal(&main_cond);
+				wget_thread_mutex_unlock(&main_mutex);
+			} else if (config.progress) {
+				wget_thread_mutex_lock(&main_mutex);
+				wget_thread_cond_signal(&main_cond); // needed for progress bar updates
+				wget_thread_mutex_unlock(&main_mutex);
 			}
 
+			continue;
+		}
+
+		// hey, we got a job...
+		job = downloader->job;
+
+		if (job_head_first(job)) {
+			// In spider mode, we first make a HEAD request.
+			// If the Content-Type header gives us not a parsable type, we are done.
+			print_status(downloader, "[%d] Checking '%s' ...\n", downloader->id, job->iri->uri);
+
+			resp = http_get(job->iri, NULL, downloader, "HEAD");
+			if (resp)
+				print_status(downloader, "HTTP response %d %s\n", resp->code, resp->reason);
+			else if (downloader->final_error)
+				goto ready;
+
+			if (job_needs_retry(job, resp))
+				goto retry;
+
+			if (!resp || !process_head_response(&job, resp))
+				goto ready;
+
 			wget_http_free_response(&resp);
 		}
 
@@ -1251,213 +1954,465 @@ void *downloader_thread(void *p)
 		else
 			print_status(downloader, "[%d] Downloading '%s' ...\n", downloader->id, job->iri->uri);
 
-		for (int tries = 0; !resp && tries < config.tries && !terminate; tries++) {
-			wget_millisleep(tries * 1000 > config.waitretry ? config.waitretry : tries * 1000);
-
-			if (terminate)
-				break;
+		resp = http_get(job->iri, NULL, downloader, NULL);
+		if (resp)
+			print_status(downloader, "HTTP response %d %s\n", resp->code, resp->reason);
+		else if (downloader->final_error)
+			goto ready;
 
-			resp = http_get(job->iri, NULL, downloader, NULL);
-			if (resp)
-				print_status(downloader, "HTTP response %d %s\n", resp->code, resp->reason);
-			else if (downloader->final_error)
-				goto ready;
-		}
+		if (job_needs_retry(job, resp))
+			goto retry;
 
 		if (!resp) {
 			print_status(downloader, "[%d] Failed to download\n", downloader->id);
 			goto ready;
 		}
 
-		wget_cookie_normalize_cookies(job->iri, resp->cookies); // sanitize cookies
-		wget_cookie_store_cookies(config.cookie_db, resp->cookies); // store cookies
-
-		// care for HSTS feature
-		if (config.hsts && job->iri->scheme == WGET_IRI_SCHEME_HTTPS && resp->hsts) {
-			wget_hsts_db_add(config.hsts_db, wget_hsts_new(job->iri->host, atoi(job->iri->resolv_port), resp->hsts_maxage, resp->hsts_include_subdomains));
-			hsts_changed = 1;
-		}
-
-		// check if we got a RFC 6249 Metalink response
-		// HTTP/1.1 302 Found
-		// Date: Fri, 20 Apr 2012 15:00:40 GMT
-		// Server: Apache/2.2.22 (Linux/SUSE) mod_ssl/2.2.22 OpenSSL/1.0.0e DAV/2 SVN/1.7.4 mod_wsgi/3.3 Python/2.7.2 mod_asn/1.5 mod_mirrorbrain/2.17.0 mod_fastcgi/2.4.2
-		// X-Prefix: 87.128.0.0/10
-		// X-AS: 3320
-		// X-MirrorBrain-Mirror: ftp.suse.com
-		// X-MirrorBrain-Realm: country
-		// Link: <http://go-oo.mirrorbrain.org/evolution/stable/Evolution-2.24.0.exe.meta4>; rel=describedby; type="application/metalink4+xml"
-		// Link: <http://go-oo.mirrorbrain.org/evolution/stable/Evolution-2.24.0.exe.torrent>; rel=describedby; type="application/x-bittorrent"
-		// Link: <http://ftp.suse.com/pub/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=1; geo=de
-		// Link: <http://ftp.hosteurope.de/mirror/ftp.suse.com/pub/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=2; geo=de
-		// Link: <http://ftp.isr.ist.utl.pt/pub/MIRRORS/ftp.suse.com/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=3; geo=pt
-		// Link: <http://suse.mirrors.tds.net/pub/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=4; geo=us
-		// Link: <http://ftp.kddilabs.jp/Linux/distributions/ftp.suse.com/projects/go-oo/evolution/stable/Evolution-2.24.0.exe>; rel=duplicate; pri=5; geo=jp
-		// Digest: MD5=/sr/WFcZH1MKTyt3JHL2tA==
-		// Digest: SHA=pvNwuuHWoXkNJMYSZQvr3xPzLZY=
-		// Digest: SHA-256=5QgXpvMLXWCi1GpNZI9mtzdhFFdtz6tuNwCKIYbbZfU=
-		// Location: http://ftp.suse.com/pub/projects/go-oo/evolution/stable/Evolution-2.24.0.exe
-		// Content-Type: text/html; charset=iso-8859-1
-
-		if (resp->links) {
-			// Found a Metalink answer (RFC 6249 Metalink/HTTP: Mirrors and Hashes).
-			// We try to find and download the .meta4 file (RFC 5854).
-			// If we can't find the .meta4, download from the link with the highest priority.
-
-			wget_http_link_t *top_link = NULL, *metalink = NULL;
-			int it;
-
-			for (it = 0; it < wget_vector_size(resp->links); it++) {
-				wget_http_link_t *link = wget_vector_get(resp->links, it);
-				if (link->rel == link_rel_describedby) {
-					if (link->type && (!wget_strcasecmp_ascii(link->type, "application/metalink4+xml") ||
-						 !wget_strcasecmp_ascii(link->type, "application/metalink+xml")))
-					{
-						// found a link to a metalink4 description
-						metalink = link;
-						break;
-					}
-				} else if (link->rel == link_rel_duplicate) {
-					if (!top_link || top_link->pri > link->pri)
-						// just save the top priority link
-						top_link = link;
-				}
-			}
+		process_response(&job, resp);
 
-			if (metalink) {
-				// found a link to a metalink3 or metalink4 description, create a new job
-				add_url(job, "utf-8", metalink->uri, 0);
-				goto ready;
-			} else if (top_link) {
-				// no metalink4 description found, create a new job
-				add_url(job, "utf-8", top_link->uri, 0);
-				goto ready;
+		// regular download
+ready:
+		wget_http_free_response(&resp);
+
+		// download of single-part file complete, remove from job queue
+		job_done(job);
+
+		// tell the main thread, it checks for termination and quota
+		wget_thread_mutex_lock(&main_mutex);
+		wget_thread_cond_signal(&main_cond);
+		wget_thread_mutex_unlock(&main_mutex);
+		continue;
+
+		// the queue hands out the job again when the retry is due, meanwhile we do other work
+retry:
+		job->tries++;
+		queue_retry(job, NULL, retry_delay(job->tries, resp));
+		wget_http_free_response(&resp);
+	}
+
+	pipeline_cancel(downloader);
+	wget_http_pool_checkin(&downloader->conn);
+	downloader_exit(downloader);
+
+	return NULL;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+// Event driven engine (--io-engine=epoll).
+// Each downloader thread drives up to config.max_connections non-blocking connections
+// with a single epoll instance. Jobs come from the same queue as in threaded mode,
+// the responses are processed by the same functions.
+// A transfer to a host that is not in the DNS cache waits until the resolver threads
+// have looked it up, so the connect doesn't block.
+// Limitations: HTTP/1.1 only, metalink parts are downloaded with the blocking code,
+// OCSP requests would block (--ocsp is refused, see init()).
+
+typedef struct {
+	JOB
+		*job;
+	wget_http_connection_t
+		*conn; // kept open after a job for the next job to the same host
+	wget_http_request_t
+		*req;
+	wget_vector_t
+		*challenges;
+	const char
+		*iri_scheme; // original scheme if changed by HSTS
+	struct _body_callback_context
+		body; // receives the body of the GET response
+	long long
+		deadline; // ms, read/write timeout
+	int
+		events; // registered epoll events
+	char
+		head, // HEAD request is sent before GET
+		resolving; // waits for the DNS resolution of the server
+} TRANSFER;
+
+typedef struct {
+	DOWNLOADER
+		*downloader;
+	TRANSFER
+		*transfers;
+	int
+		*free_slots, // stack of unused transfers
+		nfree,
+		nresolving, // transfers waiting for DNS resolution
+		epfd;
+} REACTOR;
+
+static void transfer_close(REACTOR *reactor, TRANSFER *t)
+{
+	if (t->conn) {
+		// closing the socket removes it from the epoll set
+		wget_http_close(&t->conn);
+		t->events = 0;
+	}
+}
+
+// free the slot of a transfer, the connection is kept for the next job
+static void transfer_release(REACTOR *reactor, TRANSFER *t)
+{
+	if (t->iri_scheme)
+		wget_iri_set_scheme(t->job->iri, t->iri_scheme); // may have been changed by HSTS
+
+	_body_context_finish(&t->body, NULL, NULL); // close a file left open by a failed transfer
+	wget_http_free_request(&t->req);
+	wget_http_free_challenges(&t->challenges);
+	t->iri_scheme = NULL;
+	t->job = NULL;
+	t->deadline = 0;
+
+	reactor->free_slots[reactor->nfree++] = t - reactor->transfers;
+}
+
+static void transfer_done(REACTOR *reactor, TRANSFER *t, JOB *job)
+{
+	transfer_release(reactor, t);
+
+	job_done(job);
+
+	// tell the main thread, it checks for termination and quota
+	wget_thread_mutex_lock(&main_mutex);
+	wget_thread_cond_signal(&main_cond);
+	wget_thread_mutex_unlock(&main_mutex);
+}
+
+static void
+	transfer_process(REACTOR *reactor, TRANSFER *t),
+	transfer_failed(REACTOR *reactor, TRANSFER *t, int rc);
+
+static void transfer_request(REACTOR *reactor, TRANSFER *t)
+{
+	wget_iri_t *iri = t->job->iri;
+	wget_http_connection_t *conn = t->conn;
+	const void *body = NULL;
+	char *data = NULL;
+	size_t length = 0;
+	int rc;
+
+	if (conn && !wget_strcmp(conn->esc_host, iri->host) &&
+		conn->scheme == iri->scheme &&
+		!wget_strcmp(conn->port, iri->resolv_port))
+	{
+		debug_printf("reuse connection %s\n", conn->esc_host);
+	} else {
+		transfer_close(reactor, t);
+
+		if (t->resolving) {
+			// resolved meanwhile, the connect finds the address in the DNS cache
+			t->resolving = 0;
+			reactor->nresolving--;
+		} else {
+			wget_http_prefetch(iri);
+
+			if (wget_http_resolving(iri)) {
+				// don't let one lookup stall all connections, we come back when the address is known
+				t->resolving = 1;
+				reactor->nresolving++;
+				return;
 			}
 		}
 
-		if (resp->content_type) {
-			if (!wget_strcasecmp_ascii(resp->content_type, "application/metalink4+xml")) {
-				// print_status(downloader, "get metalink4 info\n");
-				// save_file(resp, job->local_filename, O_TRUNC);
-				job->metalink = metalink4_parse(resp->body->data);
-			}
-			else if (!wget_strcasecmp_ascii(resp->content_type, "application/metalink+xml")) {
-				// print_status(downloader, "get metalink3 info\n");
-				// save_file(resp, job->local_filename, O_TRUNC);
-				job->metalink = metalink3_parse(resp->body->data);
-			}
-			if (job->metalink) {
-				if (job->metalink->size <= 0) {
-					error_printf("File length %llu - remove job\n", (unsigned long long)job->metalink->size);
-				} else if (!job->metalink->mirrors) {
-					error_printf("No download mirrors found - remove job\n");
-				} else {
-					// just loaded a metalink description, create parts and sort mirrors
+		if ((rc = wget_http_open_async(&t->conn, iri)) != WGET_E_SUCCESS) {
+			debug_printf("Failed to http_open (%d)\n", rc);
+			transfer_failed(reactor, t, rc);
+			return;
+		}
 
-					// start or resume downloading
-					if (!job_validate_file(job)) {
-						// sort mirrors by priority to download from highest priority first
-						wget_metalink_sort_mirrors(job->metalink);
+		struct epoll_event ev = { .events = t->events = EPOLLOUT, .data.ptr = t };
+		epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, wget_tcp_get_sockfd(t->conn->tcp), &ev);
+	}
 
-						// wake up sleeping workers
-						wget_thread_cond_signal(&worker_cond);
+	t->req = http_create_request(iri, t->head ? "HEAD" : NULL, t->job, NULL, t->challenges);
 
-						job = NULL; // do not remove this job from queue yet
-					} // else file already downloaded and checksum ok
-				}
-				goto ready;
-			}
+	if (config.post_data && !t->head) {
+		body = config.post_data;
+		length = strlen(config.post_data);
+	} else if (config.post_file && !t->head) {
+		if (!(body = data = wget_read_file(config.post_file, &length))) {
+			transfer_done(reactor, t, t->job);
+			return;
 		}
+	}
 
-		if (resp->code == 200) {
-			if (config.content_disposition && resp->content_filename)
-				save_file(resp, resp->content_filename);
-			else
-				save_file(resp, config.output_document ? config.output_document : job->local_filename);
-
-			if (config.recursive && (!config.level || job->level < config.level + config.page_requisites)) {
-				if (resp->content_type) {
-					if (!wget_strcasecmp_ascii(resp->content_type, "text/html")) {
-						html_parse(job, job->level, resp->body->data, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
-					} else if (!wget_strcasecmp_ascii(resp->content_type, "application/xhtml+xml")) {
-						html_parse(job, job->level, resp->body->data, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
-						// xml_parse(sockfd, resp, job->iri);
-					} else if (!wget_strcasecmp_ascii(resp->content_type, "text/css")) {
-						css_parse(job, resp->body->data, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
-					} else if (!wget_strcasecmp_ascii(resp->content_type, "application/atom+xml")) { // see RFC4287, http://de.wikipedia.org/wiki/Atom_%28Format%29
-						atom_parse(job, resp->body->data, "utf-8", job->iri);
-					} else if (!wget_strcasecmp_ascii(resp->content_type, "application/rss+xml")) { // see http://cyber.law.harvard.edu/rss/rss.html
-						rss_parse(job, resp->body->data, "utf-8", job->iri);
-					} else if (job->sitemap) {
-						if (!wget_strcasecmp_ascii(resp->content_type, "application/xml"))
-							sitemap_parse_xml(job, resp->body->data, "utf-8", job->iri);
-						else if (!wget_strcasecmp_ascii(resp->content_type, "application/x-gzip"))
-							sitemap_parse_xml_gz(job, resp->body, "utf-8", job->iri);
-						else if (!wget_strcasecmp_ascii(resp->content_type, "text/plain"))
-							sitemap_parse_text(job, resp->body->data, "utf-8", job->iri);
-					} else if (job->deferred && !wget_strcasecmp_ascii(resp->content_type, "text/plain")) {
-						debug_printf("Scanning robots.txt ...\n");
-						if ((job->host->robots = wget_robots_parse(resp->body->data))) {
-							// add sitemaps to be downloaded (format http://www.sitemaps.org/protocol.html)
-							for (int it = 0; it < wget_vector_size(job->host->robots->sitemaps); it++) {
-								const char *sitemap = wget_vector_get(job->host->robots->sitemaps, it);
-								info_printf("adding sitemap '%s'\n", sitemap);
-//	debug_printf("XXX adding %s\n", sitemap);
-								add_url(job, "utf-8", sitemap, URL_FLG_SITEMAP); // see http://www.sitemaps.org/protocol.html#escaping
-							}
-//	debug_printf("XXX 4\n");
-//							info_printf("host->robots %p\n", job->host->robots);
-						}
-					}
-				}
+	if (body) {
+		wget_http_add_header(t->req, "Content-Type", "application/x-www-form-urlencoded");
+		wget_http_add_header_printf(t->req, "Content-Length", "%zu", length);
+	}
+
+	if (t->head)
+		rc = wget_http_send_request_async(t->conn, t->req, body, length,
+			config.save_headers || config.server_response ? WGET_HTTP_RESPONSE_KEEPHEADER : 0, NULL, NULL, NULL);
+	else {
+		// bodies that are not parsed go straight to disk
+		_body_context_finish(&t->body, NULL, NULL);
+		_body_context_init(&t->body, NULL, t->job, 1);
+		rc = wget_http_send_request_async(t->conn, t->req, body, length,
+			config.save_headers || config.server_response ? WGET_HTTP_RESPONSE_KEEPHEADER : 0, _get_header, _get_body, &t->body);
+	}
+
+	xfree(data);
+
+	if (rc == WGET_E_SUCCESS)
+		transfer_process(reactor, t);
+	else
+		transfer_failed(reactor, t, rc);
+}
+
+static void transfer_start(REACTOR *reactor, TRANSFER *t, JOB *job)
+{
+	DOWNLOADER *downloader = reactor->downloader;
+	wget_iri_t *iri = job->iri;
+
+	t->job = job;
+	t->head = job_head_first(job);
+
+	if (config.hsts && iri->scheme == WGET_IRI_SCHEME_HTTP && wget_hsts_host_match(config.hsts_db, iri->host, atoi(iri->resolv_port))) {
+		info_printf("HSTS in effect for %s:%s\n", iri->host, iri->resolv_port);
+		t->iri_scheme = wget_iri_set_scheme(iri, WGET_IRI_SCHEME_HTTPS);
+	}
+
+	if (t->head)
+		print_status(downloader, "[%d] Checking '%s' ...\n", downloader->id, iri->uri);
+	else
+		print_status(downloader, "[%d] Downloading '%s' ...\n", downloader->id, iri->uri);
+
+	transfer_request(reactor, t);
+}
+
+// hand the job back to the queue for another try, the slot is free for other jobs meanwhile
+static void transfer_retry(REACTOR *reactor, TRANSFER *t, wget_http_response_t *resp)
+{
+	JOB *job = t->job;
+
+	transfer_release(reactor, t);
+
+	job->tries++;
+	queue_retry(job, NULL, retry_delay(job->tries, resp));
+}
+
+// the request failed: close the connection and try again later
+static void transfer_failed(REACTOR *reactor, TRANSFER *t, int rc)
+{
+	DOWNLOADER *downloader = reactor->downloader;
+
+	transfer_close(reactor, t);
+	wget_http_free_request(&t->req);
+
+	if (rc == WGET_E_HANDSHAKE || rc == WGET_E_CERTIFICATE) {
+		set_exit_status(5);
+	} else if (job_needs_retry(t->job, NULL)) {
+		transfer_retry(reactor, t, NULL);
+		return;
+	}
+
+	print_status(downloader, "[%d] Failed to download\n", downloader->id);
+	transfer_done(reactor, t, t->job);
+}
+
+static void transfer_process(REACTOR *reactor, TRANSFER *t)
+{
+	DOWNLOADER *downloader = reactor->downloader;
+	wget_http_response_t *resp;
+	JOB *job = t->job;
+	int rc, events;
+
+	if ((rc = wget_http_process(t->conn, &resp)) > 0) {
+		events = (rc & WGET_IO_READABLE ? EPOLLIN : 0) | (rc & WGET_IO_WRITABLE ? EPOLLOUT : 0);
+		if (events != t->events) {
+			struct epoll_event ev = { .events = t->events = events, .data.ptr = t };
+			epoll_ctl(reactor->epfd, EPOLL_CTL_MOD, wget_tcp_get_sockfd(t->conn->tcp), &ev);
+		}
+		if (config.read_timeout > 0)
+			t->deadline = wget_get_timemillis() + config.read_timeout;
+		return;
+	}
+
+	if (rc < 0) {
+		transfer_failed(reactor, t, rc);
+		return;
+	}
+
+	if (!t->head)
+		_body_context_finish(&t->body, resp, t->req);
+
+	wget_http_free_request(&t->req);
+	t->deadline = 0;
+
+	print_status(downloader, "HTTP response %d %s\n", resp->code, resp->reason);
+
+	if (config.server_response)
+		info_printf("# got header %zd bytes:\n%s\n\n", resp->header->length, resp->header->data);
+
+	// server doesn't support keep-alive or want us to close the connection
+	if (!resp->keep_alive)
+		transfer_close(reactor, t);
+
+	http_count_response(resp, NULL);
+
+	if (job_needs_retry(job, resp)) { // 429 Too Many Requests or 503 Service Unavailable
+		transfer_retry(reactor, t, resp);
+		wget_http_free_response(&resp);
+		return;
+	}
+
+	if (resp->code == 401 && !t->challenges && resp->challenges) { // Unauthorized
+		// try again with credentials
+		t->challenges = resp->challenges;
+		resp->challenges = NULL;
+		wget_http_free_response(&resp);
+		transfer_request(reactor, t);
+		return;
+	}
+
+	if (resp->location && resp->code / 100 == 3 && resp->code != 304 && !(resp->code == 302 && resp->links && resp->digests)) {
+		wget_buffer_t uri_buf;
+		char uri_sbuf[1024];
+
+		wget_cookie_normalize_cookies(job->iri, resp->cookies);
+		wget_cookie_store_cookies(config.cookie_db, resp->cookies);
+
+		wget_buffer_init(&uri_buf, uri_sbuf, sizeof(uri_sbuf));
+		wget_iri_relative_to_abs(job->iri, resp->location, strlen(resp->location), &uri_buf);
+		add_url(job, "utf-8", uri_buf.data, URL_FLG_REDIRECTION);
+		wget_buffer_deinit(&uri_buf);
+	}
+
+	if (t->head) {
+		t->head = 0;
+
+		if (process_head_response(&job, resp)) {
+			// now download the document
+			wget_http_free_response(&resp);
+			print_status(downloader, "[%d] Downloading '%s' ...\n", downloader->id, job->iri->uri);
+			transfer_request(reactor, t);
+			return;
+		}
+	} else
+		process_response(&job, resp);
+
+	wget_http_free_response(&resp);
+	transfer_done(reactor, t, job);
+}
+
+void *event_thread(void *p)
+{
+	DOWNLOADER *downloader = p;
+	REACTOR reactor = { .downloader = downloader };
+	struct epoll_event events[256];
+	long long now, next_check = 0;
+	JOB *job;
+	PART *part;
+	int n, it, timeout;
+
+	downloader->tid = wget_thread_self(); // to avoid race condition
+
+	if ((reactor.epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		error_printf(_("Failed to create epoll instance (%d)\n"), errno);
+		downloader_exit(downloader);
+		return NULL;
+	}
+
+	reactor.transfers = xcalloc(config.max_connections, sizeof(TRANSFER));
+	reactor.free_slots = xmalloc(config.max_connections * sizeof(int));
+	for (it = config.max_connections - 1; it >= 0; it--)
+		reactor.free_slots[reactor.nfree++] = it;
+
+	while (!terminate) {
+		// start new transfers, the most recently used slot likely has a matching open connection
+		while (reactor.nfree > 0 && !terminate && !queue_retired(downloader->id) && queue_get(downloader->id, &job, &part)) {
+			if (part) {
+				// download metalink part the blocking way
+				downloader->job = job;
+				downloader->part = part;
+				if (download_part(downloader) == 0)
+					job_done(job);
+				wget_thread_mutex_lock(&main_mutex);
+				wget_thread_cond_signal(&main_cond);
+				wget_thread_mutex_unlock(&main_mutex);
+				continue;
 			}
+
+			transfer_start(&reactor, &reactor.transfers[reactor.free_slots[--reactor.nfree]], job);
 		}
-		else if (resp->code == 206 && config.continue_download) { // partial content
-			if (config.content_disposition && resp->content_filename)
-				append_file(resp, resp->content_filename);
+
+		if (terminate)
+			break;
+
+		if (reactor.nfree == config.max_connections) {
+			// a retired downloader exits when its transfers are done
+			if (queue_retired(downloader->id))
+				break;
+
+			// nothing to do, wait for new jobs
+			queue_wait(downloader->id);
+			continue;
+		}
+
+		// new jobs from other downloaders and finished DNS resolutions don't wake us up,
+		// so we look for them regularly
+		timeout = reactor.nresolving ? 10 : reactor.nfree ? 100 : 1000;
+
+		if ((n = epoll_wait(reactor.epfd, events, countof(events), timeout)) < 0 && errno != EINTR) {
+			error_printf(_("Failed to wait for events (%d)\n"), errno);
+			break;
+		}
+
+		for (it = 0; it < n; it++) {
+			TRANSFER *t = events[it].data.ptr;
+
+			if (t->job && t->req)
+				transfer_process(&reactor, t);
 			else
-				append_file(resp, config.output_document ? config.output_document : job->local_filename);
+				transfer_close(&reactor, t); // idle connection closed by server
 		}
-		else if (resp->code == 304 && config.timestamping) { // local document is up-to-date
-			if (config.recursive && (!config.level || job->level < config.level + config.page_requisites) && job->local_filename) {
-				const char *ext;
 
-				if (config.content_disposition && resp->content_filename)
-					ext = strrchr(resp->content_filename, '.');
-				else
-					ext = strrchr(job->local_filename, '.');
+		// connect the transfers whose server has been resolved
+		for (it = 0; reactor.nresolving && it < config.max_connections; it++) {
+			TRANSFER *t = &reactor.transfers[it];
 
-				if (ext) {
-					if (!wget_strcasecmp_ascii(ext, ".html") || !wget_strcasecmp_ascii(ext, ".htm")) {
-						html_parse_localfile(job, job->level, job->local_filename, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
-					} else if (!wget_strcasecmp_ascii(ext, ".css")) {
-						css_parse_localfile(job, job->local_filename, resp->content_type_encoding ? resp->content_type_encoding : config.remote_encoding, job->iri);
-					}
+			if (t->resolving && !wget_http_resolving(t->job->iri))
+				transfer_request(&reactor, t);
+		}
+
+		// handle timeouts
+		if ((now = wget_get_timemillis()) >= next_check) {
+			next_check = now + 1000;
+
+			for (it = 0; it < config.max_connections; it++) {
+				TRANSFER *t = &reactor.transfers[it];
+
+				if (!t->job)
+					continue;
+
+				if (t->deadline && t->deadline <= now) {
+					print_status(downloader, "[%d] Timeout on '%s'\n", downloader->id, t->job->iri->uri);
+					transfer_failed(&reactor, t, WGET_E_TIMEOUT);
 				}
 			}
-		} else if (resp->code == 404) {
-			if (!job->deferred) // ignore errors on robots.txt
-				set_exit_status(8);
 		}
+	}
 
-		// regular download
-ready:
-		wget_http_free_response(&resp);
+	for (it = 0; it < config.max_connections; it++) {
+		TRANSFER *t = &reactor.transfers[it];
 
-		// download of single-part file complete, remove from job queue
-		wget_thread_mutex_lock(&main_mutex);
-		queue_del(job);
-		wget_thread_cond_signal(&main_cond);
+		transfer_close(&reactor, t);
+		_body_context_finish(&t->body, NULL, NULL);
+		wget_http_free_request(&t->req);
+		wget_http_free_challenges(&t->challenges);
 	}
 
-	wget_thread_mutex_unlock(&main_mutex);
-	wget_http_close(&downloader->conn);
+	xfree(reactor.transfers);
+	xfree(reactor.free_slots);
+	close(reactor.epfd);
 
-	// if we terminate, tell the other downloaders
-	wget_thread_cond_signal(&worker_cond);
+	wget_http_close(&downloader->conn);
+	downloader_exit(downloader);
 
 	return NULL;
 }
+#endif /* HAVE_SYS_EPOLL_H */
 
 static void _free_conversion_entry(_conversion_t *conversion)
 {
@@ -1491,14 +2446,11 @@ static void _remember_for_conversion(const char *filename, wget_iri_t *base_url,
 	wget_thread_mutex_unlock(&mutex);
 }
 
-static unsigned int G_GNUC_WGET_PURE hash_url(const char *url)
+// Returns 1 if the URL is already known, else it is added to the known URLs.
+// To be called with known_urls_mutex locked.
+static int known_url(const char *url, size_t len)
 {
-	unsigned int hash = 0; // use 0 as SALT if hash table attacks doesn't matter
-
-	while (*url)
-		hash = hash * 101 + (unsigned char)*url++;
-
-	return hash;
+	return wget_fpset_add_fingerprint(known_urls, wget_fpset_hash(0, url, len)) != 0;
 }
 
 void html_parse(JOB *job, int level, const char *html, const char *encoding, wget_iri_t *base)
@@ -1577,7 +2529,7 @@ void html_parse(JOB *job, int level, const char *html, const char *encoding, wge
 		wget_string_t *url = &html_url->url;
 
 		// Blacklist for URLs before they are processed
-		if (wget_hashmap_put_noalloc(known_urls, wget_strmemdup(url->p, url->len), NULL)) {
+		if (known_url(url->p, url->len)) {
 			// error_printf(_("URL '%.*s' already known\n"), (int)url->len, url->p);
 			continue;
 		} else {
@@ -1664,13 +2616,14 @@ void sitemap_parse_xml(JOB *job, const char *data, const char *encoding, wget_ir
 		}
 
 		// Blacklist for URLs before they are processed
-		if (wget_hashmap_put_noalloc(known_urls, (p = wget_strmemdup(url->p, url->len)), NULL)) {
-			// the dup'ed url has already been freed when we come here
+		if (known_url(url->p, url->len)) {
 			info_printf(_("URL '%.*s' not followed (already known)\n"), (int)url->len, url->p);
 			continue;
 		}
 
+		p = wget_strmemdup(url->p, url->len);
 		add_url(job, encoding, p, 0);
+		xfree(p);
 	}
 
 	// process the sitemap index urls here
@@ -1681,13 +2634,14 @@ void sitemap_parse_xml(JOB *job, const char *data, const char *encoding, wget_ir
 		// TODO: url must have same scheme, port and host as base
 
 		// Blacklist for URLs before they are processed
-		if (wget_hashmap_put_noalloc(known_urls, (p = wget_strmemdup(url->p, url->len)), NULL)) {
-			// the dup'ed url has already been freed when we come here
+		if (known_url(url->p, url->len)) {
 			info_printf(_("URL '%.*s' not followed (already known)\n"), (int)url->len, url->p);
 			continue;
 		}
 
+		p = wget_strmemdup(url->p, url->len);
 		add_url(job, encoding, p, URL_FLG_SITEMAP);
+		xfree(p);
 	}
 	wget_thread_mutex_unlock(&known_urls_mutex);
 
@@ -1790,13 +2744,14 @@ static void _add_urls(JOB *job, wget_vector_t *urls, const char *encoding, wget_
 		}
 
 		// Blacklist for URLs before they are processed
-		if (wget_hashmap_put_noalloc(known_urls, (p = wget_strmemdup(url->p, url->len)), NULL)) {
-			// the dup'ed url has already been freed when we come here
+		if (known_url(url->p, url->len)) {
 			info_printf(_("URL '%.*s' not followed (already known)\n"), (int)url->len, url->p);
 			continue;
 		}
 
+		p = wget_strmemdup(url->p, url->len);
 		add_url(job, encoding, p, 0);
+		xfree(p);
 	}
 	wget_thread_mutex_unlock(&known_urls_mutex);
 }
@@ -1956,67 +2911,60 @@ static void set_file_mtime(int fd, time_t modified)
 		error_printf (_("Failed to set file date: %s\n"), strerror (errno));
 }
 
-static void G_GNUC_WGET_NONNULL((1)) _save_file(wget_http_response_t *resp, const char *fname, int flag)
+static wget_thread_mutex_t
+	savefile_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+
+// Open the file to save the body of 'resp' into, following the clobber, backup and timestamping rules.
+// 'length' is the number of bytes to be written, used for the quota.
+// Returns the file descriptor or -1 if the body is not to be saved. STDOUT_FILENO with *saved_fname NULL means stdout.
+// On success, *flag is the open flag in effect and *saved_fname the name of the opened file.
+// Must be called with savefile_mutex locked.
+static int G_GNUC_WGET_NONNULL((1,3,5)) _open_file(wget_http_response_t *resp, const char *fname, int *flag, size_t length, char **saved_fname)
 {
-	static wget_thread_mutex_t
-		savefile_mutex = WGET_THREAD_MUTEX_INITIALIZER;
 	char *alloced_fname = NULL;
-	int fd, multiple = 0, fnum, oflag = flag, maxloop;
+	int fd, multiple = 0, fnum, oflag = *flag, maxloop;
 	size_t fname_length;
 
+	*saved_fname = NULL;
+
 	if (!fname)
-		return;
+		return -1;
 
 	if (config.spider) {
 		debug_printf("not saved '%s' (spider mode enabled)\n", fname);
-		return;
+		return -1;
 	}
 
 	// do not save into directories
 	fname_length = strlen(fname);
 	if (fname[fname_length - 1] == '/') {
 		debug_printf("not saved '%s' (file is a directory)\n", fname);
-		return;
+		return -1;
 	}
 
 	// - optimistic approach expects data being written without error
 	// - to be Wget compatible: quota_modify_read() returns old quota value
 	if (config.quota) {
-		if (quota_modify_read(config.save_headers ? resp->header->length + resp->body->length : resp->body->length) >= config.quota) {
+		if (quota_modify_read(length) >= config.quota) {
 			debug_printf("not saved '%s' (quota of %lld reached)\n", fname, config.quota);
-			return;
+			return -1;
 		}
 	} else {
 		// just update number bytes read (body only) for display purposes
-		quota_modify_read(config.save_headers ? resp->header->length + resp->body->length : resp->body->length);
+		quota_modify_read(length);
 	}
 
 	if (fname == config.output_document) {
 		// <fname> can only be NULL if config.delete_after is set
-		if (!strcmp(fname, "-")) {
-			size_t rc;
-
-			if (config.save_headers) {
-				if ((rc = fwrite(resp->header->data, 1, resp->header->length, stdout)) != resp->header->length) {
-					error_printf(_("Failed to write to STDOUT (%zu, errno=%d)\n"), rc, errno);
-					set_exit_status(3);
-				}
-			}
-
-			if ((rc = fwrite(resp->body->data, 1, resp->body->length, stdout)) != resp->body->length) {
-				error_printf(_("Failed to write to STDOUT (%zu, errno=%d)\n"), rc, errno);
-				set_exit_status(3);
-			}
-
-			return;
-		}
+		if (!strcmp(fname, "-"))
+			return STDOUT_FILENO;
 
 		if (config.delete_after) {
 			debug_printf("not saved '%s' (--delete-after)\n", fname);
-			return;
+			return -1;
 		}
 
-		flag = O_APPEND;
+		*flag = O_APPEND;
 	}
 
 	if (config.adjust_extension && resp->content_type) {
@@ -2048,29 +2996,27 @@ static void G_GNUC_WGET_NONNULL((1)) _save_file(wget_http_response_t *resp, cons
 	if (config.accept_patterns && !in_pattern_list(config.accept_patterns, fname)) {
 		debug_printf("not saved '%s' (doesn't match accept pattern)\n", fname);
 		xfree(alloced_fname);
-		return;
+		return -1;
 	}
 
 	if (config.reject_patterns && in_pattern_list(config.reject_patterns, fname)) {
 		debug_printf("not saved '%s' (matches reject pattern)\n", fname);
 		xfree(alloced_fname);
-		return;
+		return -1;
 	}
 
-	wget_thread_mutex_lock(&savefile_mutex);
-
 	fname_length += 16;
 
 	if (config.timestamping) {
 		if (oflag == O_TRUNC)
-			flag = O_TRUNC;
+			*flag = O_TRUNC;
 	} else if (!config.clobber || (config.recursive && config.directories)) {
 		if (oflag == O_TRUNC && !(config.recursive && config.directories))
-			flag = O_EXCL;
-	} else if (flag != O_APPEND) {
+			*flag = O_EXCL;
+	} else if (*flag != O_APPEND) {
 		// wget compatibility: "clobber" means generating of .x files
 		multiple = 1;
-		flag = O_EXCL;
+		*flag = O_EXCL;
 
 		if (config.backups) {
 			char src[fname_length + 1], dst[fname_length + 1];
@@ -2090,7 +3036,7 @@ static void G_GNUC_WGET_NONNULL((1)) _save_file(wget_http_response_t *resp, cons
 
 	// create the complete directory path
 	mkdir_path((char *) fname);
-	fd = open(fname, O_WRONLY | flag | O_CREAT, 0644);
+	fd = open(fname, O_WRONLY | *flag | O_CREAT, 0644);
 	// debug_printf("1 fd=%d flag=%02x (%02x %02x %02x) errno=%d %s\n",fd,flag,O_EXCL,O_TRUNC,O_APPEND,errno,fname);
 
 	// find a non-existing filename
@@ -2098,49 +3044,83 @@ static void G_GNUC_WGET_NONNULL((1)) _save_file(wget_http_response_t *resp, cons
 	*unique = 0;
 	for (fnum = 0, maxloop = 999; fd < 0 && ((multiple && errno == EEXIST) || errno == EISDIR) && fnum < maxloop; fnum++) {
 		snprintf(unique, sizeof(unique), "%s.%d", fname, fnum + 1);
-		fd = open(unique, O_WRONLY | flag | O_CREAT, 0644);
+		fd = open(unique, O_WRONLY | *flag | O_CREAT, 0644);
+	}
+
+	if (fd >= 0)
+		*saved_fname = wget_strdup(fnum ? unique : fname);
+	else if (errno == EEXIST)
+		error_printf(_("File '%s' already there; not retrieving.\n"), fname);
+	else if (errno == EISDIR)
+		info_printf(_("Directory / file name clash - not saving '%s'\n"), fname);
+	else {
+		error_printf(_("Failed to open '%s' (errno=%d): %s\n"), fname, errno, strerror(errno));
+		set_exit_status(3);
 	}
 
-	if (fd >= 0) {
-		ssize_t rc;
+	xfree(alloced_fname);
+
+	return fd;
+}
+
+// Finish a file opened by _open_file()
+static void G_GNUC_WGET_NONNULL((1,3)) _close_file(wget_http_response_t *resp, int fd, const char *fname, int flag)
+{
+	if ((flag & (O_TRUNC | O_EXCL)) && resp->last_modified)
+		set_file_mtime(fd, resp->last_modified);
+
+	if (flag == O_APPEND)
+		info_printf("appended to '%s'\n", fname);
+	else
+		info_printf("saved '%s'\n", fname);
+
+	close(fd);
+}
+
+static void G_GNUC_WGET_NONNULL((1)) _save_file(wget_http_response_t *resp, const char *fname, int flag)
+{
+	char *saved_fname;
+	int fd;
+
+	wget_thread_mutex_lock(&savefile_mutex);
+
+	fd = _open_file(resp, fname, &flag, config.save_headers ? resp->header->length + resp->body->length : resp->body->length, &saved_fname);
+
+	if (fd == STDOUT_FILENO && !saved_fname) {
+		size_t rc;
 
 		if (config.save_headers) {
-			if ((rc = write(fd, resp->header->data, resp->header->length)) != (ssize_t)resp->header->length) {
-				error_printf(_("Failed to write file %s (%zd, errno=%d)\n"), fnum ? unique : fname, rc, errno);
+			if ((rc = fwrite(resp->header->data, 1, resp->header->length, stdout)) != resp->header->length) {
+				error_printf(_("Failed to write to STDOUT (%zu, errno=%d)\n"), rc, errno);
 				set_exit_status(3);
 			}
 		}
 
-		if ((rc = write(fd, resp->body->data, resp->body->length)) != (ssize_t)resp->body->length) {
-			error_printf(_("Failed to write file %s (%zd, errno=%d)\n"), fnum ? unique : fname, rc, errno);
+		if ((rc = fwrite(resp->body->data, 1, resp->body->length, stdout)) != resp->body->length) {
+			error_printf(_("Failed to write to STDOUT (%zu, errno=%d)\n"), rc, errno);
 			set_exit_status(3);
 		}
+	} else if (fd >= 0) {
+		ssize_t rc;
 
-		if ((flag & (O_TRUNC | O_EXCL)) && resp->last_modified)
-			set_file_mtime(fd, resp->last_modified);
-
-		if (flag == O_APPEND)
-			info_printf("appended to '%s'\n", fnum ? unique : fname);
-		else
-			info_printf("saved '%s'\n", fnum ? unique : fname);
-
-		close(fd);
-	} else {
-		if (fd == -1) {
-			if (errno == EEXIST)
-				error_printf(_("File '%s' already there; not retrieving.\n"), fname);
-			else if (errno == EISDIR)
-				info_printf(_("Directory / file name clash - not saving '%s'\n"), fname);
-			else {
-				error_printf(_("Failed to open '%s' (errno=%d): %s\n"), fname, errno, strerror(errno));
+		if (config.save_headers) {
+			if ((rc = write(fd, resp->header->data, resp->header->length)) != (ssize_t)resp->header->length) {
+				error_printf(_("Failed to write file %s (%zd, errno=%d)\n"), saved_fname, rc, errno);
 				set_exit_status(3);
 			}
 		}
+
+		if ((rc = write(fd, resp->body->data, resp->body->length)) != (ssize_t)resp->body->length) {
+			error_printf(_("Failed to write file %s (%zd, errno=%d)\n"), saved_fname, rc, errno);
+			set_exit_status(3);
+		}
+
+		_close_file(resp, fd, saved_fname, flag);
 	}
 
 	wget_thread_mutex_unlock(&savefile_mutex);
 
-	xfree(alloced_fname);
+	xfree(saved_fname);
 }
 
 static void G_GNUC_WGET_NONNULL((1)) save_file(wget_http_response_t *resp, const char *fname)
@@ -2161,58 +3141,51 @@ int download_part(DOWNLOADER *downloader)
 	int mirror_index = downloader->id % wget_vector_size(metalink->mirrors);
 	int ret = -1;
 
-	// we try every mirror max. 'config.tries' number of times
-	for (int tries = 0; tries < config.tries && !part->done && !terminate; tries++) {
-		wget_millisleep(tries * 1000 > config.waitretry ? config.waitretry : tries * 1000);
+	// we try every mirror once, failed parts are retried via queue_retry() max. 'config.tries' number of times
+	for (int mirrors = 0; mirrors < wget_vector_size(metalink->mirrors) && !part->done && !terminate; mirrors++) {
+		wget_http_response_t *resp;
+		wget_metalink_mirror_t *mirror = wget_vector_get(metalink->mirrors, mirror_index);
 
-		if (terminate)
-			break;
+		print_status(downloader, "downloading part %d/%d (%lld-%lld) %s from %s (mirror %d)\n",
+			part->id, wget_vector_size(job->parts),
+			(long long)part->position, (long long)(part->position + part->length - 1),
+			metalink->name, mirror->iri->host, mirror_index);
 
-		for (int mirrors = 0; mirrors < wget_vector_size(metalink->mirrors) && !part->done; mirrors++) {
-			wget_http_response_t *resp;
-			wget_metalink_mirror_t *mirror = wget_vector_get(metalink->mirrors, mirror_index);
+		mirror_index = (mirror_index + 1) % wget_vector_size(metalink->mirrors);
 
-			print_status(downloader, "downloading part %d/%d (%lld-%lld) %s from %s (mirror %d)\n",
-				part->id, wget_vector_size(job->parts),
-				(long long)part->position, (long long)(part->position + part->length - 1),
-				metalink->name, mirror->iri->host, mirror_index);
+		resp = http_get(mirror->iri, part, downloader, "GET");
+		if (resp) {
+			wget_cookie_store_cookies(config.cookie_db, resp->cookies); // sanitize and store cookies
 
-			mirror_index = (mirror_index + 1) % wget_vector_size(metalink->mirrors);
+			// just update number bytes read (body only) for display purposes
+			quota_modify_read(config.save_headers ? resp->header->length + resp->body->length : resp->body->length);
 
-			resp = http_get(mirror->iri, part, downloader, "GET");
-			if (resp) {
-				wget_cookie_store_cookies(config.cookie_db, resp->cookies); // sanitize and store cookies
+			if (resp->code != 200 && resp->code != 206) {
+				print_status(downloader, "part %d download error %d\n", part->id, resp->code);
+			} else if (!resp->body) {
+				print_status(downloader, "part %d download error 'empty body'\n", part->id);
+			} else if (resp->body->length != (size_t)part->length) {
+				print_status(downloader, "part %d download error '%zd bytes of %lld expected'\n",
+					part->id, resp->body->length, (long long)part->length);
+			} else {
+				int fd;
 
-				// just update number bytes read (body only) for display purposes
-				quota_modify_read(config.save_headers ? resp->header->length + resp->body->length : resp->body->length);
+				print_status(downloader, "part %d downloaded\n", part->id);
+				if ((fd = open(metalink->name, O_WRONLY | O_CREAT, 0644)) != -1) {
+					ssize_t nbytes;
+					if ((nbytes = pwrite(fd, resp->body->data, resp->body->length, part->position)) == (ssize_t)resp->body->length)
+						part->done = 1; // set this when downloaded ok
+					else
+						error_printf(_("Failed to pwrite %zd bytes at pos %lld (%zd)\n"), resp->body->length, (long long)part->position, nbytes);
 
-				if (resp->code != 200 && resp->code != 206) {
-					print_status(downloader, "part %d download error %d\n", part->id, resp->code);
-				} else if (!resp->body) {
-					print_status(downloader, "part %d download error 'empty body'\n", part->id);
-				} else if (resp->body->length != (size_t)part->length) {
-					print_status(downloader, "part %d download error '%zd bytes of %lld expected'\n",
-						part->id, resp->body->length, (long long)part->length);
+					close(fd);
 				} else {
-					int fd;
-
-					print_status(downloader, "part %d downloaded\n", part->id);
-					if ((fd = open(metalink->name, O_WRONLY | O_CREAT, 0644)) != -1) {
-						ssize_t nbytes;
-						if ((nbytes = pwrite(fd, resp->body->data, resp->body->length, part->position)) == (ssize_t)resp->body->length)
-							part->done = 1; // set this when downloaded ok
-						else
-							error_printf(_("Failed to pwrite %zd bytes at pos %lld (%zd)\n"), resp->body->length, (long long)part->position, nbytes);
-
-						close(fd);
-					} else {
-						error_printf(_("Failed to write open %s\n"), metalink->name);
-						set_exit_status(3);
-					}
+					error_printf(_("Failed to write open %s\n"), metalink->name);
+					set_exit_status(3);
 				}
-
-				wget_http_free_response(&resp);
 			}
+
+			wget_http_free_response(&resp);
 		}
 	}
 
@@ -2251,244 +3224,507 @@ int download_part(DOWNLOADER *downloader)
 					debug_printf("checksum failed\n");
 			}
 		}
+	} else if (++part->tries < config.tries) {
+		queue_retry(job, part, retry_delay(part->tries, NULL));
 	} else {
 		print_status(downloader, "part %d failed\n", part->id);
-		part->inuse = 0; // something was wrong, reload again later
+		part->tries = 0;
+		queue_retry(job, part, config.waitretry); // something was wrong, reload again later
 	}
 
 	return ret;
 }
 
-// the following is just needed for the progress bar
-struct _body_callback_context {
-	DOWNLOADER *downloader;
-	wget_buffer_t *body;
-	size_t expected_length;
-};
+// Open the destination file when the body isn't needed in memory.
+// The body is then written while downloading, an identity encoded plain HTTP body
+// is even spliced from the socket into the file by libwget.
+static void _open_body_file(struct _body_callback_context *ctx, wget_http_response_t *resp)
+{
+	JOB *job = ctx->job;
+	const char *fname;
+	int flag;
+
+	if (resp->code == 200)
+		flag = O_TRUNC;
+	else if (resp->code == 206 && config.continue_download)
+		flag = O_APPEND;
+	else
+		return;
+
+	if (body_needed(job, resp))
+		return;
+
+	// concurrent appends to the same file must not interleave
+	fname = local_filename(job, resp);
+	if (fname && fname == config.output_document && config.max_threads > 1)
+		return;
+
+	// the quota is updated for each chunk of the body, see _get_body()
+	wget_thread_mutex_lock(&savefile_mutex);
+	ctx->fd = _open_file(resp, fname, &flag, config.save_headers ? resp->header->length : 0, &ctx->fname);
+	wget_thread_mutex_unlock(&savefile_mutex);
+
+	job->saved = 1; // also if not to be saved, _open_file() decided that already
+
+	if (ctx->fd == STDOUT_FILENO && !ctx->fname) {
+		if (config.save_headers) {
+			size_t rc;
+
+			if ((rc = fwrite(resp->header->data, 1, resp->header->length, stdout)) != resp->header->length) {
+				error_printf(_("Failed to write to STDOUT (%zu, errno=%d)\n"), rc, errno);
+				set_exit_status(3);
+			}
+		}
+	} else if (ctx->fd >= 0) {
+		ctx->flag = flag;
+		resp->body_fd = ctx->fd;
+
+		// splice() refuses O_APPEND, we are the only writer of this file
+		if (flag == O_APPEND) {
+			fcntl(ctx->fd, F_SETFL, fcntl(ctx->fd, F_GETFL) & ~O_APPEND);
+			lseek(ctx->fd, 0, SEEK_END);
+		}
+
+		if (config.save_headers) {
+			ssize_t rc;
+
+			if ((rc = write(ctx->fd, resp->header->data, resp->header->length)) != (ssize_t)resp->header->length) {
+				error_printf(_("Failed to write file %s (%zd, errno=%d)\n"), ctx->fname, rc, errno);
+				set_exit_status(3);
+			}
+		}
+	} else
+		ctx->discard = 1;
+}
+
 static int _get_header(void *context, wget_http_response_t *resp)
 {
 	struct _body_callback_context *ctx = (struct _body_callback_context *)context;
 
 	// initialize the expected max. number of bytes for bar display
-	bar_update(ctx->downloader->id, ctx->expected_length = resp->content_length, 0);
+	if (config.progress && ctx->downloader)
+		bar_update(ctx->downloader->id, ctx->expected_length = resp->content_length, 0);
+
+	if (ctx->direct)
+		_open_body_file(ctx, resp);
+
+	// only bodies that are parsed or saved afterwards are kept in memory
+	if (!ctx->body && ctx->fd < 0 && !ctx->discard)
+		ctx->body = wget_buffer_alloc(102400);
 
 	return 0;
 }
+
 static int _get_body(void *context, const char *data, size_t length)
 {
 	struct _body_callback_context *ctx = (struct _body_callback_context *)context;
 
-	wget_buffer_memcat(ctx->body, data, length); // append new data to body
+	if (ctx->fd == STDOUT_FILENO && !ctx->fname) {
+		size_t rc;
+
+		if ((rc = fwrite(data, 1, length, stdout)) != length) {
+			error_printf(_("Failed to write to STDOUT (%zu, errno=%d)\n"), rc, errno);
+			set_exit_status(3);
+		}
+
+		quota_modify_read(length);
+	} else if (ctx->fd >= 0) {
+		ssize_t rc;
+
+		// data is NULL if libwget already spliced it into the file
+		if (data && (rc = write(ctx->fd, data, length)) != (ssize_t)length) {
+			error_printf(_("Failed to write file %s (%zd, errno=%d)\n"), ctx->fname, rc, errno);
+			set_exit_status(3);
+		}
+
+		quota_modify_read(length);
+	} else if (ctx->body)
+		wget_buffer_memcat(ctx->body, data, length); // append new data to body
 
-	bar_update(ctx->downloader->id, ctx->expected_length, ctx->body->length);
+	ctx->length += length;
+
+	if (config.progress && ctx->downloader)
+		bar_update(ctx->downloader->id, ctx->expected_length, ctx->length);
 
 	return 0;
 }
 
-wget_http_response_t *http_get(wget_iri_t *iri, PART *part, DOWNLOADER *downloader, const char *method)
+// Prepare receiving the body of the response to a request of 'job'.
+// If 'direct' is set, the body may be written into the destination file while downloading.
+static void _body_context_init(struct _body_callback_context *ctx, DOWNLOADER *downloader, JOB *job, int direct)
 {
-	wget_iri_t *dont_free = iri;
-	wget_http_connection_t *conn;
-	wget_http_response_t *resp = NULL;
-	wget_vector_t *challenges = NULL;
-	const char *iri_scheme;
-//	int max_redirect = 3;
-	wget_buffer_t buf;
-	char sbuf[256];
-	int rc, tries = 0;
+	*ctx = (struct _body_callback_context) {
+		.downloader = downloader,
+		.job = job,
+		.fd = -1,
+		.direct = direct
+	};
+
+	if (direct)
+		job->saved = 0;
+}
 
-	downloader->final_error = 0;
+// Close the file written while downloading and hand the body over to 'resp'.
+static void _body_context_finish(struct _body_callback_context *ctx, wget_http_response_t *resp, wget_http_request_t *req)
+{
+	if (ctx->fd >= 0 && ctx->fname) {
+		if (resp)
+			_close_file(resp, ctx->fd, ctx->fname, ctx->flag);
+		else {
+			// the transfer failed, a retry must not find a partial file
+			close(ctx->fd);
+			if (ctx->flag != O_APPEND)
+				unlink(ctx->fname);
+		}
+	}
+
+	xfree(ctx->fname);
+	ctx->fd = -1;
+
+	if (resp) {
+		// an empty body if it has been written to disk (or no body was received)
+		resp->body = ctx->body ? ctx->body : wget_buffer_alloc(0);
+		ctx->body = NULL;
+		if (!wget_strcasecmp_ascii(req->method, "GET"))
+			resp->content_length = ctx->length;
+	} else
+		wget_buffer_free(&ctx->body);
+}
+
+// the headers that are the same for all requests, sent before the per-request headers
+static wget_http_request_template_t *http_create_request_template(void)
+{
+	wget_http_request_template_t *tmpl = wget_http_create_request_template();
+	wget_buffer_t buf;
+	char sbuf[64];
 
 	wget_buffer_init(&buf, sbuf, sizeof(sbuf));
 
-	if (config.hsts && iri && iri->scheme == WGET_IRI_SCHEME_HTTP && wget_hsts_host_match(config.hsts_db, iri->host, atoi(iri->resolv_port))) {
-		info_printf("HSTS in effect for %s:%s\n", iri->host, iri->resolv_port);
-		iri_scheme = wget_iri_set_scheme(iri, WGET_IRI_SCHEME_HTTPS);
-	} else
-		iri_scheme = NULL;
+	// 20.06.2012: www.google.de only sends gzip responses with one of the
+	// following header lines in the request.
+	// User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.5) Gecko/20100101 Firefox/10.0.5 Iceweasel/10.0.5
+	// User-Agent: Mozilla/5.0 (X11; Linux) KHTML/4.8.3 (like Gecko) Konqueror/4.8
+	// User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/536.11 (KHTML, like Gecko) Chrome/20.0.1132.34 Safari/536.11
+	// User-Agent: Opera/9.80 (X11; Linux x86_64; U; en) Presto/2.10.289 Version/12.00
+	// User-Agent: Wget/1.13.4 (linux-gnu)
+	//
+	// Accept: prefer XML over HTML
+	/*				"Accept-Encoding: gzip\r\n"\
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.5) Gecko/20100101 Firefox/10.0.5 Iceweasel/10.0.5\r\n"\
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,/;q=0.8\r\n"
+	"Accept-Language: en-us,en;q=0.5\r\n");
+	 */
 
-	while (iri && ++tries <= config.tries) {
-		conn = downloader->conn;
+#if WITH_ZLIB
+	wget_buffer_strcat(&buf, buf.length ? ", gzip, deflate" : "gzip, deflate");
+#endif
+#if WITH_BZIP2
+	wget_buffer_strcat(&buf, buf.length ? ", bzip2" : "bzip2");
+#endif
+#if WITH_LZMA
+	wget_buffer_strcat(&buf, buf.length ? ", xz, lzma" : "xz, lzma");
+#endif
+#if WITH_BROTLIDEC
+	wget_buffer_strcat(&buf, buf.length ? ", br" : "br");
+#endif
+#if WITH_ZSTD
+	wget_buffer_strcat(&buf, buf.length ? ", zstd" : "zstd");
+#endif
+	if (!buf.length)
+		wget_buffer_strcat(&buf, "identity");
 
-		if (conn && !wget_strcmp(conn->esc_host, iri->host) &&
-			conn->scheme == iri->scheme &&
-			!wget_strcmp(conn->port, iri->resolv_port))
-		{
-			debug_printf("reuse connection %s\n", conn->esc_host);
-		} else {
-			if (conn) {
-				debug_printf("close connection %s\n", conn->esc_host);
-				wget_http_close(&downloader->conn);
-			}
+	wget_http_request_template_add_header(tmpl, "Accept-Encoding", buf.data);
 
-			if ((rc = wget_http_open(&downloader->conn, iri)) == WGET_E_SUCCESS) {
-				debug_printf("opened connection %s\n", downloader->conn->esc_host);
-			} else {
-				debug_printf("Failed to http_open (%d)\n", rc);
-				if (rc == WGET_E_HANDSHAKE || rc == WGET_E_CERTIFICATE) {
-					downloader->final_error = 1;
-					set_exit_status(5);
-				}
-			}
+	wget_http_request_template_add_header(tmpl, "Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8");
 
-			conn = downloader->conn;
-		}
+	if (config.user_agent)
+		wget_http_request_template_add_header(tmpl, "User-Agent", config.user_agent);
 
-		if (conn) {
-			wget_http_request_t *req;
+	if (config.keep_alive)
+		wget_http_request_template_add_header(tmpl, "Connection", "keep-alive");
 
-			if (method)
-				req = wget_http_create_request(iri, method);
-			else if (config.post_data || config.post_file)
-				req = wget_http_create_request(iri, "POST");
-			else
-				req = wget_http_create_request(iri, "GET");
+	if (!config.cache)
+		wget_http_request_template_add_header(tmpl, "Pragma", "no-cache");
+
+	if (config.referer)
+		wget_http_request_template_add_header(tmpl, "Referer", config.referer);
+
+	wget_buffer_deinit(&buf);
 
-			if (config.continue_download || config.timestamping) {
-				const char *local_filename = downloader->job->local_filename;
+	return tmpl;
+}
 
-				if (config.continue_download)
-					wget_http_add_header_printf(req, "Range", "bytes=%llu-",
-						get_file_size(local_filename));
+// create a request for iri, method NULL means GET or POST (with --post-data or --post-file)
+static wget_http_request_t *http_create_request(wget_iri_t *iri, const char *method, JOB *job, PART *part, wget_vector_t *challenges)
+{
+	wget_http_request_t *req;
 
-				if (config.timestamping) {
-					time_t mtime = get_file_mtime(local_filename);
+	if (method)
+		req = wget_http_create_request_with_template(iri, method, request_template);
+	else if (config.post_data || config.post_file)
+		req = wget_http_create_request_with_template(iri, "POST", request_template);
+	else
+		req = wget_http_create_request_with_template(iri, "GET", request_template);
 
-					if (mtime) {
-						char http_date[32];
+	if (config.continue_download || config.timestamping) {
+		const char *local_filename = job->local_filename;
 
-						wget_http_print_date(mtime + 1, http_date, sizeof(http_date));
-						wget_http_add_header(req, "If-Modified-Since", http_date);
-					}
-				}
-			}
+		if (config.continue_download)
+			wget_http_add_header_printf(req, "Range", "bytes=%llu-",
+				get_file_size(local_filename));
 
-			// 20.06.2012: www.google.de only sends gzip responses with one of the
-			// following header lines in the request.
-			// User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.5) Gecko/20100101 Firefox/10.0.5 Iceweasel/10.0.5
-			// User-Agent: Mozilla/5.0 (X11; Linux) KHTML/4.8.3 (like Gecko) Konqueror/4.8
-			// User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/536.11 (KHTML, like Gecko) Chrome/20.0.1132.34 Safari/536.11
-			// User-Agent: Opera/9.80 (X11; Linux x86_64; U; en) Presto/2.10.289 Version/12.00
-			// User-Agent: Wget/1.13.4 (linux-gnu)
-			//
-			// Accept: prefer XML over HTML
-			/*				"Accept-Encoding: gzip\r\n"\
-			"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.5) Gecko/20100101 Firefox/10.0.5 Iceweasel/10.0.5\r\n"\
-			"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,/;q=0.8\r\n"
-			"Accept-Language: en-us,en;q=0.5\r\n");
-			 */
-
-			wget_buffer_reset(&buf);
-#if WITH_ZLIB
-			wget_buffer_strcat(&buf, buf.length ? ", gzip, deflate" : "gzip, deflate");
-#endif
-#if WITH_BZIP2
-			wget_buffer_strcat(&buf, buf.length ? ", bzip2" : "bzip2");
-#endif
-#if WITH_LZMA
-			wget_buffer_strcat(&buf, buf.length ? ", xz, lzma" : "xz, lzma");
-#endif
-			if (!buf.length)
-				wget_buffer_strcat(&buf, "identity");
+		if (config.timestamping) {
+			time_t mtime = get_file_mtime(local_filename);
 
-			wget_http_add_header(req, "Accept-Encoding", buf.data);
+			if (mtime) {
+				char http_date[32];
 
-			wget_http_add_header(req, "Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8");
+				wget_http_print_date(mtime + 1, http_date, sizeof(http_date));
+				wget_http_add_header(req, "If-Modified-Since", http_date);
+			}
+		}
+	}
 
 //			if (config.spider && !config.recursive)
 //				http_add_header_if_modified_since(time(NULL));
 //				http_add_header(req, "If-Modified-Since", "Wed, 29 Aug 2012 00:00:00 GMT");
 
-			if (config.user_agent)
-				wget_http_add_header(req, "User-Agent", config.user_agent);
+	// --referer is part of the request template
+	if (!config.referer && job->referer) {
+		wget_iri_t *referer = job->referer;
+		wget_buffer_t buf;
+		char sbuf[256];
 
-			if (config.keep_alive)
-				wget_http_add_header(req, "Connection", "keep-alive");
+		wget_buffer_init(&buf, sbuf, sizeof(sbuf));
+		wget_buffer_strcpy(&buf, referer->scheme);
+		wget_buffer_memcat(&buf, "://", 3);
+		wget_buffer_strcat(&buf, referer->host);
+		if (referer->resolv_port) {
+			wget_buffer_memcat(&buf, ":", 1);
+			wget_buffer_strcat(&buf, referer->resolv_port);
+		}
+		wget_buffer_memcat(&buf, "/", 1);
+		wget_iri_get_escaped_resource(referer, &buf);
 
-			if (!config.cache)
-				wget_http_add_header(req, "Pragma", "no-cache");
+		wget_http_add_header(req, "Referer", buf.data);
+		wget_buffer_deinit(&buf);
+	}
 
-			if (config.referer)
-				wget_http_add_header(req, "Referer", config.referer);
-			else if (downloader->job->referer) {
-				wget_iri_t *referer = downloader->job->referer;
+	if (challenges) {
+		// There might be more than one challenge, we could select the most secure one.
+		// Prefer 'Digest' over 'Basic'
+		// the following adds an Authorization: HTTP header
+		wget_http_challenge_t *challenge, *selected_challenge = NULL;
 
-				wget_buffer_strcpy(&buf, referer->scheme);
-				wget_buffer_memcat(&buf, "://", 3);
-				wget_buffer_strcat(&buf, referer->host);
-				if (referer->resolv_port) {
-					wget_buffer_memcat(&buf, ":", 1);
-					wget_buffer_strcat(&buf, referer->resolv_port);
-				}
-				wget_buffer_memcat(&buf, "/", 1);
-				wget_iri_get_escaped_resource(referer, &buf);
+		for (int it = 0; it < wget_vector_size(challenges); it++) {
+			challenge = wget_vector_get(challenges, it);
 
-				wget_http_add_header(req, "Referer", buf.data);
+			if (wget_strcasecmp_ascii(challenge->auth_scheme, "digest")) {
+				selected_challenge = challenge;
+				break;
 			}
+			else if (wget_strcasecmp_ascii(challenge->auth_scheme, "basic")) {
+				if (!selected_challenge)
+					selected_challenge = challenge;
+			}
+		}
 
-			if (challenges) {
-				// There might be more than one challenge, we could select the most secure one.
-				// Prefer 'Digest' over 'Basic'
-				// the following adds an Authorization: HTTP header
-				wget_http_challenge_t *challenge, *selected_challenge = NULL;
-
-				for (int it = 0; it < wget_vector_size(challenges); it++) {
-					challenge = wget_vector_get(challenges, it);
+		if (selected_challenge) {
+			if (config.http_username) {
+				wget_http_add_credentials(req, selected_challenge, config.http_username, config.http_password);
+			} else if (config.netrc_file) {
+				static wget_thread_mutex_t
+					mutex = WGET_THREAD_MUTEX_INITIALIZER;
 
-					if (wget_strcasecmp_ascii(challenge->auth_scheme, "digest")) {
-						selected_challenge = challenge;
-						break;
-					}
-					else if (wget_strcasecmp_ascii(challenge->auth_scheme, "basic")) {
-						if (!selected_challenge)
-							selected_challenge = challenge;
-					}
+				wget_thread_mutex_lock(&mutex);
+				if (!config.netrc_db) {
+					config.netrc_db = wget_netrc_db_init(NULL);
+					wget_netrc_db_load(config.netrc_db, config.netrc_file);
 				}
+				wget_thread_mutex_unlock(&mutex);
 
-				if (selected_challenge) {
-					if (config.http_username) {
-						wget_http_add_credentials(req, selected_challenge, config.http_username, config.http_password);
-					} else if (config.netrc_file) {
-						static wget_thread_mutex_t
-							mutex = WGET_THREAD_MUTEX_INITIALIZER;
-
-						wget_thread_mutex_lock(&mutex);
-						if (!config.netrc_db) {
-							config.netrc_db = wget_netrc_db_init(NULL);
-							wget_netrc_db_load(config.netrc_db, config.netrc_file);
-						}
-						wget_thread_mutex_unlock(&mutex);
-
-						wget_netrc_t *netrc = wget_netrc_get(config.netrc_db, iri->host);
-						if (!netrc)
-							netrc = wget_netrc_get(config.netrc_db, "default");
+				wget_netrc_t *netrc = wget_netrc_get(config.netrc_db, iri->host);
+				if (!netrc)
+					netrc = wget_netrc_get(config.netrc_db, "default");
 
-						if (netrc) {
-							wget_http_add_credentials(req, selected_challenge, netrc->login, netrc->password);
-						} else {
-							wget_http_add_credentials(req, selected_challenge, config.http_username, config.http_password);
-						}
-					} else {
-						wget_http_add_credentials(req, selected_challenge, config.http_username, config.http_password);
-					}
+				if (netrc) {
+					wget_http_add_credentials(req, selected_challenge, netrc->login, netrc->password);
+				} else {
+					wget_http_add_credentials(req, selected_challenge, config.http_username, config.http_password);
 				}
+			} else {
+				wget_http_add_credentials(req, selected_challenge, config.http_username, config.http_password);
 			}
+		}
+	}
+
+	if (part)
+		wget_http_add_header_printf(req, "Range", "bytes=%llu-%llu",
+			(unsigned long long) part->position, (unsigned long long) part->position + part->length - 1);
+
+	// add cookies
+	if (config.cookies) {
+		const char *cookie_string;
+
+		if ((cookie_string = wget_cookie_create_request_header(config.cookie_db, iri))) {
+			wget_http_add_header(req, "Cookie", cookie_string);
+			xfree(cookie_string);
+		}
+	}
+
+	return req;
+}
+
+// count the response for the final statistics
+static void http_count_response(wget_http_response_t *resp, PART *part)
+{
+	if (resp->code == 200) {
+		if (part)
+			_atomic_increment_int(&stats.nchunks);
+		else
+			_atomic_increment_int(&stats.ndownloads);
+	}
+	else if (resp->code == 301 || resp->code == 302)
+		_atomic_increment_int(&stats.nredirects);
+	else if (resp->code == 304)
+		_atomic_increment_int(&stats.nnotmodified);
+	else
+		_atomic_increment_int(&stats.nerrors);
+}
+
+static int pipeline_accept(JOB *job)
+{
+	return !job_head_first(job);
+}
+
+// Send the requests for the next jobs of our deque to the same host ahead (--pipelining),
+// as many as the connection takes. The server works on them while we read the current response.
+static void pipeline_fill(DOWNLOADER *downloader, JOB *job)
+{
+	PIPELINED pipelined;
+
+	while (downloader->npipelined + 1 < wget_http_get_max_streams(downloader->conn)) {
+		if (!(pipelined.job = queue_get_pipelined(downloader->id, job, pipeline_accept)))
+			break;
+
+		pipelined.req = http_create_request(pipelined.job->iri, NULL, pipelined.job, NULL, NULL);
+
+		if (wget_http_send_request(downloader->conn, pipelined.req) != WGET_E_SUCCESS) {
+			wget_http_free_request(&pipelined.req);
+			queue_retry(pipelined.job, NULL, 0);
+			break;
+		}
+
+		debug_printf("pipelined %s\n", pipelined.job->iri->uri);
+		wget_list_append(&downloader->pipeline, &pipelined, sizeof(PIPELINED));
+		downloader->npipelined++;
+	}
+}
+
+// take the request sent ahead for the current job
+static wget_http_request_t *pipeline_take(DOWNLOADER *downloader)
+{
+	PIPELINED *pipelined;
+	wget_http_request_t *req;
 
-			if (part)
-				wget_http_add_header_printf(req, "Range", "bytes=%llu-%llu",
-					(unsigned long long) part->position, (unsigned long long) part->position + part->length - 1);
+	if (!downloader->pipeline || (pipelined = wget_list_getfirst(downloader->pipeline))->job != downloader->job)
+		return NULL;
+
+	req = pipelined->req;
+	wget_list_remove(&downloader->pipeline, pipelined);
+	downloader->npipelined--;
+
+	return req;
+}
+
+// The responses to the requests sent ahead won't be read, give the jobs back to the queue.
+// The connection is dropped, the server might still send the responses.
+static void pipeline_cancel(DOWNLOADER *downloader)
+{
+	PIPELINED *pipelined;
+
+	if (!downloader->pipeline)
+		return;
+
+	while ((pipelined = wget_list_getfirst(downloader->pipeline))) {
+		debug_printf("unpipelined %s\n", pipelined->job->iri->uri);
+		wget_http_free_request(&pipelined->req);
+		queue_retry(pipelined->job, NULL, 0);
+		wget_list_remove(&downloader->pipeline, pipelined);
+	}
+
+	downloader->npipelined = 0;
+	wget_http_pool_discard(&downloader->conn);
+}
+
+wget_http_response_t *http_get(wget_iri_t *iri, PART *part, DOWNLOADER *downloader, const char *method)
+{
+	wget_iri_t *dont_free = iri;
+	wget_http_connection_t *conn;
+	wget_http_response_t *resp = NULL;
+	wget_vector_t *challenges = NULL;
+	wget_http_request_t *sent_ahead = NULL;
+	const char *iri_scheme;
+//	int max_redirect = 3;
+	int rc, tries = 0;
+
+	downloader->final_error = 0;
+
+	if (config.hsts && iri && iri->scheme == WGET_IRI_SCHEME_HTTP && wget_hsts_host_match(config.hsts_db, iri->host, atoi(iri->resolv_port))) {
+		info_printf("HSTS in effect for %s:%s\n", iri->host, iri->resolv_port);
+		iri_scheme = wget_iri_set_scheme(iri, WGET_IRI_SCHEME_HTTPS);
+	} else
+		iri_scheme = NULL;
+
+	// the request for this job might have been sent ahead, nothing else must be sent before it
+	if (downloader->pipeline && !method && !part)
+		sent_ahead = pipeline_take(downloader);
+	if (!sent_ahead)
+		pipeline_cancel(downloader);
+
+	while (iri && ++tries <= config.tries) {
+		conn = downloader->conn;
+
+		if (conn && !wget_strcmp(conn->esc_host, iri->host) &&
+			conn->scheme == iri->scheme &&
+			!wget_strcmp(conn->port, iri->resolv_port))
+		{
+			debug_printf("reuse connection %s\n", conn->esc_host);
+		} else {
+			if (sent_ahead) {
+				// the response to the request sent ahead won't be read
+				wget_http_free_request(&sent_ahead);
+				wget_http_pool_discard(&downloader->conn);
+			}
+			pipeline_cancel(downloader);
 
-			// add cookies
-			if (config.cookies) {
-				const char *cookie_string;
+			if (downloader->conn) {
+				debug_printf("pool connection %s\n", conn->esc_host);
+				wget_http_pool_checkin(&downloader->conn);
+			}
 
-				if ((cookie_string = wget_cookie_create_request_header(config.cookie_db, iri))) {
-					wget_http_add_header(req, "Cookie", cookie_string);
-					xfree(cookie_string);
+			if ((rc = wget_http_pool_checkout(&downloader->conn, iri)) == WGET_E_SUCCESS) {
+				debug_printf("got connection %s\n", downloader->conn->esc_host);
+				if (config.pipelining)
+					wget_http_set_pipelining(downloader->conn, config.pipelining);
+			} else {
+				debug_printf("Failed to http_open (%d)\n", rc);
+				if (rc == WGET_E_HANDSHAKE || rc == WGET_E_CERTIFICATE) {
+					downloader->final_error = 1;
+					set_exit_status(5);
 				}
 			}
 
-			if (config.post_data) {
+			conn = downloader->conn;
+		}
+
+		if (conn) {
+			wget_http_request_t *req = sent_ahead ? sent_ahead : http_create_request(iri, method, downloader->job, part, challenges);
+
+			if (sent_ahead) {
+				sent_ahead = NULL;
+				rc = WGET_E_SUCCESS; // sent while reading the previous response
+			} else if (config.post_data) {
 				size_t length = strlen(config.post_data);
 
 				wget_http_add_header(req, "Content-Type", "application/x-www-form-urlencoded");
@@ -2510,29 +3746,25 @@ wget_http_response_t *http_get(wget_iri_t *iri, PART *part, DOWNLOADER *download
 			}
 
 			if (rc == WGET_E_SUCCESS) {
-				if (config.progress) {
-					wget_buffer_t *body = wget_buffer_alloc(102400);
-					struct _body_callback_context context = { .downloader = downloader, .body = body };
-
-					resp = wget_http_get_response_cb(conn, req, config.save_headers || config.server_response ? WGET_HTTP_RESPONSE_KEEPHEADER : 0, _get_header, _get_body, &context);
-
-					if (resp) {
-						resp->body = body;
-						if (!wget_strcasecmp_ascii(req->method, "GET"))
-							resp->content_length = body->length;
-					} else {
-						wget_buffer_free(&body);
-					}
+				if (config.pipelining && !method && !part && !config.post_data && !config.post_file)
+					pipeline_fill(downloader, downloader->job);
 
-				} else
-					resp = wget_http_get_response(conn, NULL, req, config.save_headers || config.server_response ? WGET_HTTP_RESPONSE_KEEPHEADER : 0);
+				struct _body_callback_context context;
+
+				// bodies that are not parsed go straight to disk
+				_body_context_init(&context, downloader, downloader->job, !part && !method);
+
+				resp = wget_http_get_response_cb(conn, req, config.save_headers || config.server_response ? WGET_HTTP_RESPONSE_KEEPHEADER : 0, _get_header, _get_body, &context);
+
+				_body_context_finish(&context, resp, req);
 			}
 
 			wget_http_free_request(&req);
 		} else break;
 
 		if (!resp) {
-			wget_http_close(&downloader->conn);
+			pipeline_cancel(downloader);
+			wget_http_pool_discard(&downloader->conn);
 			break;
 		}
 
@@ -2540,22 +3772,13 @@ wget_http_response_t *http_get(wget_iri_t *iri, PART *part, DOWNLOADER *download
 			info_printf("# got header %zd bytes:\n%s\n\n", resp->header->length, resp->header->data);
 
 		// server doesn't support keep-alive or want us to close the connection
-		if (!resp->keep_alive)
+		if (!resp->keep_alive) {
+			pipeline_cancel(downloader);
 			wget_http_close(&downloader->conn);
+		}
 
 		// do some statistics
-		if (resp->code == 200) {
-			if (part)
-				_atomic_increment_int(&stats.nchunks);
-			else
-				_atomic_increment_int(&stats.ndownloads);
-		}
-		else if (resp->code == 301 || resp->code == 302)
-			_atomic_increment_int(&stats.nredirects);
-		else if (resp->code == 304)
-			_atomic_increment_int(&stats.nnotmodified);
-		else
-			_atomic_increment_int(&stats.nerrors);
+		http_count_response(resp, part);
 
 		if (resp->code == 302 && resp->links && resp->digests)
 			break; // 302 with Metalink information
@@ -2565,6 +3788,7 @@ wget_http_response_t *http_get(wget_iri_t *iri, PART *part, DOWNLOADER *download
 			if ((challenges = resp->challenges)) {
 				resp->challenges = NULL;
 				wget_http_free_response(&resp);
+				pipeline_cancel(downloader); // the next request must be answered first
 				continue; // try again with credentials
 			}
 			break;
@@ -2616,7 +3840,6 @@ wget_http_response_t *http_get(wget_iri_t *iri, PART *part, DOWNLOADER *download
 	}
 
 	wget_http_free_challenges(&challenges);
-	wget_buffer_deinit(&buf);
 
 	return resp;
 }
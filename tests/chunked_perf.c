@@ -0,0 +1,185 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing performance of decoding chunked response bodies
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libwget.h>
+#include "libtest.h"
+
+#define BLOCK_SIZE (1024 * 1024) // chunk data sent with each write()
+
+static const struct chunk_test {
+	size_t
+		chunk_size;
+	int
+		blocks; // body size in units of BLOCK_SIZE
+} tests[] = {
+	{ 1, 4 },
+	{ 1024, 64 },
+	{ 65536, 256 },
+};
+
+static int
+	server_fd;
+
+// serve "/<n>" with a body of tests[n].blocks * BLOCK_SIZE bytes in chunks of tests[n].chunk_size bytes
+static void *server_thread(void *p G_GNUC_WGET_UNUSED)
+{
+	static const char header[] = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+	char request[1024], *block = wget_malloc(BLOCK_SIZE * 6 + 64);
+	int fd, n;
+
+	while ((fd = accept(server_fd, NULL, NULL)) >= 0) {
+		const struct chunk_test *t;
+		size_t length = 0;
+		ssize_t nbytes;
+
+		if ((nbytes = read(fd, request, sizeof(request) - 1)) <= 0 || (n = atoi(request + 5)) < 0 || n >= (int) countof(tests)) {
+			close(fd);
+			continue;
+		}
+
+		t = &tests[n];
+
+		// one block of chunks, each one is "<hex size>\r\n<data>\r\n"
+		for (size_t sent = 0; sent < BLOCK_SIZE; sent += t->chunk_size) {
+			length += sprintf(block + length, "%zx\r\n", t->chunk_size);
+			memset(block + length, 'x', t->chunk_size);
+			length += t->chunk_size;
+			memcpy(block + length, "\r\n", 2);
+			length += 2;
+		}
+
+		if (write(fd, header, sizeof(header) - 1) != sizeof(header) - 1) {
+			close(fd);
+			continue;
+		}
+
+		for (int it = 0; it < t->blocks; it++) {
+			if (write(fd, block, length) != (ssize_t) length)
+				break;
+		}
+
+		if (write(fd, "0\r\n\r\n", 5) != 5)
+			fprintf(stderr, "Failed to write last-chunk\n");
+
+		close(fd);
+	}
+
+	wget_xfree(block);
+
+	return NULL;
+}
+
+struct body_context {
+	wget_buffer_t
+		*buf;
+	size_t
+		received;
+};
+
+// collect the body like wget_http_get_response() does, but don't keep more than 1MB
+static int _get_body(void *context, const char *data, size_t length)
+{
+	struct body_context *ctx = context;
+
+	if (ctx->buf->length >= 1024 * 1024)
+		wget_buffer_reset(ctx->buf);
+
+	wget_buffer_memcat(ctx->buf, data, length);
+	ctx->received += length;
+
+	return 0;
+}
+
+int main(void)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addrlen = sizeof(addr);
+	wget_thread_t tid;
+	char url[64];
+
+	if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+		|| bind(server_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+		|| listen(server_fd, 4) < 0
+		|| getsockname(server_fd, (struct sockaddr *) &addr, &addrlen) < 0)
+	{
+		fprintf(stderr, "Failed to start server\n");
+		return 1;
+	}
+
+	wget_thread_start(&tid, server_thread, NULL, 0);
+
+	for (int n = 0; n < (int) countof(tests); n++) {
+		const struct chunk_test *t = &tests[n];
+		struct body_context ctx = { .buf = wget_buffer_alloc(2 * 1024 * 1024) };
+		long long best = 0;
+
+		snprintf(url, sizeof(url), "http://127.0.0.1:%d/%d", ntohs(addr.sin_port), n);
+
+		for (int run = 0; run < 3; run++) {
+			wget_iri_t *iri = wget_iri_parse(url, NULL);
+			wget_http_connection_t *conn = NULL;
+			wget_http_request_t *req = wget_http_create_request(iri, "GET");
+			wget_http_response_t *resp = NULL;
+			long long start = wget_test_get_time_nanos() / 1000;
+
+			ctx.received = 0;
+
+			if (wget_http_open(&conn, iri) == WGET_E_SUCCESS && wget_http_send_request(conn, req) == 0)
+				resp = wget_http_get_response_cb(conn, req, 0, NULL, _get_body, &ctx);
+
+			start = wget_test_get_time_nanos() / 1000 - start;
+			if (!best || start < best)
+				best = start;
+
+			wget_http_free_response(&resp);
+			wget_http_free_request(&req);
+			wget_http_close(&conn);
+			wget_iri_free(&iri);
+		}
+
+		if (ctx.received != (size_t) t->blocks * BLOCK_SIZE)
+			fprintf(stderr, "chunk size %zu: got %zu instead of %zu bytes\n", t->chunk_size, ctx.received, (size_t) t->blocks * BLOCK_SIZE);
+
+		wget_buffer_free(&ctx.buf);
+
+		printf("chunk size %5zu: %3d MB in %7lld us, %5.0f MB/s, %7.1f ns/chunk\n",
+			t->chunk_size, t->blocks, best, best ? t->blocks * 1000000.0 / best : 0.0,
+			best * 1000.0 / (t->blocks * (BLOCK_SIZE / t->chunk_size)));
+	}
+
+	close(server_fd);
+
+	return 0;
+}
@@ -0,0 +1,265 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing throughput of the content decoders
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if WITH_ZLIB
+#include <zlib.h>
+#endif
+#if WITH_BZIP2
+#include <bzlib.h>
+#endif
+#if WITH_LZMA
+#include <lzma.h>
+#endif
+#if WITH_BROTLIDEC && WITH_BROTLIENC
+#include <brotli/encode.h>
+#endif
+#if WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <libwget.h>
+#include "libtest.h"
+
+#define PLAIN_SIZE (4 * 1024 * 1024) // size of the generated HTML
+#define READ_SIZE 16384 // compressed data is fed in slices of this size, like read from a socket
+
+// compress 'in' into '*out', returns the compressed length or 0 on failure
+typedef size_t (*compress_func)(const char *in, size_t inlen, char **out);
+
+#if WITH_ZLIB
+static size_t _zlib_compress(const char *in, size_t inlen, char **out, int window_bits)
+{
+	z_stream strm;
+	size_t outlen = 0;
+
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, 6, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0;
+
+	*out = wget_malloc(deflateBound(&strm, inlen));
+	strm.next_in = (unsigned char *) in;
+	strm.avail_in = inlen;
+	strm.next_out = (unsigned char *) *out;
+	strm.avail_out = deflateBound(&strm, inlen);
+
+	if (deflate(&strm, Z_FINISH) == Z_STREAM_END)
+		outlen = strm.total_out;
+
+	deflateEnd(&strm);
+	return outlen;
+}
+
+static size_t _gzip_compress(const char *in, size_t inlen, char **out)
+{
+	return _zlib_compress(in, inlen, out, 15 + 16);
+}
+
+static size_t _deflate_compress(const char *in, size_t inlen, char **out)
+{
+	return _zlib_compress(in, inlen, out, -15);
+}
+#endif
+
+#if WITH_BZIP2
+static size_t _bzip2_compress(const char *in, size_t inlen, char **out)
+{
+	unsigned int outlen = inlen + inlen / 100 + 600;
+
+	*out = wget_malloc(outlen);
+	if (BZ2_bzBuffToBuffCompress(*out, &outlen, (char *) in, inlen, 9, 0, 0) != BZ_OK)
+		return 0;
+
+	return outlen;
+}
+#endif
+
+#if WITH_LZMA
+static size_t _xz_compress(const char *in, size_t inlen, char **out)
+{
+	size_t outlen = 0, size = lzma_stream_buffer_bound(inlen);
+
+	*out = wget_malloc(size);
+	if (lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, NULL, (const uint8_t *) in, inlen, (uint8_t *) *out, &outlen, size) != LZMA_OK)
+		return 0;
+
+	return outlen;
+}
+#endif
+
+#if WITH_BROTLIDEC && WITH_BROTLIENC
+static size_t _brotli_compress(const char *in, size_t inlen, char **out)
+{
+	size_t outlen = BrotliEncoderMaxCompressedSize(inlen);
+
+	*out = wget_malloc(outlen);
+	if (!BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, inlen, (const uint8_t *) in, &outlen, (uint8_t *) *out))
+		return 0;
+
+	return outlen;
+}
+#endif
+
+#if WITH_ZSTD
+static size_t _zstd_compress(const char *in, size_t inlen, char **out)
+{
+	size_t outlen = ZSTD_compressBound(inlen);
+
+	*out = wget_malloc(outlen);
+	outlen = ZSTD_compress(*out, outlen, in, inlen, 3);
+
+	return ZSTD_isError(outlen) ? 0 : outlen;
+}
+#endif
+
+static const struct codec {
+	const char *
+		name;
+	compress_func
+		compress;
+	int
+		encoding;
+} codecs[] = {
+#if WITH_ZLIB
+	{ "gzip", _gzip_compress, wget_content_encoding_gzip },
+	{ "deflate", _deflate_compress, wget_content_encoding_deflate },
+#endif
+#if WITH_BZIP2
+	{ "bzip2", _bzip2_compress, wget_content_encoding_bzip2 },
+#endif
+#if WITH_LZMA
+	{ "xz", _xz_compress, wget_content_encoding_lzma },
+#endif
+#if WITH_BROTLIDEC && WITH_BROTLIENC
+	{ "br", _brotli_compress, wget_content_encoding_brotli },
+#endif
+#if WITH_ZSTD
+	{ "zstd", _zstd_compress, wget_content_encoding_zstd },
+#endif
+};
+
+// a page of HTML made from a few hundred words, compresses about like real pages
+static char *_create_html(size_t size)
+{
+	static const char *words[] = {
+		"the", "download", "of", "and", "file", "to", "in", "server", "is", "for", "release", "with",
+		"page", "on", "mirror", "that", "by", "this", "archive", "from", "be", "package", "are", "an",
+		"version", "or", "at", "source", "as", "documentation", "it", "project", "you", "can", "link",
+		"news", "all", "new", "more", "security", "support", "was", "not", "which", "has", "list",
+	};
+	static const char *tags[] = {
+		"<p>", "</p>\n", "<li><a href=\"/", "</a></li>\n", "<div class=\"content\">", "</div>\n",
+		"<span class=\"date\">2016-10-", "</span>", "<h2>", "</h2>\n", "<td>", "</td>",
+	};
+	char *html = wget_malloc(size + 64);
+	size_t length = 0;
+	unsigned int seed = 1;
+
+	length += sprintf(html, "<!DOCTYPE html>\n<html><head><title>Wget</title></head><body>\n");
+
+	while (length < size) {
+		seed = seed * 1103515245 + 12345;
+
+		if ((seed >> 16) % 8 == 0)
+			length += sprintf(html + length, "%s", tags[(seed >> 20) % countof(tags)]);
+		else
+			length += sprintf(html + length, "%s ", words[(seed >> 20) % countof(words)]);
+	}
+	html[length = size] = 0;
+
+	return html;
+}
+
+static int _count_data(void *context, const char *data G_GNUC_WGET_UNUSED, size_t length)
+{
+	*((size_t *) context) += length;
+
+	return 0;
+}
+
+int main(void)
+{
+	char *html = _create_html(PLAIN_SIZE);
+
+	if (!countof(codecs))
+		printf("no decoder compiled in\n");
+
+	for (int n = 0; n < (int) countof(codecs); n++) {
+		const struct codec *c = &codecs[n];
+		char *compressed = NULL, *data;
+		size_t length, decoded = 0;
+		long long best = 0;
+
+		if (!(length = c->compress(html, PLAIN_SIZE, &compressed))) {
+			printf("%-8s failed to compress\n", c->name);
+			wget_xfree(compressed);
+			continue;
+		}
+
+		// the decoders may change their input
+		data = wget_malloc(length);
+
+		for (int run = 0; run < 5; run++) {
+			wget_decompressor_t *dc = wget_decompress_open(c->encoding, _count_data, &decoded);
+			long long start;
+			int rc = 0;
+
+			memcpy(data, compressed, length);
+			decoded = 0;
+
+			start = wget_test_get_time_nanos() / 1000;
+			for (size_t pos = 0; pos < length && !rc; pos += READ_SIZE)
+				rc = wget_decompress(dc, data + pos, length - pos < READ_SIZE ? length - pos : READ_SIZE);
+			start = wget_test_get_time_nanos() / 1000 - start;
+
+			wget_decompress_close(dc);
+
+			if (rc || decoded != PLAIN_SIZE) {
+				printf("%-8s failed to decompress (%zu of %d bytes)\n", c->name, decoded, PLAIN_SIZE);
+				best = 0;
+				break;
+			}
+
+			if (!best || start < best)
+				best = start;
+		}
+
+		if (best)
+			printf("%-8s %5.1f%% of %d bytes, %6.0f MB/s decompressed\n",
+				c->name, length * 100.0 / PLAIN_SIZE, PLAIN_SIZE, (double) PLAIN_SIZE / best);
+
+		wget_xfree(data);
+		wget_xfree(compressed);
+	}
+
+	wget_xfree(html);
+
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DNS cache lookups: old sorted vector vs. hashed cache, resolving through a stub resolver
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+
+#include <libwget.h>
+
+static char host[64];
+
+static long
+	stub_calls;
+
+static const char *_make_host(long n)
+{
+	snprintf(host, sizeof(host), "%s%ld.example%ld.com", n < 0 ? "fail" : "www", labs(n), labs(n) % 1000);
+	return host;
+}
+
+// every name resolves to 127.0.0.1, names starting with 'fail' don't resolve
+static int stub_resolver(const char *name, const char *port, const struct addrinfo *hints, struct addrinfo **res)
+{
+	struct addrinfo numeric = *hints;
+
+	stub_calls++;
+
+	if (!strncmp(name, "fail", 4))
+		return EAI_NONAME;
+
+	numeric.ai_flags |= AI_NUMERICHOST;
+	numeric.ai_flags &= ~AI_ADDRCONFIG;
+	return getaddrinfo("127.0.0.1", port, &numeric, res);
+}
+
+// the old DNS cache: a vector sorted by host and port
+struct ADDR_ENTRY {
+	const char *
+		host;
+	const char *
+		port;
+	struct addrinfo *
+		addrinfo;
+};
+
+static int _compare_addr(struct ADDR_ENTRY *a1, struct ADDR_ENTRY *a2)
+{
+	int n;
+
+	if ((n = wget_strcasecmp(a1->host, a2->host)) == 0)
+		return wget_strcasecmp_ascii(a1->port, a2->port);
+
+	return n;
+}
+
+static void _free_addr(struct ADDR_ENTRY *entry)
+{
+	freeaddrinfo(entry->addrinfo);
+	free((void *)entry->host);
+}
+
+static void vector_cache(long nhosts)
+{
+	wget_vector_t *cache = wget_vector_create(4, -2, (int(*)(const void *, const void *))_compare_addr);
+	struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+	long long start = wget_get_timemillis(), fill = start;
+	long it;
+	int pass;
+
+	wget_vector_set_destructor(cache, (void(*)(void *))_free_addr);
+
+	for (pass = 0; pass < 2; pass++) {
+		for (it = 0; it < nhosts; it++) {
+			struct ADDR_ENTRY entry = { .host = _make_host(it), .port = "80" };
+
+			if (wget_vector_find(cache, &entry) < 0) {
+				stub_resolver(entry.host, entry.port, &hints, &entry.addrinfo);
+				entry.host = wget_strdup(entry.host);
+				wget_vector_insert_sorted(cache, &entry, sizeof(entry));
+			}
+		}
+
+		if (pass == 0)
+			fill = wget_get_timemillis();
+	}
+
+	printf("%-28s %8ld hosts: fill %6lld ms, lookup %6lld ms, resolver calls %ld\n",
+		"sorted vector (old)", nhosts, fill - start, wget_get_timemillis() - fill, stub_calls);
+
+	wget_vector_free(&cache);
+}
+
+static void hashed_cache(long nhosts)
+{
+	wget_tcp_t *tcp = wget_tcp_init();
+	wget_dns_cache_stats_t stats;
+	long long start = wget_get_timemillis(), fill = start;
+	long it;
+	int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (it = 0; it < nhosts; it++)
+			wget_tcp_resolve(tcp, _make_host(it), "80");
+
+		if (pass == 0)
+			fill = wget_get_timemillis();
+	}
+
+	wget_dns_cache_get_stats(&stats);
+	printf("%-28s %8ld hosts: fill %6lld ms, lookup %6lld ms, resolver calls %ld (hits %llu, misses %llu)\n",
+		"hashed cache", nhosts, fill - start, wget_get_timemillis() - fill, stub_calls, stats.hits, stats.misses);
+
+	// unresolvable names are resolved only once within the negative TTL
+	stub_calls = 0;
+	start = wget_get_timemillis();
+	for (pass = 0; pass < 2; pass++) {
+		for (it = 1; it <= nhosts / 10; it++)
+			wget_tcp_resolve(tcp, _make_host(-it), "80");
+	}
+
+	wget_dns_cache_get_stats(&stats);
+	printf("%-28s %8ld hosts: %6lld ms, resolver calls %ld (negative hits %llu)\n",
+		"hashed cache, failures", nhosts / 10, wget_get_timemillis() - start, stub_calls, stats.negative_hits);
+
+	wget_tcp_deinit(&tcp);
+	wget_dns_cache_free();
+}
+
+int main(int argc, const char *const *argv)
+{
+	long nhosts = argc > 1 ? atol(argv[1]) : 100000;
+
+	if (nhosts < 10)
+		nhosts = 10;
+
+	wget_dns_set_resolver(stub_resolver);
+
+	vector_cache(nhosts);
+	stub_calls = 0;
+	hashed_cache(nhosts);
+
+	return 0;
+}
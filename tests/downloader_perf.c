@@ -0,0 +1,116 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * stress test: recursive download with many downloader threads or the epoll engine (jobs/sec)
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h> // exit()
+#include "libtest.h"
+
+#define NSECTIONS 20 // HTML pages linked from index.html
+#define NLEAVES 100 // text files linked from each section
+
+int main(void)
+{
+	static const struct {
+		const char
+			*engine;
+		int
+			nthreads;
+		char
+			adaptive; // --adaptive-threads, nthreads is the upper bound
+	} runs[] = {
+		{ "threads", 8, 0 },
+		{ "threads", 64, 0 },
+		{ "threads", 256, 0 },
+		{ "threads", 256, 1 },
+#ifdef HAVE_SYS_EPOLL_H
+		{ "epoll", 1, 0 },
+#endif
+	};
+	wget_test_url_t *urls = wget_calloc(1 + NSECTIONS * (NLEAVES + 1), sizeof(wget_test_url_t));
+	wget_buffer_t *body = wget_buffer_alloc(4096);
+	size_t nurls = 0;
+	char executable[192];
+
+	// the test server sends responses up to 4k, so we build a tree of small pages
+	wget_buffer_strcpy(body, "<html><body>");
+	for (int it = 0; it < NSECTIONS; it++)
+		wget_buffer_printf_append(body, "<a href=\"s%d.html\">%d</a>", it, it);
+	wget_buffer_strcat(body, "</body></html>");
+	urls[nurls].name = "/index.html";
+	urls[nurls].code = "200 Dontcare";
+	urls[nurls].body = wget_strdup(body->data);
+	urls[nurls].body_alloc = 1;
+	urls[nurls++].headers[0] = "Content-Type: text/html";
+
+	for (int it = 0; it < NSECTIONS; it++) {
+		wget_buffer_strcpy(body, "<html><body>");
+		for (int it2 = 0; it2 < NLEAVES; it2++)
+			wget_buffer_printf_append(body, "<a href=\"s%d/%d.txt\">%d</a>", it, it2, it2);
+		wget_buffer_strcat(body, "</body></html>");
+		urls[nurls].name = wget_str_asprintf("/s%d.html", it);
+		urls[nurls].code = "200 Dontcare";
+		urls[nurls].body = wget_strdup(body->data);
+		urls[nurls].body_alloc = 1;
+		urls[nurls++].headers[0] = "Content-Type: text/html";
+
+		for (int it2 = 0; it2 < NLEAVES; it2++) {
+			urls[nurls].name = wget_str_asprintf("/s%d/%d.txt", it, it2);
+			urls[nurls].code = "200 Dontcare";
+			urls[nurls].body = "x";
+			urls[nurls++].headers[0] = "Content-Type: text/plain";
+		}
+	}
+
+	wget_buffer_free(&body);
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, urls, nurls,
+		0);
+
+	for (unsigned it = 0; it < countof(runs); it++) {
+		long long start;
+
+		// the epoll engine multiplexes up to --max-connections transfers per thread
+		snprintf(executable, sizeof(executable), "../../src/wget2 --io-engine=%s --max-threads=%d --max-connections=256 --prefer-family=ipv4 --no-ocsp%s",
+			runs[it].engine, runs[it].nthreads, runs[it].adaptive ? " --adaptive-threads" : "");
+
+		start = wget_get_timemillis();
+		wget_test(
+			WGET_TEST_EXECUTABLE, executable,
+			WGET_TEST_OPTIONS, "--spider -r -q",
+			WGET_TEST_REQUEST_URL, "index.html",
+			WGET_TEST_EXPECTED_ERROR_CODE, 0,
+			0);
+		start = wget_get_timemillis() - start;
+
+		printf("%-7s %3d threads%s: %zu jobs in %lld ms, %.0f jobs/s\n",
+			runs[it].engine, runs[it].nthreads, runs[it].adaptive ? " (adaptive)" : "", nurls, start, start ? nurls * 1000.0 / start : 0.0);
+	}
+
+	exit(0);
+}
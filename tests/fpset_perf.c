@@ -0,0 +1,178 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * memory usage of URL dedup tables: hashmap of strings vs. fingerprint set (bytes/URL)
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <libwget.h>
+
+static char url[128];
+
+// resident set size in bytes
+static long long _rss(void)
+{
+	FILE *fp;
+	long long pages = 0;
+
+	if ((fp = fopen("/proc/self/statm", "r"))) {
+		if (fscanf(fp, "%*s %lld", &pages) != 1)
+			pages = 0;
+		fclose(fp);
+	}
+
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+// synthetic URLs, spread over 1000 hosts
+static int _make_url(long n)
+{
+	return snprintf(url, sizeof(url), "https://www%ld.example.com/dir%ld/page-%ld.html?id=%ld", n % 1000, n % 97, n, n * 7);
+}
+
+// the old known_urls hash function
+static unsigned int G_GNUC_WGET_PURE hash_url(const char *s)
+{
+	unsigned int hash = 0;
+
+	while (*s)
+		hash = hash * 101 + (unsigned char)*s++;
+
+	return hash;
+}
+
+// keys of the blacklist tables are opaque pointers (IRIs in wget2), we just measure the table
+static unsigned int hash_key32(const void *key)
+{
+	_make_url((long)(size_t)key);
+	return hash_url(url);
+}
+
+static unsigned long long hash_key64(const void *key)
+{
+	return wget_fpset_hash(0, url, _make_url((long)(size_t)key));
+}
+
+static int G_GNUC_WGET_CONST cmp_key(const void *key1, const void *key2)
+{
+	return key1 != key2;
+}
+
+// the tables are measured before they are freed
+static long long
+	rss_start,
+	ms_start;
+
+static void _start(void)
+{
+	rss_start = _rss();
+	ms_start = wget_get_timemillis();
+}
+
+static void _report(const char *name, long nurls)
+{
+	long long ms = wget_get_timemillis() - ms_start;
+
+	printf("%-34s %10ld URLs %8.1f bytes/URL %8lld ms\n", name, nurls, (double)(_rss() - rss_start) / nurls, ms);
+	fflush(stdout);
+}
+
+static void known_urls_hashmap(long nurls)
+{
+	wget_hashmap_t *map = wget_hashmap_create(128, -2, (unsigned int(*)(const void *))hash_url, (int(*)(const void *, const void *))strcmp);
+
+	for (long it = 0; it < nurls; it++)
+		wget_hashmap_put_noalloc(map, wget_strmemdup(url, _make_url(it)), NULL);
+
+	_report("known_urls: hashmap of strings", nurls);
+	wget_hashmap_free(&map);
+}
+
+static void known_urls_fpset(long nurls)
+{
+	wget_fpset_t *set = wget_fpset_create(128, NULL, NULL);
+
+	for (long it = 0; it < nurls; it++)
+		wget_fpset_add_fingerprint(set, wget_fpset_hash(0, url, _make_url(it)));
+
+	_report("known_urls: fingerprint set", nurls);
+	wget_fpset_free(&set);
+}
+
+static void blacklist_hashmap(long nurls)
+{
+	wget_hashmap_t *map = wget_hashmap_create(128, -2, hash_key32, cmp_key);
+
+	wget_hashmap_set_key_destructor(map, NULL);
+	wget_hashmap_set_value_destructor(map, NULL);
+	for (long it = 0; it < nurls; it++)
+		wget_hashmap_put_noalloc(map, (void *)(size_t)(it + 1), NULL);
+
+	_report("blacklist: hashmap", nurls);
+	wget_hashmap_free(&map);
+}
+
+static void blacklist_fpset(long nurls)
+{
+	wget_fpset_t *set = wget_fpset_create(128, hash_key64, cmp_key);
+
+	wget_fpset_set_key_destructor(set, NULL);
+	for (long it = 0; it < nurls; it++)
+		wget_fpset_add(set, (void *)(size_t)(it + 1));
+
+	_report("blacklist: fingerprint set (exact)", nurls);
+	wget_fpset_free(&set);
+}
+
+int main(int argc, const char *const *argv)
+{
+	static void (*tests[])(long) = {
+		known_urls_hashmap, known_urls_fpset, blacklist_hashmap, blacklist_fpset
+	};
+	long nurls = argc > 1 ? atol(argv[1]) : 10000000;
+
+	if (nurls < 1)
+		nurls = 1;
+
+	// each test runs in its own process, memory freed by a test must not be reused by the next one
+	for (unsigned it = 0; it < sizeof(tests) / sizeof(tests[0]); it++) {
+		pid_t pid = fork();
+
+		if (pid == 0) {
+			_start();
+			tests[it](nurls);
+			exit(0);
+		} else if (pid < 0 || waitpid(pid, NULL, 0) != pid) {
+			fprintf(stderr, "Failed to run test %u\n", it);
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing performance of the HTTP response header parser
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwget.h>
+#include "libtest.h"
+
+// response headers as sent by popular servers and CDNs
+static const char *corpus[] = {
+	"HTTP/1.1 200 OK\r\n"
+	"Server: nginx/1.10.1\r\n"
+	"Date: Sun, 16 Oct 2016 10:12:31 GMT\r\n"
+	"Content-Type: text/html; charset=utf-8\r\n"
+	"Content-Length: 48211\r\n"
+	"Connection: keep-alive\r\n"
+	"Vary: Accept-Encoding\r\n"
+	"Last-Modified: Fri, 14 Oct 2016 08:01:12 GMT\r\n"
+	"ETag: \"57ff7f18-bc53\"\r\n"
+	"Cache-Control: max-age=600\r\n"
+	"Accept-Ranges: bytes\r\n"
+	"\r\n",
+
+	"HTTP/1.1 200 OK\r\n"
+	"Date: Sun, 16 Oct 2016 10:12:32 GMT\r\n"
+	"Server: Apache/2.4.10 (Debian)\r\n"
+	"Strict-Transport-Security: max-age=15768000; includeSubDomains\r\n"
+	"Last-Modified: Wed, 12 Oct 2016 19:22:05 GMT\r\n"
+	"ETag: \"2aa6-53eb0c2b8b540-gzip\"\r\n"
+	"Accept-Ranges: bytes\r\n"
+	"Vary: Accept-Encoding\r\n"
+	"Content-Encoding: gzip\r\n"
+	"Content-Length: 3324\r\n"
+	"Keep-Alive: timeout=5, max=100\r\n"
+	"Connection: Keep-Alive\r\n"
+	"Content-Type: text/css\r\n"
+	"\r\n",
+
+	"HTTP/1.1 200 OK\r\n"
+	"Date: Sun, 16 Oct 2016 10:12:33 GMT\r\n"
+	"Content-Type: text/html; charset=UTF-8\r\n"
+	"Transfer-Encoding: chunked\r\n"
+	"Connection: keep-alive\r\n"
+	"Set-Cookie: __cfduid=d2a9b5e3cbb1c4d0f4c2e0b0f0e0d0c0b1476612753; expires=Mon, 16-Oct-17 10:12:33 GMT; path=/; domain=.example.com; HttpOnly\r\n"
+	"Set-Cookie: session=8f3e2a1b7c6d5e4f; path=/; secure; HttpOnly\r\n"
+	"Cache-Control: private, must-revalidate\r\n"
+	"Pragma: no-cache\r\n"
+	"Expires: Thu, 01 Jan 1970 00:00:00 GMT\r\n"
+	"X-Frame-Options: SAMEORIGIN\r\n"
+	"X-Content-Type-Options: nosniff\r\n"
+	"Vary: Accept-Encoding\r\n"
+	"Server: cloudflare-nginx\r\n"
+	"CF-RAY: 2f2e1d0c0b0a0908-FRA\r\n"
+	"Content-Encoding: gzip\r\n"
+	"\r\n",
+
+	"HTTP/1.1 301 Moved Permanently\r\n"
+	"Server: nginx\r\n"
+	"Date: Sun, 16 Oct 2016 10:12:34 GMT\r\n"
+	"Content-Type: text/html\r\n"
+	"Content-Length: 178\r\n"
+	"Connection: keep-alive\r\n"
+	"Location: https://www.example.com/download/file-1.2.3.tar.gz\r\n"
+	"\r\n",
+
+	"HTTP/1.1 200 OK\r\n"
+	"x-amz-id-2: Gm9q2ZD1q6n1VxO1tXq0dE4YpL8kU2s0rC9bW7aF3jH6gN5mK4lP0oI8uY7tR6eW\r\n"
+	"x-amz-request-id: 3B3C7C725673C630\r\n"
+	"Date: Sun, 16 Oct 2016 10:12:35 GMT\r\n"
+	"Last-Modified: Mon, 03 Oct 2016 17:31:42 GMT\r\n"
+	"ETag: \"fba9dede5f27731c9771645a39863328\"\r\n"
+	"Accept-Ranges: bytes\r\n"
+	"Content-Type: application/octet-stream\r\n"
+	"Content-Length: 434234\r\n"
+	"Content-Disposition: attachment; filename=\"release-1.2.3.zip\"\r\n"
+	"Server: AmazonS3\r\n"
+	"\r\n",
+
+	"HTTP/1.1 302 Found\r\n"
+	"Date: Sun, 16 Oct 2016 10:12:36 GMT\r\n"
+	"Server: Apache/2.2.22 (Linux/SUSE)\r\n"
+	"X-Prefix: 87.128.0.0/10\r\n"
+	"Link: <http://download.example.org/file.iso.meta4>; rel=describedby; type=\"application/metalink4+xml\"\r\n"
+	"Link: <http://ftp1.example.org/pub/file.iso>; rel=duplicate; pri=1; geo=de\r\n"
+	"Link: <http://ftp2.example.org/pub/file.iso>; rel=duplicate; pri=2; geo=us\r\n"
+	"Digest: SHA-256=47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=\r\n"
+	"Location: http://ftp1.example.org/pub/file.iso\r\n"
+	"Content-Length: 0\r\n"
+	"Content-Type: text/html; charset=iso-8859-1\r\n"
+	"\r\n",
+
+	"HTTP/1.1 401 Unauthorized\r\n"
+	"Date: Sun, 16 Oct 2016 10:12:37 GMT\r\n"
+	"Server: Apache\r\n"
+	"WWW-Authenticate: Digest realm=\"private\", nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", qop=\"auth\", algorithm=MD5\r\n"
+	"WWW-Authenticate: Basic realm=\"private\"\r\n"
+	"Content-Length: 381\r\n"
+	"Content-Type: text/html; charset=iso-8859-1\r\n"
+	"\r\n",
+
+	"HTTP/1.1 503 Service Unavailable\r\n"
+	"Date: Sun, 16 Oct 2016 10:12:38 GMT\r\n"
+	"Server: Varnish\r\n"
+	"Retry-After: 120\r\n"
+	"Content-Type: text/html; charset=utf-8\r\n"
+	"Content-Length: 412\r\n"
+	"Connection: close\r\n"
+	"\r\n",
+};
+
+int main(void)
+{
+	size_t length[countof(corpus)], nheaders = 0, maxlen = 0;
+	long long start, copy;
+	char *buf;
+	int it, n;
+
+	for (n = 0; n < (int) countof(corpus); n++) {
+		length[n] = strlen(corpus[n]);
+		if (length[n] > maxlen)
+			maxlen = length[n];
+
+		// count header lines, the status line and the final empty line excluded
+		for (const char *p = strchr(corpus[n], '\n') + 1; *p != '\r'; p = strchr(p, '\n') + 1)
+			nheaders++;
+	}
+
+	buf = wget_malloc(maxlen + 1);
+
+	// the parser modifies the buffer, so each header is copied before parsing
+	start = wget_test_get_time_nanos();
+	for (it = 0; it < 200000; it++) {
+		for (n = 0; n < (int) countof(corpus); n++)
+			memcpy(buf, corpus[n], length[n] + 1);
+	}
+	copy = wget_test_get_time_nanos() - start;
+
+	start = wget_test_get_time_nanos();
+	for (it = 0; it < 200000; it++) {
+		for (n = 0; n < (int) countof(corpus); n++) {
+			wget_http_response_t *resp;
+
+			memcpy(buf, corpus[n], length[n] + 1);
+			resp = wget_http_parse_response_header(buf);
+			wget_http_free_response(&resp);
+		}
+	}
+	start = wget_test_get_time_nanos() - start - copy;
+
+	printf("%d responses, %zu header lines: %.1f ns/response, %.1f ns/header\n",
+		it * (int) countof(corpus), it * nheaders,
+		(double) start / (it * countof(corpus)), (double) start / (it * nheaders));
+
+	wget_xfree(buf);
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing performance of the job queue (dispatch cost vs. queue size)
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libwget.h>
+#include "libtest.h"
+
+#include "../src/wget.h"
+#include "../src/job.h"
+
+// referenced by job.c, only needed for robots.txt jobs
+const char *get_local_filename(wget_iri_t *iri G_GNUC_WGET_UNUSED)
+{
+	return NULL;
+}
+
+#define NTHREADS 64
+
+int main(int argc, const char *const *argv)
+{
+	int nhosts = argc > 1 ? atoi(argv[1]) : 100;
+	wget_iri_t **iris;
+	JOB *inflight[NTHREADS] = { NULL };
+	char url[64];
+
+	if (nhosts < 1)
+		nhosts = 1;
+
+	// jobs of the same host share the IRI, we only measure the queue
+	iris = wget_malloc(nhosts * sizeof(wget_iri_t *));
+	for (int it = 0; it < nhosts; it++) {
+		snprintf(url, sizeof(url), "http://host%d.example.com/", it);
+		iris[it] = wget_iri_parse(url, NULL);
+	}
+
+	queue_init(1);
+
+	printf("%10s %8s %14s %14s\n", "jobs", "hosts", "add ns/job", "get+del ns/job");
+
+	for (int njobs = 1000; njobs <= 1000000; njobs *= 10) {
+		JOB job, *jobp;
+		long long start, add_ns, get_ns;
+		int n;
+
+		start = wget_test_get_time_nanos();
+		for (int it = 0; it < njobs; it++)
+			queue_add_job(job_init(&job, iris[it % nhosts]));
+		add_ns = wget_test_get_time_nanos() - start;
+
+		// simulate NTHREADS downloads, each taken from the queue and finished a bit later
+		start = wget_test_get_time_nanos();
+		for (n = 0; queue_get(0, &jobp, NULL); n++) {
+			if (inflight[n % NTHREADS])
+				queue_del(inflight[n % NTHREADS]);
+			inflight[n % NTHREADS] = jobp;
+		}
+		for (int it = 0; it < NTHREADS; it++) {
+			queue_del(inflight[it]);
+			inflight[it] = NULL;
+		}
+		get_ns = wget_test_get_time_nanos() - start;
+
+		if (n != njobs || !queue_empty()) {
+			fprintf(stderr, "Got %d jobs, expected %d\n", n, njobs);
+			return 1;
+		}
+
+		printf("%10d %8d %14.1f %14.1f\n", njobs, nhosts, (double)add_ns / njobs, (double)get_ns / njobs);
+	}
+
+	queue_free();
+	hosts_free();
+
+	for (int it = 0; it < nhosts; it++)
+		wget_iri_free(&iris[it]);
+	wget_xfree(iris);
+
+	return 0;
+}
@@ -44,6 +44,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <time.h>
 
 #include <libwget.h>
 #include "libtest.h"
@@ -60,7 +61,13 @@ static int
 	ftps_server_port,
 	ftps_implicit,
 	terminate,
-	keep_tmpfiles;
+	keep_tmpfiles,
+	kill_at_request, // kill the tested command when the HTTP server gets this request, 0 = never
+	nrequests, // requests since the tested command has been started
+	server_keep_alive, // the HTTP server answers further (pipelined) requests on a connection
+	server_latency; // ms the HTTP server waits after receiving data, simulates the round trip time
+static pid_t
+	command_pid; // process group of the tested command if kill_at_request is set
 /*static const char
 	*response_code = "200 Dontcare",
 	*response_body = "";
@@ -92,9 +99,9 @@ static void *_http_server_thread(void *ctx)
 {
 	wget_tcp_t *tcp=NULL, *parent_tcp = ctx;
 	wget_test_url_t *url = NULL;
-	char buf[4096], method[32], request_url[256], tag[64], value[256], *p;
+	char buf[4096], rest[4096], method[32], request_url[256], tag[64], value[256], *p;
 	ssize_t nbytes, from_bytes, to_bytes, n;
-	size_t body_len, request_url_length;
+	size_t body_len, request_url_length, nrest;
 	unsigned it;
 	int byterange, authorized;
 	time_t modified;
@@ -109,18 +116,35 @@ static void *_http_server_thread(void *ctx)
 		wget_tcp_deinit(&tcp);
 
 		if ((tcp = wget_tcp_accept(parent_tcp))) {
+			nrest = 0;
+
+			// don't block other connections for long while the client keeps this one idle
+			if (server_keep_alive)
+				wget_tcp_set_timeout(tcp, 1000);
+
+next_request:
 			authorized = 0;
 
-			n = nbytes = 0;
-			while ((n = wget_tcp_read(tcp, buf + nbytes, sizeof(buf) - 1 - nbytes)) > 0) {
+			// the client might have sent the next request already (pipelining)
+			memcpy(buf, rest, nrest);
+			nbytes = nrest;
+			buf[nbytes] = 0;
+			nrest = n = 0;
+
+			while (!strstr(buf, "\r\n\r\n") && (n = wget_tcp_read(tcp, buf + nbytes, sizeof(buf) - 1 - nbytes)) > 0) {
 				nbytes += n;
 				buf[nbytes]=0;
 				wget_info_printf(_("[SERVER] got %zd bytes (total %zd)\n"), n, nbytes);
-				if (strstr(buf,"\r\n\r\n"))
-					break;
+				if (server_latency)
+					wget_millisleep(server_latency);
 			}
 			wget_info_printf(_("[SERVER] total %zd bytes (total %zd) (errno=%d)\n"), n, nbytes, errno);
 
+			if (server_keep_alive && (p = strstr(buf, "\r\n\r\n"))) {
+				nrest = nbytes - (p + 4 - buf);
+				memcpy(rest, p + 4, nrest);
+			}
+
 			// as a quick hack, just assume that request comes in one packet
 //			if ((nbytes = wget_tcp_read(tcp, buf, sizeof(buf)-1)) > 0) {
 //				buf[nbytes]=0;
@@ -130,6 +154,13 @@ static void *_http_server_thread(void *ctx)
 					continue;
 				}
 
+				if (kill_at_request && ++nrequests == kill_at_request && command_pid > 0) {
+					// simulate a crash, the request is not answered
+					wget_info_printf(_("[SERVER] killing tested command at request %d\n"), nrequests);
+					kill(-command_pid, SIGKILL);
+					continue;
+				}
+
 				byterange = from_bytes = to_bytes = 0;
 				modified = 0;
 
@@ -238,8 +269,8 @@ static void *_http_server_thread(void *ctx)
 					body_len = strlen(url->body ? url->body : "");
 					nbytes = snprintf(buf, sizeof(buf),
 						"HTTP/1.1 %s\r\n"\
-						"Content-Length: %zu\r\n",
-						url->code ? url->code : "200 OK\r\n", body_len);
+						"Content-Length: %zu\r\n%s",
+						url->code ? url->code : "200 OK\r\n", body_len, server_keep_alive ? "Connection: keep-alive\r\n" : "");
 					for (it = 0; it < countof(url->headers) && url->headers[it]; it++) {
 						nbytes += snprintf(buf + nbytes, sizeof(buf) - nbytes, "%s\r\n", url->headers[it]);
 					}
@@ -250,6 +281,9 @@ static void *_http_server_thread(void *ctx)
 
 				// send response
 				wget_tcp_write(tcp, buf, nbytes);
+
+				if (server_keep_alive)
+					goto next_request;
 			}
 		} else if (!terminate)
 			wget_error_printf(_("Failed to get connection (%d)\n"), errno);
@@ -580,6 +614,12 @@ void wget_test_start_server(int first_key, ...)
 		case WGET_TEST_FTPS_IMPLICIT:
 			ftps_implicit = va_arg(args, int);
 			break;
+		case WGET_TEST_SERVER_KEEP_ALIVE:
+			server_keep_alive = va_arg(args, int);
+			break;
+		case WGET_TEST_SERVER_LATENCY:
+			server_latency = va_arg(args, int);
+			break;
 		default:
 			wget_error_printf(_("Unknown option %d\n"), key);
 		}
@@ -609,7 +649,7 @@ void wget_test_start_server(int first_key, ...)
 	http_parent_tcp = wget_tcp_init();
 	wget_tcp_set_timeout(http_parent_tcp, -1); // INFINITE timeout
 	wget_tcp_set_preferred_family(http_parent_tcp, WGET_NET_FAMILY_IPV4); // to have a defined order of IPs
-	if (wget_tcp_listen(http_parent_tcp, "localhost", NULL, 5) != 0)
+	if (wget_tcp_listen(http_parent_tcp, "localhost", NULL, 256) != 0) // allow many parallel downloaders
 		exit(1);
 	http_server_port = wget_tcp_get_local_port(http_parent_tcp);
 
@@ -748,6 +788,7 @@ void wget_test(int first_key, ...)
 	va_list args;
 
 	keep_tmpfiles = 0;
+	kill_at_request = 0;
 	server_hello = "220 FTP server ready";
 
 	if (!request_urls)
@@ -782,6 +823,9 @@ void wget_test(int first_key, ...)
 		case WGET_TEST_EXECUTABLE:
 			executable = va_arg(args, const char *);
 			break;
+		case WGET_TEST_KILL_AT_REQUEST:
+			kill_at_request = va_arg(args, int);
+			break;
 		case WGET_TEST_FTP_SERVER_HELLO:
 			server_hello = va_arg(args, const char *);
 			break;
@@ -842,14 +886,34 @@ void wget_test(int first_key, ...)
 	wget_buffer_strcat(cmd, " 2>&1");
 
 	wget_error_printf("\n  Testing '%s'\n", cmd->data);
-	rc = system(cmd->data);
 
-	if (!WIFEXITED(rc)) {
-		wget_error_printf_exit(_("Unexpected error code %d, expected %d [%s]\n"), rc, expected_error_code, options);
-	}
-	else if (WEXITSTATUS(rc) != expected_error_code) {
-		wget_error_printf_exit(_("Unexpected error code %d, expected %d [%s]\n"),
-			WEXITSTATUS(rc), expected_error_code, options);
+	if (kill_at_request) {
+		// run the command in its own process group, so that the HTTP server can kill it
+		nrequests = 0;
+
+		if ((command_pid = fork()) == 0) {
+			setpgid(0, 0);
+			execl("/bin/sh", "sh", "-c", cmd->data, (char *) NULL);
+			_exit(127);
+		} else if (command_pid < 0)
+			wget_error_printf_exit(_("Failed to fork (%d)\n"), errno);
+
+		setpgid(command_pid, command_pid);
+		while (waitpid(command_pid, &rc, 0) == -1 && errno == EINTR);
+		command_pid = 0;
+
+		if (!WIFSIGNALED(rc) || WTERMSIG(rc) != SIGKILL)
+			wget_error_printf_exit(_("Command has not been killed at request %d [%s]\n"), kill_at_request, options);
+	} else {
+		rc = system(cmd->data);
+
+		if (!WIFEXITED(rc)) {
+			wget_error_printf_exit(_("Unexpected error code %d, expected %d [%s]\n"), rc, expected_error_code, options);
+		}
+		else if (WEXITSTATUS(rc) != expected_error_code) {
+			wget_error_printf_exit(_("Unexpected error code %d, expected %d [%s]\n"),
+				WEXITSTATUS(rc), expected_error_code, options);
+		}
 	}
 
 	if (expected_files) {
@@ -908,3 +972,13 @@ int wget_test_get_ftps_server_port(void)
 {
 	return ftps_server_port;
 }
+
+// monotonic time in nanoseconds for the benchmarks, wget_get_timemillis() is too coarse for them
+long long wget_test_get_time_nanos(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -46,6 +46,8 @@ extern "C" {
 #define WGET_TEST_FTP_IO_ORDERED 1004
 #define WGET_TEST_FTP_SERVER_HELLO 1005
 #define WGET_TEST_FTPS_IMPLICIT 1006
+#define WGET_TEST_SERVER_KEEP_ALIVE 1007
+#define WGET_TEST_SERVER_LATENCY 1008
 
 // defines for wget_test()
 #define WGET_TEST_REQUEST_URL 2001
@@ -56,6 +58,7 @@ extern "C" {
 #define WGET_TEST_KEEP_TMPFILES 2006
 #define WGET_TEST_REQUEST_URLS 2007
 #define WGET_TEST_EXECUTABLE 2008
+#define WGET_TEST_KILL_AT_REQUEST 2009
 
 #define countof(a) (sizeof(a)/sizeof(*(a)))
 
@@ -123,6 +126,7 @@ int wget_test_get_http_server_port(void) G_GNUC_WGET_PURE LIBWGET_EXPORT;
 int wget_test_get_https_server_port(void) G_GNUC_WGET_PURE LIBWGET_EXPORT;
 int wget_test_get_ftp_server_port(void) G_GNUC_WGET_PURE LIBWGET_EXPORT;
 int wget_test_get_ftps_server_port(void) G_GNUC_WGET_PURE LIBWGET_EXPORT;
+long long wget_test_get_time_nanos(void) LIBWGET_EXPORT;
 
 #if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 5)
 #	pragma GCC diagnostic ignored "-Wmissing-field-initializers"
@@ -0,0 +1,95 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * benchmark: many small objects of one host over a connection with latency, with and without --pipelining
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h> // exit()
+#include "libtest.h"
+
+#define NOBJECTS 200 // small files linked from index.html
+#define LATENCY 10 // ms the server waits for each chunk of request data it receives
+
+int main(void)
+{
+	static const int depth[] = { 0, 2, 4, 8, 16, 32 };
+	wget_test_url_t *urls = wget_calloc(1 + NOBJECTS, sizeof(wget_test_url_t));
+	wget_test_file_t *files = wget_calloc(1 + NOBJECTS + 1, sizeof(wget_test_file_t));
+	wget_buffer_t *body = wget_buffer_alloc(16384);
+	size_t nurls = 0;
+	char options[128];
+
+	wget_buffer_strcpy(body, "<html><body>");
+	for (int it = 0; it < NOBJECTS; it++)
+		wget_buffer_printf_append(body, "<img src=\"%d.gif\">", it);
+	wget_buffer_strcat(body, "</body></html>");
+	urls[nurls].name = "/index.html";
+	urls[nurls].code = "200 Dontcare";
+	urls[nurls].body = wget_strdup(body->data);
+	urls[nurls].body_alloc = 1;
+	urls[nurls++].headers[0] = "Content-Type: text/html";
+
+	for (int it = 0; it < NOBJECTS; it++) {
+		urls[nurls].name = wget_str_asprintf("/%d.gif", it);
+		urls[nurls].code = "200 Dontcare";
+		urls[nurls].body = "GIF89a";
+		urls[nurls++].headers[0] = "Content-Type: image/gif";
+	}
+
+	wget_buffer_free(&body);
+
+	for (size_t it = 0; it < nurls; it++) {
+		files[it].name = urls[it].name + 1;
+		files[it].content = urls[it].body;
+	}
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, urls, nurls,
+		WGET_TEST_SERVER_KEEP_ALIVE, 1,
+		WGET_TEST_SERVER_LATENCY, LATENCY,
+		0);
+
+	for (unsigned it = 0; it < countof(depth); it++) {
+		long long start;
+
+		// one downloader, all requests go over one connection
+		snprintf(options, sizeof(options), "-p -q -nH --pipelining=%d", depth[it]);
+
+		start = wget_get_timemillis();
+		wget_test(
+			WGET_TEST_OPTIONS, options,
+			WGET_TEST_REQUEST_URL, "index.html",
+			WGET_TEST_EXPECTED_ERROR_CODE, 0,
+			WGET_TEST_EXPECTED_FILES, files,
+			0);
+		start = wget_get_timemillis() - start;
+
+		printf("pipelining %2d, %d ms latency: %zu objects in %lld ms, %.0f objects/s\n",
+			depth[it], LATENCY, nurls, start, start ? nurls * 1000.0 / start : 0.0);
+	}
+
+	exit(0);
+}
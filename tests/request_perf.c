@@ -0,0 +1,136 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing cost of building and serializing HTTP requests, with and without a request template
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwget.h>
+#include "libtest.h"
+
+#define REQUESTS 200000
+
+static const char
+	*accept_encoding = "gzip, deflate, bzip2, xz, lzma",
+	*accept = "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+	*user_agent = "Wget/2.0 (linux-gnu)";
+
+static long long
+	allocations;
+
+#ifdef __GLIBC__
+// count the allocations, libwget and libc (strdup etc.) use these functions
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+// the per-request headers of a recursive download: a Referer, sometimes a Cookie
+static void _add_variable_headers(wget_http_request_t *req, int it)
+{
+	wget_http_add_header(req, "Referer", "http://www.example.com/index.html");
+	if (it % 4 == 0)
+		wget_http_add_header(req, "Cookie", "session=8f3e2a1b7c6d5e4f");
+}
+
+static void _run(const char *name, wget_iri_t *iri, wget_http_request_template_t *tmpl)
+{
+	wget_buffer_t *buf = wget_buffer_alloc(1024);
+	long long start, before;
+	size_t length = 0;
+
+	before = allocations;
+	start = wget_test_get_time_nanos();
+
+	for (int it = 0; it < REQUESTS; it++) {
+		wget_http_request_t *req;
+
+		if (tmpl)
+			req = wget_http_create_request_with_template(iri, "GET", tmpl);
+		else {
+			req = wget_http_create_request(iri, "GET");
+			wget_http_add_header(req, "Accept-Encoding", accept_encoding);
+			wget_http_add_header(req, "Accept", accept);
+			wget_http_add_header(req, "User-Agent", user_agent);
+			wget_http_add_header(req, "Connection", "keep-alive");
+		}
+
+		_add_variable_headers(req, it);
+
+		length += wget_http_request_to_buffer(req, buf);
+		wget_http_free_request(&req);
+	}
+
+	start = wget_test_get_time_nanos() - start;
+	before = allocations - before;
+
+	printf("%-16s %5.1f allocations/request, %6.1f ns/request (%zu bytes/request)\n",
+		name, (double) before / REQUESTS, (double) start / REQUESTS, length / REQUESTS);
+
+	wget_buffer_free(&buf);
+}
+
+int main(void)
+{
+	wget_iri_t *iri = wget_iri_parse("http://www.example.com/path/to/some/document.html", NULL);
+	wget_http_request_template_t *tmpl = wget_http_create_request_template();
+
+	wget_http_request_template_add_header(tmpl, "Accept-Encoding", accept_encoding);
+	wget_http_request_template_add_header(tmpl, "Accept", accept);
+	wget_http_request_template_add_header(tmpl, "User-Agent", user_agent);
+	wget_http_request_template_add_header(tmpl, "Connection", "keep-alive");
+
+#ifndef __GLIBC__
+	printf("allocations are not counted on this platform\n");
+#endif
+
+	_run("headers", iri, NULL);
+	_run("template", iri, tmpl);
+
+	wget_http_free_request_template(&tmpl);
+	wget_iri_free(&iri);
+
+	return 0;
+}
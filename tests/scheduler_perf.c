@@ -0,0 +1,269 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing performance of the job dispatch with many downloader threads (jobs/sec),
+ * the former single list queue vs. the work-stealing queue, without network and test server
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libwget.h>
+#include "libtest.h"
+
+#include "../src/wget.h"
+#include "../src/job.h"
+
+// referenced by job.c, only needed for robots.txt jobs
+const char *get_local_filename(wget_iri_t *iri G_GNUC_WGET_UNUSED)
+{
+	return NULL;
+}
+
+#define FANOUT 8 // each page links to FANOUT documents
+#define NHOSTS 16
+
+static wget_iri_t
+	*iris[NHOSTS];
+static int
+	depth = 5, // levels of the crawl below the start page
+	njobs, // jobs of the whole crawl
+	done; // jobs done so far
+static volatile int
+	finished;
+
+static int _fetch_and_add_int(int *p, int n)
+{
+#ifdef WITH_SYNC_FETCH_AND_ADD
+	return __sync_fetch_and_add(p, n);
+#else
+	static wget_thread_mutex_t
+		add_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+	int old;
+
+	wget_thread_mutex_lock(&add_mutex);
+	old = *p;
+	*p += n;
+	wget_thread_mutex_unlock(&add_mutex);
+
+	return old;
+#endif
+}
+
+// the 'download' of a job: a page of the upper levels links to FANOUT new documents
+static void _process(JOB *job, void (*add)(JOB *job, void *ctx), void *ctx)
+{
+	static int next_host;
+	JOB child;
+
+	if (job->level >= depth)
+		return;
+
+	for (int it = 0; it < FANOUT; it++) {
+		job_init(&child, iris[_fetch_and_add_int(&next_host, 1) % NHOSTS]);
+		child.level = job->level + 1;
+		add(&child, ctx);
+	}
+}
+
+// The queue as it was before the per-host and per-worker queues: one list with one mutex,
+// queue_get() searches for the first job not in use, the downloaders wait for
+// a single condition that is signalled for each new job.
+static wget_list_t
+	*base_queue;
+static wget_thread_mutex_t
+	base_mutex = WGET_THREAD_MUTEX_INITIALIZER,
+	base_main_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static wget_thread_cond_t
+	base_cond = WGET_THREAD_COND_INITIALIZER;
+
+static int _base_find_free_job(JOB **jobp, JOB *job)
+{
+	if (!job->inuse) {
+		job->inuse = 1;
+		*jobp = job;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void _base_add(JOB *job, void *ctx G_GNUC_WGET_UNUSED)
+{
+	wget_thread_mutex_lock(&base_mutex);
+	wget_list_append(&base_queue, job, sizeof(JOB));
+	wget_thread_mutex_unlock(&base_mutex);
+
+	wget_thread_mutex_lock(&base_main_mutex);
+	wget_thread_cond_signal(&base_cond);
+	wget_thread_mutex_unlock(&base_main_mutex);
+}
+
+static void *_base_downloader(void *p G_GNUC_WGET_UNUSED)
+{
+	JOB *job;
+
+	wget_thread_mutex_lock(&base_main_mutex);
+	while (!finished) {
+		wget_thread_mutex_lock(&base_mutex);
+		job = NULL;
+		wget_list_browse(base_queue, (int(*)(void *, void *))_base_find_free_job, &job);
+		wget_thread_mutex_unlock(&base_mutex);
+
+		if (!job) {
+			wget_thread_cond_wait(&base_cond, &base_main_mutex);
+			continue;
+		}
+		wget_thread_mutex_unlock(&base_main_mutex);
+
+		_process(job, _base_add, NULL);
+
+		wget_thread_mutex_lock(&base_mutex);
+		wget_list_remove(&base_queue, job);
+		wget_thread_mutex_unlock(&base_mutex);
+
+		if (_fetch_and_add_int(&done, 1) + 1 == njobs)
+			finished = 1;
+
+		wget_thread_mutex_lock(&base_main_mutex);
+	}
+
+	// pass the wakeup on to the next waiting downloader
+	wget_thread_cond_signal(&base_cond);
+	wget_thread_mutex_unlock(&base_main_mutex);
+
+	return NULL;
+}
+
+static void _queue_add(JOB *job, void *ctx)
+{
+	queue_add_job_local(job, *(int *)ctx);
+}
+
+static void *_queue_downloader(void *p)
+{
+	int worker = *(int *)p;
+	JOB *job;
+
+	while (!finished) {
+		if (!queue_get(worker, &job, NULL)) {
+			queue_wait(worker);
+			continue;
+		}
+
+		_process(job, _queue_add, &worker);
+		queue_del(job);
+
+		if (_fetch_and_add_int(&done, 1) + 1 == njobs) {
+			finished = 1;
+			queue_stop();
+		}
+	}
+
+	return NULL;
+}
+
+// returns the jobs per second of the crawl
+static double _run(int nthreads, int current)
+{
+	wget_thread_t *tids = wget_malloc(nthreads * sizeof(wget_thread_t));
+	int *ids = wget_malloc(nthreads * sizeof(int));
+	long long start;
+	JOB job;
+
+	done = finished = 0;
+
+	if (current) {
+		queue_init(nthreads);
+		queue_add_job(job_init(&job, iris[0]));
+	} else
+		wget_list_append(&base_queue, job_init(&job, iris[0]), sizeof(JOB));
+
+	start = wget_test_get_time_nanos();
+
+	for (int it = 0; it < nthreads; it++) {
+		ids[it] = it;
+		wget_thread_start(&tids[it], current ? _queue_downloader : _base_downloader, &ids[it], 0);
+	}
+	for (int it = 0; it < nthreads; it++)
+		wget_thread_join(tids[it]);
+
+	start = wget_test_get_time_nanos() - start;
+
+	if (current) {
+		if (!queue_empty())
+			done = -1;
+		queue_free();
+		hosts_free();
+	} else if (base_queue)
+		done = -1;
+
+	wget_xfree(ids);
+	wget_xfree(tids);
+
+	if (done != njobs) {
+		fprintf(stderr, "Got %d jobs, expected %d\n", done, njobs);
+		exit(1);
+	}
+
+	return njobs * 1000000000.0 / (start ? start : 1);
+}
+
+int main(int argc, const char *const *argv)
+{
+	static const int threads[] = { 1, 8, 64, 256 };
+	char url[64];
+
+	if (!wget_thread_support()) {
+		printf("Skipping, no thread support\n");
+		return 77;
+	}
+
+	if (argc > 1 && atoi(argv[1]) > 0)
+		depth = atoi(argv[1]);
+
+	for (int it = 0, n = 1; it <= depth; it++, n *= FANOUT)
+		njobs += n;
+
+	// jobs of the same host share the IRI, we only measure the queue
+	for (int it = 0; it < NHOSTS; it++) {
+		snprintf(url, sizeof(url), "http://host%d.example.com/", it);
+		iris[it] = wget_iri_parse(url, NULL);
+	}
+
+	printf("%d jobs on %d hosts\n", njobs, NHOSTS);
+	printf("%8s %16s %16s\n", "threads", "list jobs/s", "queue jobs/s");
+
+	for (unsigned it = 0; it < countof(threads); it++) {
+		double base = _run(threads[it], 0);
+		double current = _run(threads[it], 1);
+
+		printf("%8d %16.0f %16.0f\n", threads[it], base, current);
+	}
+
+	for (int it = 0; it < NHOSTS; it++)
+		wget_iri_free(&iris[it]);
+
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing Wget --adaptive-threads
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h> // exit()
+#include "libtest.h"
+
+#define PAGE(n, link1, link2) \
+	{	.name = "/page" #n ".html", \
+		.code = "200 Dontcare", \
+		.body = "<html><body><a href=\"" link1 "\">link</a><a href=\"" link2 "\">link</a></body></html>", \
+		.headers = { "Content-Type: text/html" } \
+	}
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body =
+				"<html><head><title>Main Page</title></head><body>" \
+				" <a href=\"page1.html\">1</a> <a href=\"page2.html\">2</a>" \
+				"</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		PAGE(1, "page3.html", "page4.html"),
+		PAGE(2, "page5.html", "page6.html"),
+		PAGE(3, "page7.html", "page8.html"),
+		PAGE(4, "page9.html", "page10.html"),
+		PAGE(5, "page11.html", "page12.html"),
+		PAGE(6, "page1.html", "index.html"),
+		PAGE(7, "page2.html", "index.html"),
+		PAGE(8, "page3.html", "index.html"),
+		PAGE(9, "page4.html", "index.html"),
+		PAGE(10, "page5.html", "index.html"),
+		PAGE(11, "page6.html", "index.html"),
+		PAGE(12, "page7.html", "index.html"),
+	};
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// the pool starts with a single downloader and may grow up to 8
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --adaptive-threads --min-threads=1 --max-threads=8",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[4].name + 1, urls[4].body },
+			{ urls[5].name + 1, urls[5].body },
+			{ urls[6].name + 1, urls[6].body },
+			{ urls[7].name + 1, urls[7].body },
+			{ urls[8].name + 1, urls[8].body },
+			{ urls[9].name + 1, urls[9].body },
+			{ urls[10].name + 1, urls[10].body },
+			{ urls[11].name + 1, urls[11].body },
+			{ urls[12].name + 1, urls[12].body },
+			{	NULL } },
+		0);
+
+	// the same with the event driven engine
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --adaptive-threads --min-threads=2 --max-threads=4 --io-engine=epoll --no-ocsp",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[4].name + 1, urls[4].body },
+			{ urls[5].name + 1, urls[5].body },
+			{ urls[6].name + 1, urls[6].body },
+			{ urls[7].name + 1, urls[7].body },
+			{ urls[8].name + 1, urls[8].body },
+			{ urls[9].name + 1, urls[9].body },
+			{ urls[10].name + 1, urls[10].body },
+			{ urls[11].name + 1, urls[11].body },
+			{ urls[12].name + 1, urls[12].body },
+			{	NULL } },
+		0);
+
+	exit(0);
+}
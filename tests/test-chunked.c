@@ -0,0 +1,80 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing chunked transfer-decoding
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h> // exit()
+#include "libtest.h"
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/small.txt",
+			.code = "200 Dontcare",
+			.body = "1\r\n0\r\n2\r\n12\r\n3\r\n345\r\na\r\n6789abcdef\r\n0\r\n\r\n",
+			.headers = {
+				"Content-Type: text/plain",
+				"Transfer-Encoding: chunked",
+			}
+		},
+		{	.name = "/ext.txt",
+			.code = "200 Dontcare",
+			.body = "0A;name=value\r\n0123456789\r\n1A ; x=\"y\"\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\nX-Trailer: 1\r\n\r\n",
+			.headers = {
+				"Content-Type: text/plain",
+				"Transfer-Encoding: chunked",
+			}
+		},
+	};
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// small chunks, chunk extensions and trailers
+	wget_test(
+		WGET_TEST_OPTIONS, "",
+		WGET_TEST_REQUEST_URLS, "small.txt", "ext.txt", NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, "0123456789abcdef" },
+			{ urls[1].name + 1, "0123456789abcdefghijklmnopqrstuvwxyz" },
+			{	NULL } },
+		0);
+
+	// the event driven engine uses the same decoder
+	wget_test(
+		WGET_TEST_OPTIONS, "--io-engine=epoll --no-ocsp",
+		WGET_TEST_REQUEST_URLS, "small.txt", "ext.txt", NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, "0123456789abcdef" },
+			{ urls[1].name + 1, "0123456789abcdefghijklmnopqrstuvwxyz" },
+			{	NULL } },
+		0);
+
+	exit(0);
+}
@@ -55,6 +55,13 @@ int main(void)
 			.headers = {
 				"Content-Type: text/html",
 			}
+		},
+		{	.name = "/list.txt", // input file with comments, spaces and without trailing newline
+			.code = "200 Dontcare",
+			.body = "# comment\n\n  http://localhost:{{port}}/page1.html  \r\n\thttp://localhost:{{port}}/page2.html",
+			.headers = {
+				"Content-Type: text/plain",
+			}
 		}
 	};
 
@@ -78,6 +85,21 @@ int main(void)
 			{ urls[2].name + 1, urls[2].body },
 			{	NULL } },
 		0);
+	// the same with spaces, comments and a missing newline at the end of the input file
+	wget_test(
+		WGET_TEST_OPTIONS, "-i list.txt",
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"list.txt", urls[3].body },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{	NULL } },
+		0);
+
 /*
 	// test-i-http (expands to -i http://localhost:{{port}}/urls.txt)
 	wget_test(
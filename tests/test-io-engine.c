@@ -0,0 +1,132 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing Wget --io-engine=epoll
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h> // exit()
+#include "libtest.h"
+
+#define FILE(n) \
+	{	.name = "/file" #n ".txt", \
+		.code = "200 Dontcare", \
+		.body = "content of file" #n, \
+		.headers = { "Content-Type: text/plain" } \
+	}
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body =
+				"<html><head><title>Main Page</title></head><body>" \
+				" <a href=\"file1.txt\">1</a> <a href=\"file2.txt\">2</a> <a href=\"file3.txt\">3</a>" \
+				" <a href=\"missing.txt\">x</a> <a href=\"moved.html\">m</a> <a href=\"file4.txt\">4</a>" \
+				"</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/moved.html",
+			.code = "302 Redirect",
+			.headers = {
+				"Location: http://localhost:{{port}}/target.html",
+			}
+		},
+		{	.name = "/target.html",
+			.code = "200 Dontcare",
+			.body = "<html>redirected</html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		FILE(1),
+		FILE(2),
+		FILE(3),
+		FILE(4),
+	};
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		WGET_TEST_SERVER_KEEP_ALIVE, 1,
+		0);
+
+	// the 404 closes the connection, the redirection target is saved under the requested name
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --io-engine=epoll --no-ocsp",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 8,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[4].name + 1, urls[4].body },
+			{ urls[5].name + 1, urls[5].body },
+			{ urls[6].name + 1, urls[6].body },
+			{	NULL } },
+		0);
+
+	// with one connection, all requests go over the same keep-alive connection (reopened after the 404)
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --io-engine=epoll --no-ocsp --max-connections=1",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 8,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[4].name + 1, urls[4].body },
+			{ urls[5].name + 1, urls[5].body },
+			{ urls[6].name + 1, urls[6].body },
+			{	NULL } },
+		0);
+
+	// OCSP requests would block the event loop
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --io-engine=epoll --ocsp",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 1,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{	NULL } },
+		0);
+
+	// the threads engine gets the same
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --io-engine=threads",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 8,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[4].name + 1, urls[4].body },
+			{ urls[5].name + 1, urls[5].body },
+			{ urls[6].name + 1, urls[6].body },
+			{	NULL } },
+		0);
+
+	exit(0);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing Wget
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h> // exit()
+#include "libtest.h"
+
+#define PAGE(n, link) \
+	{	.name = "/page" #n ".html", \
+		.code = "200 Dontcare", \
+		.body = "<html><body><a href=\"" link "\">link</a></body></html>", \
+		.headers = { "Content-Type: text/html" } \
+	}
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body =
+				"<html><head><title>Main Page</title></head><body>" \
+				" <a href=\"page1.html\">1</a> <a href=\"page2.html\">2</a> <a href=\"page3.html\">3</a>" \
+				" <a href=\"page4.html\">4</a> <a href=\"page5.html\">5</a> <a href=\"page6.html\">6</a>" \
+				"</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		PAGE(1, "page7.html"),
+		PAGE(2, "page8.html"),
+		PAGE(3, "redirect.html"),
+		PAGE(4, "index.html"),
+		PAGE(5, "sub/page9.html"),
+		PAGE(6, "page1.html"),
+		PAGE(7, "page2.html"),
+		PAGE(8, "page3.html"),
+		{	.name = "/sub/page9.html",
+			.code = "200 Dontcare",
+			.body = "<html><body>last page</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/redirect.html",
+			.code = "302 Redirect",
+			.headers = {
+				"Location: http://localhost:{{port}}/target.html",
+			}
+		},
+		{	.name = "/target.html",
+			.code = "200 Dontcare",
+			.body = "<html><body>redirected</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+	};
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// with a limit of one byte, all queued jobs but robots.txt are spilled to disk
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --max-queue-memory=1",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[4].name + 1, urls[4].body },
+			{ urls[5].name + 1, urls[5].body },
+			{ urls[6].name + 1, urls[6].body },
+			{ urls[7].name + 1, urls[7].body },
+			{ urls[8].name + 1, urls[8].body },
+			{ urls[9].name + 1, urls[9].body },
+			{ urls[10].name + 1, urls[11].body },
+			{	NULL } },
+		0);
+
+	// the same with a single downloader
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --max-queue-memory=1 --max-threads=1",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[4].name + 1, urls[4].body },
+			{ urls[5].name + 1, urls[5].body },
+			{ urls[6].name + 1, urls[6].body },
+			{ urls[7].name + 1, urls[7].body },
+			{ urls[8].name + 1, urls[8].body },
+			{ urls[9].name + 1, urls[9].body },
+			{ urls[10].name + 1, urls[11].body },
+			{	NULL } },
+		0);
+
+	exit(0);
+}
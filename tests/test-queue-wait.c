@@ -0,0 +1,127 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing that queue_wait() doesn't sleep on a pending retry while a new job is ready
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libwget.h>
+
+#include "../src/wget.h"
+#include "../src/job.h"
+
+// referenced by job.c, only needed for robots.txt jobs
+const char *get_local_filename(wget_iri_t *iri G_GNUC_WGET_UNUSED)
+{
+	return NULL;
+}
+
+static int
+	ok,
+	failed;
+
+static void _check(int cond, const char *msg)
+{
+	if (cond)
+		ok++;
+	else {
+		failed++;
+		fprintf(stderr, "Failed: %s\n", msg);
+	}
+}
+
+// the downloader of the threaded test: take one job, wait for it if there is none
+static void *_downloader(void *p)
+{
+	JOB **jobp = p;
+
+	while (!queue_get(0, jobp, NULL))
+		queue_wait(0);
+
+	return NULL;
+}
+
+int main(void)
+{
+	wget_iri_t *iri1 = wget_iri_parse("http://localhost/retry.html", NULL);
+	wget_iri_t *iri2 = wget_iri_parse("http://localhost/new.html", NULL);
+	wget_thread_t tid;
+	JOB job, *jobp, *retried;
+	long long start;
+
+	// a lost wakeup would let queue_wait() sleep for one hour, fail long before
+	alarm(30);
+
+	queue_init(1);
+
+	// the only job fails and is tried again in one hour (max. Retry-After)
+	queue_add_job(job_init(&job, iri1));
+	_check(queue_get(0, &retried, NULL) && retried, "got the first job");
+	queue_retry(retried, NULL, 3600 * 1000);
+
+	// a new job arrives after queue_get() found nothing but before the downloader went idle,
+	// so there is nobody to wake up
+	_check(!queue_get(0, &jobp, NULL), "nothing to do while the retry is pending");
+	queue_add_job(job_init(&job, iri2));
+
+	start = wget_get_timemillis();
+	queue_wait(0);
+	_check(wget_get_timemillis() - start < 1000, "queue_wait() returns at once if a job has been queued meanwhile");
+	_check(queue_get(0, &jobp, NULL) && jobp && jobp->iri == iri2, "got the new job");
+	queue_del(jobp);
+
+	// the downloader sleeps in queue_wait() when the new job is queued
+	if (wget_thread_support()) {
+		jobp = NULL;
+		wget_thread_start(&tid, _downloader, &jobp, 0);
+
+		for (int it = 0; it < 1000 && !queue_idle(); it++)
+			wget_millisleep(5);
+		_check(queue_idle() == 1, "the downloader is waiting");
+
+		start = wget_get_timemillis();
+		queue_add_job(job_init(&job, iri2));
+		wget_thread_join(tid);
+		_check(wget_get_timemillis() - start < 1000, "the waiting downloader is woken up for a new job");
+		_check(jobp && jobp->iri == iri2, "the downloader got the new job");
+		queue_del(jobp);
+	}
+
+	queue_free();
+	hosts_free();
+
+	wget_iri_free(&iri1);
+	wget_iri_free(&iri2);
+
+	if (failed) {
+		fprintf(stderr, "ERROR: %d out of %d queue tests failed\n", failed, ok + failed);
+		return 1;
+	}
+
+	printf("Summary: All %d queue tests passed\n", ok + failed);
+	return 0;
+}
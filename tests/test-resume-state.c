@@ -0,0 +1,112 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing Wget --resume-state
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // exit()
+#include <unistd.h> // getpid(), unlink()
+#include "libtest.h"
+
+#define PAGE(n, link) \
+	{	.name = "/page" #n ".html", \
+		.code = "200 Dontcare", \
+		.body = "<html><body><a href=\"" link "\">link</a></body></html>", \
+		.headers = { "Content-Type: text/html" } \
+	}
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body =
+				"<html><head><title>Main Page</title></head><body>" \
+				" <a href=\"page1.html\">1</a> <a href=\"page2.html\">2</a> <a href=\"page3.html\">3</a>" \
+				"</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		PAGE(1, "page4.html"),
+		PAGE(2, "page5.html"),
+		PAGE(3, "index.html"),
+		PAGE(4, "page1.html"),
+		PAGE(5, "page6.html"),
+		{	.name = "/page6.html",
+			.code = "200 Dontcare",
+			.body = "<html><body>last page</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+	};
+	char options[256], state[64];
+	static const char *suffixes[] = { "", ".journal", ".journal.old", ".tmp" };
+
+	// the state file must survive the cleanup of the test directory between the runs
+	snprintf(state, sizeof(state), "../.test_resume_%d.state", (int) getpid());
+	// checkpoint as often as possible, so that the crash also hits snapshots and journal rotation
+	snprintf(options, sizeof(options), "-r -nH --max-threads=1 --checkpoint-interval=0.001 --resume-state=%s", state);
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// crash while requesting page3.html (after robots.txt, index.html, page1.html and page2.html)
+	wget_test(
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_KILL_AT_REQUEST, 5,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{	NULL } },
+		0);
+
+	// resume: the test directory has been emptied, any URL fetched twice would show up as unexpected file
+	wget_test(
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[4].name + 1, urls[4].body },
+			{ urls[5].name + 1, urls[5].body },
+			{ urls[6].name + 1, urls[6].body },
+			{	NULL } },
+		0);
+
+	for (unsigned it = 0; it < countof(suffixes); it++) {
+		char fname[80];
+
+		snprintf(fname, sizeof(fname), "%s%s", state, suffixes[it]);
+		unlink(fname);
+	}
+
+	exit(0);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing bodies written to disk while downloading (spliced from the socket)
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h> // exit()
+#include "libtest.h"
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/file1.bin",
+			.code = "200 Dontcare",
+			.body = "0123456789abcdefghijklmnopqrstuvwxyz",
+			.headers = {
+				"Content-Type: application/octet-stream",
+			}
+		},
+		{	.name = "/file2.txt",
+			.code = "200 Dontcare",
+			.body = "second file",
+			.headers = {
+				"Content-Type: text/plain",
+			}
+		},
+	};
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// plain download
+	wget_test(
+		WGET_TEST_OPTIONS, "",
+		WGET_TEST_REQUEST_URLS, "file1.bin", "file2.txt", NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{	NULL } },
+		0);
+
+	// existing files are not overwritten
+	wget_test(
+		WGET_TEST_OPTIONS, "",
+		WGET_TEST_REQUEST_URL, "file1.bin",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, "old" },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, "old" },
+			{ "file1.bin.1", urls[0].body },
+			{	NULL } },
+		0);
+
+	// the partial content is appended to the existing file
+	wget_test(
+		WGET_TEST_OPTIONS, "-c",
+		WGET_TEST_REQUEST_URL, "file1.bin",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, "0123456789" },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{	NULL } },
+		0);
+
+	// the event driven engine writes the bodies while downloading as well
+	wget_test(
+		WGET_TEST_OPTIONS, "--io-engine=epoll --no-ocsp",
+		WGET_TEST_REQUEST_URLS, "file1.bin", "file2.txt", NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{ urls[1].name + 1, "old" },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, "old" },
+			{ "file2.txt.1", urls[1].body },
+			{	NULL } },
+		0);
+
+	// with one thread, -O is written while downloading, the bodies are concatenated
+	wget_test(
+		WGET_TEST_OPTIONS, "--max-threads=1 -O out.txt",
+		WGET_TEST_REQUEST_URLS, "file1.bin", "file2.txt", NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ "out.txt", "0123456789abcdefghijklmnopqrstuvwxyzsecond file" },
+			{	NULL } },
+		0);
+
+	exit(0);
+}
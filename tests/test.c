@@ -31,9 +31,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <dirent.h>
 #include <time.h>
+#include <unistd.h>
+#include <netdb.h>
 
 #include <libwget.h>
 #include "../libwget/private.h"
@@ -1060,6 +1063,342 @@ static void test_hsts(void)
 	wget_hsts_db_free(&hsts_db);
 }
 
+static void test_tls_session(void)
+{
+	static const struct tls_session_db_data {
+		const char *
+			host;
+		int
+			port;
+		int
+			maxage; // relative to now
+		const char *
+			data;
+	} tls_session_db_data[] = {
+		{ "www.example.com", 443, 3600, "ticket1" },
+		{ "www.example.com", 8443, 3600, "ticket2" },
+		{ "www.example.com", 443, 3600, "ticket3" }, // replaces ticket1
+		{ "www.example2.com", 443, -10, "expired" },
+		{ "www.example3.com", 443, 3600, "ticket4" },
+		{ "www.example3.com", 443, 0, "" }, // this removes the previous entry
+	};
+	static const struct tls_session_data {
+		const char *
+			host;
+		int
+			port;
+		const char *
+			data; // NULL: not found
+	} tls_session_data[] = {
+		{ "www.example.com", 443, "ticket3" },
+		{ "www.example.com", 0, "ticket3" }, // default port
+		{ "www.example.com", 8443, "ticket2" },
+		{ "www.example.com", 8080, NULL }, // wrong port
+		{ "example.com", 443, NULL }, // no subdomain matching
+		{ "www.example2.com", 443, NULL }, // entry is expired
+		{ "www.example3.com", 443, NULL }, // entry should have been removed due to maxage=0
+	};
+	static const char *fname = "test_tls_session.txt";
+	wget_tls_session_db_t *db = wget_tls_session_db_init(NULL), *db_loaded = wget_tls_session_db_init(NULL);
+	time_t now = time(NULL);
+
+	// fill TLS session database with values
+	for (unsigned it = 0; it < countof(tls_session_db_data); it++) {
+		const struct tls_session_db_data *t = &tls_session_db_data[it];
+		wget_tls_session_db_add(db, wget_tls_session_new(t->host, t->port, t->maxage ? now + t->maxage : 0, t->data, strlen(t->data)));
+	}
+
+	// the saved and reloaded database must give the same results
+	unlink(fname);
+	if (wget_tls_session_db_save(db, fname) || wget_tls_session_db_load(db_loaded, fname)) {
+		failed++;
+		info_printf("Failed to save/load TLS session file '%s'\n", fname);
+	} else
+		ok++;
+	unlink(fname);
+
+	// check TLS session database with values
+	for (unsigned it = 0; it < countof(tls_session_data); it++) {
+		const struct tls_session_data *t = &tls_session_data[it];
+
+		for (int loaded = 0; loaded <= 1; loaded++) {
+			void *data = NULL;
+			size_t size = 0;
+			int found = !wget_tls_session_get(loaded ? db_loaded : db, t->host, t->port, &data, &size);
+
+			if (t->data ? found && size == strlen(t->data) && !memcmp(data, t->data, size) : !found)
+				ok++;
+			else {
+				failed++;
+				info_printf("Failed [%u]: wget_tls_session_get(%s,%d) -> %d '%.*s' (expected '%s', loaded=%d)\n",
+					it, t->host, t->port, found, (int) size, data ? (char *) data : "", t->data ? t->data : "(null)", loaded);
+			}
+
+			xfree(data);
+		}
+	}
+
+	wget_tls_session_db_free(&db_loaded);
+	wget_tls_session_db_free(&db);
+}
+
+static void test_parse_retry_after(void)
+{
+	static const struct test_data {
+		const char *
+			value;
+		int
+			seconds;
+	} test_data[] = {
+		{ "120", 120 },
+		{ " 0", 0 },
+		{ "99999999999999999999", INT_MAX },
+		{ "Fri, 31 Dec 1999 23:59:59 GMT", 0 }, // in the past
+		{ "soon", 0 },
+	};
+
+	for (unsigned it = 0; it < countof(test_data); it++) {
+		const struct test_data *t = &test_data[it];
+		int seconds = -1;
+
+		wget_http_parse_retry_after(t->value, &seconds);
+
+		if (seconds == t->seconds)
+			ok++;
+		else {
+			failed++;
+			info_printf("Failed [%u]: wget_http_parse_retry_after(%s) -> %d (expected %d)\n", it, t->value, seconds, t->seconds);
+		}
+	}
+}
+
+static void test_parse_response_header(void)
+{
+	static const struct test_data {
+		const char *
+			header;
+		int
+			code;
+		const char *
+			reason;
+		long long
+			content_length; // -1: not valid
+		const char *
+			content_type;
+		const char *
+			location;
+		const char *
+			etag;
+		char
+			chunked,
+			keep_alive;
+	} test_data[] = {
+		{ "HTTP/1.1 200 OK\r\nContent-Length: 10\r\nConnection: keep-alive\r\n\r\n",
+			200, "OK", 10, NULL, NULL, NULL, 0, 1 },
+		{ "HTTP/1.0 404 Not Found\ncontent-type: text/html; charset=utf-8\nTRANSFER-ENCODING: chunked\n\n",
+			404, "Not Found", -1, "text/html", NULL, NULL, 1, 0 },
+		{ "HTTP/1.1 301 Moved Permanently\r\nLocation:\r\n  http://example.com/a\r\nETag: \"x1\"\r\n\r\n",
+			301, "Moved Permanently", -1, NULL, "http://example.com/a", "\"x1\"", 0, 0 },
+		{ "HTTP/1.1 200 OK\r\nContent: 5\r\nContent-Lengthy: 7\r\nX-Connection: keep-alive\r\nLocation: /x\r\n\r\n",
+			200, "OK", -1, NULL, NULL, NULL, 0, 0 }, // no prefix matches, Location only for 3xx
+		{ "HTTP/1.1 204\r\nEtag:abc\r\n\r\n",
+			204, "", -1, NULL, NULL, "abc", 0, 0 },
+		{ " HTTP/1.1 200 A rather long reason phrase that is cut off\r\n\r\n",
+			200, "A rather long reason phrase tha", -1, NULL, NULL, NULL, 0, 0 },
+		{ "HTTP/1.1 200 OK",
+			200, "OK", -1, NULL, NULL, NULL, 0, 0 },
+		{ "HTTP/1.1 OK\r\n\r\n", 0 },
+		{ "ICY 200 OK\r\n\r\n", 0 },
+	};
+
+	for (unsigned it = 0; it < countof(test_data); it++) {
+		const struct test_data *t = &test_data[it];
+		char *header = wget_strdup(t->header);
+		wget_http_response_t *resp = wget_http_parse_response_header(header);
+
+		if (!resp ? !t->code :
+			resp->code == t->code
+			&& !wget_strcmp(resp->reason, t->reason)
+			&& (resp->content_length_valid ? (long long) resp->content_length : -1) == t->content_length
+			&& !wget_strcmp(resp->content_type, t->content_type)
+			&& !wget_strcmp(resp->location, t->location)
+			&& !wget_strcmp(resp->etag, t->etag)
+			&& (resp->transfer_encoding == transfer_encoding_chunked) == t->chunked
+			&& resp->keep_alive == t->keep_alive)
+			ok++;
+		else {
+			failed++;
+			info_printf("Failed [%u]: wget_http_parse_response_header(%s)\n", it, t->header);
+		}
+
+		wget_http_free_response(&resp);
+		xfree(header);
+	}
+}
+
+static void test_robots(void)
+{
+	static const struct test_data {
+		const char *
+			data;
+		int
+			crawl_delay;
+	} test_data[] = {
+		{ "User-agent: *\nDisallow: /tmp/\nCrawl-delay: 2\n", 2000 },
+		{ "User-agent: wget\nCrawl-delay: 0.5\n", 500 },
+		{ "User-agent: *\r\nCrawl-delay:\t1.25\r\n", 1250 },
+		{ "User-agent: otherbot\nCrawl-delay: 10\n", 0 }, // not for us
+		{ "User-agent: *\nCrawl-delay: -3\n", 0 },
+		{ "User-agent: *\nDisallow: /\n", 0 },
+	};
+
+	for (unsigned it = 0; it < countof(test_data); it++) {
+		const struct test_data *t = &test_data[it];
+		ROBOTS *robots = wget_robots_parse(t->data);
+		int crawl_delay = robots ? robots->crawl_delay : -1;
+
+		if (crawl_delay == t->crawl_delay)
+			ok++;
+		else {
+			failed++;
+			info_printf("Failed [%u]: wget_robots_parse(%s) -> crawl_delay %d (expected %d)\n", it, t->data, crawl_delay, t->crawl_delay);
+		}
+
+		wget_robots_free(&robots);
+		wget_xfree(robots);
+	}
+}
+
+static void test_request_template(void)
+{
+	static const char
+		*expected_template =
+			"GET /dir/file.html HTTP/1.1\r\n"
+			"Host: example.com\r\n"
+			"Accept: */*\r\n"
+			"User-Agent: Wget\r\n"
+			"Range: bytes=10-\r\n"
+			"\r\n",
+		*expected_plain =
+			"HEAD /dir/file.html HTTP/1.1\r\n"
+			"Host: example.com\r\n"
+			"\r\n";
+	wget_iri_t *iri = wget_iri_parse("http://example.com/dir/file.html", NULL);
+	wget_http_request_template_t *tmpl = wget_http_create_request_template();
+	wget_buffer_t *buf = wget_buffer_alloc(256);
+	wget_http_request_t *req;
+
+	wget_http_request_template_add_header(tmpl, "Accept", "*/*");
+	wget_http_request_template_add_header(tmpl, "User-Agent", "Wget");
+
+	// the template headers come first, then the headers of the request
+	req = wget_http_create_request_with_template(iri, "GET", tmpl);
+	wget_http_add_header(req, "Range", "bytes=10-");
+	wget_http_request_to_buffer(req, buf);
+
+	if (!strcmp(buf->data, expected_template))
+		ok++;
+	else {
+		failed++;
+		info_printf("Failed: request with template:\n%s", buf->data);
+	}
+	wget_http_free_request(&req);
+
+	// no template, no headers
+	req = wget_http_create_request(iri, "HEAD");
+	wget_http_request_to_buffer(req, buf);
+
+	if (!strcmp(buf->data, expected_plain) && !req->headers)
+		ok++;
+	else {
+		failed++;
+		info_printf("Failed: request without headers:\n%s", buf->data);
+	}
+	wget_http_free_request(&req);
+
+	wget_buffer_free(&buf);
+	wget_http_free_request_template(&tmpl);
+	wget_iri_free(&iri);
+}
+
+static int _collect_body(void *context, const char *data, size_t length)
+{
+	wget_buffer_memcat((wget_buffer_t *) context, data, length);
+
+	return 0;
+}
+
+static void test_decompress(void)
+{
+	static const char plain[] = "Wget2 decompression test, Wget2 decompression test, Wget2!\n";
+	static const struct test_data {
+		const char *
+			name;
+		const char *
+			data;
+		size_t
+			length;
+		int
+			encoding;
+	} test_data[] = {
+#define D(name, data, encoding) { name, data, sizeof(data) - 1, encoding }
+#if WITH_ZLIB
+		D("gzip", "\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\x0b\x4f\x4f\x2d\x31\x52\x48\x49\x4d\xce\xcf\x2d\x28\x4a\x2d\x2e\xce\xcc\xcf\x53\x28\x49\x2d\x2e\xd1\x51\x08\xc7\x2f\xa3\xc8\x05\x00\x87\x13\x2a\xf1\x3b\x00\x00\x00",
+			wget_content_encoding_gzip),
+		D("deflate", "\x0b\x4f\x4f\x2d\x31\x52\x48\x49\x4d\xce\xcf\x2d\x28\x4a\x2d\x2e\xce\xcc\xcf\x53\x28\x49\x2d\x2e\xd1\x51\x08\xc7\x2f\xa3\xc8\x05\x00",
+			wget_content_encoding_deflate),
+#endif
+#if WITH_BZIP2
+		D("bzip2", "\x42\x5a\x68\x39\x31\x41\x59\x26\x53\x59\xc1\x19\xea\x04\x00\x00\x06\xdb\x80\x00\x10\x60\x04\x10\x00\x00\x80\x0e\xa3\xdc\x00\x20\x00\x40\x55\x14\x34\x1a\x7a\x86\x42\x9a\x64\x62\x62\x62\x69\xab\x65\x27\x30\xb6\xeb\xa5\x76\x16\x54\x77\x19\x60\xf5\xf3\x0c\xac\xa2\x53\x14\xfc\x5d\xc9\x14\xe1\x42\x43\x04\x67\xa8\x10",
+			wget_content_encoding_bzip2),
+#endif
+#if WITH_LZMA
+		D("xz", "\xfd\x37\x7a\x58\x5a\x00\x00\x04\xe6\xd6\xb4\x46\x02\x00\x21\x01\x16\x00\x00\x00\x74\x2f\xe5\xa3\xe0\x00\x3a\x00\x23\x5d\x00\x2b\x99\xc8\xa7\x75\xb5\x1f\xba\x01\x61\xdc\x39\x2a\x70\x04\x77\x30\x76\x67\x2f\x06\xfa\xcd\x74\x49\xb1\x2a\xe2\xb8\x3c\xcb\xaa\xb1\xf4\x00\x00\x00\xaf\xa4\xcb\x73\x56\x4d\xea\x02\x00\x01\x3f\x3b\x33\x76\x53\xc9\x1f\xb6\xf3\x7d\x01\x00\x00\x00\x00\x04\x59\x5a",
+			wget_content_encoding_lzma),
+#endif
+#if WITH_BROTLIDEC
+		D("br", "\x1b\x3a\x00\xf8\x1d\x07\x6e\x2c\x3d\x93\xc1\x53\xbf\x82\x35\x48\xc8\xd5\x99\x2c\x23\x53\x68\x3a\x96\x39\x99\x29\x49\x3d\xf8\x54\x0a\xde\x6c\x33\x16\x2c\xb8\x08\x03",
+			wget_content_encoding_brotli),
+#endif
+#if WITH_ZSTD
+		D("zstd", "\x28\xb5\x2f\xfd\x20\x3b\x15\x01\x00\xe0\x57\x67\x65\x74\x32\x20\x64\x65\x63\x6f\x6d\x70\x72\x65\x73\x73\x69\x6f\x6e\x20\x74\x65\x73\x74\x2c\x20\x21\x0a\x01\x00\x76\x33\xc7",
+			wget_content_encoding_zstd),
+#endif
+		D("identity", "Wget2 decompression test, Wget2 decompression test, Wget2!\n",
+			wget_content_encoding_identity),
+#undef D
+	};
+	wget_buffer_t *body = wget_buffer_alloc(128);
+
+	for (unsigned it = 0; it < countof(test_data); it++) {
+		const struct test_data *t = &test_data[it];
+		char data[128];
+
+		// all at once and byte by byte, the decoders must keep state between calls
+		for (size_t step = t->length; step; step = step > 1 ? 1 : 0) {
+			wget_decompressor_t *dc = wget_decompress_open(t->encoding, _collect_body, body);
+			int rc = 0;
+
+			memcpy(data, t->data, t->length);
+			wget_buffer_reset(body);
+
+			for (size_t pos = 0; pos < t->length && !rc; pos += step)
+				rc = wget_decompress(dc, data + pos, t->length - pos < step ? t->length - pos : step);
+
+			wget_decompress_close(dc);
+
+			if (!rc && !strcmp(body->data, plain))
+				ok++;
+			else {
+				failed++;
+				info_printf("Failed [%s]: decompress in steps of %zu bytes: '%s'\n", t->name, step, body->data);
+			}
+		}
+	}
+
+	wget_buffer_free(&body);
+}
+
 static void test_parse_challenge(void)
 {
 	static const struct test_data {
@@ -1350,6 +1689,88 @@ static unsigned int hash_txt(G_GNUC_WGET_UNUSED const char *key)
 	return 0;
 }
 
+static unsigned long long G_GNUC_WGET_PURE hash_fpset_str(const char *s)
+{
+	return wget_fpset_hash(0, s, strlen(s));
+}
+
+// a weak hash function forces fingerprint collisions, exact-verify mode has to tell the keys apart
+static unsigned long long G_GNUC_WGET_CONST hash_fpset_weak(const char *s G_GNUC_WGET_UNUSED)
+{
+	return 42;
+}
+
+static void test_fpset(void)
+{
+	wget_fpset_t *set;
+	char key[128];
+	int run, it;
+
+	for (run = 0; run < 3; run++) {
+		// the initial size of 16 forces the internal reshashing function to be called
+		if (run == 0)
+			set = wget_fpset_create(16, NULL, NULL);
+		else
+			set = wget_fpset_create(16, (unsigned long long(*)(const void *))(run == 1 ? hash_fpset_str : hash_fpset_weak), (int(*)(const void *, const void *))strcmp);
+
+		for (int pass = 0; pass < 2; pass++) {
+			for (it = 0; it < 100; it++) {
+				int n, len = sprintf(key, "http://www.example.com/subdir/%d.html", it);
+
+				if (run == 0)
+					n = wget_fpset_add_fingerprint(set, wget_fpset_hash(0, key, len));
+				else
+					n = wget_fpset_add(set, pass ? key : wget_strdup(key)); // added keys are owned by the set
+
+				if (n != pass) {
+					failed++;
+					info_printf("fpset_add(%s) [%d] returned %d (expected %d)\n", key, run, n, pass);
+				} else ok++;
+			}
+		}
+
+		if ((it = wget_fpset_size(set)) != 100) {
+			failed++;
+			info_printf("fpset_size() [%d] returned %d (expected 100)\n", run, it);
+		} else ok++;
+
+		sprintf(key, "http://www.example.com/subdir/%d.html", 100);
+		if (run == 0 ? wget_fpset_contains_fingerprint(set, wget_fpset_hash(0, key, strlen(key))) : wget_fpset_contains(set, key)) {
+			failed++;
+			info_printf("fpset_contains(%s) [%d] found unknown key\n", key, run);
+		} else ok++;
+
+		if (run == 0) {
+			// copy the table into an empty set (taken as it is) and into a non-empty set (rehashed)
+			const unsigned long long *fp;
+			int n = wget_fpset_get_fingerprints(set, &fp);
+
+			for (int empty = 0; empty < 2; empty++) {
+				wget_fpset_t *copy = wget_fpset_create(16, NULL, NULL);
+
+				if (!empty)
+					wget_fpset_add_fingerprint(copy, wget_fpset_hash(0, key, strlen(key)));
+
+				if ((it = wget_fpset_add_fingerprints(copy, fp, n)) != 100 || wget_fpset_size(copy) != 100 + !empty) {
+					failed++;
+					info_printf("fpset_add_fingerprints() [%d] returned %d (expected 100)\n", empty, it);
+				} else ok++;
+
+				sprintf(key, "http://www.example.com/subdir/%d.html", 42);
+				if (!wget_fpset_contains_fingerprint(copy, wget_fpset_hash(0, key, strlen(key)))) {
+					failed++;
+					info_printf("fpset_contains(%s) [%d] missing key after copy\n", key, empty);
+				} else ok++;
+
+				sprintf(key, "http://www.example.com/subdir/%d.html", 100);
+				wget_fpset_free(&copy);
+			}
+		}
+
+		wget_fpset_free(&set);
+	}
+}
+
 static void test_stringmap(void)
 {
 	wget_stringmap_t *m;
@@ -1450,6 +1871,19 @@ static void test_stringmap(void)
 	wget_stringmap_put(m, "thekey", "thevalue", 9) ? ok++ : failed++;
 	wget_stringmap_put(m, "thekey", NULL, 0) ? ok++ : failed++;
 
+	// testing remove without freeing key and value
+	wget_stringmap_clear(m);
+	{
+		char *k = wget_strdup("thekey"), *v = wget_strdup("thevalue");
+
+		wget_stringmap_put_noalloc(m, k, v);
+		wget_stringmap_remove_nofree(m, "thekey") ? ok++ : failed++;
+		wget_stringmap_get(m, "thekey") ? failed++ : ok++;
+		strcmp(v, "thevalue") ? failed++ : ok++;
+		xfree(k);
+		xfree(v);
+	}
+
 	// testing key/value identity alloc/free in stringmap/hashmap
 	wget_stringmap_clear(m);
 	wget_stringmap_put(m, "thekey", NULL, 0) ? failed++ : ok++;
@@ -1497,6 +1931,292 @@ static void test_stringmap(void)
 
 }
 
+static int
+	stub_calls,
+	prefetch_calls;
+
+// resolves every name to 127.0.0.1, except names starting with 'fail'
+static int stub_resolver(const char *host, const char *port, const struct addrinfo *hints, struct addrinfo **res)
+{
+	struct addrinfo numeric = *hints;
+
+	stub_calls++;
+	if (!strncmp(host, "prefetch", 8))
+		prefetch_calls++; // called by a resolver thread
+
+	if (!strncmp(host, "fail", 4))
+		return EAI_NONAME;
+
+	if (!strncmp(host, "slow", 4))
+		wget_millisleep(100);
+
+	numeric.ai_flags |= AI_NUMERICHOST;
+	numeric.ai_flags &= ~AI_ADDRCONFIG;
+	return getaddrinfo("127.0.0.1", port, &numeric, res);
+}
+
+static void test_dns_cache(void)
+{
+	static const struct dns_cache_test {
+		const char *
+			host;
+		int
+			ttl;
+		int
+			calls, // expected resolver calls for the two lookups
+			hits,
+			negative_hits,
+			misses,
+			expired;
+	} test_data[] = {
+		{ "www.example.com", 60000, 1, 1, 0, 1, 0 },
+		{ "WWW.Example.COM", 60000, 0, 2, 0, 0, 0 }, // case-insensitive
+		{ "failed.example.com", 60000, 1, 0, 1, 1, 0 },
+		{ "expired.example.com", 0, 2, 0, 0, 2, 1 },
+		{ "failed.example.net", 0, 2, 0, 0, 2, 1 },
+	};
+	wget_dns_cache_stats_t before, after;
+	wget_tcp_t *tcp = wget_tcp_init();
+	unsigned it;
+	int resolving;
+
+	wget_dns_set_resolver(stub_resolver);
+	wget_dns_cache_get_stats(&before);
+
+	for (it = 0; it < countof(test_data); it++) {
+		const struct dns_cache_test *t = &test_data[it];
+		int calls = stub_calls;
+
+		wget_dns_cache_set_ttl(t->ttl);
+		wget_dns_cache_set_negative_ttl(t->ttl);
+		wget_tcp_resolve(tcp, t->host, "80");
+		wget_tcp_resolve(tcp, t->host, "80");
+		wget_dns_cache_get_stats(&after);
+
+		if (stub_calls - calls != t->calls
+			|| after.hits - before.hits != (unsigned) t->hits
+			|| after.negative_hits - before.negative_hits != (unsigned) t->negative_hits
+			|| after.misses - before.misses != (unsigned) t->misses
+			|| after.expired - before.expired != (unsigned) t->expired)
+		{
+			failed++;
+			info_printf("Failed [%u]: dns cache %s: calls %d hits %llu/%llu misses %llu expired %llu\n",
+				it, t->host, stub_calls - calls, after.hits - before.hits, after.negative_hits - before.negative_hits,
+				after.misses - before.misses, after.expired - before.expired);
+		} else
+			ok++;
+
+		before = after;
+	}
+
+	// a hot entry is resolved again in the background after 3/4 of its lifetime
+	wget_dns_cache_set_ttl(1000);
+	wget_tcp_resolve(tcp, "hot.example.com", "80");
+	wget_millisleep(800);
+	wget_tcp_resolve(tcp, "hot.example.com", "80");
+	wget_tcp_resolve(tcp, "hot.example.com", "80");
+	wget_dns_cache_get_stats(&after);
+
+	if (after.refreshes - before.refreshes != 1 || after.hits - before.hits != 2) {
+		failed++;
+		info_printf("Failed: dns cache refresh: refreshes %llu hits %llu\n",
+			after.refreshes - before.refreshes, after.hits - before.hits);
+	} else
+		ok++;
+
+	// prefetched names are resolved in the background, lookups wait for a pending resolution
+	before = after;
+	wget_dns_cache_set_ttl(60000);
+	wget_dns_prefetch("prefetch.example.com", "80");
+	wget_dns_prefetch("prefetch.example.com", "80");
+	wget_tcp_resolve(tcp, "prefetch.example.com", "80");
+	wget_dns_cache_get_stats(&after);
+
+	if (prefetch_calls != 1 || after.prefetches - before.prefetches != 1 || after.hits - before.hits != 1) {
+		failed++;
+		info_printf("Failed: dns prefetch: calls %d prefetches %llu hits %llu\n",
+			prefetch_calls, after.prefetches - before.prefetches, after.hits - before.hits);
+	} else
+		ok++;
+
+	// a prefetched name is reported as resolving until it is in the cache
+	wget_dns_prefetch("slow.example.com", "80");
+	resolving = wget_dns_resolving("slow.example.com", "80");
+	for (it = 0; it < 100 && wget_dns_resolving("slow.example.com", "80"); it++)
+		wget_millisleep(10);
+
+	if (!resolving || wget_dns_resolving("slow.example.com", "80") || wget_dns_resolving("unknown.example.com", "80")) {
+		failed++;
+		info_printf("Failed: dns resolving: %d %d\n", resolving, wget_dns_resolving("slow.example.com", "80"));
+	} else
+		ok++;
+
+	wget_tcp_deinit(&tcp);
+	wget_dns_cache_free();
+	wget_dns_cache_set_ttl(5 * 60 * 1000);
+	wget_dns_cache_set_negative_ttl(10 * 1000);
+	wget_dns_set_resolver(NULL);
+}
+
+static char
+	blackhole_port[8],
+	live_port[8];
+
+// resolves every name to a black-holed address followed by a live one
+static int eyeballs_resolver(const char *host G_GNUC_WGET_UNUSED, const char *port G_GNUC_WGET_UNUSED,
+	const struct addrinfo *hints, struct addrinfo **res)
+{
+	struct addrinfo numeric = *hints, *live, *ai;
+	int rc;
+
+	numeric.ai_flags |= AI_NUMERICHOST | AI_NUMERICSERV;
+	numeric.ai_flags &= ~AI_ADDRCONFIG;
+
+	if ((rc = getaddrinfo("127.0.0.1", blackhole_port, &numeric, res)))
+		return rc;
+
+	if ((rc = getaddrinfo("127.0.0.1", live_port, &numeric, &live))) {
+		freeaddrinfo(*res);
+		return rc;
+	}
+
+	for (ai = *res; ai->ai_next; ai = ai->ai_next);
+	ai->ai_next = live;
+
+	return 0;
+}
+
+static void test_tcp_connect_parallel(void)
+{
+	wget_tcp_t *blackhole = wget_tcp_init(), *live = wget_tcp_init(), *filler = wget_tcp_init(), *tcp, *peer;
+	long long start, elapsed;
+	int rc;
+
+	// a listener with a full accept queue drops further SYNs, connecting to it hangs
+	wget_tcp_set_timeout(blackhole, -1);
+	wget_tcp_set_timeout(live, 5000);
+	if (wget_tcp_listen(blackhole, "127.0.0.1", NULL, 0) != 0 || wget_tcp_listen(live, "127.0.0.1", NULL, 8) != 0) {
+		failed++;
+		info_printf("Failed: parallel connect: cannot listen\n");
+		goto out;
+	}
+
+	snprintf(blackhole_port, sizeof(blackhole_port), "%d", wget_tcp_get_local_port(blackhole));
+	snprintf(live_port, sizeof(live_port), "%d", wget_tcp_get_local_port(live));
+	wget_tcp_set_tcp_fastopen(filler, 0);
+	wget_tcp_connect(filler, "127.0.0.1", blackhole_port);
+	wget_millisleep(50);
+
+	wget_dns_set_resolver(eyeballs_resolver);
+
+	tcp = wget_tcp_init();
+	wget_tcp_set_dns_caching(tcp, 0);
+	wget_tcp_set_tcp_fastopen(tcp, 0);
+	wget_tcp_set_connect_timeout(tcp, 10 * 1000);
+	wget_tcp_set_connect_attempt_delay(tcp, 100);
+
+	// the second address is tried after the attempt delay, not after the connect timeout of the first
+	start = wget_get_timemillis();
+	rc = wget_tcp_connect(tcp, "eyeballs.example.com", "80");
+	elapsed = wget_get_timemillis() - start;
+	peer = rc == WGET_E_SUCCESS ? wget_tcp_accept(live) : NULL;
+
+	if (rc != WGET_E_SUCCESS || !peer || elapsed >= 2000) {
+		failed++;
+		info_printf("Failed: parallel connect: rc %d, accepted %d after %lld ms\n", rc, !!peer, elapsed);
+	} else
+		ok++;
+
+	wget_tcp_deinit(&peer);
+	wget_tcp_deinit(&tcp);
+	wget_dns_set_resolver(NULL);
+
+out:
+	wget_tcp_deinit(&filler);
+	wget_tcp_deinit(&live);
+	wget_tcp_deinit(&blackhole);
+}
+
+static void test_http_pool(void)
+{
+	wget_http_pool_stats_t before, after;
+	wget_http_connection_t *conn1 = NULL, *conn2 = NULL;
+	wget_tcp_t *server = wget_tcp_init(), *peer1, *peer2;
+	wget_iri_t *iri;
+	char url[64];
+
+	wget_tcp_set_timeout(server, -1);
+	if (wget_tcp_listen(server, "127.0.0.1", NULL, 8) != 0) {
+		failed++;
+		info_printf("Failed: http pool: cannot listen\n");
+		wget_tcp_deinit(&server);
+		return;
+	}
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/", wget_tcp_get_local_port(server));
+	iri = wget_iri_parse(url, NULL);
+
+	// with TCP Fast Open, nothing is connected before the first write
+	wget_tcp_set_tcp_fastopen(NULL, 0);
+	wget_http_pool_set_max_idle_per_host(1);
+	wget_http_pool_get_stats(&before);
+
+	// two connections to the same host, only one may stay idle
+	wget_http_pool_checkout(&conn1, iri);
+	wget_http_pool_checkout(&conn2, iri);
+	wget_http_pool_checkin(&conn1);
+	wget_http_pool_checkin(&conn2);
+	wget_http_pool_checkout(&conn1, iri);
+	wget_http_pool_checkin(&conn1);
+	wget_http_pool_get_stats(&after);
+
+	if (conn1 || after.opened - before.opened != 2 || after.evicted - before.evicted != 1 || after.reused - before.reused != 1) {
+		failed++;
+		info_printf("Failed: http pool reuse: opened %llu evicted %llu reused %llu\n",
+			after.opened - before.opened, after.evicted - before.evicted, after.reused - before.reused);
+	} else
+		ok++;
+
+	// the server closes the idle connection
+	before = after;
+	peer1 = wget_tcp_accept(server);
+	peer2 = wget_tcp_accept(server);
+	wget_tcp_deinit(&peer1);
+	wget_tcp_deinit(&peer2);
+	wget_millisleep(50);
+	wget_http_pool_checkout(&conn1, iri);
+	wget_http_pool_get_stats(&after);
+
+	if (!conn1 || after.dead - before.dead != 1 || after.opened - before.opened != 1) {
+		failed++;
+		info_printf("Failed: http pool liveness: dead %llu opened %llu\n",
+			after.dead - before.dead, after.opened - before.opened);
+	} else
+		ok++;
+
+	// idle timeout
+	before = after;
+	wget_http_pool_set_idle_timeout(0);
+	wget_http_pool_checkin(&conn1);
+	wget_http_pool_checkout(&conn1, iri);
+	wget_http_pool_get_stats(&after);
+
+	if (!conn1 || after.expired - before.expired != 1 || after.opened - before.opened != 1) {
+		failed++;
+		info_printf("Failed: http pool timeout: expired %llu opened %llu\n",
+			after.expired - before.expired, after.opened - before.opened);
+	} else
+		ok++;
+
+	wget_http_pool_checkin(&conn1);
+	wget_http_pool_free();
+	wget_http_pool_set_idle_timeout(30 * 1000);
+	wget_http_pool_set_max_idle_per_host(4);
+	wget_tcp_set_tcp_fastopen(NULL, config.tcp_fastopen);
+	wget_iri_free(&iri);
+	wget_tcp_deinit(&server);
+}
+
 int main(int argc, const char * const *argv)
 {
 	// if VALGRIND testing is enabled, we have to call ourselves with valgrind checking
@@ -1529,6 +2249,7 @@ int main(int argc, const char * const *argv)
 	test_strcasecmp_ascii();
 	test_hashing();
 	test_vector();
+	test_fpset();
 	test_stringmap();
 
 	if (failed) {
@@ -1544,7 +2265,16 @@ int main(int argc, const char * const *argv)
 
 	test_cookies();
 	test_hsts();
+	test_tls_session();
 	test_parse_challenge();
+	test_parse_retry_after();
+	test_parse_response_header();
+	test_request_template();
+	test_decompress();
+	test_robots();
+	test_dns_cache();
+	test_tcp_connect_parallel();
+	test_http_pool();
 
 	selftest_options() ? failed++ : ok++;
 